@@ -30,6 +30,7 @@
 #include "KadrxStatusThread.h"
 #include <logx/Logging.h>
 #include <QtCore/QMetaType>
+#include <QtCore/QSocketNotifier>
 #include <QtCore/QTimer>
 
 LOGGING("KadrxStatusThread")
@@ -38,7 +39,10 @@ KadrxStatusThread::KadrxStatusThread(QString kadrxHost, int kadrxPort) :
     _responsive(false),
     _kadrxHost(kadrxHost),
     _kadrxPort(kadrxPort),
-    _client(0) {
+    _client(0),
+    _pushClient(0),
+    _pushNotifier(0),
+    _nextSubscribeTime(0) {
     // We need to register KadrxStatus as a metatype, since we'll be passing it
     // as an argument in a signal.
     qRegisterMetaType<KadrxStatus>("KadrxStatus");
@@ -57,12 +61,19 @@ void
 KadrxStatusThread::run() {
     _client = new KadrxRpcClient(_kadrxHost.toStdString(), _kadrxPort);
 
-    // Set up a 1 second timer to call _getStatus()
+    _pushClient = new StatusPushClient(_kadrxHost.toStdString(),
+                                       _kadrxPort + StatusPush::PORT_OFFSET);
+
+    // Set up a 1 second timer to call _checkSubscription(), and subscribe
+    // right away
     QTimer timer;
-    connect(&timer, SIGNAL(timeout()), this, SLOT(_getStatus()));
+    connect(&timer, SIGNAL(timeout()), this, SLOT(_checkSubscription()));
     timer.start(1000);
+    _checkSubscription();
     // Start the event loop
     exec();
+    _unsubscribe();
+    delete(_pushClient);
     return;
 }
 
@@ -70,15 +81,67 @@ void
 KadrxStatusThread::_getStatus() {
     KadrxStatus status;
     if (_client->getStatus(status)) {
-        if (! _responsive) {
-            _responsive = true;
-            emit serverResponsive(true);
-        }
+        _setResponsive(true);
         emit newStatus(status);
     } else {
-        if (_responsive) {
-            _responsive = false;
-            emit serverResponsive(false);
+        _setResponsive(false);
+    }
+}
+
+void
+KadrxStatusThread::_checkSubscription() {
+    if (_pushClient->timedOut()) {
+        WLOG << "Pushed status from kadrx has stopped; unsubscribing";
+        _unsubscribe();
+    }
+    if (! _pushClient->isConnected() && time(0) >= _nextSubscribeTime) {
+        if (_pushClient->connectToServer(500)) {
+            _pushNotifier = new QSocketNotifier(_pushClient->fd(),
+                                                QSocketNotifier::Read);
+            connect(_pushNotifier, SIGNAL(activated(int)),
+                    this, SLOT(_readPushedStatus()));
+        } else {
+            _nextSubscribeTime = time(0) + SUBSCRIBE_RETRY_SECS;
+        }
+    }
+    // Poll while we are not getting pushed status
+    if (! _pushClient->isConnected()) {
+        _getStatus();
+    }
+}
+
+void
+KadrxStatusThread::_readPushedStatus() {
+    bool changed = _pushClient->readAvailable();
+    if (! _pushClient->isConnected()) {
+        // Polling takes over until we can subscribe again
+        _unsubscribe();
+        return;
+    }
+    if (changed) {
+        KadrxStatus status;
+        if (! StatusPush::decode(_pushClient->status(), status)) {
+            WLOG << "Cannot decode pushed status from kadrx; unsubscribing";
+            _unsubscribe();
+            _nextSubscribeTime = time(0) + SUBSCRIBE_RETRY_SECS;
+            return;
         }
+        _setResponsive(true);
+        emit newStatus(status);
+    }
+}
+
+void
+KadrxStatusThread::_unsubscribe() {
+    delete(_pushNotifier);
+    _pushNotifier = 0;
+    _pushClient->disconnect();
+}
+
+void
+KadrxStatusThread::_setResponsive(bool responsive) {
+    if (responsive != _responsive) {
+        _responsive = responsive;
+        emit serverResponsive(responsive);
     }
 }
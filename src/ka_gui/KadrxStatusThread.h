@@ -32,13 +32,19 @@
 #define KADRXSTATUSTHREAD_H_
 
 #include <KadrxRpcClient.h>
+#include <StatusPushClient.h>
 #include <QtCore/QThread>
+#include <ctime>
+
+class QSocketNotifier;
 
 /// @brief Class providing a thread which gets kadrx status on a regular
 /// basis using a KadrxClient connection.
 ///
-/// This class uses the given KadrxClient connection to poll for status
-/// from kadrx on a ~1 Hz basis (when connected). When new status is received,
+/// This class subscribes to the status which kadrx pushes whenever it
+/// changes, and falls back to using the given KadrxClient connection to poll
+/// for status on a ~1 Hz basis when it cannot subscribe (e.g., with an older
+/// kadrx). When new status is received,
 /// a newStatus(DrxStatus) signal is emitted. The class also provides a useful
 /// way to test for good connection to the kadrx XML-RPC server, via
 /// serverResponsive(bool) signals emitted when connection/disconnection is
@@ -81,7 +87,26 @@ private slots:
     /// @brief Try to get latest status from kadrx, and emit a newStatus()
     /// signal if successful.
     void _getStatus();
+
+    /// @brief Subscribe to pushed status if we are not subscribed, drop a
+    /// subscription which has gone silent, and poll for status with
+    /// _getStatus() while we are not subscribed.
+    void _checkSubscription();
+
+    /// @brief Read pushed status, and emit a newStatus() signal if it has
+    /// changed.
+    void _readPushedStatus();
 private:
+    /// @brief Drop our status subscription
+    void _unsubscribe();
+
+    /// @brief Emit serverResponsive() if responsiveness has changed
+    /// @param responsive true iff the server is responsive
+    void _setResponsive(bool responsive);
+
+    /// Seconds to wait before trying again to subscribe
+    static const int SUBSCRIBE_RETRY_SECS = 10;
+
     /// True iff the client had a successful connection with the kadrx
     /// XML-RPC server on the last XML-RPC method call.
     bool _responsive;
@@ -91,6 +116,15 @@ private:
 
     /// The KadrxClient object handling the XML-RPC connection
     KadrxRpcClient * _client;
+
+    /// Subscription to status pushed by kadrx
+    StatusPushClient * _pushClient;
+
+    /// Watches the subscription socket for pushed status
+    QSocketNotifier * _pushNotifier;
+
+    /// Time of the next attempt to subscribe
+    time_t _nextSubscribeTime;
 };
 
 #endif /* KADRXSTATUSTHREAD_H_ */
@@ -32,13 +32,19 @@
 #define XMITDSTATUSTHREAD_H_
 
 #include <XmitClient.h>
+#include <StatusPushClient.h>
 #include <QtCore/QThread>
+#include <ctime>
+
+class QSocketNotifier;
 
 /// @brief Class providing a thread which gets hcr_xmitd status on a regular
 /// basis using a XmitClient connection.
 ///
-/// This class uses the given XmitClient connection to poll for status
-/// from hcr_xmitd on a ~1 Hz basis (when connected). When new status is received,
+/// This class subscribes to the status which ka_xmitd pushes whenever it
+/// changes, and falls back to using the given XmitClient connection to poll
+/// for status on a ~1 Hz basis when it cannot subscribe (e.g., with an older
+/// ka_xmitd). When new status is received,
 /// a newStatus(DrxStatus) signal is emitted. The class also provides a useful
 /// way to test for good connection to the hcr_xmitd RPC server, via
 /// serverResponsive(bool) signals emitted when connection/disconnection is
@@ -79,7 +85,26 @@ private slots:
     /// @brief Try to get latest status from ka_xmitd, and emit a newStatus()
     /// signal if successful.
     void _getStatus();
+
+    /// @brief Subscribe to pushed status if we are not subscribed, drop a
+    /// subscription which has gone silent, and poll for status with
+    /// _getStatus() while we are not subscribed.
+    void _checkSubscription();
+
+    /// @brief Read pushed status, and emit a newStatus() signal if it has
+    /// changed.
+    void _readPushedStatus();
 private:
+    /// @brief Drop our status subscription
+    void _unsubscribe();
+
+    /// @brief Emit serverResponsive() if responsiveness has changed
+    /// @param responsive true iff the server is responsive
+    void _setResponsive(bool responsive);
+
+    /// Seconds to wait before trying again to subscribe
+    static const int SUBSCRIBE_RETRY_SECS = 10;
+
     /// True iff the client had a successful connection with the hcr_xmitd
     /// XML-RPC server on the last XML-RPC method call.
     bool _responsive;
@@ -89,6 +114,15 @@ private:
 
     /// The XmitClient object handling the XML-RPC connection
     XmitClient * _client;
+
+    /// Subscription to status pushed by ka_xmitd
+    StatusPushClient * _pushClient;
+
+    /// Watches the subscription socket for pushed status
+    QSocketNotifier * _pushNotifier;
+
+    /// Time of the next attempt to subscribe
+    time_t _nextSubscribeTime;
 };
 
 #endif /* XMITDSTATUSTHREAD_H_ */
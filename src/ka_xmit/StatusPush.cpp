@@ -0,0 +1,92 @@
+/*
+ * StatusPush.cpp
+ *
+ * Wire format shared by StatusPushServer and StatusPushClient.
+ */
+
+#include "StatusPush.h"
+#include <arpa/inet.h>
+#include <cstring>
+
+namespace StatusPush {
+
+// Runs closer together than this are merged, since a RunHeader costs
+// more than the unchanged bytes between them.
+static const size_t MIN_RUN_GAP = sizeof(RunHeader);
+
+std::string
+makeFrame(FrameType type, const std::string & payload) {
+    FrameHeader header;
+    header.magic = htonl(MAGIC);
+    header.type = htonl(type);
+    header.len = htonl(payload.size());
+    std::string frame(reinterpret_cast<const char *>(&header), sizeof(header));
+    frame += payload;
+    return(frame);
+}
+
+std::string
+makeUpdateFrame(const std::string & prev, const std::string & next) {
+    if (next.size() != prev.size()) {
+        return(makeFrame(KEYFRAME, next));
+    }
+    std::string payload;
+    size_t len = next.size();
+    size_t pos = 0;
+    while (pos < len) {
+        // find the start of the next changed run
+        while (pos < len && next[pos] == prev[pos]) {
+            pos++;
+        }
+        if (pos == len) {
+            break;
+        }
+        // extend it until there is a long enough unchanged gap
+        size_t start = pos;
+        size_t end = pos + 1;
+        for (size_t ii = end; ii < len; ii++) {
+            if (next[ii] != prev[ii]) {
+                end = ii + 1;
+            } else if (ii - end >= MIN_RUN_GAP) {
+                break;
+            }
+        }
+        RunHeader run;
+        run.offset = htonl(start);
+        run.len = htonl(end - start);
+        payload.append(reinterpret_cast<const char *>(&run), sizeof(run));
+        payload.append(next, start, end - start);
+        if (payload.size() >= len) {
+            return(makeFrame(KEYFRAME, next));
+        }
+        pos = end;
+    }
+    if (payload.empty()) {
+        return(std::string());
+    }
+    return(makeFrame(DELTA, payload));
+}
+
+bool
+applyDelta(std::string & status, const std::string & payload) {
+    size_t pos = 0;
+    while (pos < payload.size()) {
+        if (payload.size() - pos < sizeof(RunHeader)) {
+            return(false);
+        }
+        RunHeader run;
+        memcpy(&run, payload.data() + pos, sizeof(run));
+        pos += sizeof(run);
+        size_t offset = ntohl(run.offset);
+        size_t len = ntohl(run.len);
+        if (len > payload.size() - pos || offset > status.size() ||
+                len > status.size() - offset) {
+            return(false);
+        }
+        status.replace(offset, len, payload, pos, len);
+        pos += len;
+    }
+    return(true);
+}
+
+}
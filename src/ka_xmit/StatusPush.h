@@ -0,0 +1,120 @@
+/*
+ * StatusPush.h
+ *
+ * Wire format shared by StatusPushServer and StatusPushClient.
+ */
+
+#ifndef SRC_KA_XMIT_STATUSPUSH_H_
+#define SRC_KA_XMIT_STATUSPUSH_H_
+
+#include <sstream>
+#include <string>
+#include <stdint.h>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+
+/// @brief Wire format for pushing status from a server (kadrx or ka_xmitd)
+/// to subscribers such as ka_gui.
+///
+/// A status is sent as the bytes of its boost binary serialization. On
+/// connect, a subscriber is sent a KEYFRAME holding the whole current
+/// status. After that, each change is sent as a DELTA listing only the
+/// byte runs which differ from the previous status. When nothing changes
+/// for a while, a HEARTBEAT is sent so that the subscriber can tell the
+/// server is still there.
+///
+/// Each frame is a FrameHeader followed by len bytes of payload. A DELTA
+/// payload is a sequence of runs, each a RunHeader followed by the new
+/// bytes for that run. A DELTA applies only to a status of the same length
+/// as the previous one; when the length changes, a KEYFRAME is sent
+/// instead. All integers are in network byte order.
+///
+/// The push port of a server is its XML-RPC port plus PORT_OFFSET.
+namespace StatusPush {
+
+    /// Offset from a server's XML-RPC port to its status push port
+    static const int PORT_OFFSET = 1000;
+
+    /// A server sends a HEARTBEAT after this long without a change, s
+    static const double HEARTBEAT_SECS = 2.0;
+
+    /// A subscriber gives up on a server silent for this long, s
+    static const double TIMEOUT_SECS = 3 * HEARTBEAT_SECS;
+
+    /// Marks the start of every frame
+    static const uint32_t MAGIC = 0x4b535031;   // "KSP1"
+
+    /// Frame types
+    enum FrameType {
+        KEYFRAME = 1,   ///< the whole status
+        DELTA = 2,      ///< changed byte runs since the last status
+        HEARTBEAT = 3   ///< no change; no payload
+    };
+
+    /// Header at the start of each frame
+    struct FrameHeader {
+        uint32_t magic;     ///< MAGIC
+        uint32_t type;      ///< FrameType
+        uint32_t len;       ///< length of the payload, bytes
+    };
+
+    /// Header of each run in a DELTA payload
+    struct RunHeader {
+        uint32_t offset;    ///< offset of the run in the status, bytes
+        uint32_t len;       ///< length of the run, bytes
+    };
+
+    /// Largest payload a subscriber will accept, bytes
+    static const uint32_t MAX_PAYLOAD = 1024 * 1024;
+
+    /// @brief Build the frame which takes a subscriber from one status to
+    /// the next: a DELTA if possible, or a KEYFRAME if the length has
+    /// changed or the DELTA would be no smaller.
+    /// @param prev the status the subscriber holds
+    /// @param next the new status
+    /// @return the complete frame, or an empty string if the two are the
+    /// same
+    std::string makeUpdateFrame(const std::string & prev,
+                                const std::string & next);
+
+    /// @brief Build a frame of the given type
+    /// @param type the frame type
+    /// @param payload the payload
+    /// @return the complete frame
+    std::string makeFrame(FrameType type, const std::string & payload);
+
+    /// @brief Apply a DELTA payload to a status
+    /// @param status the status to update in place
+    /// @param payload the DELTA payload
+    /// @return true iff the payload was well formed and fits the status
+    bool applyDelta(std::string & status, const std::string & payload);
+
+    /// @brief Serialize a status object to its wire form
+    /// @param status the status object, which must be boost serializable
+    /// @return the serialized status
+    template<class T>
+    std::string encode(const T & status) {
+        std::ostringstream oss;
+        boost::archive::binary_oarchive oar(oss);
+        oar << status;
+        return(oss.str());
+    }
+
+    /// @brief Populate a status object from its wire form
+    /// @param bytes the serialized status
+    /// @param status the status object to populate
+    /// @return true iff the bytes were decoded successfully
+    template<class T>
+    bool decode(const std::string & bytes, T & status) {
+        try {
+            std::istringstream iss(bytes);
+            boost::archive::binary_iarchive iar(iss);
+            iar >> status;
+        } catch (std::exception & e) {
+            return(false);
+        }
+        return(true);
+    }
+}
+
+#endif /* SRC_KA_XMIT_STATUSPUSH_H_ */
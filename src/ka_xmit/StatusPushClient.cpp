@@ -0,0 +1,178 @@
+/*
+ * StatusPushClient.cpp
+ *
+ * Subscriber to a StatusPushServer.
+ */
+
+#include "StatusPushClient.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <logx/Logging.h>
+
+LOGGING("StatusPushClient")
+
+StatusPushClient::StatusPushClient(std::string host, int port) :
+    _host(host),
+    _port(port),
+    _fd(-1),
+    _inBuf(),
+    _status(),
+    _haveStatus(false),
+    _lastFrameTime(0.0) {
+}
+
+StatusPushClient::~StatusPushClient() {
+    disconnect();
+}
+
+bool
+StatusPushClient::connectToServer(int timeoutMs) {
+    disconnect();
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo * addrs;
+    if (getaddrinfo(_host.c_str(), NULL, &hints, &addrs) != 0) {
+        DLOG << "Cannot resolve status server host " << _host;
+        return(false);
+    }
+    struct sockaddr_in addr = *reinterpret_cast<struct sockaddr_in *>(addrs->ai_addr);
+    freeaddrinfo(addrs);
+    addr.sin_port = htons(_port);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return(false);
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    // Non-blocking connect, so that we can limit the wait
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) &&
+            errno != EINPROGRESS) {
+        DLOG << "Cannot connect to status server " << _host << ":" <<
+            _port << ": " << strerror(errno);
+        close(fd);
+        return(false);
+    }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    int err = 0;
+    socklen_t errLen = sizeof(err);
+    if (poll(&pfd, 1, timeoutMs) != 1 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen) || err) {
+        DLOG << "Cannot connect to status server " << _host << ":" <<
+            _port << ": " << (err ? strerror(err) : "timed out");
+        close(fd);
+        return(false);
+    }
+
+    ILOG << "Subscribed to status from " << _host << ":" << _port;
+    _fd = fd;
+    _lastFrameTime = _now();
+    return(true);
+}
+
+void
+StatusPushClient::disconnect() {
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+    _inBuf.clear();
+    _status.clear();
+    _haveStatus = false;
+}
+
+bool
+StatusPushClient::readAvailable() {
+    if (_fd < 0) {
+        return(false);
+    }
+    char buf[65536];
+    while (true) {
+        ssize_t n = recv(_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            _inBuf.append(buf, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        ILOG << "Status server " << _host << ":" << _port <<
+            " closed the connection";
+        disconnect();
+        return(false);
+    }
+    return(_handleFrames());
+}
+
+// Handle the complete frames in _inBuf. Returns true iff the status
+// changed.
+bool
+StatusPushClient::_handleFrames() {
+    bool changed = false;
+    size_t pos = 0;
+    while (_inBuf.size() - pos >= sizeof(StatusPush::FrameHeader)) {
+        StatusPush::FrameHeader header;
+        memcpy(&header, _inBuf.data() + pos, sizeof(header));
+        uint32_t type = ntohl(header.type);
+        uint32_t len = ntohl(header.len);
+        if (ntohl(header.magic) != StatusPush::MAGIC ||
+                len > StatusPush::MAX_PAYLOAD) {
+            WLOG << "Bad frame from status server " << _host << ":" <<
+                _port << "; disconnecting";
+            disconnect();
+            return(false);
+        }
+        if (_inBuf.size() - pos - sizeof(header) < len) {
+            break;  // wait for the rest of the frame
+        }
+        std::string payload(_inBuf, pos + sizeof(header), len);
+        pos += sizeof(header) + len;
+        _lastFrameTime = _now();
+
+        if (type == StatusPush::KEYFRAME) {
+            _status = payload;
+            _haveStatus = true;
+            changed = true;
+        } else if (type == StatusPush::DELTA) {
+            if (! _haveStatus || ! StatusPush::applyDelta(_status, payload)) {
+                WLOG << "Bad delta from status server " << _host << ":" <<
+                    _port << "; disconnecting";
+                disconnect();
+                return(false);
+            }
+            changed = true;
+        }
+        // HEARTBEAT frames just show that the server is alive
+    }
+    _inBuf.erase(0, pos);
+    return(changed);
+}
+
+bool
+StatusPushClient::timedOut() const {
+    return(_fd >= 0 && (_now() - _lastFrameTime) > StatusPush::TIMEOUT_SECS);
+}
+
+double
+StatusPushClient::_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + 1.0e-9 * ts.tv_nsec);
+}
@@ -0,0 +1,89 @@
+/*
+ * StatusPushClient.h
+ *
+ * Subscriber to a StatusPushServer.
+ */
+
+#ifndef SRC_KA_XMIT_STATUSPUSHCLIENT_H_
+#define SRC_KA_XMIT_STATUSPUSHCLIENT_H_
+
+#include <string>
+#include "StatusPush.h"
+
+/// @brief StatusPushClient subscribes to status pushed by a
+/// StatusPushServer, and keeps the latest status up to date from the
+/// KEYFRAME and DELTA frames it receives.
+///
+/// The socket is non-blocking once connected. The owner should call
+/// readAvailable() whenever fd() is readable (e.g., from a
+/// QSocketNotifier), and check timedOut() from time to time. Any error
+/// disconnects the client; the owner may then call connectToServer()
+/// again.
+class StatusPushClient {
+public:
+    /// @brief Construct an unconnected client
+    /// @param host the host running the server
+    /// @param port the server's status push port
+    StatusPushClient(std::string host, int port);
+
+    /// @brief Disconnect
+    ~StatusPushClient();
+
+    /// @brief Connect to the server, waiting up to timeoutMs milliseconds.
+    /// @param timeoutMs the longest time to wait for the connection, ms
+    /// @return true iff connected
+    bool connectToServer(int timeoutMs);
+
+    /// @brief Disconnect from the server and forget the status
+    void disconnect();
+
+    /// @brief Return true iff connected to the server
+    /// @return true iff connected to the server
+    bool isConnected() const { return(_fd >= 0); }
+
+    /// @brief Return the socket, for watching for input
+    /// @return the socket, or -1 if not connected
+    int fd() const { return(_fd); }
+
+    /// @brief Read and apply everything the server has sent, without
+    /// blocking. On error or end of file, the client is disconnected.
+    /// @return true iff a new status was received
+    bool readAvailable();
+
+    /// @brief Return true iff the server has been silent for longer than
+    /// StatusPush::TIMEOUT_SECS
+    /// @return true iff the server has been silent for longer than
+    /// StatusPush::TIMEOUT_SECS
+    bool timedOut() const;
+
+    /// @brief Return true iff a status has been received since connecting
+    /// @return true iff a status has been received since connecting
+    bool haveStatus() const { return(_haveStatus); }
+
+    /// @brief Return the latest serialized status, for StatusPush::decode()
+    /// @return the latest serialized status
+    const std::string & status() const { return(_status); }
+
+private:
+    StatusPushClient(const StatusPushClient &);
+    StatusPushClient & operator=(const StatusPushClient &);
+
+    bool _handleFrames();
+    static double _now();
+
+    std::string _host;
+    int _port;
+    int _fd;
+
+    /// Data read but not yet handled
+    std::string _inBuf;
+
+    /// The latest status
+    std::string _status;
+    bool _haveStatus;
+
+    /// Time the last frame was received, from _now()
+    double _lastFrameTime;
+};
+
+#endif /* SRC_KA_XMIT_STATUSPUSHCLIENT_H_ */
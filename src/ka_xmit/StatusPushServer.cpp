@@ -0,0 +1,232 @@
+/*
+ * StatusPushServer.cpp
+ *
+ * TCP server which pushes status changes to subscribers.
+ */
+
+#include "StatusPushServer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <logx/Logging.h>
+
+LOGGING("StatusPushServer")
+
+StatusPushServer::StatusPushServer(int port) :
+    _port(port),
+    _listenFd(-1),
+    _clients(),
+    _status(),
+    _haveStatus(false),
+    _lastSendTime(0.0) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        ELOG << "Cannot create status push socket: " << strerror(errno);
+        return;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) ||
+            listen(fd, 8)) {
+        ELOG << "Cannot listen for status subscribers on port " << port <<
+            ": " << strerror(errno);
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    _listenFd = fd;
+    ILOG << "Pushing status to subscribers on port " << port;
+}
+
+StatusPushServer::~StatusPushServer() {
+    for (size_t i = 0; i < _clients.size(); i++) {
+        if (_clients[i].fd >= 0) {
+            close(_clients[i].fd);
+        }
+    }
+    if (_listenFd >= 0) {
+        close(_listenFd);
+    }
+}
+
+void
+StatusPushServer::publish(const std::string & status) {
+    if (_haveStatus && status == _status) {
+        return;
+    }
+    // Build each kind of frame once, for all subscribers
+    std::string update;
+    if (_haveStatus) {
+        update = StatusPush::makeUpdateFrame(_status, status);
+    }
+    std::string keyframe;
+    for (size_t i = 0; i < _clients.size(); i++) {
+        Client & client = _clients[i];
+        if (client.synced) {
+            _send(client, update);
+        } else {
+            if (keyframe.empty()) {
+                keyframe = StatusPush::makeFrame(StatusPush::KEYFRAME, status);
+            }
+            _send(client, keyframe);
+            client.synced = true;
+        }
+    }
+    _status = status;
+    _haveStatus = true;
+    _lastSendTime = _now();
+    _dropClosedClients();
+}
+
+void
+StatusPushServer::service() {
+    _acceptNewClients();
+    bool heartbeat = (_now() - _lastSendTime) > StatusPush::HEARTBEAT_SECS;
+    std::string frame;
+    if (heartbeat) {
+        frame = StatusPush::makeFrame(StatusPush::HEARTBEAT, std::string());
+        _lastSendTime = _now();
+    }
+    for (size_t i = 0; i < _clients.size(); i++) {
+        Client & client = _clients[i];
+        if (heartbeat && client.synced) {
+            _send(client, frame);
+        } else if (client.fd >= 0 && ! _flush(client)) {
+            client.fd = -1;
+        }
+        if (client.fd >= 0 && ! _isOpen(client)) {
+            ILOG << "Status subscriber " << client.peer << " disconnected";
+            close(client.fd);
+            client.fd = -1;
+        }
+    }
+    _dropClosedClients();
+}
+
+void
+StatusPushServer::_acceptNewClients() {
+    if (_listenFd < 0) {
+        return;
+    }
+    while (true) {
+        struct sockaddr_in addr;
+        socklen_t addrLen = sizeof(addr);
+        int fd = accept(_listenFd, reinterpret_cast<struct sockaddr *>(&addr),
+                        &addrLen);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                WLOG << "Error accepting status subscriber: " <<
+                    strerror(errno);
+            }
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        Client client;
+        client.fd = fd;
+        client.peer = inet_ntoa(addr.sin_addr);
+        client.synced = false;
+        ILOG << "New status subscriber " << client.peer << " (" <<
+            _clients.size() + 1 << " total)";
+        // Start the new subscriber off with the whole current status
+        if (_haveStatus) {
+            client.synced = true;
+            _send(client,
+                  StatusPush::makeFrame(StatusPush::KEYFRAME, _status));
+        }
+        _clients.push_back(client);
+    }
+}
+
+void
+StatusPushServer::_send(Client & client, const std::string & frame) {
+    if (client.fd < 0 || frame.empty()) {
+        return;
+    }
+    if (client.pending.size() + frame.size() > MAX_PENDING) {
+        WLOG << "Status subscriber " << client.peer <<
+            " is not keeping up; disconnecting";
+        close(client.fd);
+        client.fd = -1;
+        return;
+    }
+    client.pending += frame;
+    if (! _flush(client)) {
+        client.fd = -1;
+    }
+}
+
+// Write as much pending data as the socket will take. Returns false, with
+// the socket closed, if the subscriber has gone.
+bool
+StatusPushServer::_flush(Client & client) {
+    size_t nSent = 0;
+    while (nSent < client.pending.size()) {
+        ssize_t n = send(client.fd, client.pending.data() + nSent,
+                         client.pending.size() - nSent,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            ILOG << "Status subscriber " << client.peer << " dropped: " <<
+                strerror(errno);
+            close(client.fd);
+            return(false);
+        }
+        nSent += n;
+    }
+    client.pending.erase(0, nSent);
+    return(true);
+}
+
+// Subscribers send nothing, so a readable socket means it has been closed
+// (or the subscriber is misbehaving).
+bool
+StatusPushServer::_isOpen(Client & client) {
+    char buf[256];
+    ssize_t n = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0) {
+        return(false);
+    }
+    if (n < 0) {
+        return(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+    return(true);
+}
+
+void
+StatusPushServer::_dropClosedClients() {
+    for (size_t i = 0; i < _clients.size(); ) {
+        if (_clients[i].fd < 0) {
+            _clients.erase(_clients.begin() + i);
+        } else {
+            i++;
+        }
+    }
+}
+
+double
+StatusPushServer::_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + 1.0e-9 * ts.tv_nsec);
+}
@@ -0,0 +1,93 @@
+/*
+ * StatusPushServer.h
+ *
+ * TCP server which pushes status changes to subscribers.
+ */
+
+#ifndef SRC_KA_XMIT_STATUSPUSHSERVER_H_
+#define SRC_KA_XMIT_STATUSPUSHSERVER_H_
+
+#include <string>
+#include <vector>
+#include "StatusPush.h"
+
+/// @brief StatusPushServer accepts subscriber connections on a TCP port, and
+/// pushes each new status to them in the StatusPush wire format.
+///
+/// The owner serializes its status with StatusPush::encode() and passes it
+/// to publish() whenever it may have changed. Each distinct change is
+/// encoded once, as a DELTA from the previous status, and that same frame
+/// is sent to every subscriber, so extra subscribers cost little more than
+/// the socket writes. New subscribers get a KEYFRAME first.
+///
+/// All sockets are non-blocking, and nothing is done except in publish()
+/// and service(), so the server can be driven from any existing loop or
+/// timer without a thread of its own. A subscriber which falls more than
+/// MAX_PENDING bytes behind is disconnected; it will get a fresh KEYFRAME
+/// when it reconnects.
+class StatusPushServer {
+public:
+    /// @brief Start listening for subscribers
+    /// @param port the TCP port to listen on
+    StatusPushServer(int port);
+
+    /// @brief Close all connections
+    ~StatusPushServer();
+
+    /// @brief Return true iff the server is listening
+    /// @return true iff the server is listening
+    bool isListening() const { return(_listenFd >= 0); }
+
+    /// @brief Return the port on which the server listens
+    /// @return the port on which the server listens
+    int port() const { return(_port); }
+
+    /// @brief Return the number of connected subscribers
+    /// @return the number of connected subscribers
+    int nSubscribers() const { return(_clients.size()); }
+
+    /// @brief Publish a status, sending its changes to all subscribers.
+    /// Nothing is sent if it is the same as the last status published.
+    /// @param status the serialized status
+    void publish(const std::string & status);
+
+    /// @brief Accept new subscribers, send a HEARTBEAT if nothing has been
+    /// sent for a while, finish pending writes, and drop subscribers which
+    /// have disconnected. Should be called several times per
+    /// StatusPush::HEARTBEAT_SECS.
+    void service();
+
+private:
+    StatusPushServer(const StatusPushServer &);
+    StatusPushServer & operator=(const StatusPushServer &);
+
+    /// Largest amount of unsent data kept for one subscriber, bytes
+    static const size_t MAX_PENDING = 256 * 1024;
+
+    struct Client {
+        int fd;
+        std::string peer;       ///< address of the subscriber, for logging
+        bool synced;            ///< has the subscriber had a KEYFRAME?
+        std::string pending;    ///< data not yet written to the socket
+    };
+
+    void _acceptNewClients();
+    void _send(Client & client, const std::string & frame);
+    bool _flush(Client & client);
+    bool _isOpen(Client & client);
+    void _dropClosedClients();
+    static double _now();
+
+    int _port;
+    int _listenFd;
+    std::vector<Client> _clients;
+
+    /// The last status published
+    std::string _status;
+    bool _haveStatus;
+
+    /// Time a frame was last sent to the subscribers, from _now()
+    double _lastSendTime;
+};
+
+#endif /* SRC_KA_XMIT_STATUSPUSHSERVER_H_ */
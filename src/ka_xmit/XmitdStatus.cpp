@@ -6,6 +6,7 @@
  */
 
 #include "XmitdStatus.h"
+#include "XmitdStatusShm.h"
 #include <logx/Logging.h>
 
 LOGGING("XmitdStatus")
@@ -109,6 +110,55 @@ XmitdStatus::XmitdStatus(XmlRpc::XmlRpcValue & statusDict) {
 
 }
 
+XmitdStatus::XmitdStatus(const XmitdShmStatus & shmStatus) {
+    const KaXmitStatus & xs = shmStatus.xmitStatus;
+    _serialConnected = xs.serialConnected;
+    _faultSummary = xs.faultSummary;
+    _hvpsRunup = xs.hvpsRunup;
+    _standby = xs.standby;
+    _heaterWarmup = xs.heaterWarmup;
+    _cooldown = xs.cooldown;
+    _unitOn = xs.unitOn;
+    _magnetronCurrentFault = xs.magnetronCurrentFault;
+    _blowerFault = xs.blowerFault;
+    _hvpsOn = xs.hvpsOn;
+    _remoteEnabled = xs.remoteEnabled;
+    _safetyInterlock = xs.safetyInterlock;
+    _reversePowerFault = xs.reversePowerFault;
+    _pulseInputFault = xs.pulseInputFault;
+    _hvpsCurrentFault = xs.hvpsCurrentFault;
+    _waveguidePressureFault = xs.waveguidePressureFault;
+    _hvpsUnderVoltage = xs.hvpsUnderVoltage;
+    _hvpsOverVoltage = xs.hvpsOverVoltage;
+
+    _magnetronCurrentFaultCount = shmStatus.magnetronCurrentFaultCount;
+    _blowerFaultCount = shmStatus.blowerFaultCount;
+    _safetyInterlockCount = shmStatus.safetyInterlockCount;
+    _reversePowerFaultCount = shmStatus.reversePowerFaultCount;
+    _pulseInputFaultCount = shmStatus.pulseInputFaultCount;
+    _hvpsCurrentFaultCount = shmStatus.hvpsCurrentFaultCount;
+    _waveguidePressureFaultCount = shmStatus.waveguidePressureFaultCount;
+    _hvpsUnderVoltageCount = shmStatus.hvpsUnderVoltageCount;
+    _hvpsOverVoltageCount = shmStatus.hvpsOverVoltageCount;
+
+    _autoPulseFaultResets = shmStatus.autoPulseFaultResets;
+
+    _magnetronCurrentFaultTime = shmStatus.magnetronCurrentFaultTime;
+    _blowerFaultTime = shmStatus.blowerFaultTime;
+    _safetyInterlockTime = shmStatus.safetyInterlockTime;
+    _reversePowerFaultTime = shmStatus.reversePowerFaultTime;
+    _pulseInputFaultTime = shmStatus.pulseInputFaultTime;
+    _hvpsCurrentFaultTime = shmStatus.hvpsCurrentFaultTime;
+    _waveguidePressureFaultTime = shmStatus.waveguidePressureFaultTime;
+    _hvpsUnderVoltageTime = shmStatus.hvpsUnderVoltageTime;
+    _hvpsOverVoltageTime = shmStatus.hvpsOverVoltageTime;
+
+    _hvpsVoltage = xs.hvpsVoltage;
+    _magnetronCurrent = xs.magnetronCurrent;
+    _hvpsCurrent = xs.hvpsCurrent;
+    _temperature = xs.temperature;
+}
+
 XmitdStatus::~XmitdStatus() {
 }
 
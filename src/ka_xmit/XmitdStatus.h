@@ -11,6 +11,10 @@
 #include <ctime>
 #include <string>
 #include <XmlRpc.h>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/version.hpp>
+
+struct XmitdShmStatus;
 
 /// XmitdStatus is a class encapsulating all status values available from the
 /// Ka-band transmitter.
@@ -24,6 +28,11 @@ public:
     /// should come from an XML-RPC getStatus() call to ka_xmitd.
     /// @param statusDict the XML-RPC dictionary containing ka_xmitd status
     XmitdStatus(XmlRpc::XmlRpcValue & statusDict);
+
+    /// @brief Construct from status read from ka_xmitd's shared memory
+    /// segment (see XmitdStatusShm).
+    /// @param shmStatus the status from shared memory
+    XmitdStatus(const XmitdShmStatus & shmStatus);
     /**
      * Destructor
      */
@@ -259,6 +268,63 @@ public:
     int autoPulseFaultResets() const { return(_autoPulseFaultResets); }
 
 private:
+    friend class boost::serialization::access;
+
+    /// @brief Serialize our members to a boost save (output) archive or populate
+    /// our members from a boost load (input) archive.
+    /// @param ar the archive to load from or save to
+    /// @param version the XmitdStatus version number
+    template<class Archive>
+    void serialize(Archive & ar, const unsigned int version) {
+        // Version 0 (see BOOST_CLASS_VERSION macro below for latest version)
+        if (version >= 0) {
+            ar & BOOST_SERIALIZATION_NVP(_serialConnected);
+            ar & BOOST_SERIALIZATION_NVP(_faultSummary);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsRunup);
+            ar & BOOST_SERIALIZATION_NVP(_standby);
+            ar & BOOST_SERIALIZATION_NVP(_heaterWarmup);
+            ar & BOOST_SERIALIZATION_NVP(_cooldown);
+            ar & BOOST_SERIALIZATION_NVP(_unitOn);
+            ar & BOOST_SERIALIZATION_NVP(_magnetronCurrentFault);
+            ar & BOOST_SERIALIZATION_NVP(_blowerFault);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsOn);
+            ar & BOOST_SERIALIZATION_NVP(_remoteEnabled);
+            ar & BOOST_SERIALIZATION_NVP(_safetyInterlock);
+            ar & BOOST_SERIALIZATION_NVP(_reversePowerFault);
+            ar & BOOST_SERIALIZATION_NVP(_pulseInputFault);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsCurrentFault);
+            ar & BOOST_SERIALIZATION_NVP(_waveguidePressureFault);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsUnderVoltage);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsOverVoltage);
+            ar & BOOST_SERIALIZATION_NVP(_magnetronCurrentFaultCount);
+            ar & BOOST_SERIALIZATION_NVP(_blowerFaultCount);
+            ar & BOOST_SERIALIZATION_NVP(_safetyInterlockCount);
+            ar & BOOST_SERIALIZATION_NVP(_reversePowerFaultCount);
+            ar & BOOST_SERIALIZATION_NVP(_pulseInputFaultCount);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsCurrentFaultCount);
+            ar & BOOST_SERIALIZATION_NVP(_waveguidePressureFaultCount);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsUnderVoltageCount);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsOverVoltageCount);
+            ar & BOOST_SERIALIZATION_NVP(_autoPulseFaultResets);
+            ar & BOOST_SERIALIZATION_NVP(_magnetronCurrentFaultTime);
+            ar & BOOST_SERIALIZATION_NVP(_blowerFaultTime);
+            ar & BOOST_SERIALIZATION_NVP(_safetyInterlockTime);
+            ar & BOOST_SERIALIZATION_NVP(_reversePowerFaultTime);
+            ar & BOOST_SERIALIZATION_NVP(_pulseInputFaultTime);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsCurrentFaultTime);
+            ar & BOOST_SERIALIZATION_NVP(_waveguidePressureFaultTime);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsUnderVoltageTime);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsOverVoltageTime);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsVoltage);
+            ar & BOOST_SERIALIZATION_NVP(_magnetronCurrent);
+            ar & BOOST_SERIALIZATION_NVP(_hvpsCurrent);
+            ar & BOOST_SERIALIZATION_NVP(_temperature);
+        }
+        if (version >= 1) {
+            // Version 1 stuff will go here...
+        }
+    }
+
     static bool _StatusBool(XmlRpc::XmlRpcValue statusDict, std::string key);
     static int _StatusInt(XmlRpc::XmlRpcValue statusDict, std::string key);
     static double _StatusDouble(XmlRpc::XmlRpcValue statusDict, std::string key);
@@ -310,4 +376,7 @@ private:
     double _temperature;
 };
 
+// Increment this class version number when member variables are changed.
+BOOST_CLASS_VERSION(XmitdStatus, 0)
+
 #endif /* SRC_KA_XMIT_XMITDSTATUS_H_ */
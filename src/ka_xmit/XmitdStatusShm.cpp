@@ -0,0 +1,194 @@
+/*
+ * XmitdStatusShm.cpp
+ *
+ * Transmitter status published by ka_xmitd in POSIX shared memory.
+ */
+
+#include "XmitdStatusShm.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <ios>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <logx/Logging.h>
+
+LOGGING("XmitdStatusShm")
+
+const char XmitdStatusShm::SEGMENT_NAME[] = "/ka_xmitd_status";
+
+// Readers try to (re)map a missing or stale segment no more often than this
+static const int64_t REMAP_INTERVAL_NS = 1000000000LL;
+
+XmitdStatusShm::XmitdStatusShm(bool writer) :
+    _writer(writer),
+    _segment(0),
+    _mapProblem(MAP_OK),
+    _lastMapTryNs(0) {
+    _map();
+}
+
+XmitdStatusShm::~XmitdStatusShm() {
+    _unmap();
+    if (_writer) {
+        shm_unlink(SEGMENT_NAME);
+    }
+}
+
+bool
+XmitdStatusShm::_map() {
+    _lastMapTryNs = _nowNs();
+    int fd;
+    if (_writer) {
+        // Start with a fresh segment, so that readers of a segment left by
+        // an earlier ka_xmitd see it go stale and remap.
+        shm_unlink(SEGMENT_NAME);
+        fd = shm_open(SEGMENT_NAME, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0 || ftruncate(fd, sizeof(Segment))) {
+            ELOG << "Cannot create shared memory segment " << SEGMENT_NAME <<
+                ": " << strerror(errno);
+            if (fd >= 0) {
+                close(fd);
+            }
+            return(false);
+        }
+    } else {
+        fd = shm_open(SEGMENT_NAME, O_RDONLY, 0);
+        if (fd < 0) {
+            return(false);
+        }
+        struct stat st;
+        if (fstat(fd, &st) || size_t(st.st_size) < sizeof(Segment)) {
+            close(fd);
+            return(false);
+        }
+    }
+    int prot = _writer ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void * addr = mmap(0, sizeof(Segment), prot, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        ELOG << "Cannot map shared memory segment " << SEGMENT_NAME << ": " <<
+            strerror(errno);
+        return(false);
+    }
+    Segment * segment = static_cast<Segment *>(addr);
+
+    if (_writer) {
+        // The new segment is zero-filled. Fill in the header, with the
+        // magic number last so readers don't accept a partial header.
+        segment->layoutVersion = LAYOUT_VERSION;
+        segment->segmentSize = sizeof(Segment);
+        segment->writerPid = getpid();
+        segment->seq.store(0, std::memory_order_relaxed);
+        segment->updateTimeNs = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        segment->magic = MAGIC;
+        ILOG << "Publishing transmitter status in shared memory " <<
+            SEGMENT_NAME;
+    } else if (segment->magic == 0) {
+        // ka_xmitd has created the segment but not yet filled in the header
+        munmap(addr, sizeof(Segment));
+        return(false);
+    } else if (segment->magic != MAGIC) {
+        if (_setMapProblem(MAP_BAD_MAGIC)) {
+            WLOG << "Shared memory segment " << SEGMENT_NAME <<
+                " has bad magic number 0x" << std::hex << segment->magic <<
+                std::dec << "; not using it";
+        }
+        munmap(addr, sizeof(Segment));
+        return(false);
+    } else if (segment->layoutVersion != LAYOUT_VERSION ||
+               segment->segmentSize != sizeof(Segment)) {
+        if (_setMapProblem(MAP_BAD_LAYOUT)) {
+            WLOG << "Shared memory segment " << SEGMENT_NAME <<
+                " has layout version " << segment->layoutVersion <<
+                " and size " << segment->segmentSize << " (expected " <<
+                LAYOUT_VERSION << " and " << sizeof(Segment) <<
+                "); not using it";
+        }
+        munmap(addr, sizeof(Segment));
+        return(false);
+    } else if (_setMapProblem(MAP_OK)) {
+        ILOG << "Using shared memory segment " << SEGMENT_NAME;
+    }
+    _segment = segment;
+    return(true);
+}
+
+// Record the problem found when mapping the segment, and return true iff
+// it differs from the last one, so that it should be logged
+bool
+XmitdStatusShm::_setMapProblem(MapProblem problem) {
+    bool changed = (problem != _mapProblem);
+    _mapProblem = problem;
+    return(changed);
+}
+
+void
+XmitdStatusShm::_unmap() {
+    if (_segment) {
+        munmap(_segment, sizeof(Segment));
+        _segment = 0;
+    }
+}
+
+void
+XmitdStatusShm::write(const XmitdShmStatus & status) {
+    if (! _writer || ! _segment) {
+        return;
+    }
+    uint32_t seq = _segment->seq.load(std::memory_order_relaxed);
+    _segment->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&_segment->status, &status, sizeof(status));
+    _segment->updateTimeNs = _nowNs();
+    _segment->seq.store(seq + 2, std::memory_order_release);
+}
+
+bool
+XmitdStatusShm::read(XmitdShmStatus & status) {
+    if (_writer) {
+        return(false);
+    }
+    if (! _segment && (_nowNs() - _lastMapTryNs < REMAP_INTERVAL_NS || ! _map())) {
+        return(false);
+    }
+    // Retry while the writer is mid-update. A write takes well under a
+    // microsecond, so this rarely loops unless the writer was preempted.
+    int64_t updateTimeNs = 0;
+    for (int tries = 0; ; tries++) {
+        uint32_t seq0 = _segment->seq.load(std::memory_order_acquire);
+        if (! (seq0 & 1)) {
+            memcpy(&status, &_segment->status, sizeof(status));
+            updateTimeNs = _segment->updateTimeNs;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_segment->seq.load(std::memory_order_relaxed) == seq0) {
+                break;
+            }
+        }
+        if (tries == 100) {
+            // Give up for now, but keep the mapping
+            return(false);
+        }
+        sched_yield();
+    }
+    if ((_nowNs() - updateTimeNs) > STALE_SECS * 1000000000LL) {
+        // ka_xmitd has stopped or been restarted; drop this mapping and
+        // look for a new segment later.
+        _unmap();
+        return(false);
+    }
+    return(true);
+}
+
+int64_t
+XmitdStatusShm::_nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec);
+}
@@ -0,0 +1,140 @@
+/*
+ * XmitdStatusShm.h
+ *
+ * Transmitter status published by ka_xmitd in POSIX shared memory.
+ */
+
+#ifndef SRC_KA_XMIT_XMITDSTATUSSHM_H_
+#define SRC_KA_XMIT_XMITDSTATUSSHM_H_
+
+#include <atomic>
+#include <stdint.h>
+#include "KaXmitter.h"
+
+/// @brief Transmitter status and ka_xmitd's fault history, as plain data
+/// which can live in shared memory.
+struct XmitdShmStatus {
+    /// latest status from the transmitter
+    KaXmitStatus xmitStatus;
+
+    /// fault counts since ka_xmitd startup
+    int32_t magnetronCurrentFaultCount;
+    int32_t blowerFaultCount;
+    int32_t safetyInterlockCount;
+    int32_t reversePowerFaultCount;
+    int32_t pulseInputFaultCount;
+    int32_t hvpsCurrentFaultCount;
+    int32_t waveguidePressureFaultCount;
+    int32_t hvpsUnderVoltageCount;
+    int32_t hvpsOverVoltageCount;
+    int32_t autoPulseFaultResets;
+
+    /// Unix times of the latest faults, or -1 if none
+    int64_t magnetronCurrentFaultTime;
+    int64_t blowerFaultTime;
+    int64_t safetyInterlockTime;
+    int64_t reversePowerFaultTime;
+    int64_t pulseInputFaultTime;
+    int64_t hvpsCurrentFaultTime;
+    int64_t waveguidePressureFaultTime;
+    int64_t hvpsUnderVoltageTime;
+    int64_t hvpsOverVoltageTime;
+};
+
+/// @brief XmitdStatusShm maps the shared memory segment in which ka_xmitd
+/// publishes its latest XmitdShmStatus, so that local processes (kadrx in
+/// particular) can get transmitter status without an XML-RPC call.
+///
+/// There is one writer, ka_xmitd, which creates the segment. Readers map
+/// it read-only. The status is guarded by a sequence lock: the writer makes
+/// the sequence number odd while it copies in a new status, and a reader
+/// retries its copy if the sequence number was odd or changed meanwhile.
+/// Neither side ever blocks the other.
+///
+/// The segment header holds a magic number and a layout version, which
+/// must be incremented whenever XmitdShmStatus or the header changes;
+/// readers refuse a segment with a different layout. Readers also treat
+/// the status as stale if ka_xmitd has not updated it for more than
+/// STALE_SECS, and remap the segment in case ka_xmitd has restarted.
+class XmitdStatusShm {
+public:
+    /// Name of the shared memory segment
+    static const char SEGMENT_NAME[];
+
+    /// Magic number identifying the segment ("KXS1")
+    static const uint32_t MAGIC = 0x4b585331;
+
+    /// Segment layout version. Increment this whenever XmitdShmStatus or
+    /// the segment header changes.
+    static const uint32_t LAYOUT_VERSION = 1;
+
+    /// Status older than this is considered stale, seconds. ka_xmitd
+    /// normally updates several times a second, but may pause for up to
+    /// 5 seconds while resetting the transmitter serial port.
+    static const int STALE_SECS = 10;
+
+    /// @brief Construct, and create (for the writer) or map (for readers)
+    /// the segment. A reader which cannot map the segment now will try
+    /// again in read().
+    /// @param writer true for ka_xmitd, which creates the segment and is
+    /// its only writer, false for a read-only reader
+    XmitdStatusShm(bool writer);
+
+    /// @brief Unmap the segment. The writer also removes it, so that
+    /// readers see no status when ka_xmitd is not running.
+    ~XmitdStatusShm();
+
+    /// @brief Return true iff the segment is mapped
+    /// @return true iff the segment is mapped
+    bool isMapped() const { return(_segment != 0); }
+
+    /// @brief Publish a new status. Writer only.
+    /// @param status the new status
+    void write(const XmitdShmStatus & status);
+
+    /// @brief Get a consistent copy of the latest status, mapping the
+    /// segment first if necessary. Reader only.
+    /// @param status the status is copied here on success
+    /// @return true iff a status no older than STALE_SECS was copied
+    bool read(XmitdShmStatus & status);
+
+private:
+    XmitdStatusShm(const XmitdStatusShm &);
+    XmitdStatusShm & operator=(const XmitdStatusShm &);
+
+    /// The shared memory segment
+    struct Segment {
+        uint32_t magic;
+        uint32_t layoutVersion;
+        uint32_t segmentSize;       ///< sizeof(Segment)
+        int32_t writerPid;
+        std::atomic<uint32_t> seq;  ///< odd while a write is in progress
+        uint32_t pad;
+        int64_t updateTimeNs;       ///< CLOCK_MONOTONIC time of last write
+        XmitdShmStatus status;
+    };
+
+    /// Why a reader last failed to use the segment
+    enum MapProblem {
+        MAP_OK,             ///< mapped, or not (yet) created by ka_xmitd
+        MAP_BAD_MAGIC,      ///< not a ka_xmitd status segment
+        MAP_BAD_LAYOUT      ///< written by an incompatible ka_xmitd
+    };
+
+    bool _map();
+    void _unmap();
+    bool _setMapProblem(MapProblem problem);
+    static int64_t _nowNs();
+
+    bool _writer;
+    Segment * _segment;
+
+    /// The problem found by the last attempt to map the segment, so that
+    /// each is logged only when it first appears
+    MapProblem _mapProblem;
+
+    /// Time of the last attempt to map the segment (readers), from _nowNs()
+    int64_t _lastMapTryNs;
+};
+
+#endif /* SRC_KA_XMIT_XMITDSTATUSSHM_H_ */
@@ -26,6 +26,9 @@
 #include <XmlRpc.h>
 
 #include "KaXmitter.h"
+#include "StatusPushServer.h"
+#include "XmitdStatus.h"
+#include "XmitdStatusShm.h"
 #include "../kadrx/KaPmc730.h"
 
 namespace po = boost::program_options;
@@ -45,6 +48,13 @@ XmlRpcServer RpcServer;
 /// (see documentation for GetStatusMethod below)
 XmlRpcValue StatusDict;
 
+/// Server pushing status changes to subscribers, on our XML-RPC port plus
+/// StatusPush::PORT_OFFSET
+StatusPushServer *PushServer = 0;
+
+/// Shared memory segment where we publish status for local readers
+XmitdStatusShm *StatusShm = 0;
+
 /// What was the last time we saw the transmitter in "operate" mode?
 time_t LastOperateTime = 0;
 
@@ -533,6 +543,32 @@ updateStatus() {
     StatusDict["hvps_under_voltage_time"] = XmlRpcValue(int(HvpsUnderVoltageTime));
     StatusDict["hvps_over_voltage_time"] = XmlRpcValue(int(HvpsOverVoltagetTime));
     
+    // Publish the same status for local readers in shared memory
+    if (StatusShm) {
+        XmitdShmStatus shmStatus;
+        shmStatus.xmitStatus = XmitStatus;
+        shmStatus.magnetronCurrentFaultCount = MagnetronCurrentFaultCount;
+        shmStatus.blowerFaultCount = BlowerFaultCount;
+        shmStatus.safetyInterlockCount = SafetyInterlockFaultCount;
+        shmStatus.reversePowerFaultCount = ReversePowerFaultCount;
+        shmStatus.pulseInputFaultCount = PulseInputFaultCount;
+        shmStatus.hvpsCurrentFaultCount = HvpsCurrentFaultCount;
+        shmStatus.waveguidePressureFaultCount = WaveguidePressureFaultFaultCount;
+        shmStatus.hvpsUnderVoltageCount = HvpsUnderVoltageCount;
+        shmStatus.hvpsOverVoltageCount = HvpsOverVoltagetCount;
+        shmStatus.autoPulseFaultResets = AutoResetCount;
+        shmStatus.magnetronCurrentFaultTime = MagnetronCurrentFaultTime;
+        shmStatus.blowerFaultTime = BlowerFaultTime;
+        shmStatus.safetyInterlockTime = SafetyInterlockFaultTime;
+        shmStatus.reversePowerFaultTime = ReversePowerFaultTime;
+        shmStatus.pulseInputFaultTime = PulseInputFaultTime;
+        shmStatus.hvpsCurrentFaultTime = HvpsCurrentFaultTime;
+        shmStatus.waveguidePressureFaultTime = WaveguidePressureFaultFaultTime;
+        shmStatus.hvpsUnderVoltageTime = HvpsUnderVoltageTime;
+        shmStatus.hvpsOverVoltageTime = HvpsOverVoltagetTime;
+        StatusShm->write(shmStatus);
+    }
+
     // If we're operating (hvps_runup is true), update LastOperateTime to now
     if (XmitStatus.hvpsRunup)
         LastOperateTime = time(0);
@@ -735,6 +771,8 @@ usage(const char* argv0) {
     std::cerr << std::endl;
     std::cerr << "Use ""SimulatedKaXmitter"" as <xmitter_ttydev> to " << 
             "simulate a transmitter" << std::endl;
+    std::cerr << "Status changes are pushed to subscribers on port " <<
+            "<server_port> + " << StatusPush::PORT_OFFSET << std::endl;
 }
 
 /// Parse the command line options, removing the successfully parsed bits from
@@ -834,6 +872,12 @@ main(int argc, char *argv[]) {
     PMU_auto_register("starting XML-RPC server");
     RpcServer.bindAndListen(atoi(argv[2]));
     RpcServer.enableIntrospection(true);
+
+    // Start pushing status to subscribers
+    PushServer = new StatusPushServer(atoi(argv[2]) + StatusPush::PORT_OFFSET);
+
+    // Publish status in shared memory for local readers (i.e., kadrx)
+    StatusShm = new XmitdStatusShm(true);
     
     /*
      * How many times do we try to reset the serial port gently before moving
@@ -890,12 +934,22 @@ main(int argc, char *argv[]) {
         if (XmitStatus.pulseInputFault)
             handlePulseInputFault();
         
+        // Accept new status subscribers, and push them any status change.
+        // The status is only encoded when someone is listening.
+        PushServer->service();
+        if (PushServer->nSubscribers() > 0) {
+            XmitdStatus status(StatusDict);
+            PushServer->publish(StatusPush::encode(status));
+        }
+
         // Listen for XML-RPC commands.
         // Note that work() mostly goes for 2x the given time, but sometimes
         // goes for 1x the given time. Who knows why?
         RpcServer.work(0.2);
     }
     
+    delete(StatusShm);
+    delete(PushServer);
     delete(Xmitter);
     return 0;
 } 
@@ -1,9 +1,11 @@
 #
-# Rules to build XmitStatus class and export it (and its header) as a tool
+# Rules to build XmitStatus class, the status push classes and the status
+# shared memory class, and export
+# them (and their headers) as a tool
 #
 import os
 
-tools = ['xmlrpc']
+tools = ['boost_serialization', 'logx', 'xmlrpc']
 env = Environment(tools=['default'] + tools)
 
 # The object file and header file live in this directory.
@@ -11,14 +13,18 @@ tooldir = env.Dir('.').srcnode().abspath    # this directory
 includeDir = tooldir
 
 sources = Split("""
+    StatusPush.cpp
+    StatusPushClient.cpp
+    StatusPushServer.cpp
     XmitClient.cpp
     XmitdStatus.cpp
+    XmitdStatusShm.cpp
 """)
 lib = env.Library('xmitclient', sources)
     
 def xmitclient(env):
     env.Require(tools)
     env.AppendUnique(CPPPATH = [includeDir])
-    env.AppendUnique(LIBS = [lib])
+    env.AppendUnique(LIBS = [lib, 'rt'])
 
 Export('xmitclient')
@@ -0,0 +1,96 @@
+/*
+ * BeamLease.h
+ *
+ * Reference-counted hold on a beam buffer lent by a data source, so that
+ * IQ data can be passed to KaMerge without being copied.
+ */
+
+#ifndef BEAMLEASE_H_
+#define BEAMLEASE_H_
+
+#include <atomic>
+#include <stdint.h>
+
+class BeamLease;
+
+/// BeamLender is implemented by a data source which can lend out the
+/// memory holding its beams, rather than reusing it for the next beam.
+///
+/// KaReplay lends the IQ data it reads when zero_copy_beams is set in the
+/// configuration: each beam is handed to KaMerge as a BeamLease, through
+/// PulseData::lend() or BurstData::lend(), instead of being copied. The
+/// Pentek downconverter reuses its beam buffer on every read, so KaDrxPub
+/// always copies.
+class BeamLender {
+public:
+    virtual ~BeamLender() {}
+
+    /**
+     * Called when the last reference to a lease has been released, after
+     * which the lender may reuse the lease and its memory. This may be
+     * called from any thread, and must be thread safe.
+     * @param lease the lease being returned
+     */
+    virtual void returnBeam(BeamLease *lease) = 0;
+};
+
+/// BeamLease gives a reference-counted view of one beam of IQ data, held
+/// in memory which belongs to a BeamLender. While any reference is held,
+/// the lender will not reuse the memory, and the holder may modify the IQ
+/// data in place. When the last reference is released, the lease goes back
+/// to its lender.
+class BeamLease {
+public:
+    /**
+     * Constructor. The lease starts with no references.
+     * @param lender the lender to which the lease is returned
+     */
+    BeamLease(BeamLender *lender) :
+        _lender(lender),
+        _iq(0),
+        _nGates(0),
+        _refCount(0) {}
+
+    /**
+     * Point the lease at a beam, and take the first reference to it. Used by
+     * the lender when lending the beam.
+     * @param iq the IQ data for the beam, interleaved I and Q
+     * @param nGates the number of gates in the beam
+     */
+    void assign(int16_t *iq, int nGates) {
+        _iq = iq;
+        _nGates = nGates;
+        _refCount.store(1, std::memory_order_relaxed);
+    }
+
+    /// @return the IQ data for the beam
+    int16_t *iq() const { return _iq; }
+
+    /// @return the number of gates in the beam
+    int nGates() const { return _nGates; }
+
+    /// Take another reference to the lease
+    void addRef() {
+        _refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// Release a reference to the lease, returning it to the lender when
+    /// the last reference has been released.
+    void release() {
+        if (_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            _lender->returnBeam(this);
+        }
+    }
+
+private:
+    // not copyable
+    BeamLease(const BeamLease &rhs);
+    BeamLease & operator=(const BeamLease &rhs);
+
+    BeamLender *_lender;
+    int16_t *_iq;
+    int _nGates;
+    std::atomic<int> _refCount;
+};
+
+#endif /* BEAMLEASE_H_ */
@@ -1,4 +1,5 @@
 #include "BurstData.h"
+#include "BeamLease.h"
 #include <cstdio>
 #include <cstring>
 
@@ -19,6 +20,9 @@ BurstData::BurstData()
   _nSamples = 0;
   _nSamplesAlloc = 0;
   _iq = NULL;
+  _iqBuf = NULL;
+  _ownIqBuf = false;
+  _lease = NULL;
 
 }
 
@@ -27,8 +31,29 @@ BurstData::~BurstData()
 
 {
 
-  if (_iq) {
-    delete[] _iq;
+  releaseIq();
+
+  if (_ownIqBuf) {
+    delete[] _iqBuf;
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// use storage owned by the caller for the iq data
+
+void BurstData::useIqStorage(int16_t *iqBuf, int nSamples)
+
+{
+
+  if (_ownIqBuf) {
+    delete[] _iqBuf;
+  }
+  _iqBuf = iqBuf;
+  _ownIqBuf = false;
+  _nSamplesAlloc = nSamples;
+  if (!_lease) {
+    _iq = _iqBuf;
   }
 
 }
@@ -63,12 +88,67 @@ void BurstData::set(int64_t pulseSeqNum,
   _g0FreqHz = g0FreqHz;
   _g0FreqCorrHz = g0FreqCorrHz;
 
+  releaseIq();
   _nSamples = nSamples;
   _allocIq();
+  _iq = _iqBuf;
   memcpy(_iq, iq, _nSamples * 2 * sizeof(int16_t));
 
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// set the data, referencing lent beam memory
+
+void BurstData::lend(int64_t pulseSeqNum,
+                     time_t timeSecs,
+                     int nanoSecs,
+                     double g0Magnitude,
+                     double g0PowerDbm,
+                     double g0PhaseDeg,
+                     double g0IvalNorm,
+                     double g0QvalNorm,
+                     double g0FreqHz,
+                     double g0FreqCorrHz,
+                     BeamLease *lease)
+
+{
+  
+  _pulseSeqNum = pulseSeqNum;
+  _timeSecs = timeSecs;
+  _nanoSecs = nanoSecs;
+
+  _g0Magnitude = g0Magnitude;
+  _g0PowerDbm = g0PowerDbm;
+  _g0PhaseDeg = g0PhaseDeg;
+  _g0IvalNorm = g0IvalNorm;
+  _g0QvalNorm = g0QvalNorm;
+  _g0FreqHz = g0FreqHz;
+  _g0FreqCorrHz = g0FreqCorrHz;
+
+  lease->addRef();
+  releaseIq();
+  _lease = lease;
+  _iq = _lease->iq();
+  _nSamples = _lease->nGates();
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// release lent IQ samples back to the data source
+
+void BurstData::releaseIq()
+
+{
+
+  if (_lease) {
+    _lease->release();
+    _lease = NULL;
+    _iq = _iqBuf;
+    _nSamples = 0;
+  }
+
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // alloc the iq data
 
@@ -80,11 +160,13 @@ void BurstData::_allocIq()
     return;
   }
 
-  if (_iq) {
-    delete[] _iq;
+  if (_ownIqBuf) {
+    delete[] _iqBuf;
   }
 
-  _iq = new int16_t[_nSamples * 2];
+  _iqBuf = new int16_t[_nSamples * 2];
+  _ownIqBuf = true;
+  _nSamplesAlloc = _nSamples;
 
 }
 
@@ -8,8 +8,12 @@
 
 #include <sys/time.h>
 #include <sys/types.h>
+#include <cstddef>
+#include "SlabArena.h"
 
-class BurstData {
+class BeamLease;
+
+class BurstData : public SlabArenaObject {
 
 public:
     
@@ -37,7 +41,35 @@ public:
            double g0FreqCorrHz,
            int nSamples,
            const int16_t *iq);
-    
+
+  // set the data, taking a reference to beam memory lent by the
+  // data source instead of copying the IQ samples
+
+  void lend(int64_t pulseSeqNum,
+            time_t timeSecs,
+            int nanoSecs,
+            double g0Magnitude,
+            double g0PowerDbm,
+            double g0PhaseDeg,
+            double g0IvalNorm,
+            double g0QvalNorm,
+            double g0FreqHz,
+            double g0FreqCorrHz,
+            BeamLease *lease);
+
+  // release any lent IQ samples back to the data source. This must be
+  // called once the IQ samples have been used, so that the source can
+  // reuse the memory. The IQ samples are no longer valid afterwards.
+
+  void releaseIq();
+
+  // use the given buffer, which holds up to nSamples samples and is owned
+  // by the caller, for copies of the IQ samples. Must be called before
+  // set(). Used by PulsePool, which places objects and their IQ samples
+  // together.
+
+  void useIqStorage(int16_t *iqBuf, int nSamples);
+
   // get methods
 
   inline int64_t getPulseSeqNum() const { return _pulseSeqNum; }
@@ -52,6 +84,7 @@ public:
   inline double getG0FreqCorrHz() const { return _g0FreqCorrHz; }
   inline int getNSamples() const { return _nSamples; }
   inline const int16_t *getIq() const { return _iq; }
+  inline bool isLent() const { return _lease != NULL; }
     
 private:
 
@@ -93,10 +126,14 @@ private:
   int _nSamplesAlloc;
 
   /**
-   * IQ data
+   * IQ data. _iq points either into _iqBuf, which we own,
+   * or into memory lent to us by the data source via _lease.
    */
 
   int16_t *_iq;
+  int16_t *_iqBuf;
+  bool _ownIqBuf;
+  BeamLease *_lease;
 
   // functions
 
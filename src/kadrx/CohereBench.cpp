@@ -0,0 +1,235 @@
+/*
+ * CohereBench.cpp
+ *
+ * Accuracy check and microbenchmark for the kernels which cohere IQ data
+ * to the burst phase (IqKernels::cohere()).
+ *
+ * First, each vector kernel supported by this CPU is checked against the
+ * scalar kernel, which is the double precision code KaMerge has always
+ * used. The inputs are random IQ data and phases, plus edge cases: full
+ * scale and zero IQ values, phases of 0, 90, 180 and 270 degrees, values
+ * which round exactly at 0.5, and values which saturate. Every output must
+ * be within one count of the scalar result. The program exits with status
+ * 1 if any is not.
+ *
+ * Then each kernel is timed on pulses of nGates gates, reporting gates
+ * per second.
+ *
+ * Usage: CohereBench [nGates] [nPulses]
+ */
+
+#include "IqKernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static std::vector<IqKernels::Isa>
+supportedIsas() {
+  std::vector<IqKernels::Isa> isas;
+  isas.push_back(IqKernels::SCALAR);
+  if (IqKernels::bestIsa() >= IqKernels::SSE2) {
+    isas.push_back(IqKernels::SSE2);
+  }
+  if (IqKernels::bestIsa() >= IqKernels::AVX2) {
+    isas.push_back(IqKernels::AVX2);
+  }
+  return isas;
+}
+
+// Compare one kernel against the scalar kernel for the given input.
+// Returns the largest difference in counts.
+
+static int
+compare(IqKernels::Isa isa, const std::vector<int16_t> &input,
+        double cosNorm, double sinNorm) {
+  int nGates = input.size() / 2;
+  std::vector<int16_t> expected(input), actual(input);
+  IqKernels::cohere(IqKernels::SCALAR, &expected[0], nGates,
+                    cosNorm, sinNorm);
+  IqKernels::cohere(isa, &actual[0], nGates, cosNorm, sinNorm);
+  int maxDiff = 0;
+  for (size_t ii = 0; ii < input.size(); ii++) {
+    int diff = abs(expected[ii] - actual[ii]);
+    if (diff > maxDiff) {
+      maxDiff = diff;
+    }
+  }
+  return maxDiff;
+}
+
+// Check a kernel over random and edge case inputs.
+// Returns true if every output is within one count of the scalar kernel.
+
+static bool
+checkAccuracy(IqKernels::Isa isa) {
+
+  std::mt19937 rng(12345);
+  std::uniform_int_distribution<int> countDist(-32768, 32767);
+  std::uniform_real_distribution<double> phaseDist(-M_PI, M_PI);
+
+  int maxDiff = 0;
+  long nCompared = 0;
+
+  // Gate counts which exercise the vector loop and the scalar tail
+  const int gateCounts[] = { 1, 3, 4, 7, 8, 9, 15, 16, 17, 1001 };
+  const int nGateCounts = sizeof(gateCounts) / sizeof(gateCounts[0]);
+
+  // Edge case IQ values
+  const int16_t edgeCounts[] = { 0, 1, -1, 2, -2, 32767, -32767, -32768,
+                                 16384, -16384, 23170, -23170 };
+  const int nEdgeCounts = sizeof(edgeCounts) / sizeof(edgeCounts[0]);
+
+  // Edge case phases, including the axes and 45 degrees, where the
+  // rotated values saturate
+  std::vector<double> phases;
+  for (int ii = -8; ii <= 8; ii++) {
+    phases.push_back(ii * M_PI / 8.0);
+  }
+  for (int ii = 0; ii < 200; ii++) {
+    phases.push_back(phaseDist(rng));
+  }
+
+  for (size_t iphase = 0; iphase < phases.size(); iphase++) {
+
+    double cosNorm = cos(phases[iphase]);
+    double sinNorm = sin(phases[iphase]);
+
+    // random data
+    for (int icount = 0; icount < nGateCounts; icount++) {
+      std::vector<int16_t> iq(2 * gateCounts[icount]);
+      for (size_t ii = 0; ii < iq.size(); ii++) {
+        iq[ii] = (int16_t) countDist(rng);
+      }
+      int diff = compare(isa, iq, cosNorm, sinNorm);
+      maxDiff = std::max(maxDiff, diff);
+      nCompared += iq.size();
+    }
+
+    // every pair of edge case values
+    std::vector<int16_t> iq;
+    for (int ii = 0; ii < nEdgeCounts; ii++) {
+      for (int jj = 0; jj < nEdgeCounts; jj++) {
+        iq.push_back(edgeCounts[ii]);
+        iq.push_back(edgeCounts[jj]);
+      }
+    }
+    int diff = compare(isa, iq, cosNorm, sinNorm);
+    maxDiff = std::max(maxDiff, diff);
+    nCompared += iq.size();
+
+  }
+
+  // exact halves: rotating by 180 degrees (cos -1) gives -x exactly, and
+  // by 60 degrees (cos 0.5) gives values ending in .5 for odd counts
+  const double exactCos[] = { -1.0, 0.5, -0.5 };
+  for (int ii = 0; ii < 3; ii++) {
+    std::vector<int16_t> iq;
+    for (int count = -32768; count <= 32767; count += 7) {
+      iq.push_back((int16_t) count);
+      iq.push_back(0);
+    }
+    int diff = compare(isa, iq, exactCos[ii], 0.0);
+    maxDiff = std::max(maxDiff, diff);
+    nCompared += iq.size();
+  }
+
+  bool ok = (maxDiff <= 1);
+  std::cout << std::left << std::setw(8) << IqKernels::isaName(isa)
+            << std::right << " accuracy: " << nCompared
+            << " values, max difference from scalar " << maxDiff
+            << (ok ? " counts - OK" : " counts - FAILED") << std::endl;
+  return ok;
+
+}
+
+// Time a kernel, returning gates per second
+
+static double
+timeKernel(IqKernels::Isa isa, int nGates, int nPulses) {
+
+  std::mt19937 rng(54321);
+  std::uniform_int_distribution<int> countDist(-2000, 2000);
+  std::vector<int16_t> source(2 * nGates);
+  for (size_t ii = 0; ii < source.size(); ii++) {
+    source[ii] = (int16_t) countDist(rng);
+  }
+  std::vector<int16_t> iq(source);
+
+  // untimed warm-up, so that caches are loaded and the CPU has
+  // powered up its vector units
+  for (int ipulse = 0; ipulse < 1000; ipulse++) {
+    IqKernels::cohere(isa, &iq[0], nGates, 1.0, 0.0);
+  }
+
+  double phase = 0.0;
+  double secs = 0.0;
+  for (int ipulse = 0; ipulse < nPulses; ipulse++) {
+    // restore the data between pulses, so that rotations don't
+    // accumulate, and keep the copy out of the timing
+    iq = source;
+    phase += 0.01;
+    Clock::time_point start = Clock::now();
+    IqKernels::cohere(isa, &iq[0], nGates, cos(phase), sin(phase));
+    secs += std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  return (double) nGates * nPulses / secs;
+
+}
+
+int
+main(int argc, char *argv[])
+{
+
+  int nGates = 2000;
+  int nPulses = 20000;
+
+  if (argc > 1) {
+    nGates = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    nPulses = atoi(argv[2]);
+  }
+
+  std::vector<IqKernels::Isa> isas = supportedIsas();
+
+  std::cout << "CohereBench: best kernel for this CPU is "
+            << IqKernels::isaName(IqKernels::bestIsa()) << std::endl;
+
+  bool ok = true;
+  for (size_t ii = 0; ii < isas.size(); ii++) {
+    if (isas[ii] != IqKernels::SCALAR && !checkAccuracy(isas[ii])) {
+      ok = false;
+    }
+  }
+  if (!ok) {
+    return 1;
+  }
+
+  std::cout << nGates << " gates, " << nPulses << " pulses" << std::endl;
+  double scalarRate = 0.0;
+  for (size_t ii = 0; ii < isas.size(); ii++) {
+    double rate = timeKernel(isas[ii], nGates, nPulses);
+    if (isas[ii] == IqKernels::SCALAR) {
+      scalarRate = rate;
+    }
+    std::cout << std::left << std::setw(8) << IqKernels::isaName(isas[ii])
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << rate / 1.0e6 << " Mgates/s, "
+              << std::setprecision(2) << rate / scalarRate
+              << "x scalar" << std::endl;
+  }
+
+  return 0;
+
+}
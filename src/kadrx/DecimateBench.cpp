@@ -0,0 +1,231 @@
+/*
+ * DecimateBench.cpp
+ *
+ * Accuracy check and microbenchmark for the kernels which decimate IQ data
+ * in range (IqKernels::decimate()).
+ *
+ * First, each vector kernel supported by this CPU is checked against the
+ * scalar kernel, which is the double precision code PulseData has always
+ * used, for every supported factor. The inputs are random IQ data, plus
+ * edge cases: full scale and zero IQ values, first gates with no power,
+ * and groups whose mean power saturates the first gate. Since the vector
+ * kernels sum the powers exactly, every output must match the scalar
+ * result exactly. The program exits with status 1 if any does not.
+ *
+ * Then each kernel is timed on pulses of nGates gates for each factor,
+ * reporting input gates per second.
+ *
+ * Usage: DecimateBench [nGates] [nPulses]
+ */
+
+#include "IqKernels.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const int Factors[] = { 2, 3, 4, 8 };
+static const int NFactors = sizeof(Factors) / sizeof(Factors[0]);
+
+static std::vector<IqKernels::Isa>
+supportedIsas() {
+  std::vector<IqKernels::Isa> isas;
+  isas.push_back(IqKernels::SCALAR);
+  if (IqKernels::bestIsa() >= IqKernels::SSE2) {
+    isas.push_back(IqKernels::SSE2);
+  }
+  if (IqKernels::bestIsa() >= IqKernels::AVX2) {
+    isas.push_back(IqKernels::AVX2);
+  }
+  return isas;
+}
+
+// Compare one kernel against the scalar kernel for the given input.
+// Returns the number of outputs which differ.
+
+static long
+compare(IqKernels::Isa isa, const std::vector<int16_t> &input, int factor) {
+  int nGates = input.size() / 2;
+  std::vector<int16_t> expected(input), actual(input);
+  int nExpected = IqKernels::decimate(IqKernels::SCALAR, &expected[0],
+                                      nGates, factor);
+  int nActual = IqKernels::decimate(isa, &actual[0], nGates, factor);
+  if (nActual != nExpected) {
+    return nGates;
+  }
+  long nDiffer = 0;
+  for (int ii = 0; ii < 2 * nExpected; ii++) {
+    if (expected[ii] != actual[ii]) {
+      nDiffer++;
+    }
+  }
+  return nDiffer;
+}
+
+// Check a kernel over random and edge case inputs.
+// Returns true if every output matches the scalar kernel.
+
+static bool
+checkAccuracy(IqKernels::Isa isa) {
+
+  std::mt19937 rng(12345);
+  std::uniform_int_distribution<int> countDist(-32768, 32767);
+  std::uniform_int_distribution<int> smallDist(-3, 3);
+
+  long nDiffer = 0;
+  long nCompared = 0;
+
+  // Gate counts which exercise the vector loops, the scalar tails, and
+  // gates left over at the end
+  const int gateCounts[] = { 1, 2, 3, 7, 8, 9, 15, 16, 17, 63, 64, 65, 1001 };
+  const int nGateCounts = sizeof(gateCounts) / sizeof(gateCounts[0]);
+
+  // Edge case IQ values
+  const int16_t edgeCounts[] = { 0, 1, -1, 2, -2, 32767, -32767, -32768,
+                                 16384, -16384, 23170, -23170 };
+  const int nEdgeCounts = sizeof(edgeCounts) / sizeof(edgeCounts[0]);
+
+  for (int ifactor = 0; ifactor < NFactors; ifactor++) {
+
+    int factor = Factors[ifactor];
+
+    for (int icount = 0; icount < nGateCounts; icount++) {
+
+      // random data, full scale
+      std::vector<int16_t> iq(2 * gateCounts[icount]);
+      for (size_t ii = 0; ii < iq.size(); ii++) {
+        iq[ii] = (int16_t) countDist(rng);
+      }
+      nDiffer += compare(isa, iq, factor);
+      nCompared += iq.size() / factor;
+
+      // weak first gates among strong ones, which saturate when scaled
+      // up, and first gates with no power
+      for (size_t ii = 0; ii < iq.size(); ii += 2 * factor) {
+        iq[ii] = (int16_t) smallDist(rng);
+        iq[ii + 1] = (int16_t) smallDist(rng);
+      }
+      nDiffer += compare(isa, iq, factor);
+      nCompared += iq.size() / factor;
+
+    }
+
+    // every pair of edge case values, in groups of the same value and in
+    // groups of different values
+    std::vector<int16_t> same, mixed;
+    for (int ii = 0; ii < nEdgeCounts; ii++) {
+      for (int jj = 0; jj < nEdgeCounts; jj++) {
+        for (int kk = 0; kk < factor; kk++) {
+          same.push_back(edgeCounts[ii]);
+          same.push_back(edgeCounts[jj]);
+        }
+        mixed.push_back(edgeCounts[ii]);
+        mixed.push_back(edgeCounts[jj]);
+      }
+    }
+    nDiffer += compare(isa, same, factor);
+    nCompared += same.size() / factor;
+    nDiffer += compare(isa, mixed, factor);
+    nCompared += mixed.size() / factor;
+
+  }
+
+  bool ok = (nDiffer == 0);
+  std::cout << std::left << std::setw(8) << IqKernels::isaName(isa)
+            << std::right << " accuracy: " << nCompared
+            << " values, " << nDiffer << " differ from scalar"
+            << (ok ? " - OK" : " - FAILED") << std::endl;
+  return ok;
+
+}
+
+// Time a kernel, returning input gates per second
+
+static double
+timeKernel(IqKernels::Isa isa, int nGates, int nPulses, int factor) {
+
+  std::mt19937 rng(54321);
+  std::uniform_int_distribution<int> countDist(-2000, 2000);
+  std::vector<int16_t> source(2 * nGates);
+  for (size_t ii = 0; ii < source.size(); ii++) {
+    source[ii] = (int16_t) countDist(rng);
+  }
+  std::vector<int16_t> iq(source);
+
+  // untimed warm-up, so that caches are loaded and the CPU has
+  // powered up its vector units
+  for (int ipulse = 0; ipulse < 1000; ipulse++) {
+    iq = source;
+    IqKernels::decimate(isa, &iq[0], nGates, factor);
+  }
+
+  double secs = 0.0;
+  for (int ipulse = 0; ipulse < nPulses; ipulse++) {
+    // restore the data between pulses, and keep the copy out of the
+    // timing
+    iq = source;
+    Clock::time_point start = Clock::now();
+    IqKernels::decimate(isa, &iq[0], nGates, factor);
+    secs += std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  return (double) nGates * nPulses / secs;
+
+}
+
+int
+main(int argc, char *argv[])
+{
+
+  int nGates = 2000;
+  int nPulses = 20000;
+
+  if (argc > 1) {
+    nGates = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    nPulses = atoi(argv[2]);
+  }
+
+  std::vector<IqKernels::Isa> isas = supportedIsas();
+
+  std::cout << "DecimateBench: best kernel for this CPU is "
+            << IqKernels::isaName(IqKernels::bestIsa()) << std::endl;
+
+  bool ok = true;
+  for (size_t ii = 0; ii < isas.size(); ii++) {
+    if (isas[ii] != IqKernels::SCALAR && !checkAccuracy(isas[ii])) {
+      ok = false;
+    }
+  }
+  if (!ok) {
+    return 1;
+  }
+
+  std::cout << nGates << " gates, " << nPulses << " pulses" << std::endl;
+  for (int ifactor = 0; ifactor < NFactors; ifactor++) {
+    int factor = Factors[ifactor];
+    double scalarRate = 0.0;
+    for (size_t ii = 0; ii < isas.size(); ii++) {
+      double rate = timeKernel(isas[ii], nGates, nPulses, factor);
+      if (isas[ii] == IqKernels::SCALAR) {
+        scalarRate = rate;
+      }
+      std::cout << "factor " << factor << " "
+                << std::left << std::setw(8) << IqKernels::isaName(isas[ii])
+                << std::right << std::fixed << std::setprecision(1)
+                << std::setw(10) << rate / 1.0e6 << " Mgates/s, "
+                << std::setprecision(2) << rate / scalarRate
+                << "x scalar" << std::endl;
+    }
+  }
+
+  return 0;
+
+}
@@ -0,0 +1,186 @@
+/*
+ * ForkJoinPool.cpp
+ *
+ * A small fixed pool of worker threads which run the tasks of one job at a
+ * time, with the calling thread taking part.
+ */
+
+#include "ForkJoinPool.h"
+#include <QThread>
+#include <sched.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FJP_PAUSE() _mm_pause()
+#else
+#define FJP_PAUSE()
+#endif
+
+// Number of times a worker checks for a new job before it goes to sleep,
+// and the number of times the caller checks for the end of a job before it
+// starts yielding the CPU. Each check takes of the order of 10-100 ns.
+static const int WorkerSpins = 2000;
+static const int JoinSpins = 1000;
+
+// The claim word: the generation in the top 32 bits, then the number of
+// tasks and the next task to be claimed, 16 bits each
+
+static uint64_t
+claimWord(unsigned int generation, int nTasks, int nextTask)
+{
+  return ((uint64_t) generation << 32) | ((uint64_t) nTasks << 16) |
+    (uint64_t) nextTask;
+}
+
+/// A worker thread
+class ForkJoinPool::Worker : public QThread {
+public:
+  Worker(ForkJoinPool &pool) : _pool(pool) {}
+  void run() {
+    _pool._threadPolicy.applyToCurrentThread();
+    _pool._workerLoop();
+  }
+private:
+  ForkJoinPool &_pool;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+ForkJoinPool::ForkJoinPool(int nWorkers, const ThreadPolicy &policy) :
+  _threadPolicy(policy),
+  _job(0),
+  _claim(0),
+  _nLeft(0),
+  _generation(0),
+  _nSleeping(0),
+  _stop(false)
+{
+  for (int ii = 0; ii < nWorkers; ii++) {
+    _workers.push_back(new Worker(*this));
+    _workers.back()->start();
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+ForkJoinPool::~ForkJoinPool()
+{
+  _mutex.lock();
+  _stop = true;
+  _generation.fetch_add(1);
+  _wakeup.wakeAll();
+  _mutex.unlock();
+  for (size_t ii = 0; ii < _workers.size(); ii++) {
+    _workers[ii]->wait();
+    delete _workers[ii];
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// run all tasks of a job, returning when they are done
+
+void ForkJoinPool::run(Job &job, int nTasks)
+{
+
+  if (_workers.empty()) {
+    for (int task = 0; task < nTasks; task++) {
+      job.runTask(task);
+    }
+    return;
+  }
+
+  // Publish the job, then start it. A worker late leaving the last job
+  // sees the new generation in the claim word, and claims nothing.
+
+  unsigned int generation = _generation.load(std::memory_order_relaxed) + 1;
+  _job = &job;
+  _nLeft.store(nTasks, std::memory_order_relaxed);
+  _claim.store(claimWord(generation, nTasks, 0), std::memory_order_release);
+
+  // fork: start the spinning workers, and wake any sleeping ones
+
+  _generation.store(generation, std::memory_order_seq_cst);
+  if (_nSleeping.load(std::memory_order_seq_cst) > 0) {
+    _mutex.lock();
+    _wakeup.wakeAll();
+    _mutex.unlock();
+  }
+
+  // take part
+
+  _runTasks(generation);
+
+  // join
+
+  for (int spin = 0; _nLeft.load(std::memory_order_acquire) > 0; spin++) {
+    if (spin < JoinSpins) {
+      FJP_PAUSE();
+    } else {
+      sched_yield();
+    }
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// claim and run tasks of the given generation until there are none left
+
+void ForkJoinPool::_runTasks(unsigned int generation)
+{
+  while (true) {
+    uint64_t claim = _claim.load(std::memory_order_acquire);
+    int task;
+    do {
+      int nTasks = (claim >> 16) & 0xffff;
+      task = claim & 0xffff;
+      if ((claim >> 32) != generation || task >= nTasks) {
+        return;
+      }
+    } while (!_claim.compare_exchange_weak(claim, claim + 1,
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_acquire));
+    // the job cannot change until this task is done
+    _job->runTask(task);
+    _nLeft.fetch_sub(1, std::memory_order_acq_rel);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// worker thread loop
+
+void ForkJoinPool::_workerLoop()
+{
+
+  unsigned int seen = _generation.load(std::memory_order_acquire);
+
+  while (true) {
+
+    // wait for the next job, spinning at first
+
+    unsigned int gen = _generation.load(std::memory_order_acquire);
+    for (int spin = 0; gen == seen && spin < WorkerSpins; spin++) {
+      FJP_PAUSE();
+      gen = _generation.load(std::memory_order_acquire);
+    }
+
+    if (gen == seen) {
+      // The fences pair with the one in run(), so that either run() sees
+      // that we are sleeping, or we see the new generation.
+      _mutex.lock();
+      _nSleeping.fetch_add(1, std::memory_order_seq_cst);
+      while ((gen = _generation.load(std::memory_order_seq_cst)) == seen &&
+             !_stop) {
+        _wakeup.wait(&_mutex);
+      }
+      _nSleeping.fetch_sub(1, std::memory_order_relaxed);
+      bool stop = _stop;
+      _mutex.unlock();
+      if (stop) {
+        return;
+      }
+    }
+
+    seen = gen;
+    _runTasks(gen);
+
+  }
+
+}
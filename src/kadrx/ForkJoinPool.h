@@ -0,0 +1,95 @@
+/*
+ * ForkJoinPool.h
+ *
+ * A small fixed pool of worker threads which run the tasks of one job at a
+ * time, with the calling thread taking part.
+ */
+
+#ifndef FORKJOINPOOL_H_
+#define FORKJOINPOOL_H_
+
+#include "ThreadPolicy.h"
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+/// ForkJoinPool runs the tasks of a job concurrently on a fixed set of
+/// worker threads and the calling thread, returning when all of them are
+/// done. It is meant for splitting up the work on a single pulse, where
+/// a job is a handful of tasks taking some microseconds each, so the fork
+/// and the join must be cheap:
+///
+/// - the tasks are claimed from an atomic word holding the job's
+///   generation, its number of tasks and the next task, with no locking.
+///   A worker only claims tasks of the generation it was started for, so
+///   one which is late leaving a job can never claim tasks of the next.
+/// - the workers spin for a short time after each job, so that the next one
+///   usually starts without a wakeup, and only then sleep on a condition
+///   variable
+/// - the calling thread joins by spinning on an atomic count of the tasks
+///   left
+///
+/// Only one thread may call run(). With no workers, run() simply runs the
+/// tasks in order on the calling thread.
+class ForkJoinPool {
+public:
+    /// A job, split into tasks which may run concurrently
+    class Job {
+    public:
+        virtual ~Job() {}
+        /// Run one task
+        /// @param task the task number, from 0 to nTasks - 1
+        virtual void runTask(int task) = 0;
+    };
+
+    /// Start the worker threads
+    /// @param nWorkers the number of worker threads
+    /// @param policy CPU set and scheduling applied by each worker
+    ForkJoinPool(int nWorkers, const ThreadPolicy &policy = ThreadPolicy());
+
+    /// Stop the worker threads
+    ~ForkJoinPool();
+
+    /// The most tasks a job may have
+    static const int MaxTasks = 0xffff;
+
+    /// Run all tasks of a job, returning when they are done
+    /// @param job the job
+    /// @param nTasks the number of tasks, at most MaxTasks
+    void run(Job &job, int nTasks);
+
+    /// @return the number of worker threads
+    int nWorkers() const { return _workers.size(); }
+
+private:
+    class Worker;
+    friend class Worker;
+
+    void _workerLoop();
+    void _runTasks(unsigned int generation);
+
+    std::vector<Worker *> _workers;
+    ThreadPolicy _threadPolicy;
+
+    /// the current job, read only by a thread which has claimed one of
+    /// its tasks
+    Job *_job;
+    /// the current job's generation, number of tasks and next task to be
+    /// claimed, packed so that they change together
+    std::atomic<uint64_t> _claim;
+    /// the number of tasks not yet finished
+    std::atomic<int> _nLeft;
+
+    /// incremented to start each job
+    std::atomic<unsigned int> _generation;
+
+    /// for workers which have stopped spinning
+    QMutex _mutex;
+    QWaitCondition _wakeup;
+    std::atomic<int> _nSleeping;
+    bool _stop;
+};
+
+#endif /* FORKJOINPOOL_H_ */
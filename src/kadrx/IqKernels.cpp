@@ -0,0 +1,719 @@
+/*
+ * IqKernels.cpp
+ *
+ * Vectorized kernels for the per-gate IQ processing done by KaMerge.
+ */
+
+#include "IqKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// The vector kernels are built for x86 only. The AVX2 kernel is compiled
+// with a target attribute, so the rest of the program need not be built
+// for AVX2, and it is used only if the CPU supports it.
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define IQK_HAVE_SSE2 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define IQK_HAVE_AVX2 1
+#endif
+
+IqKernels::Isa IqKernels::_bestIsa = IqKernels::bestIsa();
+
+/////////////////////////////////////////////////////////////////////////////
+// best instruction set supported by this CPU
+
+IqKernels::Isa IqKernels::bestIsa()
+{
+#ifdef IQK_HAVE_AVX2
+  // may be called during static initialization, before the CPU model
+  // would otherwise have been initialized
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return AVX2;
+  }
+#endif
+#ifdef IQK_HAVE_SSE2
+  return SSE2;
+#else
+  return SCALAR;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// name of an instruction set
+
+std::string IqKernels::isaName(Isa isa)
+{
+  switch (isa) {
+    case SCALAR:
+      return "scalar";
+    case SSE2:
+      return "SSE2";
+    case AVX2:
+      return "AVX2";
+  }
+  return "unknown";
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// cohere IQ data to the burst phase, using the best kernel for this CPU
+
+void IqKernels::cohere(int16_t *iq, int nGates,
+                       double cosNorm, double sinNorm)
+{
+  cohere(_bestIsa, iq, nGates, cosNorm, sinNorm);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// cohere IQ data to the burst phase, using the given kernel
+
+void IqKernels::cohere(Isa isa, int16_t *iq, int nGates,
+                       double cosNorm, double sinNorm)
+{
+  _cohere(isa, iq, nGates, cosNorm, sinNorm, iq);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// cohere IQ data to the burst phase, using the given kernel, from iq to out,
+// which may be the same
+
+void IqKernels::_cohere(Isa isa, const int16_t *iq, int nGates,
+                        double cosNorm, double sinNorm, int16_t *out)
+{
+
+  // The fixed point kernels need coefficients in [-1, 1]. Anything else,
+  // such as the placeholder values used before the first burst arrives,
+  // goes to the scalar kernel.
+
+  if (!(fabs(cosNorm) <= 1.0 && fabs(sinNorm) <= 1.0)) {
+    isa = SCALAR;
+  }
+
+  switch (isa) {
+#ifdef IQK_HAVE_AVX2
+    case AVX2:
+      _cohereAvx2(iq, nGates, cosNorm, sinNorm, out);
+      return;
+#endif
+#ifdef IQK_HAVE_SSE2
+    case SSE2:
+      _cohereSse2(iq, nGates, cosNorm, sinNorm, out);
+      return;
+#endif
+    default:
+      _cohereScalar(iq, nGates, cosNorm, sinNorm, out);
+      return;
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// scalar kernel, in double precision
+
+void IqKernels::_cohereScalar(const int16_t *iq, int nGates,
+                              double cosNorm, double sinNorm, int16_t *out)
+{
+
+  const int16_t *II = iq;
+  const int16_t *QQ = iq + 1;
+  int16_t *outII = out;
+  int16_t *outQQ = out + 1;
+
+  for (int igate = 0; igate < nGates;
+       igate++, II += 2, QQ += 2, outII += 2, outQQ += 2) {
+
+    double ival = *II;
+    double qval = *QQ;
+
+    double ivalCohered = ival * cosNorm + qval * sinNorm;
+    double qvalCohered = qval * cosNorm - ival * sinNorm;
+
+    if (ivalCohered < -32767.0) {
+      ivalCohered = -32767.0;
+    } else if (ivalCohered > 32767.0) {
+      ivalCohered = 32767.0;
+    }
+
+    if (qvalCohered < -32767.0) {
+      qvalCohered = -32767.0;
+    } else if (qvalCohered > 32767.0) {
+      qvalCohered = 32767.0;
+    }
+
+    *outII = (int16_t) (ivalCohered + 0.5);
+    *outQQ = (int16_t) (qvalCohered + 0.5);
+
+  } // igate
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Fixed point coefficients for the vector kernels.
+//
+// Each coefficient is scaled to Q29 and split into a signed high part and
+// a 15-bit low part, C = hi * 2^15 + lo, both of which fit in an int16.
+// _mm_madd_epi16 on an interleaved (I, Q) pair then gives
+//     hiSum = I * hi0 + Q * hi1   and   loSum = I * lo0 + Q * lo1
+// without overflow, and hiSum + (loSum >> 15) is the rotated value in Q14,
+// good to about 1e-4 counts.
+//
+// Rounding follows the scalar kernel: trunc(x + 0.5), with x clamped to
+// +/-32767 first. Clamping before rounding is the same as saturating to
+// [-32766, 32767] after it, which the vector kernels do with a saturating
+// pack and a 16-bit max.
+
+namespace {
+
+struct CohereCoeffs {
+  // (I, Q) multipliers for I' and Q', as 32-bit words holding two int16
+  int32_t iHi, iLo, qHi, qLo;
+};
+
+void splitQ29(double coeff, int16_t &hi, int16_t &lo)
+{
+  int32_t c = (int32_t) lrint(coeff * (1 << 29));
+  hi = (int16_t) (c >> 15);
+  lo = (int16_t) (c & 0x7fff);
+}
+
+int32_t pairWord(int16_t forI, int16_t forQ)
+{
+  return (int32_t) ((uint32_t) (uint16_t) forI |
+                    ((uint32_t) (uint16_t) forQ << 16));
+}
+
+CohereCoeffs makeCoeffs(double cosNorm, double sinNorm)
+{
+  int16_t cosHi, cosLo, sinHi, sinLo, negSinHi, negSinLo;
+  splitQ29(cosNorm, cosHi, cosLo);
+  splitQ29(sinNorm, sinHi, sinLo);
+  splitQ29(-sinNorm, negSinHi, negSinLo);
+  CohereCoeffs coeffs;
+  // I' = I * cos + Q * sin
+  coeffs.iHi = pairWord(cosHi, sinHi);
+  coeffs.iLo = pairWord(cosLo, sinLo);
+  // Q' = I * -sin + Q * cos
+  coeffs.qHi = pairWord(negSinHi, cosHi);
+  coeffs.qLo = pairWord(negSinLo, cosLo);
+  return coeffs;
+}
+
+// Q14 value of the rounding offset, 0.5
+const int32_t HalfQ14 = 1 << 13;
+
+// lowest output, since the scalar kernel clamps to -32767 before adding 0.5
+const int16_t MinOut = -32766;
+
+} // namespace
+
+#ifdef IQK_HAVE_SSE2
+
+/////////////////////////////////////////////////////////////////////////////
+// SSE2 kernel, 4 gates at a time
+
+void IqKernels::_cohereSse2(const int16_t *iq, int nGates,
+                            double cosNorm, double sinNorm, int16_t *out)
+{
+
+  CohereCoeffs coeffs = makeCoeffs(cosNorm, sinNorm);
+  const __m128i iHi = _mm_set1_epi32(coeffs.iHi);
+  const __m128i iLo = _mm_set1_epi32(coeffs.iLo);
+  const __m128i qHi = _mm_set1_epi32(coeffs.qHi);
+  const __m128i qLo = _mm_set1_epi32(coeffs.qLo);
+  const __m128i half = _mm_set1_epi32(HalfQ14);
+  const __m128i minOut = _mm_set1_epi16(MinOut);
+
+  int igate = 0;
+  for (; igate + 4 <= nGates; igate += 4) {
+
+    __m128i v = _mm_loadu_si128((const __m128i *) (iq + 2 * igate));
+
+    // rotated values in Q14, plus 0.5
+    __m128i ival = _mm_add_epi32(_mm_madd_epi16(v, iHi),
+                                 _mm_srai_epi32(_mm_madd_epi16(v, iLo), 15));
+    __m128i qval = _mm_add_epi32(_mm_madd_epi16(v, qHi),
+                                 _mm_srai_epi32(_mm_madd_epi16(v, qLo), 15));
+    ival = _mm_add_epi32(ival, half);
+    qval = _mm_add_epi32(qval, half);
+
+    // truncate toward zero: bias negative values by 2^14 - 1 before the
+    // arithmetic shift
+    ival = _mm_add_epi32(ival, _mm_srli_epi32(_mm_srai_epi32(ival, 31), 18));
+    qval = _mm_add_epi32(qval, _mm_srli_epi32(_mm_srai_epi32(qval, 31), 18));
+    ival = _mm_srai_epi32(ival, 14);
+    qval = _mm_srai_epi32(qval, 14);
+
+    // saturate, and interleave back into (I, Q) pairs
+    __m128i packed = _mm_max_epi16(_mm_packs_epi32(ival, qval), minOut);
+    _mm_storeu_si128((__m128i *) (out + 2 * igate),
+                     _mm_unpacklo_epi16(packed, _mm_srli_si128(packed, 8)));
+
+  }
+
+  _cohereScalar(iq + 2 * igate, nGates - igate, cosNorm, sinNorm,
+                out + 2 * igate);
+
+}
+
+#endif
+
+#ifdef IQK_HAVE_AVX2
+
+/////////////////////////////////////////////////////////////////////////////
+// AVX2 kernel, 8 gates at a time. The same as the SSE2 kernel, in both
+// 128-bit lanes at once.
+
+__attribute__((target("avx2")))
+void IqKernels::_cohereAvx2(const int16_t *iq, int nGates,
+                            double cosNorm, double sinNorm, int16_t *out)
+{
+
+  CohereCoeffs coeffs = makeCoeffs(cosNorm, sinNorm);
+  const __m256i iHi = _mm256_set1_epi32(coeffs.iHi);
+  const __m256i iLo = _mm256_set1_epi32(coeffs.iLo);
+  const __m256i qHi = _mm256_set1_epi32(coeffs.qHi);
+  const __m256i qLo = _mm256_set1_epi32(coeffs.qLo);
+  const __m256i half = _mm256_set1_epi32(HalfQ14);
+  const __m256i minOut = _mm256_set1_epi16(MinOut);
+
+  int igate = 0;
+  for (; igate + 8 <= nGates; igate += 8) {
+
+    __m256i v = _mm256_loadu_si256((const __m256i *) (iq + 2 * igate));
+
+    __m256i ival =
+      _mm256_add_epi32(_mm256_madd_epi16(v, iHi),
+                       _mm256_srai_epi32(_mm256_madd_epi16(v, iLo), 15));
+    __m256i qval =
+      _mm256_add_epi32(_mm256_madd_epi16(v, qHi),
+                       _mm256_srai_epi32(_mm256_madd_epi16(v, qLo), 15));
+    ival = _mm256_add_epi32(ival, half);
+    qval = _mm256_add_epi32(qval, half);
+
+    ival = _mm256_add_epi32(ival,
+                            _mm256_srli_epi32(_mm256_srai_epi32(ival, 31), 18));
+    qval = _mm256_add_epi32(qval,
+                            _mm256_srli_epi32(_mm256_srai_epi32(qval, 31), 18));
+    ival = _mm256_srai_epi32(ival, 14);
+    qval = _mm256_srai_epi32(qval, 14);
+
+    // pack and unpack work within each 128-bit lane, so each lane ends up
+    // holding its own 4 gates in order
+    __m256i packed = _mm256_max_epi16(_mm256_packs_epi32(ival, qval), minOut);
+    _mm256_storeu_si256((__m256i *) (out + 2 * igate),
+                        _mm256_unpacklo_epi16(packed,
+                                              _mm256_srli_si256(packed, 8)));
+
+  }
+
+  // the compiler does not always do this before the tail call, and SSE
+  // code run with the upper halves of the registers dirty is very slow
+  _mm256_zeroupper();
+  _cohereScalar(iq + 2 * igate, nGates - igate, cosNorm, sinNorm,
+                out + 2 * igate);
+
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// decimate IQ data in range, using the best kernel for this CPU
+
+int IqKernels::decimate(int16_t *iq, int nGates, int factor)
+{
+  return decimate(_bestIsa, iq, nGates, factor);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// decimate IQ data in range, using the given kernel
+
+int IqKernels::decimate(Isa isa, int16_t *iq, int nGates, int factor)
+{
+
+  if (factor <= 1) {
+    return nGates;
+  }
+  int newNGates = nGates / factor;
+  _decimate(isa, iq, newNGates, factor, iq);
+  return newNGates;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// decimate IQ data in range, using the given kernel, from iq to newIq,
+// which may be the same
+
+void IqKernels::_decimate(Isa isa, const int16_t *iq, int newNGates,
+                          int factor, int16_t *newIq)
+{
+
+  if (factor > MAX_VECTOR_DECIMATION) {
+    isa = SCALAR;
+  }
+
+  switch (isa) {
+#ifdef IQK_HAVE_SSE2
+    case AVX2:
+    case SSE2:
+      _decimateVector(isa, iq, newNGates, factor, newIq);
+      return;
+#endif
+    default:
+      _decimateScalar(iq, newNGates, factor, newIq);
+      return;
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// decimate, cohere and pack one channel of a pulse, using the best kernels
+// for this CPU
+
+int IqKernels::packPulse(const int16_t *iq, int nGates, int factor,
+                         bool doCohere, double cosNorm, double sinNorm,
+                         void *out)
+{
+  return packPulse(_bestIsa, iq, nGates, factor,
+                   doCohere, cosNorm, sinNorm, out);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// decimate, cohere and pack one channel of a pulse, using the given kernels
+//
+// The work is done a chunk of new gates at a time, small enough to stay in
+// L1 between the decimation and the coherence. Chunks are built in place
+// in the destination, unless it is not aligned for int16_t, which happens
+// when it follows a packet of odd length in the output batch. Then each
+// chunk is built in a buffer on the stack and copied.
+
+namespace {
+
+const int PackChunk = 256;  // new gates per chunk, 1 kB
+
+} // namespace
+
+int IqKernels::packPulse(Isa isa, const int16_t *iq, int nGates, int factor,
+                         bool doCohere, double cosNorm, double sinNorm,
+                         void *out)
+{
+
+  if (factor < 1) {
+    factor = 1;
+  }
+  int newNGates = nGates / factor;
+  char *dest = (char *) out;
+
+  if (factor == 1 && !doCohere) {
+    memcpy(dest, iq, newNGates * 2 * sizeof(int16_t));
+    return newNGates;
+  }
+
+  bool aligned = ((uintptr_t) dest % sizeof(int16_t)) == 0;
+  int16_t chunk[2 * PackChunk];
+
+  for (int newG = 0; newG < newNGates; newG += PackChunk) {
+
+    int nNew = std::min(PackChunk, newNGates - newG);
+    const int16_t *in = iq + 2 * newG * factor;
+    int16_t *newIq = aligned ? (int16_t *) dest : chunk;
+
+    if (factor == 1) {
+      _cohere(isa, in, nNew, cosNorm, sinNorm, newIq);
+    } else {
+      _decimate(isa, in, nNew, factor, newIq);
+      if (doCohere) {
+        _cohere(isa, newIq, nNew, cosNorm, sinNorm, newIq);
+      }
+    }
+
+    size_t chunkLen = nNew * 2 * sizeof(int16_t);
+    if (!aligned) {
+      memcpy(dest, chunk, chunkLen);
+    }
+    dest += chunkLen;
+
+  }
+
+  return newNGates;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// scalar decimation kernel, in double precision
+
+void IqKernels::_decimateScalar(const int16_t *iq, int newNGates,
+                                int factor, int16_t *newIq)
+{
+
+  for (int newG = 0; newG < newNGates; newG++) {
+
+    // Save I and Q of the first gate being averaged for this new gate
+    double firstI = iq[0];
+    double firstQ = iq[1];
+    double firstPower = firstI * firstI + firstQ * firstQ;
+
+    // Sum powers for the gates going into the new gate
+    double powerSum = 0.0;
+    for (int subG = 0; subG < factor; subG++) {
+      double i = iq[0];
+      double q = iq[1];
+      powerSum += i * i + q * q;
+      iq += 2;    // step to the next original gate
+    }
+
+    // Average power for the gates
+    double newPower = powerSum / factor;
+
+    // Scale factor for firstI and firstQ so that they keep their original
+    // phase but will yield the average power of the combined gates.
+
+    double iqScale = (firstPower > 0.0) ? sqrt(newPower / firstPower) : 1.0;
+
+    double newI = firstI * iqScale;
+    double newQ = firstQ * iqScale;
+
+    if (newI < -32768) {
+      newI = -32768;
+    } else if (newI > 32767) {
+      newI = 32767;
+    }
+
+    if (newQ < -32768) {
+      newQ = -32768;
+    } else if (newQ > 32767) {
+      newQ = 32767;
+    }
+
+    newIq[0] = (int16_t) newI;
+    newIq[1] = (int16_t) newQ;
+
+    newIq += 2; // step to the next new gate
+
+  }
+
+}
+
+#ifdef IQK_HAVE_SSE2
+
+/////////////////////////////////////////////////////////////////////////////
+// Vector decimation.
+//
+// The power of each gate, I^2 + Q^2, is computed with one 16-bit multiply-
+// add per gate, and summed over each group in 64-bit integers, so both are
+// exact. The only case which overflows a signed 32-bit result, I = Q =
+// -32768, gives 2^31, which is still correct read as unsigned.
+//
+// The scale factor for the first gate of each group then needs a divide
+// and a square root, which are done for 2 (SSE2) or 4 (AVX2) new gates at
+// a time in double precision. These are the same IEEE operations, in the
+// same order, as the scalar kernel does, so the results are identical.
+//
+// The gates are handled in chunks of DecimateChunk new gates, so the
+// temporary arrays stay on the stack. All of a chunk is read before any of
+// it is written, and since new gate n is written at or before old gate n,
+// the next chunk is never overwritten before it is read.
+
+namespace {
+
+const int DecimateChunk = 32;
+
+} // namespace
+
+void IqKernels::_decimateVector(Isa isa, const int16_t *iq, int newNGates,
+                                int factor, int16_t *newIq)
+{
+
+  uint32_t power[DecimateChunk * MAX_VECTOR_DECIMATION];
+  double firstI[DecimateChunk];
+  double firstQ[DecimateChunk];
+  double firstPower[DecimateChunk];
+  double meanPower[DecimateChunk];
+
+  for (int newG = 0; newG < newNGates; newG += DecimateChunk) {
+
+    int nNew = std::min(DecimateChunk, newNGates - newG);
+    const int16_t *in = iq + 2 * newG * factor;
+
+    // power of every old gate in the chunk
+
+#ifdef IQK_HAVE_AVX2
+    if (isa == AVX2) {
+      _gatePowersAvx2(in, nNew * factor, power);
+    } else
+#endif
+    {
+      _gatePowersSse2(in, nNew * factor, power);
+    }
+
+    // first gate and mean power of each group
+
+    for (int ii = 0; ii < nNew; ii++) {
+      const uint32_t *groupPower = power + ii * factor;
+      uint64_t powerSum = 0;
+      for (int subG = 0; subG < factor; subG++) {
+        powerSum += groupPower[subG];
+      }
+      firstI[ii] = in[2 * ii * factor];
+      firstQ[ii] = in[2 * ii * factor + 1];
+      firstPower[ii] = groupPower[0];
+      meanPower[ii] = (double) powerSum / factor;
+    }
+
+    // new gates
+
+    int16_t *out = newIq + 2 * newG;
+#ifdef IQK_HAVE_AVX2
+    if (isa == AVX2) {
+      _scaleGatesAvx2(firstI, firstQ, firstPower, meanPower, nNew, out);
+    } else
+#endif
+    {
+      _scaleGatesSse2(firstI, firstQ, firstPower, meanPower, nNew, out);
+    }
+
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// gate powers, 4 gates at a time
+
+void IqKernels::_gatePowersSse2(const int16_t *iq, int nGates,
+                                uint32_t *power)
+{
+  int igate = 0;
+  for (; igate + 4 <= nGates; igate += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (iq + 2 * igate));
+    _mm_storeu_si128((__m128i *) (power + igate), _mm_madd_epi16(v, v));
+  }
+  for (; igate < nGates; igate++) {
+    int32_t ival = iq[2 * igate];
+    int32_t qval = iq[2 * igate + 1];
+    power[igate] = (uint32_t) (ival * ival) + (uint32_t) (qval * qval);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// scale the first gate of each group to the group's mean power, 2 groups at
+// a time
+
+void IqKernels::_scaleGatesSse2(const double *firstI, const double *firstQ,
+                                const double *firstPower,
+                                const double *meanPower,
+                                int nGates, int16_t *iq)
+{
+
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128d minOut = _mm_set1_pd(-32768.0);
+  const __m128d maxOut = _mm_set1_pd(32767.0);
+
+  int igate = 0;
+  for (; igate + 2 <= nGates; igate += 2) {
+
+    // sqrt(mean / first), or 1 where the first gate has no power
+    __m128d first = _mm_loadu_pd(firstPower + igate);
+    __m128d scale = _mm_sqrt_pd(_mm_div_pd(_mm_loadu_pd(meanPower + igate),
+                                           first));
+    __m128d hasPower = _mm_cmpgt_pd(first, zero);
+    scale = _mm_or_pd(_mm_and_pd(hasPower, scale),
+                      _mm_andnot_pd(hasPower, one));
+
+    __m128d ival = _mm_mul_pd(_mm_loadu_pd(firstI + igate), scale);
+    __m128d qval = _mm_mul_pd(_mm_loadu_pd(firstQ + igate), scale);
+    ival = _mm_min_pd(_mm_max_pd(ival, minOut), maxOut);
+    qval = _mm_min_pd(_mm_max_pd(qval, minOut), maxOut);
+
+    // truncate, and interleave into (I, Q) pairs. The values are already
+    // in range, so the pack does not saturate.
+    __m128i pairs = _mm_unpacklo_epi32(_mm_cvttpd_epi32(ival),
+                                       _mm_cvttpd_epi32(qval));
+    _mm_storel_epi64((__m128i *) (iq + 2 * igate),
+                     _mm_packs_epi32(pairs, pairs));
+
+  }
+
+  for (; igate < nGates; igate++) {
+    // the same as the scalar kernel, from its intermediate values
+    double scale = (firstPower[igate] > 0.0) ?
+      sqrt(meanPower[igate] / firstPower[igate]) : 1.0;
+    double ival = std::min(std::max(firstI[igate] * scale, -32768.0), 32767.0);
+    double qval = std::min(std::max(firstQ[igate] * scale, -32768.0), 32767.0);
+    iq[2 * igate] = (int16_t) ival;
+    iq[2 * igate + 1] = (int16_t) qval;
+  }
+
+}
+
+#endif
+
+#if defined(IQK_HAVE_SSE2) && defined(IQK_HAVE_AVX2)
+
+/////////////////////////////////////////////////////////////////////////////
+// gate powers, 8 gates at a time
+
+__attribute__((target("avx2")))
+void IqKernels::_gatePowersAvx2(const int16_t *iq, int nGates,
+                                uint32_t *power)
+{
+  int igate = 0;
+  for (; igate + 8 <= nGates; igate += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (iq + 2 * igate));
+    _mm256_storeu_si256((__m256i *) (power + igate), _mm256_madd_epi16(v, v));
+  }
+  // as in _cohereAvx2()
+  _mm256_zeroupper();
+  _gatePowersSse2(iq + 2 * igate, nGates - igate, power + igate);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// scale the first gate of each group to the group's mean power, 4 groups at
+// a time
+
+__attribute__((target("avx2")))
+void IqKernels::_scaleGatesAvx2(const double *firstI, const double *firstQ,
+                                const double *firstPower,
+                                const double *meanPower,
+                                int nGates, int16_t *iq)
+{
+
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d minOut = _mm256_set1_pd(-32768.0);
+  const __m256d maxOut = _mm256_set1_pd(32767.0);
+
+  int igate = 0;
+  for (; igate + 4 <= nGates; igate += 4) {
+
+    __m256d first = _mm256_loadu_pd(firstPower + igate);
+    __m256d scale =
+      _mm256_sqrt_pd(_mm256_div_pd(_mm256_loadu_pd(meanPower + igate), first));
+    __m256d hasPower = _mm256_cmp_pd(first, zero, _CMP_GT_OQ);
+    scale = _mm256_blendv_pd(one, scale, hasPower);
+
+    __m256d ival = _mm256_mul_pd(_mm256_loadu_pd(firstI + igate), scale);
+    __m256d qval = _mm256_mul_pd(_mm256_loadu_pd(firstQ + igate), scale);
+    ival = _mm256_min_pd(_mm256_max_pd(ival, minOut), maxOut);
+    qval = _mm256_min_pd(_mm256_max_pd(qval, minOut), maxOut);
+
+    __m128i itrunc = _mm256_cvttpd_epi32(ival);
+    __m128i qtrunc = _mm256_cvttpd_epi32(qval);
+    __m128i pairs = _mm_packs_epi32(_mm_unpacklo_epi32(itrunc, qtrunc),
+                                    _mm_unpackhi_epi32(itrunc, qtrunc));
+    _mm_storeu_si128((__m128i *) (iq + 2 * igate), pairs);
+
+  }
+
+  _mm256_zeroupper();
+  _scaleGatesSse2(firstI + igate, firstQ + igate, firstPower + igate,
+                  meanPower + igate, nGates - igate, iq + 2 * igate);
+
+}
+
+#endif
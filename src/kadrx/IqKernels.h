@@ -0,0 +1,145 @@
+/*
+ * IqKernels.h
+ *
+ * Vectorized kernels for the per-gate IQ processing done by KaMerge.
+ */
+
+#ifndef IQKERNELS_H_
+#define IQKERNELS_H_
+
+#include <stdint.h>
+#include <string>
+
+/// IqKernels holds the inner loops applied to every gate of every pulse,
+/// with SSE2 and AVX2 versions chosen at run time according to what the
+/// CPU supports.
+///
+/// The vector versions use fixed point arithmetic, but are written to give
+/// the same results as the scalar (double precision) version, to within
+/// one count.
+class IqKernels {
+public:
+    /// Instruction set used by a kernel
+    typedef enum {
+        SCALAR,
+        SSE2,
+        AVX2
+    } Isa;
+
+    /// @return the best instruction set supported by this CPU
+    static Isa bestIsa();
+
+    /// @return the name of an instruction set
+    static std::string isaName(Isa isa);
+
+    /**
+     * Cohere IQ data to the burst phase, in place, by rotating each gate
+     * by the negative of the burst phase. For each gate:
+     *     I' = I * cosNorm + Q * sinNorm
+     *     Q' = Q * cosNorm - I * sinNorm
+     * The results are clamped to +/-32767 and rounded as
+     * (int16_t)(x + 0.5), as KaMerge has always done.
+     * @param iq interleaved I and Q counts, modified in place
+     * @param nGates the number of gates
+     * @param cosNorm burst I normalized by the burst magnitude
+     * @param sinNorm burst Q normalized by the burst magnitude
+     */
+    static void cohere(int16_t *iq, int nGates,
+                       double cosNorm, double sinNorm);
+
+    /// As cohere(), using the given instruction set, which must be
+    /// supported by the CPU. For testing and benchmarks.
+    static void cohere(Isa isa, int16_t *iq, int nGates,
+                       double cosNorm, double sinNorm);
+
+    /// Largest factor for which decimate() uses the vector kernels.
+    /// Larger factors work, but use the scalar kernel.
+    static const int MAX_VECTOR_DECIMATION = 8;
+
+    /**
+     * Decimate IQ data in range, in place, combining each group of factor
+     * adjacent gates into one. The new gate keeps the phase of the first
+     * gate in the group, scaled to the mean power of the group:
+     *     I' = I0 * sqrt(meanPower / power0)
+     *     Q' = Q0 * sqrt(meanPower / power0)
+     * The results are clamped to [-32768, 32767] and truncated, as
+     * PulseData has always done. Gates left over at the end, which do not
+     * fill a group, are dropped.
+     *
+     * The vector kernels compute the gate powers in integer arithmetic,
+     * which is exact, so they give the same results as the scalar kernel.
+     * @param iq interleaved I and Q counts, modified in place
+     * @param nGates the number of gates
+     * @param factor the number of gates to combine into each new gate
+     * @return the new number of gates, nGates / factor
+     */
+    static int decimate(int16_t *iq, int nGates, int factor);
+
+    /// As decimate(), using the given instruction set, which must be
+    /// supported by the CPU. For testing and benchmarks.
+    static int decimate(Isa isa, int16_t *iq, int nGates, int factor);
+
+    /**
+     * Process one channel of a pulse for output in a single pass: decimate
+     * it in range, cohere it to the burst phase, and write it to a packet
+     * buffer. The input is read once and not modified, and the result is
+     * the same as decimate() followed by cohere().
+     *
+     * The work is done a chunk of gates at a time, so the intermediate
+     * values never leave the L1 cache.
+     * @param iq interleaved I and Q counts
+     * @param nGates the number of gates
+     * @param factor the number of gates to combine into each new gate,
+     *     1 for none
+     * @param doCohere true to cohere the data to the burst phase
+     * @param cosNorm burst I normalized by the burst magnitude
+     * @param sinNorm burst Q normalized by the burst magnitude
+     * @param out destination for the new gates, as interleaved I and Q
+     *     counts. Need not be aligned.
+     * @return the number of gates written, nGates / factor
+     */
+    static int packPulse(const int16_t *iq, int nGates, int factor,
+                         bool doCohere, double cosNorm, double sinNorm,
+                         void *out);
+
+    /// As packPulse(), using the given instruction set, which must be
+    /// supported by the CPU. For testing and benchmarks.
+    static int packPulse(Isa isa, const int16_t *iq, int nGates, int factor,
+                         bool doCohere, double cosNorm, double sinNorm,
+                         void *out);
+
+private:
+    static void _cohere(Isa isa, const int16_t *iq, int nGates,
+                        double cosNorm, double sinNorm, int16_t *out);
+    static void _cohereScalar(const int16_t *iq, int nGates,
+                              double cosNorm, double sinNorm, int16_t *out);
+    static void _cohereSse2(const int16_t *iq, int nGates,
+                            double cosNorm, double sinNorm, int16_t *out);
+    static void _cohereAvx2(const int16_t *iq, int nGates,
+                            double cosNorm, double sinNorm, int16_t *out);
+
+    static void _decimate(Isa isa, const int16_t *iq, int newNGates,
+                          int factor, int16_t *newIq);
+    static void _decimateScalar(const int16_t *iq, int newNGates,
+                                int factor, int16_t *newIq);
+    static void _decimateVector(Isa isa, const int16_t *iq, int newNGates,
+                                int factor, int16_t *newIq);
+    static void _gatePowersSse2(const int16_t *iq, int nGates,
+                                uint32_t *power);
+    static void _gatePowersAvx2(const int16_t *iq, int nGates,
+                                uint32_t *power);
+    static void _scaleGatesSse2(const double *firstI,
+                                const double *firstQ,
+                                const double *firstPower,
+                                const double *meanPower,
+                                int nGates, int16_t *iq);
+    static void _scaleGatesAvx2(const double *firstI,
+                                const double *firstQ,
+                                const double *firstPower,
+                                const double *meanPower,
+                                int nGates, int16_t *iq);
+
+    static Isa _bestIsa;
+};
+
+#endif /* IQKERNELS_H_ */
@@ -0,0 +1,585 @@
+#include "IwrfArchiver.h"
+#include <logx/Logging.h>
+#include <radar/iwrf_data.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+LOGGING("IwrfArchiver")
+
+// Longest time to sleep waiting for data, microseconds. After this long
+// with no data, the partly filled buffer is written out, and the thread
+// checks whether it should stop.
+static const int IdleWaitUsecs = 100000;
+
+// The metadata packets written at the start of each file, in order
+static const int MetaDataIds[] = {
+  IWRF_RADAR_INFO_ID,
+  IWRF_TS_PROCESSING_ID,
+  IWRF_CALIBRATION_ID
+};
+static const int NMetaDataIds = sizeof(MetaDataIds) / sizeof(MetaDataIds[0]);
+
+// Alignment of the write buffer, and of its size
+static const size_t BufAlign = 4096;
+
+// Wait before trying a new file after the first failure, seconds
+static const int FirstRetrySecs = 1;
+
+// monotonic time, seconds
+
+static double
+monotonicNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+// create a directory and any missing parents
+
+static bool
+makeDirs(const std::string &path)
+{
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+    std::string dir = path.substr(0, pos);
+    if (!dir.empty() && mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+      return false;
+    }
+    if (pos == std::string::npos) {
+      return true;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+IwrfArchiver::IwrfArchiver(const KaDrxConfig& config) :
+        QThread(),
+        _stopping(false),
+        _dir(config.archive_dir()),
+        _fileSecs(3600),
+        _maxFileBytes(2048ULL * 1024 * 1024),
+        _indexPulses(1000),
+        _buf(NULL),
+        _bufSize(1024 * 1024),
+        _bufLen(0),
+        _bufOffset(0),
+        _bufSynced(true),
+        _fileBytesWritten(0),
+        _retryTime(0.0),
+        _retrySecs(FirstRetrySecs),
+        _fd(-1),
+        _indexFile(NULL),
+        _filePeriod(-1),
+        _pulsesSinceIndex(0),
+        _burstPulseSeqNum(-1),
+        _burstOffset(0),
+        _threadPolicy(config, "archive_writer"),
+        _nBytesWritten(0),
+        _nFiles(0)
+{
+
+  int queueSize = 1000;
+  if (config.archive_queue_size() != KaDrxConfig::UNSET_INT) {
+    queueSize = config.archive_queue_size();
+  }
+  if (config.archive_file_seconds() != KaDrxConfig::UNSET_INT &&
+      config.archive_file_seconds() > 0) {
+    _fileSecs = config.archive_file_seconds();
+  }
+  if (config.archive_file_megabytes() != KaDrxConfig::UNSET_INT &&
+      config.archive_file_megabytes() > 0) {
+    _maxFileBytes = (uint64_t) config.archive_file_megabytes() * 1024 * 1024;
+  }
+  if (config.archive_index_pulses() != KaDrxConfig::UNSET_INT &&
+      config.archive_index_pulses() > 0) {
+    _indexPulses = config.archive_index_pulses();
+  }
+  if (config.archive_write_kb() != KaDrxConfig::UNSET_INT &&
+      config.archive_write_kb() > 0) {
+    _bufSize = (size_t) config.archive_write_kb() * 1024;
+  }
+
+  // round the buffer up to whole pages, so every full write starts and
+  // ends at an aligned offset
+
+  _bufSize = (_bufSize + BufAlign - 1) / BufAlign * BufAlign;
+  void *buf;
+  if (posix_memalign(&buf, BufAlign, _bufSize) != 0) {
+    ELOG << "Cannot allocate " << _bufSize << " byte archive buffer";
+    abort();
+  }
+  _buf = static_cast<char *>(buf);
+
+  _queue = new SpscRing<PacketBatcher>(queueSize);
+  _spare = new PacketBatcher;
+
+  // make sure the archive directory is there now, rather than finding out
+  // with the first pulse
+
+  if (!makeDirs(_dir) || access(_dir.c_str(), W_OK | X_OK) != 0) {
+    ELOG << "Cannot write to archive directory " << _dir << ": " <<
+        strerror(errno) << "; nothing will be archived until it can be";
+  }
+
+  ILOG << "IWRF archive in " << _dir << ", new file every " << _fileSecs <<
+      " s or " << _maxFileBytes / (1024 * 1024) << " MB, index every " <<
+      _indexPulses << " pulses, " << _bufSize / 1024 << " kB writes, queue " <<
+      queueSize << " batches";
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+IwrfArchiver::~IwrfArchiver()
+
+{
+  // Stop the thread, which completes the current file
+  _stopping.store(true);
+  if (! wait(5000)) {
+    ELOG << "IwrfArchiver thread failed to stop in 5 seconds.";
+  }
+
+  delete _queue;
+  delete _spare;
+  free(_buf);
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Thread run method
+
+void IwrfArchiver::run()
+
+{
+
+  _threadPolicy.applyToCurrentThread();
+
+  _timer.busy();
+
+  while (! _stopping.load(std::memory_order_relaxed)) {
+
+    PacketBatcher *batch = _queue->read(_spare);
+    if (batch == NULL) {
+      _timer.idle();
+      batch = _queue->readWait(_spare, IdleWaitUsecs);
+      _timer.busy();
+      if (batch == NULL) {
+        // the stream has paused, so write out what we have
+        _syncBuf();
+        continue;
+      }
+    }
+    _archiveBatch(*batch);
+    _spare = batch;
+
+  } // while
+
+  // archive anything still queued, then finish the file
+
+  PacketBatcher *batch;
+  while ((batch = _queue->read(_spare)) != NULL) {
+    _archiveBatch(*batch);
+    _spare = batch;
+  }
+  _closeFile();
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// queue a batch of packets for the archive
+// called by the KaNetWriter thread
+// Returns a batch object for recycling
+
+PacketBatcher *IwrfArchiver::write(PacketBatcher *batch)
+{
+  return _queue->write(batch);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// archive each packet in a batch, starting new files and adding index
+// entries as needed
+
+void IwrfArchiver::_archiveBatch(const PacketBatcher &batch)
+{
+
+  size_t pos = 0;
+  while (pos + sizeof(iwrf_packet_info_t) <= batch.len()) {
+
+    const char *packet = batch.data() + pos;
+    iwrf_packet_info_t info;
+    memcpy(&info, packet, sizeof(info));
+    if (info.len_bytes < (int) sizeof(info) ||
+        pos + info.len_bytes > batch.len()) {
+      WLOG << "Bad IWRF packet length " << info.len_bytes <<
+          " in batch, rest of batch not archived";
+      return;
+    }
+    size_t len = info.len_bytes;
+    pos += len;
+
+    for (int ii = 0; ii < NMetaDataIds; ii++) {
+      if (info.id == MetaDataIds[ii]) {
+        _metaData[info.id].assign(packet, packet + len);
+      }
+    }
+
+    // A pulse starts with its burst packet, or with its pulse packet if
+    // there is no burst. Files are only started at the start of a pulse.
+
+    bool pulseStart = false;
+    int64_t pulseSeqNum = -1;
+    if (info.id == IWRF_BURST_HEADER_ID &&
+        len >= sizeof(iwrf_burst_header_t)) {
+      iwrf_burst_header_t hdr;
+      memcpy(&hdr, packet, sizeof(hdr));
+      pulseSeqNum = hdr.pulse_seq_num;
+      pulseStart = true;
+    } else if (info.id == IWRF_PULSE_HEADER_ID &&
+               len >= sizeof(iwrf_pulse_header_t)) {
+      iwrf_pulse_header_t hdr;
+      memcpy(&hdr, packet, sizeof(hdr));
+      pulseSeqNum = hdr.pulse_seq_num;
+      pulseStart = (pulseSeqNum != _burstPulseSeqNum);
+    }
+
+    if (pulseStart && (_fd < 0 ||
+                       _rotateDue(info.time_secs_utc,
+                                  _pulseLen(batch, pos - len, pulseSeqNum))) &&
+        monotonicNow() >= _retryTime) {
+      _closeFile();
+      _openFile(info.time_secs_utc);
+    }
+    if (_fd < 0) {
+      // no pulse yet, or no file until the next retry
+      continue;
+    }
+
+    if (info.id == IWRF_BURST_HEADER_ID) {
+      _burstPulseSeqNum = pulseSeqNum;
+      _burstOffset = _bufOffset + _bufLen;
+    } else if (info.id == IWRF_PULSE_HEADER_ID && pulseSeqNum >= 0) {
+      if (_pulsesSinceIndex == 0 && _indexFile) {
+        // held until the data it points to have been written
+        IndexEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.pulseSeqNum = pulseSeqNum;
+        entry.timeSecs = info.time_secs_utc;
+        entry.nanoSecs = info.time_nano_secs;
+        entry.offset = (pulseSeqNum == _burstPulseSeqNum) ?
+            _burstOffset : _bufOffset + _bufLen;
+        _indexPending.push_back(entry);
+      }
+      _pulsesSinceIndex = (_pulsesSinceIndex + 1) % _indexPulses;
+    }
+
+    _append(packet, len);
+
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// length of the pulse starting with the packet at the given position in a
+// batch: the packet, and the pulse packets for the same pulse which follow
+// it. KaMerge batches a pulse's burst and pulse packets together.
+
+size_t IwrfArchiver::_pulseLen(const PacketBatcher &batch, size_t pos,
+                               int64_t pulseSeqNum)
+{
+  iwrf_packet_info_t info;
+  memcpy(&info, batch.data() + pos, sizeof(info));
+  size_t len = info.len_bytes;
+  size_t next = pos + len;
+  while (next + sizeof(iwrf_pulse_header_t) <= batch.len()) {
+    iwrf_pulse_header_t hdr;
+    memcpy(&hdr, batch.data() + next, sizeof(hdr));
+    memcpy(&info, batch.data() + next, sizeof(info));
+    if (info.id != IWRF_PULSE_HEADER_ID ||
+        hdr.pulse_seq_num != pulseSeqNum ||
+        info.len_bytes < (int) sizeof(hdr) ||
+        next + info.len_bytes > batch.len()) {
+      break;
+    }
+    len += info.len_bytes;
+    next += info.len_bytes;
+  }
+  return len;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// is a new file due before a pulse at the given time, with the given
+// length?
+
+bool IwrfArchiver::_rotateDue(int64_t timeSecs, size_t nextLen) const
+{
+  return (timeSecs / _fileSecs != _filePeriod ||
+          _bufOffset + _bufLen + nextLen > _maxFileBytes);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// start a new file and index, named for the time of the first pulse, and
+// write the metadata packets at its start
+
+void IwrfArchiver::_openFile(int64_t timeSecs)
+{
+
+  time_t fileTime = timeSecs;
+  struct tm tm;
+  gmtime_r(&fileTime, &tm);
+  char dayStr[16];
+  char timeStr[32];
+  strftime(dayStr, sizeof(dayStr), "%Y%m%d", &tm);
+  strftime(timeStr, sizeof(timeStr), "%Y%m%d_%H%M%S", &tm);
+
+  std::string dayDir = _dir + "/" + dayStr;
+  if (mkdir(dayDir.c_str(), 0755) != 0 && errno != EEXIST) {
+    ELOG << "Cannot create archive directory " << dayDir << ": " <<
+        strerror(errno);
+    _backOff();
+    return;
+  }
+
+  // add a suffix if need be, so an earlier file is never overwritten
+
+  for (int ii = 0; ii < 100 && _fd < 0; ii++) {
+    std::ostringstream name;
+    name << dayDir << "/kadrx_" << timeStr;
+    if (ii > 0) {
+      name << "_" << ii;
+    }
+    name << ".iwrf";
+    _path = name.str();
+    _fd = open(_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (_fd < 0 && errno != EEXIST) {
+      break;
+    }
+  }
+  if (_fd < 0) {
+    ELOG << "Cannot create archive file " << _path << ": " <<
+        strerror(errno);
+    _backOff();
+    return;
+  }
+
+  std::string indexPath = _path + ".idx";
+  _indexFile = fopen(indexPath.c_str(), "w");
+  if (_indexFile) {
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "KAIX", 4);
+    header.version = INDEX_VERSION;
+    header.entrySize = sizeof(IndexEntry);
+    fwrite(&header, sizeof(header), 1, _indexFile);
+  } else {
+    ELOG << "Cannot create archive index " << indexPath << ": " <<
+        strerror(errno);
+  }
+
+  _bufOffset = 0;
+  _bufLen = 0;
+  _fileBytesWritten = 0;
+  _filePeriod = timeSecs / _fileSecs;
+  _pulsesSinceIndex = 0;
+  _burstPulseSeqNum = -1;
+  _nFiles++;
+  ILOG << "Archiving to " << _path;
+
+  for (int ii = 0; ii < NMetaDataIds; ii++) {
+    std::vector<char> &packet = _metaData[MetaDataIds[ii]];
+    if (!packet.empty()) {
+      _append(&packet[0], packet.size());
+    }
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// put off the next new file after a failure, for twice as long each time
+// in a row, up to the file period
+
+void IwrfArchiver::_backOff()
+{
+  _retryTime = monotonicNow() + _retrySecs;
+  ELOG << "Archiving suspended, next attempt in " << _retrySecs << " s";
+  _retrySecs *= 2;
+  if (_retrySecs > _fileSecs) {
+    _retrySecs = _fileSecs;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// write out the rest of the current file and close it
+
+void IwrfArchiver::_closeFile()
+{
+  if (_fd < 0) {
+    return;
+  }
+  _syncBuf();
+  if (close(_fd) != 0) {
+    ELOG << "Error closing archive file " << _path << ": " << strerror(errno);
+  }
+  _fd = -1;
+  if (_indexFile) {
+    fclose(_indexFile);
+    _indexFile = NULL;
+  }
+  _indexPending.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// add data to the current file, writing the buffer each time it fills
+
+void IwrfArchiver::_append(const char *data, size_t len)
+{
+  while (len > 0 && _fd >= 0) {
+    size_t n = _bufSize - _bufLen;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(_buf + _bufLen, data, n);
+    _bufLen += n;
+    _bufSynced = false;
+    data += n;
+    len -= n;
+    if (_bufLen == _bufSize) {
+      if (_writeBuf()) {
+        _bufOffset += _bufSize;
+        _bufLen = 0;
+      }
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// write out a partly filled buffer, keeping it so that it is rewritten
+// whole, at the same aligned offset, once it fills
+
+void IwrfArchiver::_syncBuf()
+{
+  if (_fd >= 0 && !_bufSynced) {
+    _writeBuf();
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// write the buffer at its place in the file, then the index entries for
+// the pulses it holds. On error the file is abandoned, and a new one started with the
+// first pulse after the retry wait.
+
+bool IwrfArchiver::_writeBuf()
+{
+  size_t done = 0;
+  while (done < _bufLen) {
+    ssize_t n = pwrite(_fd, _buf + done, _bufLen - done, _bufOffset + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      ELOG << "Error writing archive file " << _path << ": " <<
+          strerror(errno) << "; abandoning it";
+      close(_fd);
+      _fd = -1;
+      if (_indexFile) {
+        fclose(_indexFile);
+        _indexFile = NULL;
+      }
+      _indexPending.clear();
+      _backOff();
+      return false;
+    }
+    done += n;
+  }
+  _bufSynced = true;
+  _retrySecs = FirstRetrySecs;
+
+  // count what the file has gained; a partly filled buffer is written
+  // again once it fills, but its bytes are only counted once
+
+  uint64_t fileBytes = _bufOffset + _bufLen;
+  _nBytesWritten.fetch_add(fileBytes - _fileBytesWritten,
+                           std::memory_order_relaxed);
+  _fileBytesWritten = fileBytes;
+
+  // now index the pulses which start in the data written, so that an
+  // entry never reaches the disk before its data
+
+  size_t nIndexed = 0;
+  while (nIndexed < _indexPending.size() &&
+         _indexPending[nIndexed].offset < fileBytes) {
+    nIndexed++;
+  }
+  if (nIndexed > 0 && _indexFile) {
+    fwrite(&_indexPending[0], sizeof(IndexEntry), nIndexed, _indexFile);
+    fflush(_indexFile);
+  }
+  _indexPending.erase(_indexPending.begin(),
+                      _indexPending.begin() + nIndexed);
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// find the index entry for a time, by binary search of the index file
+
+bool IwrfArchiver::SeekTime(const std::string &indexPath, int64_t timeSecs,
+                            int nanoSecs, IndexEntry &entry)
+{
+
+  int fd = open(indexPath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  IndexHeader header;
+  struct stat st;
+  if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+      memcmp(header.magic, "KAIX", 4) != 0 ||
+      header.version != INDEX_VERSION ||
+      header.entrySize != sizeof(IndexEntry) ||
+      fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  int64_t nEntries = (st.st_size - (off_t) sizeof(header)) /
+      (off_t) sizeof(IndexEntry);
+  if (nEntries <= 0) {
+    close(fd);
+    return false;
+  }
+
+  // find the last entry at or before the time
+
+  int64_t lo = 0;
+  int64_t hi = nEntries - 1;
+  int64_t found = 0;
+  while (lo <= hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    IndexEntry midEntry;
+    if (pread(fd, &midEntry, sizeof(midEntry),
+              sizeof(header) + mid * sizeof(IndexEntry)) !=
+        (ssize_t) sizeof(midEntry)) {
+      close(fd);
+      return false;
+    }
+    if (midEntry.timeSecs < timeSecs ||
+        (midEntry.timeSecs == timeSecs && midEntry.nanoSecs <= nanoSecs)) {
+      found = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  bool ok = (pread(fd, &entry, sizeof(entry),
+                   sizeof(header) + found * sizeof(IndexEntry)) ==
+             (ssize_t) sizeof(entry));
+  close(fd);
+  return ok;
+
+}
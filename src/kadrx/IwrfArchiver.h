@@ -0,0 +1,213 @@
+#ifndef IWRF_ARCHIVER_H_
+#define IWRF_ARCHIVER_H_
+
+#include "KaDrxConfig.h"
+#include "SpscRing.h"
+#include "PacketBatcher.h"
+#include "StageTimer.h"
+#include "ThreadPolicy.h"
+#include <QThread>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// IwrfArchiver writes the IWRF stream to disk, in its own thread, so that
+/// the disk can never hold up KaMerge or the network writer.
+///
+/// KaNetWriter hands each batch of packets over with write() once it has
+/// published it, through a bounded lock-free SpscRing. Batches are swapped,
+/// not copied, and write() never blocks: if the queue is full, the batch is
+/// not archived and is counted as an overrun.
+///
+/// The archiver thread gathers the packets in a page-aligned buffer, and
+/// writes it out whole, so the files are written with large writes at
+/// aligned offsets. A new file is started when the time of the next pulse
+/// crosses a multiple of archive_file_seconds, or when the file would
+/// exceed archive_file_megabytes. Files are named for the time of their
+/// first pulse, in a directory for each day, and each starts with the
+/// latest radar info, time series processing and calibration packets so
+/// that it can be read on its own. Burst and pulse packets for the same
+/// pulse are always kept in the same file.
+///
+/// The archive directory is created at startup if need be. If a file
+/// cannot be created, or a write fails, the data are dropped until the
+/// next attempt at a new file, which is put off for a second at first,
+/// then twice as long after each failure in a row, up to
+/// archive_file_seconds.
+///
+/// Beside each file is a sparse index with the suffix ".idx": an
+/// IndexHeader then an IndexEntry for every archive_index_pulses pulses,
+/// giving the pulse sequence number, time and file offset. Entries are in
+/// time order, so SeekTime() finds the entry for a given time with a binary
+/// search. An entry is written only once the data it points to are in the
+/// file.
+///
+/// The archiver thread is stopped, and the current file completed, by the
+/// destructor.
+
+class IwrfArchiver : public QThread {
+
+  Q_OBJECT
+
+public:
+
+  /// Header at the start of an index file
+  struct IndexHeader {
+    char magic[4];              ///< "KAIX"
+    uint32_t version;           ///< INDEX_VERSION
+    uint32_t entrySize;         ///< sizeof(IndexEntry)
+    uint32_t spare;
+  };
+
+  /// One index entry
+  struct IndexEntry {
+    int64_t pulseSeqNum;        ///< pulse sequence number
+    int64_t timeSecs;           ///< pulse time, seconds since 1970-01-01
+    int32_t nanoSecs;           ///< and nanoseconds
+    int32_t spare;
+    uint64_t offset;            ///< file offset of the pulse's first packet
+  };
+
+  /// Index file format version
+  static const uint32_t INDEX_VERSION = 1;
+
+  /**
+   * Constructor.
+   * @param config KaDrxConfig defining the desired configuration. The
+   *     archive directory must be set.
+   */
+
+  IwrfArchiver(const KaDrxConfig& config);
+
+  /// Destructor, completing the current file
+
+  virtual ~IwrfArchiver();
+
+  /// thread run method
+
+  void run();
+
+  // queue a batch of serialized packets for the archive
+  // called by the KaNetWriter thread
+  // Returns a batch object for recycling, which must be cleared before use
+
+  PacketBatcher *write(PacketBatcher *batch);
+
+  /// input queue, for occupancy and overrun statistics
+  const SpscRing<PacketBatcher> &queue() const { return *_queue; }
+
+  /// busy and idle time of the archiver thread
+  const StageTimer &timer() const { return _timer; }
+
+  /// @return the number of bytes successfully written to archive files
+  uint64_t nBytesWritten() const {
+    return _nBytesWritten.load(std::memory_order_relaxed);
+  }
+
+  /// @return the number of archive files started
+  uint64_t nFiles() const {
+    return _nFiles.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Find where to start reading an archive file to get the data from a
+   * given time, using its index.
+   * @param indexPath the path of the index file
+   * @param timeSecs the time wanted, seconds since 1970-01-01
+   * @param nanoSecs and nanoseconds
+   * @param entry set to the last entry at or before the time, or the first
+   *     entry if the time is before the start of the file
+   * @return true on success, false if the index cannot be read or is empty
+   */
+  static bool SeekTime(const std::string &indexPath, int64_t timeSecs,
+                       int nanoSecs, IndexEntry &entry);
+
+private:
+
+  void _archiveBatch(const PacketBatcher &batch);
+  static size_t _pulseLen(const PacketBatcher &batch, size_t pos,
+                          int64_t pulseSeqNum);
+  bool _rotateDue(int64_t timeSecs, size_t nextLen) const;
+  void _openFile(int64_t timeSecs);
+  void _backOff();
+  void _closeFile();
+  void _append(const char *data, size_t len);
+  void _syncBuf();
+  bool _writeBuf();
+
+  /// queue of batches from KaNetWriter, and the batch returned to it next
+
+  SpscRing<PacketBatcher> *_queue;
+  PacketBatcher *_spare;
+
+  /// set by the destructor to stop the thread
+
+  std::atomic<bool> _stopping;
+
+  /// configuration
+
+  std::string _dir;
+  int _fileSecs;
+  uint64_t _maxFileBytes;
+  int _indexPulses;
+
+  /// write buffer, page aligned, used only by the archiver thread. It holds
+  /// the file from _bufOffset on, and _bufSynced is set while its contents
+  /// have all been written out.
+
+  char *_buf;
+  size_t _bufSize;
+  size_t _bufLen;
+  uint64_t _bufOffset;
+  bool _bufSynced;
+
+  /// how much of the current file has been written out and counted in
+  /// _nBytesWritten
+
+  uint64_t _fileBytesWritten;
+
+  /// when a new file may next be tried, after a failure, monotonic
+  /// seconds, and how long to wait after the next failure
+
+  double _retryTime;
+  int _retrySecs;
+
+  /// current file and index, and the period of the file time
+
+  int _fd;
+  FILE *_indexFile;
+  std::string _path;
+  int64_t _filePeriod;
+  int _pulsesSinceIndex;
+
+  /// index entries waiting for the data they point to to be written
+
+  std::vector<IndexEntry> _indexPending;
+
+  /// the latest burst packet, so that the index can point at it when its
+  /// pulse packet follows
+
+  int64_t _burstPulseSeqNum;
+  uint64_t _burstOffset;
+
+  /// latest metadata packets, by packet id, written at the start of each
+  /// file
+
+  std::map<int, std::vector<char> > _metaData;
+
+  /// CPU set and scheduling for the archiver thread
+
+  ThreadPolicy _threadPolicy;
+
+  /// busy and idle time, and counts, written by the archiver thread
+
+  StageTimer _timer;
+  std::atomic<uint64_t> _nBytesWritten;
+  std::atomic<uint64_t> _nFiles;
+
+};
+
+#endif /* IWRF_ARCHIVER_H_ */
@@ -0,0 +1,304 @@
+/*
+ * IwrfBlackBox.cpp
+ *
+ * In-memory record of the latest IWRF output, written to a file when
+ * something goes wrong.
+ */
+
+#include "IwrfBlackBox.h"
+#include <logx/Logging.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <unistd.h>
+
+LOGGING("IwrfBlackBox")
+
+// Maximum number of ring chunks written with one writev()
+static const int MaxWriteChunks = 64;
+
+/////////////////////////////////////////////////////////////////////////////
+IwrfBlackBox::IwrfBlackBox(const KaDrxConfig &config, double seconds,
+                           size_t ringBytes, const std::string &dir) :
+  _seconds(seconds),
+  _dir(dir),
+  _triggered(false),
+  _triggerTime(0),
+  _dumping(false),
+  _stopping(false),
+  _dumpTriggerTime(0),
+  _dumpFreezeTime(0.0),
+  _nDumps(0),
+  _threadPolicy(config, "blackbox_writer")
+{
+
+  // index one chunk per 4 kB of ring, as for the IWRF server's ring. The
+  // memory for both rings is allocated here, so that recording never
+  // allocates on the publishing thread.
+
+  _live = new IwrfPacketRing(ringBytes, ringBytes / 4096);
+  _frozen = new IwrfPacketRing(ringBytes, ringBytes / 4096);
+  _live->allocCopyBuffer();
+  _frozen->allocCopyBuffer();
+
+  _dumpThread = new DumpThread(*this);
+  _dumpThread->start();
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+IwrfBlackBox::~IwrfBlackBox()
+{
+
+  // let a dump in progress finish, so that the file is complete
+
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _stopping = true;
+    _cond.notify_all();
+  }
+  _dumpThread->wait();
+  delete _dumpThread;
+
+  delete _live;
+  delete _frozen;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// record a chunk in the live ring
+
+void IwrfBlackBox::append(const struct iovec *iov, int iovCnt, int nPackets)
+{
+  _live->append(iov, iovCnt, nPackets);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// keep a copy of the metadata packets for the start of each dump
+
+void IwrfBlackBox::setMetaData(const struct iovec *iov, int iovCnt)
+{
+  _metaData.clear();
+  for (int ii = 0; ii < iovCnt; ii++) {
+    const char *data = static_cast<const char *>(iov[ii].iov_base);
+    _metaData.insert(_metaData.end(), data, data + iov[ii].iov_len);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// hand the live ring to the dump thread if a dump is pending and the dump
+// thread is free
+
+void IwrfBlackBox::service()
+{
+
+  if (!_triggered.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  boost::mutex::scoped_lock lock(_mutex);
+  if (_dumping) {
+    return;
+  }
+
+  // freeze the live ring, and carry on in the spare, which the dump
+  // thread emptied after the last dump
+
+  std::swap(_live, _frozen);
+  _dumpReason = _triggerReason;
+  _dumpTriggerTime = _triggerTime;
+  _dumpFreezeTime = IwrfPacketRing::now();
+  _dumpMetaData = _metaData;
+  _triggered.store(false, std::memory_order_relaxed);
+  _dumping = true;
+  _cond.notify_all();
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ask for a dump
+
+void IwrfBlackBox::trigger(const std::string &reason)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  if (_triggered.load(std::memory_order_relaxed)) {
+    _triggerReason += "; " + reason;
+  } else {
+    _triggerReason = reason;
+    _triggerTime = time(0);
+    _triggered.store(true, std::memory_order_relaxed);
+  }
+  ILOG << "Black box dump requested: " << reason;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+uint64_t IwrfBlackBox::nDumps() const
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _nDumps;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+std::string IwrfBlackBox::lastDumpFile() const
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _lastDumpFile;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// dump thread: write each frozen ring handed over by service()
+
+void IwrfBlackBox::_dumpLoop()
+{
+
+  _threadPolicy.applyToCurrentThread();
+
+  while (true) {
+
+    std::string reason;
+    time_t triggerTime;
+    double freezeTime;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      while (!_dumping && !_stopping) {
+        _cond.wait(lock);
+      }
+      if (!_dumping) {
+        return;
+      }
+      reason = _dumpReason;
+      triggerTime = _dumpTriggerTime;
+      freezeTime = _dumpFreezeTime;
+    }
+
+    std::string fileName = _dump(reason, triggerTime, freezeTime);
+
+    // empty the frozen ring, so it can be the next spare
+
+    _frozen->clear();
+
+    boost::mutex::scoped_lock lock(_mutex);
+    _dumping = false;
+    if (!fileName.empty()) {
+      _nDumps++;
+      _lastDumpFile = fileName;
+    }
+
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// write the frozen ring to a new file: the metadata packets, then the
+// chunks appended in the last _seconds before it was frozen. Returns the
+// file name, or an empty string on error.
+
+std::string IwrfBlackBox::_dump(const std::string &reason, time_t triggerTime,
+                                double freezeTime)
+{
+
+  // name the file for the trigger time, adding a suffix if need be so an
+  // earlier dump is never overwritten
+
+  struct tm tm;
+  gmtime_r(&triggerTime, &tm);
+  char timeStr[32];
+  strftime(timeStr, sizeof(timeStr), "%Y%m%d_%H%M%S", &tm);
+  std::string fileName;
+  int fd = -1;
+  for (int ii = 0; ii < 100 && fd < 0; ii++) {
+    std::ostringstream name;
+    name << _dir << "/kadrx_blackbox_" << timeStr;
+    if (ii > 0) {
+      name << "_" << ii;
+    }
+    name << ".iwrf";
+    fileName = name.str();
+    fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno != EEXIST) {
+      break;
+    }
+  }
+  if (fd < 0) {
+    ELOG << "Cannot create black box file " << fileName << ": " <<
+        strerror(errno);
+    return "";
+  }
+
+  // find the first chunk in the window
+
+  const IwrfPacketRing &ring = *_frozen;
+  int64_t first = ring.tailChunk();
+  while (first < ring.headChunk() &&
+         ring.chunkTime(first) < freezeTime - _seconds) {
+    first++;
+  }
+  double heldSecs = 0.0;
+  if (first < ring.headChunk()) {
+    heldSecs = freezeTime - ring.chunkTime(first);
+  }
+  if (first == ring.tailChunk() && ring.tailChunk() > 0) {
+    WLOG << "Black box ring holds only " << heldSecs << " of the " <<
+        _seconds << " seconds wanted; consider raising blackbox_megabytes";
+  }
+
+  // the metadata, then the chunks, a few at a time
+
+  struct iovec iov[MaxWriteChunks];
+  bool ok = true;
+  if (!_dumpMetaData.empty()) {
+    iov[0].iov_base = &_dumpMetaData[0];
+    iov[0].iov_len = _dumpMetaData.size();
+    ok = _writeAll(fd, iov, 1);
+  }
+  uint64_t offset = ring.chunkOffset(first);
+  uint64_t pos = offset;
+  while (ok && pos < ring.headOffset()) {
+    int iovCnt = ring.gather(pos, ring.headOffset(), iov, MaxWriteChunks);
+    for (int ii = 0; ii < iovCnt; ii++) {
+      pos += iov[ii].iov_len;
+    }
+    ok = _writeAll(fd, iov, iovCnt);
+  }
+  if (close(fd) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    ELOG << "Error writing black box file " << fileName << ": " <<
+        strerror(errno);
+    return "";
+  }
+
+  ILOG << "Black box (" << reason << "): wrote " <<
+      (ring.headOffset() - offset) / 1.0e6 << " MB, " << heldSecs <<
+      " s, to " << fileName;
+  return fileName;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// write all of the given pieces, continuing after partial writes
+
+bool IwrfBlackBox::_writeAll(int fd, struct iovec *iov, int iovCnt)
+{
+  while (iovCnt > 0) {
+    ssize_t n = writev(fd, iov, iovCnt);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    while (iovCnt > 0 && (size_t) n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iovCnt--;
+    }
+    if (iovCnt > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+  return true;
+}
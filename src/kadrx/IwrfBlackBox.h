@@ -0,0 +1,149 @@
+/*
+ * IwrfBlackBox.h
+ *
+ * In-memory record of the latest IWRF output, written to a file when
+ * something goes wrong.
+ */
+
+#ifndef IWRFBLACKBOX_H_
+#define IWRFBLACKBOX_H_
+
+#include "IwrfPacketRing.h"
+#include "ThreadPolicy.h"
+#include <QThread>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <atomic>
+#include <ctime>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// IwrfBlackBox keeps the last few seconds of IWRF output in memory, so
+/// that the time series leading up to a fault can be saved. When
+/// trigger() is called, the data are written to a timestamped IWRF file,
+/// starting with the latest metadata packets.
+///
+/// There are two IwrfPacketRing objects of the same size, each filling
+/// with copies of the output and then reusing its memory, which is all
+/// allocated by the constructor. One is live and receives every chunk
+/// published. When a dump starts, the live ring is frozen and handed to a
+/// dump thread, and the other ring becomes live. The thread publishing the data therefore only swaps
+/// two pointers, and never waits for the disk. A trigger which arrives
+/// while a dump is in progress is held until it finishes; the next dump
+/// then holds the data since the previous one.
+///
+/// append(), setMetaData() and service() must be called from the thread
+/// which publishes the data. trigger() and the statistics methods may be
+/// called from any thread.
+class IwrfBlackBox {
+public:
+
+  /**
+   * Constructor. The rings are allocated and the dump thread started.
+   * @param config the KaDrxConfig, for the dump thread's ThreadPolicy
+   * @param seconds how much of the latest output to write in each dump
+   * @param ringBytes the size of each of the two rings
+   * @param dir the directory for dump files
+   */
+  IwrfBlackBox(const KaDrxConfig &config, double seconds, size_t ringBytes,
+               const std::string &dir);
+
+  /// Destructor, waiting for any dump in progress to finish
+  ~IwrfBlackBox();
+
+  /**
+   * Record a chunk of one or more whole packets.
+   * @param iov the pieces making up the chunk
+   * @param iovCnt the number of pieces
+   * @param nPackets the number of packets in the chunk
+   */
+  void append(const struct iovec *iov, int iovCnt, int nPackets);
+
+  /**
+   * Set the metadata packets written at the start of each dump file.
+   * @param iov the pieces making up the metadata packets
+   * @param iovCnt the number of pieces
+   */
+  void setMetaData(const struct iovec *iov, int iovCnt);
+
+  /// Start a pending dump if the dump thread is free. This is cheap when
+  /// nothing is pending.
+  void service();
+
+  /**
+   * Ask for the recorded data to be dumped. This is safe to call from any
+   * thread. Triggers arriving before the dump starts are merged into one.
+   * @param reason why, for the log
+   */
+  void trigger(const std::string &reason);
+
+  /// @return the number of seconds of output written in each dump
+  double seconds() const { return _seconds; }
+
+  /// @return the number of dumps completed
+  uint64_t nDumps() const;
+
+  /// @return the name of the latest dump file, or an empty string
+  std::string lastDumpFile() const;
+
+private:
+
+  class DumpThread : public QThread {
+  public:
+    DumpThread(IwrfBlackBox &blackBox) : _blackBox(blackBox) {}
+    void run() { _blackBox._dumpLoop(); }
+  private:
+    IwrfBlackBox &_blackBox;
+  };
+
+  // not copyable
+  IwrfBlackBox(const IwrfBlackBox &rhs);
+  IwrfBlackBox & operator=(const IwrfBlackBox &rhs);
+
+  void _dumpLoop();
+  std::string _dump(const std::string &reason, time_t triggerTime,
+                    double freezeTime);
+  static bool _writeAll(int fd, struct iovec *iov, int iovCnt);
+
+  double _seconds;
+  std::string _dir;
+
+  /// the ring receiving data, used only by the publishing thread, and the
+  /// ring being dumped, or the empty spare when no dump is in progress
+
+  IwrfPacketRing *_live;
+  IwrfPacketRing *_frozen;
+
+  /// latest metadata packets, used only by the publishing thread
+
+  std::vector<char> _metaData;
+
+  /// set by trigger(), so that service() can check for a pending trigger
+  /// without taking the mutex
+
+  std::atomic<bool> _triggered;
+
+  /// Trigger and dump state, guarded by _mutex. _dumping is set when a
+  /// dump is handed to the dump thread, and cleared when it is finished
+  /// and _frozen has been emptied for reuse.
+
+  mutable boost::mutex _mutex;
+  boost::condition_variable _cond;
+  std::string _triggerReason;
+  time_t _triggerTime;
+  bool _dumping;
+  bool _stopping;
+  std::string _dumpReason;
+  time_t _dumpTriggerTime;
+  double _dumpFreezeTime;
+  std::vector<char> _dumpMetaData;
+  uint64_t _nDumps;
+  std::string _lastDumpFile;
+
+  ThreadPolicy _threadPolicy;
+  DumpThread *_dumpThread;
+
+};
+
+#endif /* IWRFBLACKBOX_H_ */
@@ -0,0 +1,695 @@
+/*
+ * IwrfFanoutServer.cpp
+ *
+ * TCP server which sends the IWRF stream held in an IwrfPacketRing to any
+ * number of clients.
+ */
+
+#include "IwrfFanoutServer.h"
+#include <logx/Logging.h>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+LOGGING("IwrfFanoutServer")
+
+// How often to retry opening the server socket, seconds
+static const double OpenRetrySecs = 1.0;
+
+// How often to poll the sockets when nothing is waiting to be written,
+// seconds. This sets how quickly new clients are noticed.
+static const double PollIntervalSecs = 0.01;
+
+// How often to update the statistics snapshot, seconds
+static const double StatsIntervalSecs = 0.5;
+
+// How long to wait for a client at a time when throttling, milliseconds
+static const int ThrottleWaitMs = 10;
+
+// Maximum number of epoll events handled per poll
+static const int MaxEvents = 32;
+
+// Maximum number of ring chunks sent with one sendmsg()
+static const int MaxSendChunks = 64;
+
+/////////////////////////////////////////////////////////////////////////////
+IwrfFanoutServer::IwrfFanoutServer(int port, IwrfPacketRing &ring,
+                                   SlowClientPolicy policy, int maxClients) :
+  _port(port),
+  _ring(ring),
+  _policy(policy),
+  _maxClients(maxClients),
+  _listenFd(-1),
+  _epollFd(-1),
+  _wakeFd(-1),
+  _lastOpenAttempt(0.0),
+  _lastPollTime(0.0),
+  _nBlocked(0),
+  _greetingPackets(0),
+  _closedPacketsSent(0),
+  _closedSendCalls(0),
+  _lastStatsTime(0.0),
+  _statsPacketsSent(0),
+  _statsSendCalls(0)
+{
+
+  // The epoll instance and the wake-up eventfd are created now, so that
+  // service() can wait on them even while the server socket can't be
+  // opened.
+
+  _epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (_epollFd < 0) {
+    ELOG << "Cannot create epoll instance: " << strerror(errno);
+    return;
+  }
+
+  _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = &_wakeFd;
+  if (_wakeFd < 0 || epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &ev)) {
+    ELOG << "Cannot create wake-up eventfd: " << strerror(errno);
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+IwrfFanoutServer::~IwrfFanoutServer()
+{
+  for (size_t ii = 0; ii < _clients.size(); ii++) {
+    if (!_clients[ii]->closed) {
+      close(_clients[ii]->fd);
+    }
+    delete _clients[ii];
+  }
+  if (_listenFd >= 0) {
+    close(_listenFd);
+  }
+  if (_wakeFd >= 0) {
+    close(_wakeFd);
+  }
+  if (_epollFd >= 0) {
+    close(_epollFd);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// parse a slow client policy name
+
+bool IwrfFanoutServer::parsePolicy(const std::string &name,
+                                   SlowClientPolicy &policy)
+{
+  if (name == "drop_oldest") {
+    policy = DROP_OLDEST;
+  } else if (name == "disconnect") {
+    policy = DISCONNECT;
+  } else if (name == "throttle") {
+    policy = THROTTLE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// name of a slow client policy
+
+std::string IwrfFanoutServer::policyName(SlowClientPolicy policy)
+{
+  switch (policy) {
+    case DROP_OLDEST:
+      return "drop_oldest";
+    case DISCONNECT:
+      return "disconnect";
+    case THROTTLE:
+      return "throttle";
+  }
+  return "unknown";
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// append a batch to the ring by reference, applying the slow client
+// policy to clients which would lose data they have not yet received
+
+int IwrfFanoutServer::publish(PacketBatcher *batch)
+{
+
+  if (batch->capacity() > _ring.capacity()) {
+    ELOG << "Dropping " << batch->capacity() << " byte batch, larger " <<
+      "than the " << _ring.capacity() << " byte ring";
+    return -1;
+  }
+
+  int64_t newTail = _ring.tailAfterAppend(batch->capacity());
+
+  for (size_t ii = 0; ii < _clients.size(); ii++) {
+    Client *client = _clients[ii];
+    if (client->closed || client->chunk >= newTail) {
+      continue;
+    }
+    switch (_policy) {
+      case DISCONNECT:
+        _closeClient(client, "fell a whole ring behind");
+        break;
+      case THROTTLE:
+        // wait for the client to catch up, or go away
+        while (!client->closed && client->chunk < newTail) {
+          _poll(ThrottleWaitMs);
+          if (!client->closed && !client->blocked) {
+            _sendTo(client);
+          }
+          pthread_testcancel();
+        }
+        break;
+      case DROP_OLDEST:
+        _lapClient(client, newTail);
+        break;
+    }
+  }
+  _purgeClosed();
+
+  _ring.append(batch);
+  return 0;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// set the packets sent to each new client first
+
+void IwrfFanoutServer::setGreeting(const struct iovec *iov, int iovCnt,
+                                   int nPackets)
+{
+  _greeting.clear();
+  for (int ii = 0; ii < iovCnt; ii++) {
+    const char *src = static_cast<const char *>(iov[ii].iov_base);
+    _greeting.insert(_greeting.end(), src, src + iov[ii].iov_len);
+  }
+  _greetingPackets = nPackets;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// accept new clients and send pending data
+
+void IwrfFanoutServer::service(int timeoutMs)
+{
+
+  if (_listenFd < 0) {
+    double now = IwrfPacketRing::now();
+    if (now - _lastOpenAttempt >= OpenRetrySecs) {
+      _lastOpenAttempt = now;
+      _openServer();
+    }
+  }
+
+  // Polling costs a system call, so when we are called for every pulse,
+  // only poll when a client is waiting to be written or it's time to look
+  // for new clients.
+
+  if (timeoutMs > 0 || _nBlocked > 0 ||
+      IwrfPacketRing::now() - _lastPollTime >= PollIntervalSecs) {
+    _poll(timeoutMs);
+  }
+
+  for (size_t ii = 0; ii < _clients.size(); ii++) {
+    Client *client = _clients[ii];
+    if (!client->closed && !client->blocked) {
+      _sendTo(client);
+    }
+  }
+
+  _purgeClosed();
+  _updateStats(false);
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// number of clients connected
+
+int IwrfFanoutServer::nClients() const
+{
+  boost::mutex::scoped_lock guard(_statsMutex);
+  return _stats.size();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// statistics for each client
+
+std::vector<IwrfFanoutServer::ClientStats> IwrfFanoutServer::clientStats() const
+{
+  boost::mutex::scoped_lock guard(_statsMutex);
+  return _stats;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// total packets sent
+
+uint64_t IwrfFanoutServer::nPacketsSent() const
+{
+  boost::mutex::scoped_lock guard(_statsMutex);
+  return _statsPacketsSent;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// total send calls made
+
+uint64_t IwrfFanoutServer::nSendCalls() const
+{
+  boost::mutex::scoped_lock guard(_statsMutex);
+  return _statsSendCalls;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// open the listening socket and the epoll instance
+// Returns 0 on success, -1 on failure
+
+int IwrfFanoutServer::_openServer()
+{
+
+  if (_epollFd < 0) {
+    return -1;
+  }
+
+  _listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (_listenFd < 0) {
+    ELOG << "Cannot create server socket: " << strerror(errno);
+    return -1;
+  }
+
+  int one = 1;
+  setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(_port);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+
+  if (bind(_listenFd, (struct sockaddr *) &addr, sizeof(addr)) ||
+      listen(_listenFd, 8) ||
+      epoll_ctl(_epollFd, EPOLL_CTL_ADD, _listenFd, &ev)) {
+    ELOG << "Cannot open server, port " << _port << ": " << strerror(errno);
+    close(_listenFd);
+    _listenFd = -1;
+    return -1;
+  }
+
+  ILOG << "IWRF server listening on port " << _port << ", up to " <<
+    _maxClients << " clients, slow client policy " << policyName(_policy);
+  return 0;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// wait for socket events, and handle them
+
+void IwrfFanoutServer::_poll(int timeoutMs)
+{
+
+  _lastPollTime = IwrfPacketRing::now();
+  if (_epollFd < 0) {
+    return;
+  }
+
+  struct epoll_event events[MaxEvents];
+  int nEvents = epoll_wait(_epollFd, events, MaxEvents, timeoutMs);
+  if (nEvents < 0) {
+    if (errno != EINTR) {
+      ELOG << "epoll_wait failed: " << strerror(errno);
+    }
+    return;
+  }
+
+  for (int ii = 0; ii < nEvents; ii++) {
+    if (events[ii].data.ptr == &_wakeFd) {
+      uint64_t count;
+      if (read(_wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        ELOG << "Reading wake-up eventfd: " << strerror(errno);
+      }
+      continue;
+    }
+    Client *client = static_cast<Client *>(events[ii].data.ptr);
+    if (client == NULL) {
+      _acceptClients();
+      continue;
+    }
+    if (client->closed) {
+      continue;
+    }
+    if (events[ii].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+      _closeClient(client, "connection closed");
+      continue;
+    }
+    if (events[ii].events & EPOLLIN) {
+      _readFromClient(client);
+    }
+    if (!client->closed && (events[ii].events & EPOLLOUT)) {
+      _setBlocked(client, false);
+    }
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// accept all pending connections
+
+void IwrfFanoutServer::_acceptClients()
+{
+
+  while (true) {
+
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int fd = accept4(_listenFd, (struct sockaddr *) &addr, &addrLen,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        ELOG << "accept failed: " << strerror(errno);
+      }
+      return;
+    }
+
+    std::ostringstream address;
+    address << inet_ntoa(addr.sin_addr) << ":" << ntohs(addr.sin_port);
+
+    int nOpen = 0;
+    for (size_t ii = 0; ii < _clients.size(); ii++) {
+      if (!_clients[ii]->closed) {
+        nOpen++;
+      }
+    }
+    if (nOpen >= _maxClients) {
+      WLOG << "Refusing IWRF client " << address.str() << ", already " <<
+        nOpen << " clients";
+      close(fd);
+      continue;
+    }
+
+    // new clients get the greeting, then start with the next chunk
+    // published
+
+    Client *client = new Client;
+    client->fd = fd;
+    client->address = address.str();
+    client->connectTime = IwrfPacketRing::now();
+    client->closed = false;
+    client->blocked = false;
+    client->chunk = _ring.headChunk();
+    client->offset = _ring.headOffset();
+    client->carry = _greeting;
+    client->carryPos = 0;
+    client->carryPackets = _greetingPackets;
+    client->bytesSent = 0;
+    client->packetsSent = 0;
+    client->nSendCalls = 0;
+    client->droppedPackets = 0;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = client;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev)) {
+      ELOG << "Cannot add IWRF client " << client->address <<
+        " to epoll: " << strerror(errno);
+      close(fd);
+      delete client;
+      continue;
+    }
+
+    _clients.push_back(client);
+    ILOG << "IWRF client connected: " << client->address;
+
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// make a waiting service() call return
+
+void IwrfFanoutServer::wake()
+{
+  uint64_t one = 1;
+  if (_wakeFd >= 0 && write(_wakeFd, &one, sizeof(one)) < 0 &&
+      errno != EAGAIN) {
+    ELOG << "Writing wake-up eventfd: " << strerror(errno);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// read and discard anything sent by a client, noticing when it closes
+
+void IwrfFanoutServer::_readFromClient(Client *client)
+{
+  char buf[1024];
+  while (true) {
+    ssize_t nRead = read(client->fd, buf, sizeof(buf));
+    if (nRead > 0) {
+      continue;
+    }
+    if (nRead == 0) {
+      _closeClient(client, "connection closed");
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      _closeClient(client, strerror(errno));
+    }
+    return;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// send a client everything it has not yet received, as far as its socket
+// will take it
+
+void IwrfFanoutServer::_sendTo(Client *client)
+{
+
+  while (true) {
+
+    // any carried data go first, then the ring from the cursor
+
+    struct iovec iov[1 + MaxSendChunks];
+    int iovCnt = 0;
+    size_t carryLen = client->carry.size() - client->carryPos;
+    if (carryLen > 0) {
+      iov[iovCnt].iov_base = &client->carry[client->carryPos];
+      iov[iovCnt].iov_len = carryLen;
+      iovCnt++;
+    }
+    iovCnt += _ring.gather(client->offset, _ring.headOffset(), iov + iovCnt,
+                           MaxSendChunks);
+    if (iovCnt == 0) {
+      return;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovCnt;
+
+    ssize_t nSent = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (nSent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        _setBlocked(client, true);
+      } else {
+        _closeClient(client, strerror(errno));
+      }
+      return;
+    }
+
+    client->nSendCalls++;
+    client->bytesSent += nSent;
+
+    // advance through the carried data, then the ring, counting whole
+    // packets sent
+
+    size_t fromCarry = ((size_t) nSent < carryLen) ? nSent : carryLen;
+    client->carryPos += fromCarry;
+    if (carryLen > 0 && client->carryPos == client->carry.size()) {
+      client->packetsSent += client->carryPackets;
+      client->carry.clear();
+      client->carryPos = 0;
+      client->carryPackets = 0;
+    }
+
+    client->offset += nSent - fromCarry;
+    while (client->chunk < _ring.headChunk() &&
+           _ring.chunkOffset(client->chunk + 1) <= client->offset) {
+      client->packetsSent += _ring.chunkPackets(client->chunk);
+      client->chunk++;
+    }
+
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// set whether a client is waiting for its socket to become writable
+
+void IwrfFanoutServer::_setBlocked(Client *client, bool blocked)
+{
+
+  if (client->closed || client->blocked == blocked) {
+    return;
+  }
+  client->blocked = blocked;
+  _nBlocked += blocked ? 1 : -1;
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLRDHUP | (blocked ? EPOLLOUT : 0);
+  ev.data.ptr = client;
+  if (epoll_ctl(_epollFd, EPOLL_CTL_MOD, client->fd, &ev)) {
+    _closeClient(client, strerror(errno));
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// move a client which is about to be lapped to the oldest chunk which
+// will survive, saving the rest of a partly sent chunk
+
+void IwrfFanoutServer::_lapClient(Client *client, int64_t newTail)
+{
+
+  int64_t chunk = client->chunk;
+  uint64_t chunkStart = _ring.chunkOffset(chunk);
+
+  if (client->offset > chunkStart) {
+    // Part of this chunk has been sent. Save the rest, so that the client
+    // still gets whole packets. Any earlier carry has been sent already,
+    // since data are always sent in order.
+    uint64_t chunkEnd = _ring.chunkOffset(chunk + 1);
+    struct iovec iov[1];
+    int iovCnt = _ring.gather(client->offset, chunkEnd, iov, 1);
+    for (int ii = 0; ii < iovCnt; ii++) {
+      const char *src = static_cast<const char *>(iov[ii].iov_base);
+      client->carry.insert(client->carry.end(), src, src + iov[ii].iov_len);
+    }
+    client->carryPackets = _ring.chunkPackets(chunk);
+    chunk++;
+  }
+
+  uint64_t nDropped = 0;
+  for (; chunk < newTail; chunk++) {
+    nDropped += _ring.chunkPackets(chunk);
+  }
+  client->droppedPackets += nDropped;
+
+  client->chunk = newTail;
+  client->offset = _ring.chunkOffset(newTail);
+
+  DLOG << "IWRF client " << client->address << " lagging, dropped " <<
+    nDropped << " packets";
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// close a client's connection. The client is removed by _purgeClosed().
+
+void IwrfFanoutServer::_closeClient(Client *client, const std::string &reason)
+{
+  if (client->closed) {
+    return;
+  }
+  client->closed = true;
+  if (client->blocked) {
+    client->blocked = false;
+    _nBlocked--;
+  }
+  epoll_ctl(_epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+  close(client->fd);
+  ILOG << "IWRF client " << client->address << " disconnected: " << reason;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// remove closed clients
+
+void IwrfFanoutServer::_purgeClosed()
+{
+
+  bool purged = false;
+  for (size_t ii = 0; ii < _clients.size(); ) {
+    Client *client = _clients[ii];
+    if (client->closed) {
+      _closedPacketsSent += client->packetsSent;
+      _closedSendCalls += client->nSendCalls;
+      delete client;
+      _clients.erase(_clients.begin() + ii);
+      purged = true;
+    } else {
+      ii++;
+    }
+  }
+
+  if (purged) {
+    _updateStats(true);
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// update the statistics snapshot, if it's time or if forced
+
+void IwrfFanoutServer::_updateStats(bool force)
+{
+
+  double now = IwrfPacketRing::now();
+  if (!force && now - _lastStatsTime < StatsIntervalSecs) {
+    return;
+  }
+  _lastStatsTime = now;
+
+  // build the snapshot in the previous one's storage, so that nothing is
+  // allocated while the clients stay the same
+
+  size_t nStats = 0;
+  uint64_t packetsSent = _closedPacketsSent;
+  uint64_t sendCalls = _closedSendCalls;
+
+  for (size_t ii = 0; ii < _clients.size(); ii++) {
+    const Client *client = _clients[ii];
+    if (client->closed) {
+      continue;
+    }
+    if (nStats == _statsWork.size()) {
+      _statsWork.push_back(ClientStats());
+    }
+    ClientStats &cs = _statsWork[nStats++];
+    cs.address = client->address;
+    cs.connectedSecs = now - client->connectTime;
+    cs.bytesSent = client->bytesSent;
+    cs.packetsSent = client->packetsSent;
+    cs.bytesPerSec = (cs.connectedSecs > 0.0) ?
+      client->bytesSent / cs.connectedSecs : 0.0;
+    cs.lagBytes = _ring.headOffset() - client->offset +
+      (client->carry.size() - client->carryPos);
+    cs.lagSecs = (client->chunk < _ring.headChunk()) ?
+      now - _ring.chunkTime(client->chunk) : 0.0;
+    cs.droppedPackets = client->droppedPackets;
+    packetsSent += client->packetsSent;
+    sendCalls += client->nSendCalls;
+  }
+
+  _statsWork.resize(nStats);
+
+  boost::mutex::scoped_lock guard(_statsMutex);
+  _stats.swap(_statsWork);
+  _statsPacketsSent = packetsSent;
+  _statsSendCalls = sendCalls;
+
+}
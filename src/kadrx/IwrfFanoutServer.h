@@ -0,0 +1,211 @@
+/*
+ * IwrfFanoutServer.h
+ *
+ * TCP server which sends the IWRF stream held in an IwrfPacketRing to any
+ * number of clients.
+ */
+
+#ifndef IWRFFANOUTSERVER_H_
+#define IWRFFANOUTSERVER_H_
+
+#include "IwrfPacketRing.h"
+#include <boost/thread/mutex.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// IwrfFanoutServer accepts TCP clients on the IWRF port and sends each of
+/// them the data published to a shared IwrfPacketRing. The ring holds the
+/// batches the packets were serialized into, and each client has its own
+/// cursor into it, so a client which reads slowly does not hold up the
+/// others.
+///
+/// Sockets are non-blocking and are managed with epoll. When a client is
+/// serviced, what it has not yet received is sent with sendmsg() calls
+/// gathering many chunks each, so a client which has fallen behind
+/// catches up with large writes.
+///
+/// When publishing a chunk would drop data a client has not yet
+/// received, the slow client policy decides what happens:
+///   - DROP_OLDEST: the client skips to the oldest data left in the ring.
+///     The rest of a partly sent chunk is saved and sent first, so the
+///     client still gets whole packets.
+///   - DISCONNECT: the client is disconnected.
+///   - THROTTLE: publish() waits for the client to catch up, which holds up
+///     the thread publishing the data.
+///
+/// A greeting, normally the latest metadata packets, may be set with
+/// setGreeting(). It is sent to each new client before any data from the
+/// ring, so that the client can interpret the data at once.
+///
+/// Clients are accepted and serviced only from service() and publish(),
+/// which must be called from the thread which owns the ring. wake() and
+/// the statistics methods may be called from any thread. The statistics
+/// are a snapshot which is updated a few times a second.
+class IwrfFanoutServer {
+public:
+    /// What to do with a client which has fallen a whole ring behind
+    typedef enum {
+        DROP_OLDEST,
+        DISCONNECT,
+        THROTTLE
+    } SlowClientPolicy;
+
+    /// Statistics for one client
+    struct ClientStats {
+        ClientStats() : connectedSecs(0.0), bytesSent(0), packetsSent(0),
+            bytesPerSec(0.0), lagBytes(0), lagSecs(0.0), droppedPackets(0) {}
+        std::string address;    ///< client address and port
+        double connectedSecs;   ///< time since the client connected
+        uint64_t bytesSent;     ///< bytes sent to the client
+        uint64_t packetsSent;   ///< whole packets sent to the client
+        double bytesPerSec;     ///< mean send rate since the client connected
+        uint64_t lagBytes;      ///< bytes published but not yet sent
+        double lagSecs;         ///< age of the oldest data not yet sent
+        uint64_t droppedPackets; ///< packets skipped because the client lagged
+    };
+
+    /**
+     * Constructor. The server is opened when first serviced.
+     * @param port the TCP port to listen on
+     * @param ring the ring holding the data to send
+     * @param policy what to do with a client which falls a ring behind
+     * @param maxClients the maximum number of clients connected at once
+     */
+    IwrfFanoutServer(int port, IwrfPacketRing &ring,
+                     SlowClientPolicy policy, int maxClients);
+
+    ~IwrfFanoutServer();
+
+    /**
+     * Parse a slow client policy name: "drop_oldest", "disconnect" or
+     * "throttle".
+     * @param name the policy name
+     * @param policy set to the policy
+     * @return true iff the name is a valid policy
+     */
+    static bool parsePolicy(const std::string &name, SlowClientPolicy &policy);
+
+    /// @return the name of the given policy
+    static std::string policyName(SlowClientPolicy policy);
+
+    /**
+     * Append a batch of one or more whole packets to the ring, by
+     * reference, applying the slow client policy to any client which
+     * would lose data it has not yet received. The batch must not change
+     * until the ring hands it back through takeDropped().
+     * @param batch the packets
+     * @return 0 on success, -1 if the batch is larger than the ring, in
+     * which case it is not held
+     */
+    int publish(PacketBatcher *batch);
+
+    /**
+     * Set the packets sent to each new client before any data from the
+     * ring.
+     * @param iov the pieces making up the greeting
+     * @param iovCnt the number of pieces
+     * @param nPackets the number of packets in the greeting
+     */
+    void setGreeting(const struct iovec *iov, int iovCnt, int nPackets);
+
+    /**
+     * Accept new clients, and send pending data to the clients which can
+     * take it.
+     * @param timeoutMs the maximum time to wait for a socket to become
+     *     ready or for wake() to be called, in milliseconds. With zero,
+     *     the sockets are only polled, and not on every call, unless a
+     *     client is waiting to be written.
+     */
+    void service(int timeoutMs);
+
+    /// Make a service() call waiting in another thread return early.
+    /// This is safe to call from any thread.
+    void wake();
+
+    /// @return the number of clients connected
+    int nClients() const;
+
+    /// @return statistics for each connected client
+    std::vector<ClientStats> clientStats() const;
+
+    /// @return the total number of packets sent, over all clients
+    uint64_t nPacketsSent() const;
+
+    /// @return the total number of send calls made, over all clients
+    uint64_t nSendCalls() const;
+
+private:
+    struct Client {
+        int fd;
+        std::string address;
+        double connectTime;
+        bool closed;
+        /// waiting for the socket to become writable
+        bool blocked;
+        /// the cursor, and the number of the chunk containing it
+        int64_t chunk;
+        uint64_t offset;
+        /// the rest of a partly sent chunk saved when the client was lapped,
+        /// the position reached in it, and its packet count
+        std::vector<char> carry;
+        size_t carryPos;
+        int carryPackets;
+        /// counts
+        uint64_t bytesSent;
+        uint64_t packetsSent;
+        uint64_t nSendCalls;
+        uint64_t droppedPackets;
+    };
+
+    // not copyable
+    IwrfFanoutServer(const IwrfFanoutServer &rhs);
+    IwrfFanoutServer & operator=(const IwrfFanoutServer &rhs);
+
+    int _openServer();
+    void _poll(int timeoutMs);
+    void _acceptClients();
+    void _readFromClient(Client *client);
+    void _sendTo(Client *client);
+    void _setBlocked(Client *client, bool blocked);
+    void _lapClient(Client *client, int64_t newTail);
+    void _closeClient(Client *client, const std::string &reason);
+    void _purgeClosed();
+    void _updateStats(bool force);
+
+    int _port;
+    IwrfPacketRing &_ring;
+    SlowClientPolicy _policy;
+    int _maxClients;
+
+    int _listenFd;
+    int _epollFd;
+    /// eventfd used by wake()
+    int _wakeFd;
+    double _lastOpenAttempt;
+    double _lastPollTime;
+
+    /// Clients, used only by the servicing thread
+    std::vector<Client *> _clients;
+    int _nBlocked;
+
+    /// packets sent to each new client first
+    std::vector<char> _greeting;
+    int _greetingPackets;
+
+    /// counts for clients which have disconnected
+    uint64_t _closedPacketsSent;
+    uint64_t _closedSendCalls;
+
+    /// Statistics snapshot, guarded by _statsMutex
+    mutable boost::mutex _statsMutex;
+    double _lastStatsTime;
+    std::vector<ClientStats> _stats;
+    uint64_t _statsPacketsSent;
+    uint64_t _statsSendCalls;
+
+    /// the snapshot before last, reused to build the next one
+    std::vector<ClientStats> _statsWork;
+};
+
+#endif /* IWRFFANOUTSERVER_H_ */
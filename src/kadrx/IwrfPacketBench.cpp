@@ -0,0 +1,241 @@
+/*
+ * IwrfPacketBench.cpp
+ *
+ * Microbenchmark comparing the ways KaMerge serializes and sends an IWRF
+ * pulse packet:
+ *   - copy: zero the IQ area of a contiguous packet buffer, copy the header
+ *     and the H and V IQ data into it, then write() the buffer, as KaMerge
+ *     used to
+ *   - gather: describe the packet as an iovec of header, H IQ and V IQ in
+ *     place, with zero padding for a short channel, and send it with a
+ *     single sendmsg(), as KaMerge does now
+ *
+ * Packets are written to one end of a local socket pair, with a second
+ * thread draining the other end, so the kernel's copy is included in both
+ * timings. Bytes touched counts only the bytes zeroed or copied in user
+ * space per pulse.
+ *
+ * Usage: IwrfPacketBench [nGates] [nPulses] [shortGates]
+ *   shortGates - if given, the V channel has this many gates, so that it
+ *                needs padding
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+typedef std::chrono::steady_clock Clock;
+
+// Stand-in for iwrf_pulse_header_t, which is not available to the
+// benchmark build. Only its size matters here.
+struct PulseHeader {
+  char bytes[256];
+};
+
+static const int N_DATA_CHANNELS = 2;
+
+// write all of a contiguous buffer
+static void
+writeAll(int sd, const char *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(sd, buf, len);
+    if (n <= 0) {
+      perror("write");
+      exit(1);
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+// send all of a gathered buffer
+static void
+sendAll(int sd, struct iovec *iov, int iovCnt)
+{
+  while (iovCnt > 0) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovCnt;
+    ssize_t n = sendmsg(sd, &msg, MSG_NOSIGNAL);
+    if (n <= 0) {
+      perror("sendmsg");
+      exit(1);
+    }
+    while (iovCnt > 0 && n >= (ssize_t) iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iovCnt--;
+    }
+    if (iovCnt > 0) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+struct Result {
+  double secs;
+  double bytesTouched;
+};
+
+// copy path: memset + memcpy of header, H and V into one buffer
+static Result
+runCopy(int sd, const PulseHeader &hdr,
+        const std::vector<int16_t> &iqH, int nGatesH,
+        const std::vector<int16_t> &iqV, int nGatesV,
+        int nGates, int nPulses)
+{
+  size_t iqLen = nGates * N_DATA_CHANNELS * 2 * sizeof(int16_t);
+  size_t bufLen = sizeof(hdr) + iqLen;
+  std::vector<char> buf(bufLen);
+  int16_t *iq = reinterpret_cast<int16_t *>(&buf[sizeof(hdr)]);
+
+  double touched = 0.0;
+  Clock::time_point start = Clock::now();
+  for (int ii = 0; ii < nPulses; ii++) {
+    memset(iq, 0, iqLen);
+    memcpy(iq, &iqH[0], nGatesH * 2 * sizeof(int16_t));
+    memcpy(iq + nGates * 2, &iqV[0], nGatesV * 2 * sizeof(int16_t));
+    memcpy(&buf[0], &hdr, sizeof(hdr));
+    touched += iqLen + (nGatesH + nGatesV) * 2 * sizeof(int16_t) +
+      sizeof(hdr);
+    writeAll(sd, &buf[0], bufLen);
+  }
+  Result result;
+  result.secs = std::chrono::duration<double>(Clock::now() - start).count();
+  result.bytesTouched = touched / nPulses;
+  return result;
+}
+
+// gather path: iovec pointing at the data in place
+static Result
+runGather(int sd, const PulseHeader &hdr,
+          const std::vector<int16_t> &iqH, int nGatesH,
+          const std::vector<int16_t> &iqV, int nGatesV,
+          int nGates, int nPulses)
+{
+  std::vector<int16_t> zeros(nGates * 2, 0);
+  const int16_t *iqs[N_DATA_CHANNELS] = { &iqH[0], &iqV[0] };
+  int gates[N_DATA_CHANNELS] = { nGatesH, nGatesV };
+
+  Clock::time_point start = Clock::now();
+  for (int ii = 0; ii < nPulses; ii++) {
+    struct iovec iov[5];
+    int iovCnt = 0;
+    iov[iovCnt].iov_base = const_cast<PulseHeader *>(&hdr);
+    iov[iovCnt].iov_len = sizeof(hdr);
+    iovCnt++;
+    for (int chan = 0; chan < N_DATA_CHANNELS; chan++) {
+      size_t len = gates[chan] * 2 * sizeof(int16_t);
+      size_t padLen = nGates * 2 * sizeof(int16_t) - len;
+      if (len > 0) {
+        iov[iovCnt].iov_base = const_cast<int16_t *>(iqs[chan]);
+        iov[iovCnt].iov_len = len;
+        iovCnt++;
+      }
+      if (padLen > 0) {
+        iov[iovCnt].iov_base = &zeros[0];
+        iov[iovCnt].iov_len = padLen;
+        iovCnt++;
+      }
+    }
+    sendAll(sd, iov, iovCnt);
+  }
+  Result result;
+  result.secs = std::chrono::duration<double>(Clock::now() - start).count();
+  // nothing is zeroed or copied in user space
+  result.bytesTouched = 0.0;
+  return result;
+}
+
+static void
+report(const std::string &name, const Result &result, int nPulses,
+       size_t packetLen)
+{
+  std::cout << std::left << std::setw(8) << name << std::right
+            << std::fixed << std::setprecision(2)
+            << "  " << std::setw(8) << result.secs / nPulses * 1.0e6
+            << " usec/pulse, " << std::setw(8)
+            << nPulses * (double) packetLen / result.secs / 1.0e6
+            << " MB/s, user-space bytes touched/pulse: "
+            << std::setprecision(0) << result.bytesTouched << std::endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+
+  int nGates = 2000;
+  int nPulses = 100000;
+  int shortGates = -1;
+
+  if (argc > 1) {
+    nGates = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    nPulses = atoi(argv[2]);
+  }
+  if (argc > 3) {
+    shortGates = atoi(argv[3]);
+  }
+
+  int nGatesH = nGates;
+  int nGatesV = (shortGates >= 0 && shortGates < nGates) ? shortGates : nGates;
+
+  PulseHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  std::vector<int16_t> iqH(nGatesH * 2 + 1), iqV(nGatesV * 2 + 1);
+  for (size_t ii = 0; ii < iqH.size(); ii++) {
+    iqH[ii] = (int16_t) ii;
+  }
+  for (size_t ii = 0; ii < iqV.size(); ii++) {
+    iqV[ii] = (int16_t) -ii;
+  }
+
+  size_t packetLen =
+    sizeof(hdr) + nGates * N_DATA_CHANNELS * 2 * sizeof(int16_t);
+
+  std::cout << "IwrfPacketBench: " << nGates << " gates (V " << nGatesV
+            << "), " << nPulses << " pulses, " << packetLen
+            << " bytes/packet" << std::endl;
+
+  int sds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sds)) {
+    perror("socketpair");
+    return 1;
+  }
+
+  // drain the far end
+  std::thread drain([&sds]() {
+    std::vector<char> buf(1 << 20);
+    while (read(sds[1], &buf[0], buf.size()) > 0) {
+    }
+  });
+
+  Result copy = runCopy(sds[0], hdr, iqH, nGatesH, iqV, nGatesV,
+                        nGates, nPulses);
+  report("copy", copy, nPulses, packetLen);
+
+  Result gather = runGather(sds[0], hdr, iqH, nGatesH, iqV, nGatesV,
+                            nGates, nPulses);
+  report("gather", gather, nPulses, packetLen);
+
+  close(sds[0]);
+  drain.join();
+  close(sds[1]);
+
+  return 0;
+
+}
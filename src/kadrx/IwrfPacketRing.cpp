@@ -0,0 +1,273 @@
+/*
+ * IwrfPacketRing.cpp
+ *
+ * Ring holding recently serialized IWRF packets, shared by all of the
+ * consumers of the IWRF stream.
+ */
+
+#include "IwrfPacketRing.h"
+#include <cstring>
+#include <ctime>
+
+/////////////////////////////////////////////////////////////////////////////
+IwrfPacketRing::IwrfPacketRing(size_t capacity, size_t maxChunks) :
+  _capacity(capacity),
+  _headChunk(0),
+  _tailChunk(0),
+  _headOffset(0),
+  _heldBytes(0),
+  _copyPos(0)
+{
+  if (maxChunks < 1) {
+    maxChunks = 1;
+  }
+  _chunks.resize(maxChunks);
+  _dropped.reserve(maxChunks);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+IwrfPacketRing::~IwrfPacketRing()
+{
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// append a batch by reference, dropping the oldest chunks as needed
+
+int64_t IwrfPacketRing::append(PacketBatcher *batch)
+{
+  if (batch->capacity() > _capacity) {
+    return -1;
+  }
+  _dropTo(tailAfterAppend(batch->capacity()));
+  return _push(batch->data(), batch->len(), batch->nPackets(), batch,
+               batch->capacity());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// append a chunk by copying it into the copy buffer
+
+int64_t IwrfPacketRing::append(const struct iovec *iov, int iovCnt,
+                               int nPackets)
+{
+
+  size_t len = 0;
+  for (int ii = 0; ii < iovCnt; ii++) {
+    len += iov[ii].iov_len;
+  }
+  if (len > _copyBuf.size()) {
+    return -1;
+  }
+
+  // the chunk goes after the last one copied, or back at the start of the
+  // buffer if it doesn't fit before the end, in which case the end of the
+  // buffer is left unused this time round
+
+  bool wrap = (_copyPos + len > _copyBuf.size());
+  size_t start = wrap ? 0 : _copyPos;
+  size_t endLen = wrap ? _copyBuf.size() - _copyPos : len;
+
+  // drop the copied chunks in the way. Since copies are made in circular
+  // order, they are the oldest copied chunks, starting at _copyPos.
+
+  int64_t tail = _tailChunk;
+  for (int64_t chunk = _tailChunk; chunk < _headChunk; chunk++) {
+    if (_chunk(chunk).batch || _chunk(chunk).heldBytes == 0) {
+      continue;
+    }
+    if (!_copyOverlaps(chunk, _copyPos, endLen) &&
+        !(wrap && _copyOverlaps(chunk, 0, len))) {
+      break;
+    }
+    tail = chunk + 1;
+  }
+  int64_t capacityTail = tailAfterAppend(len);
+  _dropTo(tail > capacityTail ? tail : capacityTail);
+
+  char *data = &_copyBuf[0] + start;
+  for (int ii = 0; ii < iovCnt; ii++) {
+    memcpy(data, iov[ii].iov_base, iov[ii].iov_len);
+    data += iov[ii].iov_len;
+  }
+  _copyPos = start + len;
+  return _push(&_copyBuf[0] + start, len, nPackets, NULL, len);
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// allocate the copy buffer, writing to it so the pages are mapped now
+
+void IwrfPacketRing::allocCopyBuffer()
+{
+  _copyBuf.assign(_capacity, 0);
+  _copyPos = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// hand back a dropped batch which was held by reference
+
+PacketBatcher *IwrfPacketRing::takeDropped()
+{
+  if (_dropped.empty()) {
+    return NULL;
+  }
+  PacketBatcher *batch = _dropped.back();
+  _dropped.pop_back();
+  return batch;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// drop everything held
+
+void IwrfPacketRing::clear()
+{
+  _dropTo(_headChunk);
+  _headChunk = 0;
+  _tailChunk = 0;
+  _headOffset = 0;
+  _copyPos = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// oldest chunk still held after appending a batch of the given capacity
+
+int64_t IwrfPacketRing::tailAfterAppend(size_t capacity) const
+{
+  size_t heldBytes = _heldBytes + capacity;
+  int64_t tail = _tailChunk;
+  while (tail < _headChunk &&
+         (heldBytes > _capacity ||
+          _headChunk - tail >= (int64_t) _chunks.size())) {
+    heldBytes -= _chunk(tail).heldBytes;
+    tail++;
+  }
+  return tail;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// offset of the start of a chunk
+
+uint64_t IwrfPacketRing::chunkOffset(int64_t chunk) const
+{
+  if (chunk >= _headChunk) {
+    return _headOffset;
+  }
+  return _chunk(chunk).offset;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// number of packets in a chunk
+
+int IwrfPacketRing::chunkPackets(int64_t chunk) const
+{
+  return _chunk(chunk).nPackets;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// time a chunk was appended
+
+double IwrfPacketRing::chunkTime(int64_t chunk) const
+{
+  return _chunk(chunk).time;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// describe the data between two offsets, a piece for each chunk
+
+int IwrfPacketRing::gather(uint64_t offset, uint64_t endOffset,
+                           struct iovec *iov, int maxIov) const
+{
+
+  int iovCnt = 0;
+  int64_t chunk = _findChunk(offset);
+  while (offset < endOffset && chunk < _headChunk && iovCnt < maxIov) {
+    uint64_t chunkStart = _chunk(chunk).offset;
+    uint64_t chunkEnd = chunkOffset(chunk + 1);
+    if (chunkEnd > endOffset) {
+      chunkEnd = endOffset;
+    }
+    const char *data = _chunk(chunk).data;
+    iov[iovCnt].iov_base = const_cast<char *>(data + (offset - chunkStart));
+    iov[iovCnt].iov_len = chunkEnd - offset;
+    iovCnt++;
+    offset = chunkEnd;
+    chunk++;
+  }
+  return iovCnt;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// monotonic time in seconds
+
+double IwrfPacketRing::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// add a chunk at the head. The caller has made room for it.
+
+int64_t IwrfPacketRing::_push(const char *data, size_t len, int nPackets,
+                              PacketBatcher *batch, size_t heldBytes)
+{
+
+  Chunk &chunk = _chunks[_headChunk % _chunks.size()];
+  chunk.offset = _headOffset;
+  chunk.nPackets = nPackets;
+  chunk.time = now();
+  chunk.data = data;
+  chunk.batch = batch;
+  chunk.heldBytes = heldBytes;
+
+  _heldBytes += heldBytes;
+  _headOffset += len;
+  return _headChunk++;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// drop the chunks before the given one, handing back the batches held by
+// reference
+
+void IwrfPacketRing::_dropTo(int64_t tail)
+{
+  for (; _tailChunk < tail; _tailChunk++) {
+    const Chunk &chunk = _chunk(_tailChunk);
+    _heldBytes -= chunk.heldBytes;
+    if (chunk.batch) {
+      _dropped.push_back(chunk.batch);
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// does a copied chunk occupy any of the given bytes of the copy buffer?
+
+bool IwrfPacketRing::_copyOverlaps(int64_t chunk, size_t start,
+                                   size_t len) const
+{
+  size_t chunkStart = _chunk(chunk).data - &_copyBuf[0];
+  size_t chunkEnd = chunkStart + _chunk(chunk).heldBytes;
+  return chunkStart < start + len && start < chunkEnd;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// the chunk containing an offset, or headChunk() for headOffset()
+
+int64_t IwrfPacketRing::_findChunk(uint64_t offset) const
+{
+  // the last chunk starting at or before the offset
+  int64_t lo = _tailChunk;
+  int64_t hi = _headChunk;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    if (_chunk(mid).offset <= offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return (lo > _tailChunk) ? lo - 1 : _tailChunk;
+}
@@ -0,0 +1,187 @@
+/*
+ * IwrfPacketRing.h
+ *
+ * Ring holding recently serialized IWRF packets, shared by all of the
+ * consumers of the IWRF stream.
+ */
+
+#ifndef IWRFPACKETRING_H_
+#define IWRFPACKETRING_H_
+
+#include "PacketBatcher.h"
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+/// IwrfPacketRing holds the most recent IWRF output, so that each packet is
+/// serialized once no matter how many consumers read it.
+///
+/// Data are appended in chunks, each holding one or more whole packets.
+/// Chunks are numbered in order from zero, and every byte has an absolute
+/// offset: the number of bytes appended before it. A consumer keeps its
+/// own cursor, as an offset and the number of the chunk containing it, and
+/// starts reading at a chunk boundary so that it always sees whole packets.
+///
+/// A chunk may be a PacketBatcher held by reference, with
+/// append(PacketBatcher *), so that the packets the merge serialized into
+/// it are never copied; the batch must not change until the ring drops it
+/// and hands it back through takeDropped(). Or the data may be copied in,
+/// with append(const struct iovec *, ...), to a buffer of the ring's
+/// capacity which allocCopyBuffer() allocates once, and which is then
+/// reused in circular order.
+///
+/// The capacity limits the memory the held chunks tie up, counting the
+/// whole buffer of each batch held by reference. When a new chunk needs
+/// the space, the oldest chunks are dropped. A consumer which has fallen
+/// behind the oldest chunk has been lapped, and must move its cursor to
+/// tailChunk(). Chunks are also dropped from the tail once the chunk index
+/// is full.
+///
+/// IwrfPacketRing is not thread safe. Appends and reads must happen on the
+/// same thread.
+class IwrfPacketRing {
+public:
+    /**
+     * Constructor.
+     * @param capacity the number of bytes of batches the ring holds
+     * @param maxChunks the maximum number of chunks the ring holds
+     */
+    IwrfPacketRing(size_t capacity, size_t maxChunks);
+
+    /// Destructor. Batches held by reference and not yet taken back with
+    /// takeDropped() are left to their owner.
+    ~IwrfPacketRing();
+
+    /**
+     * Append a chunk by reference, dropping the oldest chunks if needed.
+     * The batch is not copied, and must not change until it has been
+     * handed back by takeDropped().
+     * @param batch the packets making up the chunk
+     * @return the chunk number, or -1 if the batch is larger than the
+     * ring, in which case it is not held
+     */
+    int64_t append(PacketBatcher *batch);
+
+    /**
+     * Append a chunk by copying it, dropping the oldest chunks if needed.
+     * allocCopyBuffer() must have been called first.
+     * @param iov the pieces making up the chunk
+     * @param iovCnt the number of pieces
+     * @param nPackets the number of whole packets in the chunk
+     * @return the chunk number, or -1 if the chunk is larger than the ring
+     */
+    int64_t append(const struct iovec *iov, int iovCnt, int nPackets);
+
+    /// Allocate and touch the buffer for chunks appended by copying, so
+    /// that copying never allocates or faults in memory. This ties up the
+    /// whole capacity of the ring.
+    void allocCopyBuffer();
+
+    /// @return a batch appended by reference which the ring has dropped
+    /// since it was last called, or NULL if there are none
+    PacketBatcher *takeDropped();
+
+    /// Drop everything held, and start again from chunk zero and offset
+    /// zero. Batches held by reference are handed back by takeDropped().
+    void clear();
+
+    /// @return the number of bytes of batches the ring holds
+    size_t capacity() const { return _capacity; }
+
+    /// @return the number the next chunk appended will be given
+    int64_t headChunk() const { return _headChunk; }
+
+    /// @return the number of the oldest chunk still held
+    int64_t tailChunk() const { return _tailChunk; }
+
+    /// @return the total number of bytes appended, which is the offset of
+    /// the next chunk
+    uint64_t headOffset() const { return _headOffset; }
+
+    /// @return the offset of the start of the given chunk, or headOffset()
+    /// for headChunk(). The chunk must be between tailChunk() and
+    /// headChunk().
+    uint64_t chunkOffset(int64_t chunk) const;
+
+    /// @return the number of packets in the given chunk, which must be
+    /// held in the ring
+    int chunkPackets(int64_t chunk) const;
+
+    /// @return the monotonic time at which the given chunk was appended,
+    /// in seconds. The chunk must be held in the ring.
+    double chunkTime(int64_t chunk) const;
+
+    /// @return the number of the oldest chunk which would still be held
+    /// after appending a batch whose buffer is of the given size
+    int64_t tailAfterAppend(size_t capacity) const;
+
+    /// @return true iff the ring still holds the given chunk
+    bool holds(int64_t chunk) const {
+        return chunk >= _tailChunk && chunk < _headChunk;
+    }
+
+    /**
+     * Describe the data between two offsets, as a piece for each chunk
+     * they span. The offsets must be within the chunks held.
+     * @param offset the offset of the first byte
+     * @param endOffset the offset after the last byte
+     * @param iov set to point at the pieces
+     * @param maxIov the most pieces to describe. If the data span more
+     *     chunks, only the first maxIov pieces are described.
+     * @return the number of pieces, 0 to maxIov
+     */
+    int gather(uint64_t offset, uint64_t endOffset,
+               struct iovec *iov, int maxIov) const;
+
+    /// @return monotonic time in seconds
+    static double now();
+
+private:
+    struct Chunk {
+        uint64_t offset;
+        int nPackets;
+        double time;
+        /// the chunk's data
+        const char *data;
+        /// the batch held by reference, or NULL if the chunk was copied
+        /// into the copy buffer
+        PacketBatcher *batch;
+        /// memory the chunk ties up, counted against the capacity
+        size_t heldBytes;
+    };
+
+    // not copyable
+    IwrfPacketRing(const IwrfPacketRing &rhs);
+    IwrfPacketRing & operator=(const IwrfPacketRing &rhs);
+
+    const Chunk &_chunk(int64_t chunk) const {
+        return _chunks[chunk % _chunks.size()];
+    }
+
+    int64_t _push(const char *data, size_t len, int nPackets,
+                  PacketBatcher *batch, size_t heldBytes);
+    void _dropTo(int64_t tail);
+    bool _copyOverlaps(int64_t chunk, size_t start, size_t len) const;
+    int64_t _findChunk(uint64_t offset) const;
+
+    size_t _capacity;
+    std::vector<Chunk> _chunks;
+
+    int64_t _headChunk;
+    int64_t _tailChunk;
+    uint64_t _headOffset;
+
+    /// bytes tied up by the chunks held
+    size_t _heldBytes;
+
+    /// batches held by reference which have been dropped
+    std::vector<PacketBatcher *> _dropped;
+
+    /// buffer for chunks appended by copying, and the position at which
+    /// the next copy goes
+    std::vector<char> _copyBuf;
+    size_t _copyPos;
+};
+
+#endif /* IWRFPACKETRING_H_ */
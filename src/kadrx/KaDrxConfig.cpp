@@ -76,6 +76,16 @@ std::set<std::string> KaDrxConfig::_createDoubleLegalKeys() {
     keys.insert("sim_delta_elev");
     keys.insert("sim_az_rate");
     keys.insert("range_to_gate0");
+    keys.insert("merge_window_max_age");
+    keys.insert("iwrf_batch_max_delay");
+    keys.insert("blackbox_seconds");
+    keys.insert("synth_drop_h");
+    keys.insert("synth_drop_v");
+    keys.insert("synth_drop_burst");
+    keys.insert("synth_burst_phase_drift");
+    keys.insert("synth_freq_offset");
+    keys.insert("synth_signal_counts");
+    keys.insert("synth_noise_counts");
     return keys;
 }
 
@@ -89,10 +99,33 @@ std::set<std::string> KaDrxConfig::_createIntLegalKeys() {
     keys.insert("afc_coarse_step");
     keys.insert("afc_fine_step");
     keys.insert("merge_queue_size");
+    keys.insert("merge_window_size");
+    keys.insert("merge_window_max_depth");
+    keys.insert("merge_worker_threads");
+    keys.insert("merge_pipeline_queue_size");
     keys.insert("iwrf_server_tcp_port");
+    keys.insert("iwrf_batch_max_bytes");
+    keys.insert("iwrf_queue_size");
+    keys.insert("iwrf_ring_megabytes");
+    keys.insert("iwrf_max_clients");
+    keys.insert("blackbox_megabytes");
+    keys.insert("archive_file_seconds");
+    keys.insert("archive_file_megabytes");
+    keys.insert("archive_index_pulses");
+    keys.insert("archive_queue_size");
+    keys.insert("archive_write_kb");
     keys.insert("pulse_interval_per_iwrf_meta_data");
     keys.insert("sim_n_elev");
     keys.insert("max_pei_gates");
+    keys.insert("pei_file_seconds");
+    keys.insert("pei_file_megabytes");
+    keys.insert("pei_buffer_kb");
+    keys.insert("pei_sync_seconds");
+    keys.insert("gate_decimation_factor");
+    keys.insert("synth_seq_jump_interval");
+    keys.insert("synth_seq_jump_size");
+    keys.insert("synth_clip_counts");
+    keys.insert("synth_seed");
     return keys;
 }
 
@@ -113,6 +146,9 @@ std::set<std::string> KaDrxConfig::_createBoolLegalKeys() {
     keys.insert("write_pei_files");
     keys.insert("simulate_pmc730");
     keys.insert("simulate_tty_oscillators");
+    keys.insert("zero_copy_beams");
+    keys.insert("merge_pack_thread");
+    keys.insert("lock_memory");
     return keys;
 }
 
@@ -121,6 +157,21 @@ std::set<std::string> KaDrxConfig::_StringLegalKeys(_createStringLegalKeys());
 std::set<std::string> KaDrxConfig::_createStringLegalKeys() {
     std::set<std::string> keys;
     keys.insert("radar_id");
+    keys.insert("iwrf_slow_client_policy");
+    keys.insert("blackbox_dir");
+    keys.insert("archive_dir");
+    keys.insert("thread_policy_h_channel");
+    keys.insert("thread_policy_v_channel");
+    keys.insert("thread_policy_burst_channel");
+    keys.insert("thread_policy_merge");
+    keys.insert("thread_policy_merge_pack");
+    keys.insert("thread_policy_merge_workers");
+    keys.insert("thread_policy_iwrf_writer");
+    keys.insert("thread_policy_blackbox_writer");
+    keys.insert("thread_policy_archive_writer");
+    keys.insert("thread_policy_pei_writer");
+    keys.insert("thread_policy_monitor");
+    keys.insert("thread_policy_osc_control");
     return keys;
 }
 
@@ -134,10 +134,121 @@ public:
     int merge_queue_size() const {
         return _getIntVal("merge_queue_size");
     }
+    /// number of pulses held in the merge reorder window
+    int merge_window_size() const {
+        return _getIntVal("merge_window_size");
+    }
+    /// drop an incomplete H/V/burst triple once data this many pulses
+    /// newer have arrived
+    int merge_window_max_depth() const {
+        return _getIntVal("merge_window_max_depth");
+    }
+    /// drop an incomplete H/V/burst triple once it has held up the merge
+    /// for this long, seconds
+    double merge_window_max_age() const {
+        return _getDoubleVal("merge_window_max_age");
+    }
+    /// number of worker threads which help the merge thread write the H, V
+    /// and burst data of each pulse, 0 for none
+    int merge_worker_threads() const {
+        return _getIntVal("merge_worker_threads");
+    }
+    /// run the stage of the merge which turns H/V/burst triples into IWRF
+    /// packets on its own thread
+    int merge_pack_thread() const {
+        return _getBoolVal("merge_pack_thread");
+    }
+    /// size of the queue between the merge's sync and pack stages, in
+    /// H/V/burst triples
+    int merge_pipeline_queue_size() const {
+        return _getIntVal("merge_pipeline_queue_size");
+    }
+    /// pass replayed IQ data to the merge by reference, without copying
+    int zero_copy_beams() const {
+        return _getBoolVal("zero_copy_beams");
+    }
     /// TCP port for IWRF data server
     int iwrf_server_tcp_port() const {
         return _getIntVal("iwrf_server_tcp_port");
     }
+    /// gather IWRF packets and send them together, holding a packet for
+    /// at most this long, seconds. Packets are sent one at a time if unset
+    /// or zero.
+    double iwrf_batch_max_delay() const {
+        return _getDoubleVal("iwrf_batch_max_delay");
+    }
+    /// send batched IWRF packets once this many bytes have been gathered
+    int iwrf_batch_max_bytes() const {
+        return _getIntVal("iwrf_batch_max_bytes");
+    }
+    /// number of batches of IWRF packets which may be queued for the
+    /// network writer thread
+    int iwrf_queue_size() const {
+        return _getIntVal("iwrf_queue_size");
+    }
+    /// size of the ring holding recent IWRF packets for the server's
+    /// clients, MB
+    int iwrf_ring_megabytes() const {
+        return _getIntVal("iwrf_ring_megabytes");
+    }
+    /// maximum number of IWRF clients connected at once
+    int iwrf_max_clients() const {
+        return _getIntVal("iwrf_max_clients");
+    }
+    /// what to do with an IWRF client which falls a whole ring behind:
+    /// "drop_oldest", "disconnect" or "throttle"
+    std::string iwrf_slow_client_policy() const {
+        return _getStringVal("iwrf_slow_client_policy");
+    }
+    /// seconds of the latest IWRF output kept by the black box and written
+    /// to a file when it is triggered; the black box is disabled if unset
+    /// or zero
+    double blackbox_seconds() const {
+        return _getDoubleVal("blackbox_seconds");
+    }
+    /// size of each of the black box's two rings, MB
+    int blackbox_megabytes() const {
+        return _getIntVal("blackbox_megabytes");
+    }
+    /// directory for black box files
+    std::string blackbox_dir() const {
+        return _getStringVal("blackbox_dir");
+    }
+    /// directory for the continuous IWRF archive; archiving is disabled if
+    /// unset or empty
+    std::string archive_dir() const {
+        return _getStringVal("archive_dir");
+    }
+    /// start a new archive file when the pulse time crosses a multiple of
+    /// this many seconds
+    int archive_file_seconds() const {
+        return _getIntVal("archive_file_seconds");
+    }
+    /// largest archive file, MB
+    int archive_file_megabytes() const {
+        return _getIntVal("archive_file_megabytes");
+    }
+    /// pulses between archive index entries
+    int archive_index_pulses() const {
+        return _getIntVal("archive_index_pulses");
+    }
+    /// length of the queue of batches waiting to be archived
+    int archive_queue_size() const {
+        return _getIntVal("archive_queue_size");
+    }
+    /// size of each archive file write, kB
+    int archive_write_kb() const {
+        return _getIntVal("archive_write_kb");
+    }
+    /// CPU set, scheduling and stack pre-faulting for the named kadrx
+    /// thread (see ThreadPolicy)
+    std::string thread_policy(const std::string & threadName) const {
+        return _getStringVal("thread_policy_" + threadName);
+    }
+    /// lock all of kadrx's memory into RAM with mlockall()
+    int lock_memory() const {
+        return _getBoolVal("lock_memory");
+    }
     /// How often do we send IWRF meta data?
     int pulse_interval_per_iwrf_meta_data() const {
       return _getIntVal("pulse_interval_per_iwrf_meta_data");
@@ -221,6 +332,12 @@ public:
       return _getBoolVal("combine_every_second_gate");
     }
 
+    /// number of gates averaged into each output gate: 1 (none), 2, 3, 4
+    /// or 8. Overrides combine_every_second_gate if set.
+    int gate_decimation_factor() const {
+      return _getIntVal("gate_decimation_factor");
+    }
+
     /// write Pei format time series files?
     int write_pei_files() const {
         return _getBoolVal("write_pei_files");
@@ -230,6 +347,27 @@ public:
     int max_pei_gates() const {
         return _getIntVal("max_pei_gates");
     }
+
+    /// start a new Pei file when the pulse time crosses a multiple of
+    /// this many seconds
+    int pei_file_seconds() const {
+        return _getIntVal("pei_file_seconds");
+    }
+
+    /// largest Pei file, MB
+    int pei_file_megabytes() const {
+        return _getIntVal("pei_file_megabytes");
+    }
+
+    /// size of each of a Pei writer's two buffers, kB
+    int pei_buffer_kb() const {
+        return _getIntVal("pei_buffer_kb");
+    }
+
+    /// seconds between fdatasync() calls on Pei files
+    int pei_sync_seconds() const {
+        return _getIntVal("pei_sync_seconds");
+    }
     
     /// simulation of angles
 
@@ -259,6 +397,53 @@ public:
     	return _getBoolVal("simulate_tty_oscillators");
     }
     
+    /// synthetic pulses for kadrx_replay --synthetic (see KaSyntheticSource)
+
+    /// fraction of pulses dropped from the H channel
+    double synth_drop_h() const {
+        return _getDoubleVal("synth_drop_h");
+    }
+    /// fraction of pulses dropped from the V channel
+    double synth_drop_v() const {
+        return _getDoubleVal("synth_drop_v");
+    }
+    /// fraction of pulses dropped from the burst channel
+    double synth_drop_burst() const {
+        return _getDoubleVal("synth_drop_burst");
+    }
+    /// pulses between jumps in the pulse sequence number
+    int synth_seq_jump_interval() const {
+        return _getIntVal("synth_seq_jump_interval");
+    }
+    /// number of pulses skipped at each sequence number jump
+    int synth_seq_jump_size() const {
+        return _getIntVal("synth_seq_jump_size");
+    }
+    /// change in burst phase from one pulse to the next, deg
+    double synth_burst_phase_drift() const {
+        return _getDoubleVal("synth_burst_phase_drift");
+    }
+    /// offset of the burst from the receiver center frequency, Hz
+    double synth_freq_offset() const {
+        return _getDoubleVal("synth_freq_offset");
+    }
+    /// IQ values are clipped to +/- this many counts
+    int synth_clip_counts() const {
+        return _getIntVal("synth_clip_counts");
+    }
+    /// peak echo amplitude, counts
+    double synth_signal_counts() const {
+        return _getDoubleVal("synth_signal_counts");
+    }
+    /// noise standard deviation, counts
+    double synth_noise_counts() const {
+        return _getDoubleVal("synth_noise_counts");
+    }
+    /// random number seed
+    int synth_seed() const {
+        return _getIntVal("synth_seed");
+    }
+
     // Are we allowing sector blanking via XML-RPC calls?
     int allow_blanking() const {
         return _getBoolVal("allow_blanking");
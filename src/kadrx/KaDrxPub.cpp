@@ -32,6 +32,8 @@ KaDrxPub::KaDrxPub(
      _sd3c(sd3c),
      _chanId(chanId),
      _config(config),
+     _threadPolicy(config, chanId == KA_H_CHANNEL ? "h_channel" :
+                   chanId == KA_V_CHANNEL ? "v_channel" : "burst_channel"),
      _down(0),
      _nGates(config.gates()),
      _merge(merge),
@@ -47,8 +49,7 @@ KaDrxPub::KaDrxPub(
      _g0QvalNorm(-9999.0),
      _g0FreqHz(-9999.0),
      _g0FreqCorrHz(-9999.0),
-     _doPeiFile(config.write_pei_files()),
-     _peiFile(0),
+     _peiWriter(0),
      _maxPeiGates(config.max_pei_gates())
 {
     // scaling between A2D counts and volts
@@ -77,6 +78,12 @@ KaDrxPub::KaDrxPub(
             " gates" << std::endl;
     }
 
+    // Pei format time series files, written by their own thread
+    if (_config.write_pei_files() == 1) {
+        int peiGates = (_nGates < _maxPeiGates) ? _nGates : _maxPeiGates;
+        _peiWriter = new PeiWriter(_config, _chanId, peiGates);
+    }
+
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -90,6 +97,9 @@ KaDrxPub::~KaDrxPub() {
     delete _burstData;
   }
 
+  // write out any Pei data still held
+  delete _peiWriter;
+
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -103,6 +113,8 @@ void KaDrxPub::run() {
   // Since we have no event loop, allow thread termination via the terminate()
   // method.
   setTerminationEnabled(true);
+
+  _threadPolicy.applyToCurrentThread();
   
   // start the loop. The thread will block on getBeam()
   while (true) {
@@ -119,55 +131,16 @@ void KaDrxPub::run() {
       _handleBurst(reinterpret_cast<const int16_t *>(buf), pulseSeqNum);
     }
 
-    //
-    // If requested, write IQ data to a simple "Pei format" time series file.
-    // Pei format is written as a series of pulses, where each pulse is
-    // in the form:
-    // 
-    // time|PRF|pulse_width|n_gates|I(0)|Q(0)|I(1)|Q(1)|...|I(n_gates-1)|Q(n_gates-1)
-    //
-    // time - pulse time in seconds since 1970-01-01 00:00:00 UTC, 8-byte IEEE float
-    // PRF - PRF in Hz, 4-byte IEEE float
-    // pulse_width - receiver pulse width in seconds, 4-byte IEEE float
-    // n_gates - gate count, 4-byte int
-    // I(n) - inphase counts for gate n, 2-byte int
-    // Q(n) - quadrature counts for gate n, 2-byte int
-    //
-    // All values are written little-endian
-    //
-    if (_doPeiFile) {
-        if (! _peiFile) {
-            char filename[256];
-            ptime pulsePtime = _sd3c.timeOfPulse(pulseSeqNum);
-            boost::gregorian::date pulseDate = pulsePtime.date();
-            time_duration pulseTime = pulsePtime.time_of_day();
-            sprintf(filename, "chan%d_%4d%02d%02d_%02d%02d%02d_pei", _chanId,
-                int(pulseDate.year()), int(pulseDate.month()), int(pulseDate.day()),
-                pulseTime.hours(), pulseTime.minutes(), pulseTime.seconds());
-            if ((_peiFile = fopen(filename, "a+")) < 0) {
-                ELOG << "Error opening Pei file '" << filename;
-                abort();
-            }
-        }
-
-        int16_t *iqData = (int16_t*)buf;
+    // If requested, queue the IQ data for the Pei format time series file.
+    // The writer thread does the file I/O, so the disk never holds us up.
+    if (_peiWriter) {
         time_duration timeFromEpoch = _sd3c.timeOfPulse(pulseSeqNum) - Epoch1970;
-    
         double timeSecs = timeFromEpoch.total_seconds() + 
             double(timeFromEpoch.fractional_seconds()) / time_duration::ticks_per_second();
-        fwrite((char*)&timeSecs, sizeof(double), 1, _peiFile);
-    
-        float prf = 1.0 / _sd3c.prt();
-        fwrite((char*)&prf, sizeof(float), 1, _peiFile);
-        
-        float pulseWidth = _down->rcvrPulseWidth();
-        fwrite((char*)&pulseWidth, sizeof(float), 1, _peiFile);
-        
         int peiGates = (_nGates < _maxPeiGates) ? _nGates : _maxPeiGates;
-        fwrite((char*)&peiGates, sizeof(int), 1, _peiFile);
-        
-        // Write I and Q (4 bytes total per gate) for all gates
-        fwrite((char*)iqData, 4, peiGates, _peiFile);
+        _peiWriter->addPulse(timeSecs, 1.0 / _sd3c.prt(),
+                             _down->rcvrPulseWidth(), peiGates,
+                             reinterpret_cast<const int16_t *>(buf));
     }
 
     _addToMerge(reinterpret_cast<const int16_t *>(buf), pulseSeqNum);
@@ -248,25 +221,21 @@ KaDrxPub::_handleBurst(const int16_t * iqData, int64_t pulseSeqNum) {
     // initialize variables
     const double DIS_WT = 0.01;
 
-    // Separate I and Q data
-    double i[_nGates];
-    double q[_nGates];
+    // I and Q of sample g, read in place from the interleaved data
+    const int16_t *i = iqData;
+    const int16_t *q = iqData + 1;
     double num = 0;
     double den = 0;
-    for (unsigned int g = 0; g < _nGates; g++) {
-        i[g] = iqData[2 * g];
-        q[g] = iqData[2 * g + 1];
-    }
 
     // Frequency discriminator -- runs every hit
     // Compute cross product over middle 16 samples (frequency discriminator) 
     // using moving coherent average to reduce variance
     // i contains inphase samples; q contains quadrature samples
     for (unsigned int g = 2; g <= 17; g++) {
-        double a = i[g] + i[g + 1];
-        double b = q[g] + q[g + 1];
-        double c = i[g + 2] + i[g + 1];
-        double d = q[g + 2] + q[g + 1];
+        double a = i[2 * g] + i[2 * (g + 1)];
+        double b = q[2 * g] + q[2 * (g + 1)];
+        double c = i[2 * (g + 2)] + i[2 * (g + 1)];
+        double d = q[2 * (g + 2)] + q[2 * (g + 1)];
 
         num += a * d - b * c; // cross product
         den += a * c + b * d; // normalization factor proportional to G0 magnitude
@@ -283,8 +252,8 @@ KaDrxPub::_handleBurst(const int16_t * iqData, int64_t pulseSeqNum) {
     double normCrossProduct = _numerator / _denominator;  // normalized cross product proportional to frequency change
     double freqCorrection = 8.0e6 * normCrossProduct; // experimentally determined scale factor to convert correction to Hz
 
-    double ival = i[9] / _iqScaleForMw;
-    double qval = q[9] / _iqScaleForMw;
+    double ival = i[2 * 9] / _iqScaleForMw;
+    double qval = q[2 * 9] / _iqScaleForMw;
     double g0Power = ival * ival + qval * qval; // mW
     double g0PowerDbm = 10 * log10(g0Power);
     if (! (pulseSeqNum % 5000)) {
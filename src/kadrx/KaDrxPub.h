@@ -2,9 +2,10 @@
 #define KADRXPUB_H_
 
 #include "KaDrxConfig.h"
+#include "PeiWriter.h"
+#include "ThreadPolicy.h"
 #include "p7142sd3c.h"
 
-#include <cstdio>
 #include <QThread>
 
 class KaMerge;
@@ -78,6 +79,10 @@ class KaDrxPub : public QThread {
 		/// @return a pointer to our downconverter object
 		Pentek::p7142sd3cDn* downconverter() { return _down; }
 
+		/// @return our Pei file writer, or NULL if Pei files are not
+		/// being written
+		const PeiWriter* peiWriter() const { return _peiWriter; }
+
 	private:
         static constexpr double _RAD_TO_DEG = 57.29577951308092;
         static constexpr double _DEG_TO_RAD = 0.017453292519943295;
@@ -102,6 +107,9 @@ class KaDrxPub : public QThread {
         /// configuration
         const KaDrxConfig& _config;
 
+        /// CPU set and scheduling for this thread
+        ThreadPolicy _threadPolicy;
+
         /// Our associated Pentek downconverter
         Pentek::p7142sd3cDn* _down;
 
@@ -143,11 +151,9 @@ class KaDrxPub : public QThread {
 
         double _argDeg(double ival, double qval);
 
-        // Are we generating a Pei file of time series data?
-        bool _doPeiFile;
-
-        // Our Pei file
-        FILE* _peiFile;
+        // Our Pei file writer, if we are generating Pei files of time
+        // series data
+        PeiWriter* _peiWriter;
         
         // Maximum number of gates to write to the Pei file
         unsigned int _maxPeiGates;
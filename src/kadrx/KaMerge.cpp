@@ -1,9 +1,12 @@
 #include "KaMerge.h"
+#include "IqKernels.h"
 #include <logx/Logging.h>
 #include <sys/timeb.h>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <unistd.h>
+#include <pthread.h>
 #include <iostream>
 #include <iomanip>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -16,6 +19,10 @@ using namespace std;
 
 LOGGING("KaMerge")
 
+// Maximum time to sleep waiting for data on one of the input rings
+static const int ReadWaitUsecs = 100000;
+
+
 /////////////////////////////////////////////////////////////////////////////
 // 1970-01-01 00:00:00 UTC
 static const ptime Epoch1970(boost::gregorian::date(1970, 1, 1),
@@ -26,32 +33,81 @@ static const ptime Epoch1970(boost::gregorian::date(1970, 1, 1),
 KaMerge::KaMerge(const KaDrxConfig& config, const KaMonitor& kaMonitor) :
         QThread(),
         _config(config),
-        _kaMonitor(kaMonitor)
+        _kaMonitor(kaMonitor),
+        _threadPolicy(config, "merge"),
+        _packThreadPolicy(config, "merge_pack")
 {
 
   // initialize
 
   _queueSize = _config.merge_queue_size();
-  _iwrfServerTcpPort = _config.iwrf_server_tcp_port();
+
+  // reorder window and pipeline sizes
+
+  int windowSize = 512;
+  int windowMaxDepth = 256;
+  double windowMaxAge = 0.05;
+  if (_config.merge_window_size() != KaDrxConfig::UNSET_INT) {
+    windowSize = _config.merge_window_size();
+  }
+  if (_config.merge_window_max_depth() != KaDrxConfig::UNSET_INT) {
+    windowMaxDepth = _config.merge_window_max_depth();
+  }
+  if (_config.merge_window_max_age() != KaDrxConfig::UNSET_DOUBLE) {
+    windowMaxAge = _config.merge_window_max_age();
+  }
+
+  int pipelineQueueSize = 0;
+  if (_config.merge_pack_thread() == 1) {
+    pipelineQueueSize = 256;
+    if (_config.merge_pipeline_queue_size() != KaDrxConfig::UNSET_INT) {
+      pipelineQueueSize = _config.merge_pipeline_queue_size();
+    }
+    if (pipelineQueueSize < 1) {
+      pipelineQueueSize = 1;
+    }
+  }
+
+  // Pool for all of the pulse and burst objects held in the queues, the
+  // window, the pipeline and as spares, with room for the configured
+  // number of gates. The burst sample count is set by the downconverter,
+  // so allow a margin over the nominal count.
+
+  int nMerged = pipelineQueueSize + 2;
+  int nPerChannel = _queueSize + windowSize + 1 + nMerged;
+  int nBurstSamples = (int) ceil(_config.burst_sample_width() *
+                                 _config.burst_sample_frequency()) + 16;
+  _pool = new PulsePool(2 * nPerChannel, _config.gates(),
+                        nPerChannel, nBurstSamples, nMerged);
+  ILOG << "Pulse pool: " << _pool->describe();
 
   // queues
 
-  _qH = new CircBuffer<PulseData>(_queueSize);
-  _qV = new CircBuffer<PulseData>(_queueSize);
-  _qB = new CircBuffer<BurstData>(_queueSize);
+  _qH = new SpscRing<PulseData>(_queueSize, *_pool);
+  _qV = new SpscRing<PulseData>(_queueSize, *_pool);
+  _qB = new SpscRing<BurstData>(_queueSize, *_pool);
+
+  // reorder window
 
-  // pulse and burst data for reading from queues
+  _window = new MergeWindow(windowSize, windowMaxDepth, windowMaxAge,
+                            _pool);
 
-  _pulseH = new PulseData;
-  _pulseV = new PulseData;
-  _burst = new BurstData;
+  // triples for the sync and pack stages
+
+  _pool->create(_syncPulse);
+  _syncSeqNum = -1;
+  _pool->create(_packPulse);
+  _pulseH = _packPulse->pulseH;
+  _pulseV = _packPulse->pulseV;
+  _burst = _packPulse->burst;
+
+  _pool->create(_spareH);
+  _pool->create(_spareV);
+  _pool->create(_spareB);
 
   // iq data
 
   _nGates = 0;
-  _pulseBuf = NULL;
-  _iq = NULL;
-  _nGatesAlloc = 0;
   _pulseIntervalPerIwrfMetaData =
     config.pulse_interval_per_iwrf_meta_data();
   _pulseBufLen = 0;
@@ -59,9 +115,6 @@ KaMerge::KaMerge(const KaDrxConfig& config, const KaMonitor& kaMonitor) :
   // burst data
 
   _nSamplesBurst = 0;
-  _nSamplesBurstAlloc = 0;
-  _burstIq = NULL;
-  _burstBuf = NULL;
   _burstBufLen = 0;
 
   // status xml
@@ -70,12 +123,69 @@ KaMerge::KaMerge(const KaDrxConfig& config, const KaMonitor& kaMonitor) :
   _statusLen = 0;
   _statusBufLen = 0;
 
+  // Output batching. If a maximum batch delay is set, consecutive
+  // packets are gathered and handed to the network writer together.
+  // Otherwise each packet is handed over as soon as it is assembled.
+
+  _batchMaxBytes = 0;
+  _batchMaxDelay = 0.0;
+  if (_config.iwrf_batch_max_delay() != KaDrxConfig::UNSET_DOUBLE &&
+      _config.iwrf_batch_max_delay() > 0.0) {
+    _batchMaxDelay = _config.iwrf_batch_max_delay();
+    _batchMaxBytes = 65536;
+    if (_config.iwrf_batch_max_bytes() != KaDrxConfig::UNSET_INT) {
+      _batchMaxBytes = _config.iwrf_batch_max_bytes();
+    }
+  }
+  _batch = new PacketBatcher;
+
+  // optional workers, which write the H, V and burst data of each pulse
+  // concurrently
+
+  int nWorkers = 0;
+  if (_config.merge_worker_threads() != KaDrxConfig::UNSET_INT &&
+      _config.merge_worker_threads() > 0) {
+    nWorkers = _config.merge_worker_threads();
+  }
+  _workers = new ForkJoinPool(nWorkers,
+                              ThreadPolicy(_config, "merge_workers"));
+  _packetJob = new PacketJob(*this);
+  _burstPacket = NULL;
+  _pulsePacket = NULL;
+  _nPulsesWritten = 0;
+  _pulseWriteNsecs = 0;
+  if (nWorkers > 0) {
+    ILOG << "Using " << nWorkers << " merge worker threads";
+  }
+
   // I and Q count scaling factor to get power in mW easily:
   // mW = (I_count / _iqScaleForMw)^2 + (Q_count / _iqScaleForMw)^2
   _iqScaleForMw = _config.iqcount_scale_for_mw();
 
   _cohereIqToBurst = _config.cohere_iq_to_burst();
-  _combineEverySecondGate = _config.combine_every_second_gate();
+  if (_cohereIqToBurst) {
+    ILOG << "Cohering IQ to burst phase with the " <<
+        IqKernels::isaName(IqKernels::bestIsa()) << " kernel";
+  }
+
+  // range decimation. gate_decimation_factor, if set, overrides the older
+  // combine_every_second_gate, which is a factor of 2.
+
+  _gateDecimation = _config.combine_every_second_gate() ? 2 : 1;
+  if (_config.gate_decimation_factor() != KaDrxConfig::UNSET_INT) {
+    int factor = _config.gate_decimation_factor();
+    if (factor == 1 || factor == 2 || factor == 3 ||
+        factor == 4 || factor == 8) {
+      _gateDecimation = factor;
+    } else {
+      ELOG << "Bad gate_decimation_factor " << factor <<
+          ", must be 1, 2, 3, 4 or 8. Using " << _gateDecimation;
+    }
+  }
+  if (_gateDecimation > 1) {
+    ILOG << "Decimating gates by " << _gateDecimation << " with the " <<
+        IqKernels::isaName(IqKernels::bestIsa()) << " kernel";
+  }
 
   // pulse seq num and times
 
@@ -126,9 +236,12 @@ KaMerge::KaMerge(const KaDrxConfig& config, const KaMonitor& kaMonitor) :
   _tsProc.pulse_width_us = _config.tx_pulse_width() * 1.0e6;
   _tsProc.gate_spacing_m = _config.rcvr_pulse_width() * 1.5e8;
   _tsProc.start_range_m = _config.range_to_gate0(); // center of gate 0
-  if (_combineEverySecondGate) {
-    _tsProc.start_range_m += _tsProc.gate_spacing_m / 2.0;
-    _tsProc.gate_spacing_m *= 2.0;
+  if (_gateDecimation > 1) {
+    // each new gate spans factor old gates, and is centered on the
+    // middle of them
+    _tsProc.start_range_m +=
+      _tsProc.gate_spacing_m * (_gateDecimation - 1) / 2.0;
+    _tsProc.gate_spacing_m *= _gateDecimation;
   }
   _tsProc.pol_mode = IWRF_POL_MODE_HV_SIM;
 
@@ -210,10 +323,21 @@ KaMerge::KaMerge(const KaDrxConfig& config, const KaMonitor& kaMonitor) :
   _simVolNum = 0;
   _simSweepNum = 0;
 
-  // server
+  // network writer thread, which sends our packets to the clients
+
+  _netWriter = new KaNetWriter(_config);
 
-  _serverIsOpen = false;
-  _sock = NULL;
+  // optional pack stage thread, and the queue which feeds it
+
+  _pulseQueue = NULL;
+  _packThread = NULL;
+  _lastStatusTime = 0;
+  if (pipelineQueueSize > 0) {
+    _pulseQueue = new SpscRing<MergedPulse>(pipelineQueueSize, *_pool);
+    _packThread = new PackThread(*this);
+    ILOG << "Packing pulses on a separate thread, queue " <<
+        pipelineQueueSize << " pulses";
+  }
 
 }
 
@@ -221,26 +345,41 @@ KaMerge::KaMerge(const KaDrxConfig& config, const KaMonitor& kaMonitor) :
 KaMerge::~KaMerge()
 
 {
-  // First stop the thread if it's running
+  // First stop the threads if they're running
   terminate();
+  if (_packThread) {
+    _packThread->terminate();
+    if (! _packThread->wait(5000)) {
+      ELOG << "KaMerge pack thread failed to stop in 5 seconds.";
+    }
+    delete _packThread;
+  }
   
-  _closeSocketToClient();
+  delete _netWriter;
+
+  delete _pulseQueue;
 
   delete _qH;
   delete _qV;
   delete _qB;
 
-  delete _pulseH;
-  delete _pulseV;
-  delete _burst;
+  delete _window;
 
-  if (_pulseBuf) {
-    delete[] _pulseBuf;
-  }
+  delete _batch;
 
-  if (_burstBuf) {
-    delete[] _burstBuf;
-  }
+  delete _workers;
+  delete _packetJob;
+
+  delete _syncPulse;
+  delete _packPulse;
+
+  delete _spareH;
+  delete _spareV;
+  delete _spareB;
+
+  // last, since it holds the memory of the objects above
+
+  delete _pool;
 
 }
 
@@ -251,104 +390,149 @@ KaMerge::~KaMerge()
 void KaMerge::run()
 
 {
-  // Time of the last status packet we generated
-  time_t lastStatusTime = 0;
-  
-  // Interval between generating status packets, in seconds
-  const int StatusInterval = 2;
-  
+
   // Since we have no event loop,
   // allow thread termination via the terminate() method.
 
   setTerminationEnabled(true);
+
+  _threadPolicy.applyToCurrentThread();
   
+  // start the network writer, which does all of the socket I/O so that
+  // this thread never waits for a client, and the pack stage thread if
+  // there is one
+
+  _netWriter->start();
+  if (_packThread) {
+    _packThread->start();
+  }
+
   // start the loop
 
+  _syncTimer.busy();
+
   while (true) {
 
-    // read in next pulse
+    // sync the next H/V/burst triple
 
-    _readNextPulse();
+    _syncNextPulse(*_syncPulse);
 
-    // determine number of gates
+    if (_pulseQueue) {
+
+      // hand it to the pack stage. If the queue is full, the triple is
+      // dropped and counted as an overrun, and we reuse it.
+
+      MergedPulse *next = _pulseQueue->write(_syncPulse);
+      if (next == _syncPulse) {
+        _syncPulse->releaseIq();
+      } else {
+        _syncPulse = next;
+      }
+
+    } else {
+
+      // pack it here, timing the work as the pack stage
+
+      _syncTimer.stop();
+      _packTimer.busy();
+      _packNextPulse(*_syncPulse);
+      _packTimer.stop();
+      _syncTimer.busy();
 
-    int nGates = _pulseH->getNGates();
-    if (nGates < _pulseV->getNGates()) {
-      nGates = _pulseV->getNGates();
-    }
-    
-    // should we send meta-data?
-    
-    bool sendMeta = false;
-    if (nGates != _nGates) {
-      sendMeta = true;
-      _nGates = nGates;
-    }
-    if (_pulseSeqNum % _pulseIntervalPerIwrfMetaData == 0) {
-      sendMeta = true;
-    }
-    
-    if (sendMeta) {
-      _sendIwrfMetaData();
     }
     
-    // cohere the IQ data to the burst phase
-    
-    if (_cohereIqToBurst) {
-      _cohereIqToBurstPhase();
+  } // while
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// pack stage thread loop, used if the pack stage has its own thread
+
+void KaMerge::_packLoop()
+
+{
+
+  _packThreadPolicy.applyToCurrentThread();
+
+  _packTimer.busy();
+
+  while (true) {
+
+    // wait for the next triple, but don't hold batched packets past
+    // their delay limit
+
+    int waitUsecs = ReadWaitUsecs;
+    if (_batch->nPackets() > 0) {
+      int batchUsecs = (int) (_batch->timeRemaining(_batchMaxDelay) * 1.0e6);
+      if (batchUsecs < waitUsecs) {
+        waitUsecs = batchUsecs;
+      }
     }
-    
-    // assemble the IWRF burst packet
-    
-    _assembleIwrfBurstPacket();
-    
-    // send out the IWRF burst packet
-    
-    _sendIwrfBurstPacket();
-    
-    // assemble the IWRF pulse packet
-    
-    _assembleIwrfPulsePacket();
-    
-    // send out the IWRF pulse packet
-    
-    _sendIwrfPulsePacket();
-    
-    // If it's been long enough since our last status packet, generate a new
-    // one now. We add an IWRF transmit power packet as well.
-    time_t now = time(0);
-    if ((now - lastStatusTime) >= StatusInterval) {
-        _assembleStatusPacket();
-        _sendIwrfStatusXmlPacket();
-        lastStatusTime = now;
-        
-        // IWRF transmit power packet
-        _assembleIwrfXmitPowerPacket();
-        _sendIwrfXmitPowerPacket();
+
+    _packTimer.idle();
+    MergedPulse *pulse = _pulseQueue->readWait(_packPulse, waitUsecs);
+    _packTimer.busy();
+
+    if (pulse) {
+      _packPulse = pulse;
+      _packNextPulse(*_packPulse);
     }
-    
+    _flushBatchIfDue();
+
+    // allow terminate() to take effect while no data is arriving
+    pthread_testcancel();
+
   } // while
 
 }
 
 /////////////////////////////////////////////////////////////////////////////
-// read the next set of pulse data
+// sync stage: read the next complete H/V/burst triple
 
-void KaMerge::_readNextPulse()
+void KaMerge::_syncNextPulse(MergedPulse &pulse)
 {
 
   PMU_auto_register("reading pulses");
 
-  // read next pulse data for each channel
+  // move data from the queues into the merge window until the triple
+  // at the head of the window is complete, dropping incomplete triples
+  // as they exceed the window's age or depth limits
 
-  _readNextH();
-  _readNextV();
-  _readNextB();
+  while (!_window->popComplete(pulse.pulseH, pulse.pulseV, pulse.burst)) {
+    if (_drainQueues() == 0) {
+      _waitForHeadOfWindow();
+    }
+    _window->expire();
+    if (!_pulseQueue) {
+      // the pack stage is inline, so its batch is ours to flush
+      _flushBatchIfDue();
+    }
+  }
 
-  // synchronize the pulses and burst to have same sequence number,
-  // reading extra puses as required
-  
-  _syncPulsesAndBurst();
+  int64_t seqNum = pulse.pulseH->getPulseSeqNum();
+  if (_syncSeqNum >= 0 && seqNum != _syncSeqNum + 1) {
+    int nMissing = seqNum - _syncSeqNum - 1;
+    cerr << "Missing pulses - nmiss, prevNum, thisNum: "
+         << nMissing << ", "
+         << _syncSeqNum << ", "
+         << seqNum << endl;
+  }
+  _syncSeqNum = seqNum;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// pack stage: turn a triple into IWRF packets and batch them for the
+// network writer
+
+void KaMerge::_packNextPulse(MergedPulse &pulse)
+{
+
+  _pulseH = pulse.pulseH;
+  _pulseV = pulse.pulseV;
+  _burst = pulse.burst;
+
+  // pulse sequence number and times
 
   if (_pulseSeqNum < 0) {
     // first time
@@ -370,82 +554,57 @@ void KaMerge::_readNextPulse()
          << _pulseSeqNum << ", " << _timeSecs << ", " << _nanoSecs;
   }
 
-  if (_pulseSeqNum != _prevPulseSeqNum + 1) {
-    int nMissing = _pulseSeqNum - _prevPulseSeqNum - 1;
-    cerr << "Missing pulses - nmiss, prevNum, thisNum: "
-         << nMissing << ", "
-         << _prevPulseSeqNum << ", "
-         << _pulseSeqNum << endl;
-  }
+  // determine number of gates, after decimation
 
-  if (_combineEverySecondGate) {
-    _pulseH->combineEverySecondGate();
-    _pulseV->combineEverySecondGate();
+  int nGates = _pulseH->getNGates();
+  if (nGates < _pulseV->getNGates()) {
+    nGates = _pulseV->getNGates();
   }
-
-}
-
-/////////////////////////////////////////////////////////////////////////////
-// synchronize the pulses and burst to have same sequence number,
-// reading extra puses as required
-
-void KaMerge::_syncPulsesAndBurst()
-{
-
-  // compute the max pulse seq num
-  
-  int64_t seqNumH = _pulseH->getPulseSeqNum();
-  int64_t seqNumV = _pulseV->getPulseSeqNum();
-  int64_t seqNumB = _burst->getPulseSeqNum();
-  int64_t maxSeqNum = seqNumH;
-  if (maxSeqNum < seqNumV) {
-    maxSeqNum = seqNumV;
+  nGates /= _gateDecimation;
+    
+  // should we send meta-data?
+    
+  bool sendMeta = false;
+  if (nGates != _nGates) {
+    sendMeta = true;
+    _nGates = nGates;
   }
-  if (maxSeqNum < seqNumB) {
-    maxSeqNum = seqNumB;
+  if (_pulseSeqNum % _pulseIntervalPerIwrfMetaData == 0) {
+    sendMeta = true;
   }
+    
+  if (sendMeta) {
+    _sendIwrfMetaData();
+  }
+    
+  // assemble the IWRF burst and pulse packets
+    
+  _assembleIwrfBurstPacket();
+  _assembleIwrfPulsePacket();
+    
+  // send them out, decimating and cohering the IQ data on the way
+    
+  _sendIwrfBurstAndPulsePackets();
+    
+  // the pulse has been serialized, so hand any beam memory lent by
+  // the data source back for reuse
 
-  // read until all sequence numbers match
-
-  bool done = false;
-  while (!done) {
-
-    done = true;
-
-    // H channel
-
-    if (seqNumH < maxSeqNum) {
-      _readNextH();
-      seqNumH = _pulseH->getPulseSeqNum();
-      if (maxSeqNum < seqNumH) {
-        maxSeqNum = seqNumH;
-        done = false;
-      }
-    }
-
-    // V channel
-
-    if (seqNumV < maxSeqNum) {
-      _readNextV();
-      seqNumV = _pulseV->getPulseSeqNum();
-      if (maxSeqNum < seqNumV) {
-        maxSeqNum = seqNumV;
-        done = false;
-      }
-    }
-
-    // burst channel
+  pulse.releaseIq();
 
-    if (seqNumB < maxSeqNum) {
-      _readNextB();
-      seqNumB = _burst->getPulseSeqNum();
-      if (maxSeqNum < seqNumB) {
-        maxSeqNum = seqNumB;
-        done = false;
-      }
-    }
+  // If it's been long enough since our last status packet, generate a new
+  // one now. We add an IWRF transmit power packet as well.
 
-  } // while
+  const int StatusInterval = 2;
+  time_t now = time(0);
+  if ((now - _lastStatusTime) >= StatusInterval) {
+    _assembleStatusPacket();
+    _sendIwrfStatusXmlPacket();
+    _lastStatusTime = now;
+        
+    // IWRF transmit power packet
+    _assembleIwrfXmitPowerPacket();
+    _sendIwrfXmitPowerPacket();
+  }
 
 }
 
@@ -483,53 +642,99 @@ BurstData *KaMerge::writeBurst(BurstData *val)
 }
 
 /////////////////////////////////////////////////////////////////////////////
-// read the next H data
+// move data from the queues into the merge window, a pulse from each
+// channel in turn, so that the channels stay in step in the window and no
+// more is moved than the window has room for
+// returns the number of items moved
 
-void KaMerge::_readNextH()
+int KaMerge::_drainQueues()
 {
-  
-  PulseData *tmp = NULL;
-  while (tmp == NULL) {
-    tmp = _qH->read(_pulseH);
-    if (tmp == NULL) {
-      usleep(50);
+
+  int nMoved = 0;
+
+  int nRounds = _window->room();
+  if (nRounds < 1) {
+    nRounds = 1;
+  }
+
+  for (int ii = 0; ii < nRounds; ii++) {
+    int nMovedThisRound = 0;
+    PulseData *pulse;
+    if ((pulse = _qH->read(_spareH)) != NULL) {
+      _spareH = _window->depositH(pulse);
+      nMovedThisRound++;
     }
+    if ((pulse = _qV->read(_spareV)) != NULL) {
+      _spareV = _window->depositV(pulse);
+      nMovedThisRound++;
+    }
+    BurstData *burst;
+    if ((burst = _qB->read(_spareB)) != NULL) {
+      _spareB = _window->depositB(burst);
+      nMovedThisRound++;
+    }
+    if (nMovedThisRound == 0) {
+      break;
+    }
+    nMoved += nMovedThisRound;
   }
-  _pulseH = tmp;
+
+  return nMoved;
 
 }
 
 /////////////////////////////////////////////////////////////////////////////
-// read the next V data
+// sleep on the queue for the channel missing from the head of the merge
+// window, until data arrive or the head reaches its age limit
 
-void KaMerge::_readNextV()
+void KaMerge::_waitForHeadOfWindow()
 {
 
-  PulseData *tmp = NULL;
-  while (tmp == NULL) {
-    tmp = _qV->read(_pulseV);
-    if (tmp == NULL) {
-      usleep(50);
-    }
+  int waitUsecs = (int) (_window->headTimeRemaining() * 1.0e6);
+  if (waitUsecs > ReadWaitUsecs) {
+    waitUsecs = ReadWaitUsecs;
   }
-  _pulseV = tmp;
 
-}
+  // if the pack stage is inline, don't hold batched packets past their
+  // delay limit
 
-/////////////////////////////////////////////////////////////////////////////
-// read the next burst data
+  if (!_pulseQueue && _batch->nPackets() > 0) {
+    int batchUsecs = (int) (_batch->timeRemaining(_batchMaxDelay) * 1.0e6);
+    if (batchUsecs < waitUsecs) {
+      waitUsecs = batchUsecs;
+    }
+  }
 
-void KaMerge::_readNextB()
-{
+  _syncTimer.idle();
 
-  BurstData *tmp = NULL;
-  while (tmp == NULL) {
-    tmp = _qB->read(_burst);
-    if (tmp == NULL) {
-      usleep(50);
+  switch (_window->headMissing()) {
+    case MergeWindow::V_CHANNEL: {
+      PulseData *pulse = _qV->readWait(_spareV, waitUsecs);
+      if (pulse) {
+        _spareV = _window->depositV(pulse);
+      }
+      break;
+    }
+    case MergeWindow::BURST_CHANNEL: {
+      BurstData *burst = _qB->readWait(_spareB, waitUsecs);
+      if (burst) {
+        _spareB = _window->depositB(burst);
+      }
+      break;
+    }
+    default: {
+      PulseData *pulse = _qH->readWait(_spareH, waitUsecs);
+      if (pulse) {
+        _spareH = _window->depositH(pulse);
+      }
+      break;
     }
   }
-  _burst = tmp;
+
+  _syncTimer.busy();
+
+  // allow terminate() to take effect while no data is arriving
+  pthread_testcancel();
 
 }
 
@@ -553,86 +758,11 @@ void KaMerge::_sendIwrfMetaData()
   _calib.packet.time_secs_utc = _timeSecs;
   _calib.packet.time_nano_secs = _nanoSecs;
 
-  // check that socket to client is open
-
-  if (_openSocketToClient()) {
-    return;
-  }
-
   // write individual messages for each struct
 
-  if (_sock && _sock->writeBuffer(&_radarInfo, sizeof(_radarInfo))) {
-    cerr << "ERROR - KaMerge::_sendIwrfMetaData()" << endl;
-    cerr << "  Writing IWRF_RADAR_INFO" << endl;
-    cerr << "  " << _sock->getErrStr() << endl;
-    _closeSocketToClient();
-    return;
-  }
-  
-  if (_sock && _sock->writeBuffer(&_tsProc, sizeof(_tsProc))) {
-    cerr << "ERROR - KaMerge::_sendIwrfMetaData()" << endl;
-    cerr << "  Writing IWRF_TS_PROCESSING" << endl;
-    cerr << "  " << _sock->getErrStr() << endl;
-    _closeSocketToClient();
-    return;
-  }
-  
-  if (_sock && _sock->writeBuffer(&_calib, sizeof(_calib))) {
-    cerr << "ERROR - KaMerge::_sendIwrfMetaData()" << endl;
-    cerr << "  Writing IWRF_CALIBRATION" << endl;
-    cerr << "  " << _sock->getErrStr() << endl;
-    _closeSocketToClient();
-    return;
-  }
-
-}
-
-/////////////////////////////////////////////////////////////////////////////
-// cohere the IQ data to the burst phase
-
-void KaMerge::_cohereIqToBurstPhase()
-{
-
-  _cohereIqToBurstPhase(*_pulseH, *_burst);
-  _cohereIqToBurstPhase(*_pulseV, *_burst);
-
-}
-
-void KaMerge::_cohereIqToBurstPhase(PulseData &pulse,
-                                    const BurstData &burst)
-{
-
-  double g0IvalNorm = burst.getG0IvalNorm();
-  double g0QvalNorm = burst.getG0QvalNorm();
-
-  int nGates = pulse.getNGates();
-  int16_t *II = pulse.getIq();
-  int16_t *QQ = pulse.getIq() + 1;
-  
-  for (int igate = 0; igate < nGates; igate++, II += 2, QQ += 2) {
-    
-    double ival = *II;
-    double qval = *QQ;
-
-    double ivalCohered = ival * g0IvalNorm + qval * g0QvalNorm;
-    double qvalCohered = qval * g0IvalNorm - ival * g0QvalNorm;
-
-    if (ivalCohered < -32767.0) {
-      ivalCohered = -32767.0;
-    } else if (ivalCohered > 32767.0) {
-      ivalCohered = 32767.0;
-    }
-
-    if (qvalCohered < -32767.0) {
-      qvalCohered = -32767.0;
-    } else if (qvalCohered > 32767.0) {
-      qvalCohered = 32767.0;
-    }
-
-    *II = (int16_t) (ivalCohered + 0.5);
-    *QQ = (int16_t) (qvalCohered + 0.5);
-    
-  } // igate
+  _sendStruct(&_radarInfo, sizeof(_radarInfo));
+  _sendStruct(&_tsProc, sizeof(_tsProc));
+  _sendStruct(&_calib, sizeof(_calib));
 
 }
 
@@ -642,15 +772,10 @@ void KaMerge::_cohereIqToBurstPhase(PulseData &pulse,
 void KaMerge::_assembleIwrfPulsePacket()
 {
 
-  // allocate space for IQ data
-  
-  _allocPulseBuf();
+  // packet length: the header, then _nGates gates for each of H and V
 
-  // load up IQ data, H followed by V
-
-  memcpy(_iq, _pulseH->getIq(), _pulseH->getNGates() * 2 * sizeof(int16_t));
-  memcpy(_iq + (_nGates * 2),
-         _pulseV->getIq(), _pulseV->getNGates() * 2 * sizeof(int16_t));
+  _pulseBufLen = sizeof(iwrf_pulse_header) +
+    (_nGates * N_DATA_CHANNELS * 2 * sizeof(int16_t));
 
   // pulse header
 
@@ -726,55 +851,6 @@ void KaMerge::_assembleIwrfPulsePacket()
     _pulseHdr.azimuth = 0.0;
   }
   
-  memcpy(_pulseBuf, &_pulseHdr, sizeof(_pulseHdr));
-
-}
-
-/////////////////////////////////////////////////////////////////////////////
-// send out the IWRF pulse packet
-
-void KaMerge::_sendIwrfPulsePacket()
-{
-
-  // check that socket to client is open
-
-  if (_openSocketToClient()) {
-    return;
-  }
-  
-  if (_sock && _sock->writeBuffer(_pulseBuf, _pulseBufLen)) {
-    cerr << "ERROR - KaMerge::_sendIwrfPulsePacket()" << endl;
-    cerr << "  Writing pulse packet" << endl;
-    cerr << "  " << _sock->getErrStr() << endl;
-    _closeSocketToClient();
-    return;
-  }
-  
-}
-
-/////////////////////////////////////////////////////////////////////////////
-// allocate pulse buffer
-
-void KaMerge::_allocPulseBuf()
-{
-
-  if (_nGates > _nGatesAlloc) {
-
-    if (_pulseBuf) {
-      delete[] _pulseBuf;
-    }
-
-    _pulseBufLen =
-      sizeof(iwrf_pulse_header) + (_nGates * N_DATA_CHANNELS * 2 * sizeof(int16_t));
-    _pulseBuf = new char[_pulseBufLen];
-    _iq = reinterpret_cast<int16_t *>(_pulseBuf + sizeof(iwrf_pulse_header));
-
-    _nGatesAlloc = _nGates;
-
-  }
-
-  memset(_iq, 0, _nGates * N_DATA_CHANNELS * 2 * sizeof(int16_t));
-
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -783,16 +859,12 @@ void KaMerge::_allocPulseBuf()
 void KaMerge::_assembleIwrfBurstPacket()
 {
 
-  // allocate space for Burst IQ samples
-
   _nSamplesBurst = _burst->getNSamples();
-  _allocBurstBuf();
-  
-  // load up IQ data
-  
-  memcpy(_burstIq, _burst->getIq(), _nSamplesBurst * 2 * sizeof(int16_t));
-  
-  // burst header
+  _burstBufLen =
+    sizeof(iwrf_burst_header_t) + (_nSamplesBurst * 2 * sizeof(int16_t));
+
+  // burst header. The header and the burst IQ are copied into the output
+  // batch by _writePacketTask().
 
   _burstHdr.packet.len_bytes = _burstBufLen;
   _burstHdr.packet.seq_num = _packetSeqNum++;
@@ -810,55 +882,73 @@ void KaMerge::_assembleIwrfBurstPacket()
   _burstHdr.freq_hz = _burst->getG0FreqHz();
   _burstHdr.sampling_freq_hz = _burstSampleFreqHz;
 
-  memcpy(_burstBuf, &_burstHdr, sizeof(_burstHdr));
-
 }
 
 /////////////////////////////////////////////////////////////////////////////
-// send out the IWRF burst packet
+// send out the IWRF burst and pulse packets
+//
+// Both packets are reserved in the output batch, in order, and then filled
+// in by three tasks: the H IQ data, the V IQ data and the burst. The tasks
+// write to separate parts of the batch, so they run concurrently if there
+// are merge workers, and the packets still go out in pulse order.
 
-void KaMerge::_sendIwrfBurstPacket()
+void KaMerge::_sendIwrfBurstAndPulsePackets()
 {
 
-  // check that socket to client is open
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
 
-  if (_openSocketToClient()) {
-    return;
-  }
-  
-  if (_sock && _sock->writeBuffer(_burstBuf, _burstBufLen)) {
-    cerr << "ERROR - KaMerge::_sendIwrfBurstPacket()" << endl;
-    cerr << "  Writing burst packet" << endl;
-    cerr << "  " << _sock->getErrStr() << endl;
-    _closeSocketToClient();
-    return;
-  }
+  // appending the pulse packet may move the batch's buffer, so the burst
+  // packet is found from the pulse packet, which follows it
+  _batch->append(_burstBufLen);
+  _pulsePacket = _batch->append(_pulseBufLen);
+  _burstPacket = _pulsePacket - _burstBufLen;
+  memcpy(_pulsePacket, &_pulseHdr, sizeof(_pulseHdr));
+
+  _workers->run(*_packetJob, N_PACKET_TASKS);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  _nPulsesWritten.fetch_add(1, std::memory_order_relaxed);
+  _pulseWriteNsecs.fetch_add((end.tv_sec - start.tv_sec) * 1000000000LL +
+                             (end.tv_nsec - start.tv_nsec),
+                             std::memory_order_relaxed);
+
+  _flushBatchIfDue();
 
 }
 
 /////////////////////////////////////////////////////////////////////////////
-// allocate burst buffer
+// write one part of the burst and pulse packets reserved by
+// _sendIwrfBurstAndPulsePackets(). Called by the merge thread and the
+// workers.
+//
+// For H and V, the channel's IQ data are read once, decimated and cohered
+// to the burst phase as configured, and written into place. A channel is
+// padded with zeros out to _nGates gates, which is needed only if it has
+// fewer gates than the other channel. The IQ data lent by the source are
+// not modified.
 
-void KaMerge::_allocBurstBuf()
+void KaMerge::_writePacketTask(int task)
 {
-  
-  if (_nSamplesBurst > _nSamplesBurstAlloc) {
-    
-    if (_burstBuf) {
-      delete[] _burstBuf;
-    }
-
-    _burstBufLen =
-      sizeof(iwrf_burst_header_t) + (_nSamplesBurst * 2 * sizeof(int16_t));
-    _burstBuf = new char[_burstBufLen];
-    _burstIq = reinterpret_cast<int16_t *>
-      (_burstBuf + sizeof(iwrf_burst_header_t));
-    
-    _nSamplesBurstAlloc = _nSamplesBurst;
 
+  if (task == TASK_BURST) {
+    memcpy(_burstPacket, &_burstHdr, sizeof(_burstHdr));
+    if (_nSamplesBurst > 0) {
+      memcpy(_burstPacket + sizeof(_burstHdr), _burst->getIq(),
+             _nSamplesBurst * 2 * sizeof(int16_t));
+    }
+    return;
   }
 
-  memset(_burstIq, 0, _nSamplesBurst * 2 * sizeof(int16_t));
+  const PulseData *pulse = (task == TASK_H) ? _pulseH : _pulseV;
+  size_t chanLen = _nGates * 2 * sizeof(int16_t);
+  char *iq = _pulsePacket + sizeof(_pulseHdr) + task * chanLen;
+  int nGates = IqKernels::packPulse(pulse->getIq(), pulse->getNGates(),
+                                    _gateDecimation, _cohereIqToBurst,
+                                    _burst->getG0IvalNorm(),
+                                    _burst->getG0QvalNorm(), iq);
+  size_t iqLen = nGates * 2 * sizeof(int16_t);
+  memset(iq + iqLen, 0, chanLen - iqLen);
 
 }
 
@@ -908,8 +998,9 @@ void KaMerge::_assembleIwrfXmitPowerPacket()
   _xmitPower.packet.time_secs_utc = _timeSecs;
   _xmitPower.packet.time_nano_secs = _nanoSecs;
   
-  _xmitPower.power_dbm_h = _hTxPwrCorrectedDbm();
-  _xmitPower.power_dbm_v = _vTxPwrCorrectedDbm();
+  const KaMonitorSnapshot km = _kaMonitor.snapshot();
+  _xmitPower.power_dbm_h = _hTxPwrCorrectedDbm(km);
+  _xmitPower.power_dbm_v = _vTxPwrCorrectedDbm(km);
 
   DLOG << "iwrf_xmit_power power_dbm_h: " << _xmitPower.power_dbm_h <<
     ", power_dbm_v: " << _xmitPower.power_dbm_v;
@@ -922,38 +1013,26 @@ void KaMerge::_assembleIwrfXmitPowerPacket()
 void KaMerge::_sendIwrfXmitPowerPacket()
 {
 
-  // check that socket to client is open
-
-  if (_openSocketToClient()) {
-    return;
-  }
-  
-  if (_sock && _sock->writeBuffer(&_xmitPower, sizeof(_xmitPower))) {
-    cerr << "ERROR - KaMerge::_sendIwrfXmitPowerPacket()" << endl;
-    cerr << "  Writing transmit power packet" << endl;
-    cerr << "  " << _sock->getErrStr() << endl;
-    _closeSocketToClient();
-    return;
-  }
+  _sendStruct(&_xmitPower, sizeof(_xmitPower));
 
 }
 
 /////////////////////////////////////////////////////////////////////////////
 // Corrected H transmit power, dBm
-float KaMerge::_hTxPwrCorrectedDbm() {
-    return(_kaMonitor.hTxPowerRaw() + _config.rcvr_h_power_corr());
+float KaMerge::_hTxPwrCorrectedDbm(const KaMonitorSnapshot &km) {
+    return(km.hTxPowerRaw + _config.rcvr_h_power_corr());
 }
 
 /////////////////////////////////////////////////////////////////////////////
 // Corrected V transmit power, dBm
-float KaMerge::_vTxPwrCorrectedDbm() {
-    return(_kaMonitor.vTxPowerRaw() + _config.rcvr_v_power_corr());
+float KaMerge::_vTxPwrCorrectedDbm(const KaMonitorSnapshot &km) {
+    return(km.vTxPowerRaw + _config.rcvr_v_power_corr());
 }
 
 /////////////////////////////////////////////////////////////////////////////
 // Corrected test target power, dBm
-float KaMerge::_ttPwrCorrectedDbm() {
-    return(_kaMonitor.testTargetPowerRaw() + _config.rcvr_tt_power_corr());
+float KaMerge::_ttPwrCorrectedDbm(const KaMonitorSnapshot &km) {
+    return(km.testTargetPowerRaw + _config.rcvr_tt_power_corr());
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -967,6 +1046,9 @@ string KaMerge::_assembleStatusXml()
   time_t now = time(NULL);
   string xml;
 
+  // one consistent copy of the monitor's status
+  const KaMonitorSnapshot km = _kaMonitor.snapshot();
+
   // main block
 
   xml += TaXml::writeStartTag("KaStatus", 0);
@@ -976,7 +1058,7 @@ string KaMerge::_assembleStatusXml()
   
   xml += TaXml::writeStartTag("KaTransmitterStatus", 1);
 
-  const XmitdStatus &xs = _kaMonitor.transmitterStatus();
+  const XmitdStatus &xs = km.xmitStatus;
 
   xml += TaXml::writeBoolean
     ("SerialConnected", 2, xs.serialConnected());
@@ -1056,53 +1138,51 @@ string KaMerge::_assembleStatusXml()
 
   // receive block
 
-  const KaMonitor &km = _kaMonitor;
-
   xml += TaXml::writeStartTag("KaReceiverStatus", 1);
 
   xml += TaXml::writeDouble
-    ("ProcEnclosureTemp", 2, km.procEnclosureTemp());
+    ("ProcEnclosureTemp", 2, km.procEnclosureTemp);
   xml += TaXml::writeDouble
-    ("ProcDrxTemp", 2, km.procDrxTemp());
+    ("ProcDrxTemp", 2, km.procDrxTemp);
   xml += TaXml::writeDouble
-    ("TxEnclosureTemp", 2, km.txEnclosureTemp());
+    ("TxEnclosureTemp", 2, km.txEnclosureTemp);
   xml += TaXml::writeDouble
-    ("RxTopTemp", 2, km.rxTopTemp());
+    ("RxTopTemp", 2, km.rxTopTemp);
   xml += TaXml::writeDouble
-    ("RxBackTemp", 2, km.rxBackTemp());
+    ("RxBackTemp", 2, km.rxBackTemp);
   xml += TaXml::writeDouble
-    ("RxFrontTemp", 2, km.rxFrontTemp());
+    ("RxFrontTemp", 2, km.rxFrontTemp);
   xml += TaXml::writeDouble
-    ("HTxPowerRaw", 2, km.hTxPowerRaw());
+    ("HTxPowerRaw", 2, km.hTxPowerRaw);
   xml += TaXml::writeDouble
-    ("HTxPowerCorrected", 2, _hTxPwrCorrectedDbm());
+    ("HTxPowerCorrected", 2, _hTxPwrCorrectedDbm(km));
   xml += TaXml::writeDouble
-    ("VTxPowerRaw", 2, km.vTxPowerRaw());
+    ("VTxPowerRaw", 2, km.vTxPowerRaw);
   xml += TaXml::writeDouble
-    ("VTxPowerCorrected", 2, _vTxPwrCorrectedDbm());
+    ("VTxPowerCorrected", 2, _vTxPwrCorrectedDbm(km));
   xml += TaXml::writeDouble
-    ("TestTargetPowerRaw", 2, km.testTargetPowerRaw());
+    ("TestTargetPowerRaw", 2, km.testTargetPowerRaw);
   xml += TaXml::writeDouble
-    ("TestTargetPowerCorrected", 2, _ttPwrCorrectedDbm());
+    ("TestTargetPowerCorrected", 2, _ttPwrCorrectedDbm(km));
   xml += TaXml::writeDouble
-    ("PsVoltage", 2, km.psVoltage());
+    ("PsVoltage", 2, km.psVoltage);
   
   xml += TaXml::writeBoolean
-    ("N2WgPressureGood", 2, km.wgPressureGood());
+    ("N2WgPressureGood", 2, km.wgPressureGood);
   xml += TaXml::writeBoolean
-    ("Locked100MHz", 2, km.locked100MHz());
+    ("Locked100MHz", 2, km.locked100MHz);
   xml += TaXml::writeBoolean
-    ("GpsTimeServerGood", 2, km.gpsTimeServerGood());
+    ("GpsTimeServerGood", 2, km.gpsTimeServerGood);
   
   // Current oscillator frequencies, Hz
   xml += TaXml::writeDouble
-    ("Oscillator0Frequency", 2, km.osc0Frequency());
+    ("Oscillator0Frequency", 2, km.osc0Frequency);
   xml += TaXml::writeDouble
-    ("Oscillator1Frequency", 2, km.osc1Frequency());
+    ("Oscillator1Frequency", 2, km.osc1Frequency);
   xml += TaXml::writeDouble
-    ("Oscillator2Frequency", 2, km.osc2Frequency());
+    ("Oscillator2Frequency", 2, km.osc2Frequency);
   xml += TaXml::writeDouble
-    ("Oscillator3Frequency", 2, km.osc3Frequency());
+    ("Oscillator3Frequency", 2, km.osc3Frequency);
   
   // Last power we got from the burst channel (transmit power estimate)
   xml += TaXml::writeDouble("BurstPower", 2, _lastBurstPowerDbm);
@@ -1127,19 +1207,7 @@ void KaMerge::_sendIwrfStatusXmlPacket()
 
 {
 
-  // check that socket to client is open
-
-  if (_openSocketToClient()) {
-    return;
-  }
-  
-  if (_sock && _sock->writeBuffer(_statusBuf, _statusLen)) {
-    cerr << "ERROR - KaMerge::_sendIwrfStatusXmlPacket()" << endl;
-    cerr << "  Writing status xml packet" << endl;
-    cerr << "  " << _sock->getErrStr() << endl;
-    _closeSocketToClient();
-    return;
-  }
+  _sendStruct(_statusBuf, _statusLen);
 
 }
 
@@ -1159,78 +1227,53 @@ void KaMerge::_allocStatusBuf(size_t xmlLen)
 }
 
 //////////////////////////////////////////////////
-// open server
-// Returns 0 on success, -1 on failure
+// add a packet to the batch, and hand the batch to the network writer
+// if it has reached its limits. With batching disabled, the limits are
+// zero and each packet is handed over on its own.
 
-int KaMerge::_openServer()
+void KaMerge::_sendPacket(struct iovec *iov, int iovCnt)
 
 {
-
-  if (_serverIsOpen) {
-    return 0;
-  }
-
-  if (_server.openServer(_iwrfServerTcpPort)) {
-    cerr << "ERROR - KaMerge::_openServer" << endl;
-    cerr << "  Cannot open server, port: " << _iwrfServerTcpPort << endl;
-    cerr << "  " << _server.getErrStr() << endl;
-    return -1;
-  }
-
-  DLOG << "====>> TCP server opened <<====";
-  _serverIsOpen = true;
-  return 0;
-
+  _batch->add(iov, iovCnt);
+  _flushBatchIfDue();
 }
 
 //////////////////////////////////////////////////
-// open socket to client
-// Returns 0 on success, -1 on failure
+// publish a packet held in a single buffer
 
-int KaMerge::_openSocketToClient()
+void KaMerge::_sendStruct(void *buf, size_t len)
 
 {
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  _sendPacket(&iov, 1);
+}
 
-  if (_openServer()) {
-    return -1;
-  }
-
-  // check status
-
-  if (_sock && _sock->isOpen()) {
-    return 0;
-  }
+//////////////////////////////////////////////////
+// hand the batched packets to the network writer. This never blocks:
+// if the writer's queue is full, the batch is dropped.
 
-  // get a client if one is out there
+void KaMerge::_flushBatch()
 
-  _sock = _server.getClient(0);
+{
 
-  if (_sock == NULL) {
-    return -1;
+  if (_batch->nPackets() == 0) {
+    return;
   }
 
-  DLOG << "====>> Connected to client <<====";
+  _batch = _netWriter->write(_batch);
+  _batch->clear();
 
-  return 0;
-  
 }
 
 //////////////////////////////////////////////////
-// close socket to client
+// hand over the batched packets if they have reached the size or delay limit
 
-void KaMerge::_closeSocketToClient()
+void KaMerge::_flushBatchIfDue()
 
 {
-  
-  if (_sock == NULL) {
-    return;
+  if (_batch->flushDue(_batchMaxBytes, _batchMaxDelay)) {
+    _flushBatch();
   }
-
-  if (_sock->isOpen()) {
-    _sock->close();
-  }
-
-  delete _sock;
-  _sock = NULL;
-
 }
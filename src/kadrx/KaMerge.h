@@ -2,14 +2,24 @@
 #define KA_MERGE_H_
 
 #include "KaDrxConfig.h"
-#include "CircBuffer.h"
+#include "SpscRing.h"
+#include "MergeWindow.h"
+#include "PacketBatcher.h"
+#include "KaNetWriter.h"
 #include "PulseData.h"
 #include "BurstData.h"
 #include "KaMonitor.h"
+#include "ForkJoinPool.h"
+#include "MergedPulse.h"
+#include "PulsePool.h"
+#include "StageTimer.h"
+#include "ThreadPolicy.h"
 #include <radar/iwrf_data.h>
-#include <toolsa/ServerSocket.hh>
 #include <QThread>
+#include <atomic>
 #include <boost/thread/mutex.hpp>
+#include <string>
+#include <sys/uio.h>
 
 /// KaMerge merges data from the H and V channels, and the burst channel,
 /// converts to IWRF time series format and writes the IWRF data to a client
@@ -18,13 +28,27 @@
 /// The bulk of the work done in this object is run in a separate thread.
 ///
 /// The 3 instances of the KaDrxPub class each write their data to this
-/// object, inserting it into buffers (deques). The merge operation is
-/// carried out by removing items from the queues, synchronizing on the
-/// pulse numbers, and merging the data.
+/// object, inserting it into lock-free single-producer/single-consumer
+/// rings. The merge thread moves items from the rings into a MergeWindow,
+/// which holds them in slots indexed by pulse number and hands back
+/// complete H/V/burst triples in order. The merge thread sleeps while the
+/// data it needs have not yet arrived, and is woken by the next write to
+/// the ring it is waiting on.
 ///
-/// This thread acts as a server, listening for a client to connect. Only
-/// a single client is supported, given the high bandwidth of the data
-/// stream. If no client is connected, the data is discarded.
+/// The work is done in a pipeline of stages:
+///   - sync: move data into the window and pop complete triples, noting
+///     any missing pulses
+///   - pack: decide when to send metadata, decimate and cohere the IQ data
+///     and serialize the IWRF packets into batches, and send status XML
+///   - send: hand the batches to any number of TCP clients. This is done
+///     by a KaNetWriter, from its own thread, so that the merge never waits
+///     on a socket. If no client is connected, the data is discarded.
+///
+/// By default the sync and pack stages both run on the merge thread. If
+/// merge_pack_thread is set, the pack stage runs on its own thread, fed
+/// with MergedPulse triples through a bounded SpscRing. Each stage keeps a
+/// StageTimer of its busy and idle time, so that the stage which limits
+/// the throughput can be seen in the status.
 ///
 /// Since KaMerge does not use a Qt event loop at this point, the thread
 /// should be stopped by calling its terminate() method.
@@ -70,6 +94,38 @@ public:
 
   BurstData *writeBurst(BurstData *val);
 
+  /// H channel input queue, for occupancy and overrun statistics
+  const SpscRing<PulseData> &hQueue() const { return *_qH; }
+
+  /// V channel input queue, for occupancy and overrun statistics
+  const SpscRing<PulseData> &vQueue() const { return *_qV; }
+
+  /// burst channel input queue, for occupancy and overrun statistics
+  const SpscRing<BurstData> &burstQueue() const { return *_qB; }
+
+  /// IWRF network writer, for output queue and client statistics
+  const KaNetWriter &netWriter() const { return *_netWriter; }
+
+  /// busy and idle time of the sync stage
+  const StageTimer &syncTimer() const { return _syncTimer; }
+
+  /// busy and idle time of the pack stage
+  const StageTimer &packTimer() const { return _packTimer; }
+
+  /// queue between the sync and pack stages, for occupancy and overrun
+  /// statistics. NULL if the pack stage runs on the merge thread.
+  const SpscRing<MergedPulse> *pulseQueue() const { return _pulseQueue; }
+
+  /// number of merge worker threads
+  int nWorkers() const { return _workers->nWorkers(); }
+
+  /// number of pulses written to the output so far
+  uint64_t nPulsesWritten() const { return _nPulsesWritten.load(); }
+
+  /// total time spent writing the burst and pulse packets of those
+  /// pulses, seconds
+  double pulseWriteSecs() const { return _pulseWriteNsecs.load() * 1.0e-9; }
+
   boost::mutex printMutex;
 
 private:
@@ -81,35 +137,90 @@ private:
   /// KaMonitor which will supply Ka-band status information
   const KaMonitor &_kaMonitor;
 
+  /// CPU set and scheduling for the merge thread and the pack thread
+
+  ThreadPolicy _threadPolicy;
+  ThreadPolicy _packThreadPolicy;
+
   /// The queue size - for buffering IQ data
 
   size_t _queueSize;
   
+  /// Pool holding the pulse and burst objects below, and their IQ data
+
+  PulsePool *_pool;
+
   ///  Queues for data from channels
   
-  CircBuffer<PulseData> *_qH;
-  CircBuffer<PulseData> *_qV;
-  CircBuffer<BurstData> *_qB;
+  SpscRing<PulseData> *_qH;
+  SpscRing<PulseData> *_qV;
+  SpscRing<BurstData> *_qB;
 
-  /// objects for reading the buffered data
-  
+  /// reorder window for assembling H/V/burst triples
+
+  MergeWindow *_window;
+
+  /// the triple being filled by the sync stage
+
+  MergedPulse *_syncPulse;
+
+  /// pulse sequence number of the last triple synced, -1 before the first
+
+  int64_t _syncSeqNum;
+
+  /// the triple being packed, and its data. The pack stage uses only
+  /// these, not _syncPulse.
+
+  MergedPulse *_packPulse;
   PulseData *_pulseH;
   PulseData *_pulseV;
   BurstData *_burst;
 
+  /// Queue from the sync stage to the pack stage, and the thread running
+  /// the pack stage. Both are NULL if the pack stage runs inline on the
+  /// merge thread.
+
+  class PackThread : public QThread {
+  public:
+    PackThread(KaMerge &merge) : _merge(merge) {}
+    void run() {
+      setTerminationEnabled(true);
+      _merge._packLoop();
+    }
+  private:
+    KaMerge &_merge;
+  };
+
+  SpscRing<MergedPulse> *_pulseQueue;
+  PackThread *_packThread;
+
+  /// busy and idle time of the sync and pack stages
+
+  StageTimer _syncTimer;
+  StageTimer _packTimer;
+
+  /// time of the last status packet sent by the pack stage
+
+  time_t _lastStatusTime;
+
+  /// spare objects, swapped in when moving data from the queues
+  /// into the merge window
+
+  PulseData *_spareH;
+  PulseData *_spareV;
+  BurstData *_spareB;
+
   /// IQ data
 
   /// @brief Number of non-burst data channels (currently 2: H and V)
   static const int N_DATA_CHANNELS = 2;
 
   int _nGates;
-  int _nGatesAlloc;
   int _pulseIntervalPerIwrfMetaData;
-  int16_t *_iq;
-  char *_pulseBuf;
   int _pulseBufLen;
   bool _cohereIqToBurst;
-  bool _combineEverySecondGate;
+  /// number of gates combined into each output gate, 1 for none
+  int _gateDecimation;
   
   /// I and Q count scaling factor to get power in mW easily:
   /// mW = (I_count / _iqScaleForMw)^2 + (Q_count / _iqScaleForMw)^2
@@ -118,10 +229,8 @@ private:
   /// Burst IQ
 
   int _nSamplesBurst;
-  int _nSamplesBurstAlloc;
-  int16_t *_burstIq;
-  char *_burstBuf;
   int _burstBufLen;
+
   double _burstSampleFreqHz;
   double _lastBurstPowerDbm;
 
@@ -131,6 +240,40 @@ private:
   int _statusLen;
   int _statusBufLen;
 
+  /// Output batching. When enabled, packets are gathered and handed to
+  /// the network writer several at a time. _batchMaxDelay is zero when
+  /// batching is disabled.
+
+  size_t _batchMaxBytes;
+  double _batchMaxDelay;
+  PacketBatcher *_batch;
+
+  /// Merge workers, which help write the H, V and burst data of each
+  /// pulse. With no workers, the tasks are run on the merge thread.
+
+  enum { TASK_H = 0, TASK_V = 1, TASK_BURST = 2, N_PACKET_TASKS = 3 };
+
+  class PacketJob : public ForkJoinPool::Job {
+  public:
+    PacketJob(KaMerge &merge) : _merge(merge) {}
+    void runTask(int task) { _merge._writePacketTask(task); }
+  private:
+    KaMerge &_merge;
+  };
+
+  ForkJoinPool *_workers;
+  PacketJob *_packetJob;
+
+  /// the burst and pulse packets being written, in _batch
+
+  char *_burstPacket;
+  char *_pulsePacket;
+
+  /// throughput counters, written by the merge thread
+
+  std::atomic<uint64_t> _nPulsesWritten;
+  std::atomic<uint64_t> _pulseWriteNsecs;
+
   /// pulse sequence number and times
   
   int64_t _pulseSeqNum;
@@ -157,12 +300,9 @@ private:
   iwrf_burst_header_t _burstHdr;
   iwrf_xmit_power_t _xmitPower;
 
-  /// Server
+  /// Network writer thread, sending the IWRF packets to our clients
 
-  int _iwrfServerTcpPort;
-  ServerSocket _server;
-  bool _serverIsOpen;
-  Socket *_sock;
+  KaNetWriter *_netWriter;
 
   /// simulation of antenna angles
 
@@ -178,49 +318,47 @@ private:
   
   /// methods
 
-  void _readNextPulse();
-  void _syncPulsesAndBurst();
-  void _readNextH();
-  void _readNextV();
-  void _readNextB();
+  void _syncNextPulse(MergedPulse &pulse);
+  void _packNextPulse(MergedPulse &pulse);
+  void _packLoop();
+  int _drainQueues();
+  void _waitForHeadOfWindow();
   void _sendIwrfMetaData();
-  void _cohereIqToBurstPhase();
-  void _cohereIqToBurstPhase(PulseData &pulse,
-                             const BurstData &burst);
 
   void _assembleIwrfPulsePacket();
-  void _sendIwrfPulsePacket();
-  void _allocPulseBuf();
-  
   void _assembleIwrfBurstPacket();
-  void _sendIwrfBurstPacket();
-  void _allocBurstBuf();
+  void _sendIwrfBurstAndPulsePackets();
+  void _writePacketTask(int task);
   
   void _assembleStatusPacket();
-  string _assembleStatusXml();
+  std::string _assembleStatusXml();
   void _sendIwrfStatusXmlPacket();
   void _allocStatusBuf(size_t xmlLen);
   
   void _assembleIwrfXmitPowerPacket();
   void _sendIwrfXmitPowerPacket();
   
-  int _openServer();
-  int _openSocketToClient();
-  void _closeSocketToClient();
+  void _sendPacket(struct iovec *iov, int iovCnt);
+  void _sendStruct(void *buf, size_t len);
+  void _flushBatch();
+  void _flushBatchIfDue();
   
 
   /// Corrected H transmit power, dBm. This is an estimate of the power at the
   /// H channel of the A/D.
+  /// @param km the KaMonitor status to use
   /// @return corrected H transmit power, dBm
-  float _hTxPwrCorrectedDbm();
+  float _hTxPwrCorrectedDbm(const KaMonitorSnapshot &km);
   /// Corrected V transmit power, dBm. This is an estimate of the power at the
   /// V channel of the A/D.
+  /// @param km the KaMonitor status to use
   /// @return corrected V transmit power, dBm
-  float _vTxPwrCorrectedDbm();
+  float _vTxPwrCorrectedDbm(const KaMonitorSnapshot &km);
   /// Corrected test target power, dBm. This is an estimate of the test target
   /// power at the H channel of the A/D.
+  /// @param km the KaMonitor status to use
   /// @return corrected test target power, dBm
-  float _ttPwrCorrectedDbm();
+  float _ttPwrCorrectedDbm(const KaMonitorSnapshot &km);
   
 
 };
@@ -0,0 +1,1011 @@
+/*
+ * KaMergeBench.cpp
+ *
+ * Throughput and latency benchmark for KaMerge and everything downstream
+ * of it, with no Pentek card.
+ *
+ * A KaMerge is built from a DRX configuration (the one given, or a typical
+ * one built in) with the gate count and options of each case overridden.
+ * Three producer threads, one each for H, V and the burst, write pulses to
+ * it with writePulseH(), writePulseV() and writeBurst(), as the KaDrxPub
+ * threads do. Each pulse is stamped with the time it was due. A sink
+ * thread connects to the merge's IWRF server on the local host, as a
+ * client would, and checks the stream as it reads it:
+ *   - framing: every packet has an IWRF id and a sane length, and pulse
+ *     and burst packets have the length their headers call for
+ *   - continuity: packet sequence numbers increase by one, and pulse
+ *     sequence numbers do not go backwards
+ *
+ * For each case, pulses are written at each of a list of increasing
+ * rates, for a few seconds at each. A rate of 0 writes pulses as fast as
+ * the merge and the network writer take them, waiting whenever an input
+ * queue is full or the IWRF output queue is half full. Each step reports:
+ *   - the sustained pulse rate and data rate seen by the sink
+ *   - pulses lost: overruns of the merge input queues and of the IWRF
+ *     output queue, packets dropped for a slow client, and pulses which
+ *     never reached the sink
+ *   - percentiles of the latency from a pulse's H data being due to
+ *     reading its pulse packet from the socket. A paced pulse is due at
+ *     its scheduled time, so a producer which oversleeps adds to the
+ *     latency. In an unpaced step, a pulse is due when its producer is
+ *     ready to write it, so the time it then waits for room in the
+ *     queues counts too.
+ *
+ * Each case runs in its own process, so that every case starts with a new
+ * merge and IWRF server, on its own port. The results are written as JSON,
+ * so that they can be kept and compared from one build to the next;
+ * progress is written to stderr.
+ *
+ * Usage: KaMergeBench [options], see --help
+ */
+
+#include "BurstData.h"
+#include "KaDrxConfig.h"
+#include "KaMerge.h"
+#include "KaMonitor.h"
+#include "PulseData.h"
+
+#include <QtCore/QCoreApplication>
+#include <boost/program_options.hpp>
+#include <radar/iwrf_data.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace po = boost::program_options;
+
+// A typical DRX configuration, used when none is given. The gate count,
+// the options under test and the IWRF port are set for each case.
+
+static const char *DefaultConfig =
+  "radar_id                  Ka\n"
+  "gates                     980\n"
+  "staggered_prt             false\n"
+  "prt1                      1.0e-3\n"
+  "ant_gain                  45.9\n"
+  "ant_hbeam_width           0.86\n"
+  "ant_vbeam_width           0.91\n"
+  "rcvr_bandwidth            1.37e6\n"
+  "rcvr_cntr_freq            1.25e8\n"
+  "rcvr_digital_gain         -2.67\n"
+  "rcvr_filter_mismatch      0.4\n"
+  "rcvr_gate0_delay          5.5e-6\n"
+  "rcvr_noise_figure         8.3\n"
+  "rcvr_pulse_width          5.0e-7\n"
+  "rcvr_rf_gain              36.16\n"
+  "rcvr_h_power_corr         71.93\n"
+  "rcvr_v_power_corr         0.00\n"
+  "rcvr_tt_power_corr        -59.81\n"
+  "tx_cntr_freq              3.5e10\n"
+  "tx_peak_power             74.69\n"
+  "tx_pulse_width            5.0e-7\n"
+  "tx_delay                  0.0\n"
+  "tx_pulse_mod_delay        6.0e-7\n"
+  "tx_pulse_mod_width        6.0e-7\n"
+  "burst_sample_delay        1.55e-6\n"
+  "burst_sample_width        5.0e-7\n"
+  "burst_sample_frequency    1.0e8\n"
+  "external_clock            true\n"
+  "external_start_trigger    true\n"
+  "afc_enabled               true\n"
+  "afc_g0_threshold_dbm      -20.0\n"
+  "afc_coarse_step           5000000\n"
+  "afc_fine_step             100000\n"
+  "ldr_mode                  true\n"
+  "merge_queue_size          20000\n"
+  "pulse_interval_per_iwrf_meta_data 5000\n"
+  "iqcount_scale_for_mw      9465\n"
+  "test_target_delay         485.08e-6\n"
+  "test_target_width         5.0e-6\n"
+  "range_to_gate0            37.5\n"
+  "write_pei_files           false\n"
+  "max_pei_gates             400\n"
+  "simulate_pmc730           false\n"
+  "simulate_tty_oscillators  false\n"
+  "allow_blanking            false\n";
+
+// the pulses written before the first step, which are not reported
+static const double WarmUpSecs = 0.5;
+static const double WarmUpRate = 1000.0;
+
+// the longest wait for the sink to see the last pulse of a step
+static const double DrainSecs = 5.0;
+
+// the furthest one producer thread may run ahead of the others, in
+// pulses. The digitizer channels are triggered together, so they never
+// drift far apart; threads left to themselves could, and the merge would
+// then expire incomplete pulses.
+static const int64_t MaxLead = 32;
+
+// largest packet the sink accepts
+static const int32_t MaxPacketLen = 64 * 1024 * 1024;
+
+static double
+monotonicSecs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static void
+realtimeNow(time_t &secs, int &nanoSecs) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  secs = ts.tv_sec;
+  nanoSecs = ts.tv_nsec;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// What the sink saw of the pulses of one step
+
+struct SinkStats {
+  SinkStats() : nPulses(0), nSeqErrors(0), nLostPackets(0),
+    nFramingErrors(0), firstSecs(0.0), lastSecs(0.0), firstBytes(0),
+    lastBytes(0), lastSeqNum(-1) {}
+  int64_t nPulses;          ///< pulses of the step received
+  int64_t nSeqErrors;       ///< pulse or packet numbers going backwards
+  int64_t nLostPackets;     ///< gaps in the packet sequence numbers
+  int64_t nFramingErrors;   ///< bad packets; the stream is not read after one
+  double firstSecs;         ///< when the first and last pulses were read
+  double lastSecs;
+  uint64_t firstBytes;      ///< bytes read by then
+  uint64_t lastBytes;
+  int64_t lastSeqNum;       ///< last pulse sequence number read
+  std::vector<double> latencyUsecs;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+/// IWRF client which reads and checks the merge's output
+
+class IwrfSink {
+public:
+  IwrfSink() : _fd(-1), _stopping(false), _nBytes(0), _firstSeqNum(-1),
+    _lastPacketSeqNum(-1), _broken(false) {}
+
+  ~IwrfSink() {
+    _stopping.store(true);
+    if (_fd >= 0) {
+      shutdown(_fd, SHUT_RDWR);
+    }
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+    if (_fd >= 0) {
+      close(_fd);
+    }
+  }
+
+  /// Connect to the IWRF server on the local host and start reading.
+  /// The server is opened only once its writer thread runs, so connecting
+  /// is retried for up to timeoutSecs.
+  bool start(int port, double timeoutSecs) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    double giveUp = monotonicSecs() + timeoutSecs;
+    while (true) {
+      _fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (_fd < 0) {
+        return false;
+      }
+      if (connect(_fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        break;
+      }
+      close(_fd);
+      _fd = -1;
+      if (monotonicSecs() > giveUp) {
+        return false;
+      }
+      usleep(50000);
+    }
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int rcvBuf = 8 * 1024 * 1024;
+    setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf));
+    _thread = std::thread(&IwrfSink::_run, this);
+    return true;
+  }
+
+  /// Start collecting statistics for the pulses numbered firstSeqNum on
+  void beginStep(int64_t firstSeqNum) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats = SinkStats();
+    _firstSeqNum = firstSeqNum;
+  }
+
+  /// Wait until the pulse numbered endSeqNum - 1, or a later one, has been
+  /// read, or for timeoutSecs. Returns the statistics for the step.
+  SinkStats endStep(int64_t endSeqNum, double timeoutSecs) {
+    double giveUp = monotonicSecs() + timeoutSecs;
+    while (monotonicSecs() < giveUp) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stats.lastSeqNum >= endSeqNum - 1 || _broken) {
+          break;
+        }
+      }
+      usleep(1000);
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    SinkStats stats;
+    std::swap(stats, _stats);
+    _firstSeqNum = -1;
+    return stats;
+  }
+
+private:
+
+  // read the stream, and check each whole packet in it
+  void _run() {
+    std::vector<char> buf(16 * 1024 * 1024);
+    size_t have = 0;
+    while (!_stopping.load()) {
+      if (have == buf.size()) {
+        buf.resize(buf.size() * 2);
+      }
+      ssize_t nRead = recv(_fd, &buf[have], buf.size() - have, 0);
+      if (nRead <= 0) {
+        if (nRead < 0 && errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      // everything in this read arrived at the same time
+      time_t nowSecs;
+      int nowNanos;
+      realtimeNow(nowSecs, nowNanos);
+      double now = monotonicSecs();
+      have += nRead;
+      size_t used = 0;
+      std::lock_guard<std::mutex> lock(_mutex);
+      while (!_broken && have - used >= sizeof(iwrf_packet_info_t)) {
+        const iwrf_packet_info_t *info =
+          (const iwrf_packet_info_t *) &buf[used];
+        if (!_checkFraming(*info)) {
+          _broken = true;
+          _stats.nFramingErrors++;
+          break;
+        }
+        if (have - used < (size_t) info->len_bytes) {
+          break;
+        }
+        _nBytes += info->len_bytes;
+        _checkPacket(&buf[used], nowSecs, nowNanos, now);
+        used += info->len_bytes;
+      }
+      if (_broken) {
+        break;
+      }
+      memmove(&buf[0], &buf[used], have - used);
+      have -= used;
+    }
+  }
+
+  // is this the start of a plausible IWRF packet?
+  bool _checkFraming(const iwrf_packet_info_t &info) const {
+    if ((info.id & 0xffff0000) != (IWRF_SYNC_ID & 0xffff0000)) {
+      return false;
+    }
+    return info.len_bytes >= (int32_t) sizeof(iwrf_packet_info_t) &&
+      info.len_bytes <= MaxPacketLen;
+  }
+
+  // check a whole packet, and note the pulses in the current step
+  void _checkPacket(const char *packet, time_t nowSecs, int nowNanos,
+                    double now) {
+
+    const iwrf_packet_info_t &info = *(const iwrf_packet_info_t *) packet;
+
+    if (info.id == IWRF_BURST_HEADER_ID) {
+      const iwrf_burst_header_t &hdr = *(const iwrf_burst_header_t *) packet;
+      if (info.len_bytes != (int32_t) (sizeof(hdr) +
+                                       hdr.n_samples * 2 * sizeof(int16_t))) {
+        _stats.nFramingErrors++;
+      }
+    }
+
+    // packets sent before the first pulse may be the greeting, which is
+    // the saved metadata, so the packet numbers are checked from the first
+    // pulse on
+    if (_lastPacketSeqNum >= 0) {
+      if (info.seq_num > _lastPacketSeqNum + 1) {
+        _stats.nLostPackets += info.seq_num - _lastPacketSeqNum - 1;
+      } else if (info.seq_num <= _lastPacketSeqNum) {
+        _stats.nSeqErrors++;
+      }
+      _lastPacketSeqNum = info.seq_num;
+    }
+
+    if (info.id != IWRF_PULSE_HEADER_ID) {
+      return;
+    }
+    const iwrf_pulse_header_t &hdr = *(const iwrf_pulse_header_t *) packet;
+    _lastPacketSeqNum = info.seq_num;
+    if (info.len_bytes != (int32_t) (sizeof(hdr) +
+                                     hdr.n_data * sizeof(int16_t))) {
+      _stats.nFramingErrors++;
+    }
+    if (_firstSeqNum < 0 || hdr.pulse_seq_num < _firstSeqNum) {
+      return;
+    }
+
+    if (_stats.lastSeqNum >= 0) {
+      if (hdr.pulse_seq_num <= _stats.lastSeqNum) {
+        _stats.nSeqErrors++;
+      }
+    }
+    if (_stats.nPulses == 0) {
+      _stats.firstSecs = now;
+      _stats.firstBytes = _nBytes;
+    }
+    _stats.nPulses++;
+    _stats.lastSecs = now;
+    _stats.lastBytes = _nBytes;
+    _stats.lastSeqNum = hdr.pulse_seq_num;
+    _stats.latencyUsecs.push_back(
+      (nowSecs - info.time_secs_utc) * 1.0e6 +
+      (nowNanos - info.time_nano_secs) * 1.0e-3);
+
+  }
+
+  int _fd;
+  std::thread _thread;
+  std::atomic<bool> _stopping;
+
+  /// guards everything below
+  std::mutex _mutex;
+  uint64_t _nBytes;
+  int64_t _firstSeqNum;
+  int64_t _lastPacketSeqNum;
+  bool _broken;
+  SinkStats _stats;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+/// Writes pulses to the merge from an H, a V and a burst thread, as the
+/// three KaDrxPub threads do
+
+class PulseFeeder {
+public:
+  enum { H_CHANNEL = 0, V_CHANNEL = 1, BURST_CHANNEL = 2, N_CHANNELS = 3 };
+
+  /// maxQueued limits the pulses queued for the merge on each channel in
+  /// an unpaced step; 0 allows up to the size of the merge input queues.
+  PulseFeeder(KaMerge &merge, int nGates, int nSamplesBurst,
+              double g0FreqHz, size_t maxQueued) :
+    _merge(merge), _nGates(nGates), _nSamplesBurst(nSamplesBurst),
+    _g0FreqHz(g0FreqHz), _maxQueued(maxQueued),
+    _pulseH(new PulseData), _pulseV(new PulseData), _burst(new BurstData)
+  {
+    _iq.resize(2 * nGates);
+    for (int ii = 0; ii < 2 * nGates; ii++) {
+      _iq[ii] = (int16_t) (1000.0 * sin(0.05 * ii));
+    }
+    _burstIq.resize(2 * nSamplesBurst);
+    for (int ii = 0; ii < nSamplesBurst; ii++) {
+      _burstIq[2 * ii] = 10000;
+      _burstIq[2 * ii + 1] = 0;
+    }
+  }
+
+  ~PulseFeeder() {
+    delete _pulseH;
+    delete _pulseV;
+    delete _burst;
+  }
+
+  /// Write pulses numbered from firstSeqNum on, at rateHz for secs, or,
+  /// with a rate of 0, as fast as the merge takes them for secs. All three
+  /// channels get the same pulses. Returns the number after the last pulse
+  /// written.
+  ///
+  /// Paced pulses are written when they are due, but a thread which
+  /// oversleeps writes the pulses it has missed together, much as the
+  /// channels get pulses a DMA block at a time. No thread spins, so the
+  /// producers leave the CPUs to the merge.
+  int64_t runStep(int64_t firstSeqNum, double rateHz, double secs) {
+    int64_t endSeqNum = firstSeqNum + (int64_t) (rateHz * secs + 0.5);
+    _stopSecs = monotonicSecs() + secs;
+    _startSecs = monotonicSecs();
+    std::vector<std::thread> threads;
+    for (int chan = 0; chan < N_CHANNELS; chan++) {
+      _next[chan] = firstSeqNum;
+      threads.push_back(std::thread(&PulseFeeder::_feed, this, chan,
+                                    firstSeqNum, rateHz,
+                                    rateHz > 0.0 ? endSeqNum : INT64_MAX));
+    }
+    for (size_t ii = 0; ii < threads.size(); ii++) {
+      threads[ii].join();
+    }
+    if (rateHz > 0.0) {
+      return endSeqNum;
+    }
+    // bring the channels which stopped behind up to the one furthest on
+    endSeqNum = std::max(_next[H_CHANNEL].load(),
+                         std::max(_next[V_CHANNEL].load(),
+                                  _next[BURST_CHANNEL].load()));
+    for (int chan = 0; chan < N_CHANNELS; chan++) {
+      _feed(chan, _next[chan], 0.0, endSeqNum);
+    }
+    return endSeqNum;
+  }
+
+private:
+
+  // write pulses, each stamped with the time it was due: its scheduled
+  // time when paced, or the time the thread was ready to write it when
+  // not, so that the time spent waiting for room in the queues counts as
+  // latency
+  void _feed(int chan, int64_t firstSeqNum, double rateHz,
+             int64_t endSeqNum) {
+    for (int64_t seqNum = firstSeqNum; seqNum < endSeqNum; seqNum++) {
+      if (!_waitForOthers(chan, seqNum, endSeqNum)) {
+        break;
+      }
+      double dueSecs;
+      if (rateHz > 0.0) {
+        dueSecs = _startSecs + (seqNum - firstSeqNum) / rateHz;
+        _waitUntil(dueSecs);
+      } else {
+        dueSecs = monotonicSecs();
+        if (!_waitForRoom(chan, endSeqNum)) {
+          break;
+        }
+      }
+      _write(chan, seqNum, dueSecs);
+      _next[chan].store(seqNum + 1);
+    }
+  }
+
+  // has the time for an unpaced step run out?
+  bool _timeUp(int64_t endSeqNum) const {
+    return endSeqNum == INT64_MAX && monotonicSecs() >= _stopSecs;
+  }
+
+  // wait while this channel is too far ahead of the others. Returns false
+  // if the step's time runs out first.
+  bool _waitForOthers(int chan, int64_t seqNum, int64_t endSeqNum) const {
+    while (true) {
+      int64_t slowest = INT64_MAX;
+      for (int other = 0; other < N_CHANNELS; other++) {
+        if (other != chan) {
+          slowest = std::min(slowest, _next[other].load());
+        }
+      }
+      if (seqNum < slowest + MaxLead) {
+        return true;
+      }
+      if (_timeUp(endSeqNum)) {
+        return false;
+      }
+      usleep(10);
+    }
+  }
+
+  // write one channel of a pulse, stamped with the real time matching
+  // the given monotonic time
+  void _write(int chan, int64_t seqNum, double dueSecs) {
+    time_t secs;
+    int nanoSecs;
+    realtimeNow(secs, nanoSecs);
+    int64_t lateNanos = (int64_t) ((monotonicSecs() - dueSecs) * 1.0e9);
+    if (lateNanos > 0) {
+      int64_t stamp = (int64_t) secs * 1000000000 + nanoSecs - lateNanos;
+      secs = stamp / 1000000000;
+      nanoSecs = stamp % 1000000000;
+    }
+    switch (chan) {
+    case H_CHANNEL:
+      _pulseH->set(seqNum, secs, nanoSecs, H_CHANNEL, _nGates, &_iq[0]);
+      _pulseH = _merge.writePulseH(_pulseH);
+      _pulseH->releaseIq();
+      break;
+    case V_CHANNEL:
+      _pulseV->set(seqNum, secs, nanoSecs, V_CHANNEL, _nGates, &_iq[0]);
+      _pulseV = _merge.writePulseV(_pulseV);
+      _pulseV->releaseIq();
+      break;
+    default:
+      _burst->set(seqNum, secs, nanoSecs, 10000.0, 0.0, 0.0, 1.0, 0.0,
+                  _g0FreqHz, 0.0, _nSamplesBurst, &_burstIq[0]);
+      _burst = _merge.writeBurst(_burst);
+      _burst->releaseIq();
+      break;
+    }
+  }
+
+  // sleep until the given time
+  static void _waitUntil(double when) {
+    double wait = when - monotonicSecs();
+    if (wait > 0.0) {
+      usleep((useconds_t) (wait * 1.0e6));
+    }
+  }
+
+  // wait while the channel's merge input queue is full or holds maxQueued
+  // pulses, or, for H, while
+  // the IWRF output queue is more than half full, so that an unpaced step
+  // runs at the rate the network writer keeps up with. Returns false if
+  // the step's time runs out first.
+  bool _waitForRoom(int chan, int64_t endSeqNum) const {
+    while (true) {
+      size_t depth;
+      size_t size;
+      bool outputFull = false;
+      if (chan == H_CHANNEL) {
+        depth = _merge.hQueue().depth();
+        size = _merge.hQueue().size();
+        const SpscRing<PacketBatcher> &out = _merge.netWriter().queue();
+        outputFull = out.depth() > out.size() / 2;
+      } else if (chan == V_CHANNEL) {
+        depth = _merge.vQueue().depth();
+        size = _merge.vQueue().size();
+      } else {
+        depth = _merge.burstQueue().depth();
+        size = _merge.burstQueue().size();
+      }
+      if (!outputFull && depth + 1 < size &&
+          (_maxQueued == 0 || depth < _maxQueued)) {
+        return true;
+      }
+      if (_timeUp(endSeqNum)) {
+        return false;
+      }
+      usleep(10);
+    }
+  }
+
+  KaMerge &_merge;
+  int _nGates;
+  int _nSamplesBurst;
+  double _g0FreqHz;
+  size_t _maxQueued;
+  std::vector<int16_t> _iq;
+  std::vector<int16_t> _burstIq;
+  PulseData *_pulseH;
+  PulseData *_pulseV;
+  BurstData *_burst;
+  double _startSecs;
+  double _stopSecs;
+  /// next pulse number for each channel, after its thread has stopped
+  std::atomic<int64_t> _next[N_CHANNELS];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+/// One combination of gate count and merge options
+
+struct BenchCase {
+  int nGates;
+  bool cohere;
+  bool combine;
+};
+
+/// Options shared by all the cases
+struct BenchOptions {
+  std::string configText;
+  std::vector<double> rates;
+  double stepSecs;
+  int port;
+  size_t maxQueued;
+};
+
+static std::string
+jsonBool(bool val) {
+  return val ? "true" : "false";
+}
+
+// a JSON string literal, with quotes, backslashes and control characters
+// escaped
+static std::string
+jsonString(const std::string &val) {
+  std::ostringstream out;
+  out << '"';
+  for (size_t ii = 0; ii < val.size(); ii++) {
+    unsigned char ch = val[ii];
+    if (ch == '"' || ch == '\\') {
+      out << '\\' << ch;
+    } else if (ch == '\n') {
+      out << "\\n";
+    } else if (ch == '\t') {
+      out << "\\t";
+    } else if (ch < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0') <<
+        (int) ch << std::dec << std::setfill(' ');
+    } else {
+      out << ch;
+    }
+  }
+  out << '"';
+  return out.str();
+}
+
+// a JSON member reporting an error, closing the case's object
+static std::string
+jsonError(const std::string &message) {
+  return ", \"error\": " + jsonString(message) + "}";
+}
+
+// the value at fraction p of the way through the sorted values
+static double
+percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  size_t index = std::min(sorted.size() - 1, (size_t) (p * sorted.size()));
+  return sorted[index];
+}
+
+static uint64_t
+inputOverruns(const KaMerge &merge) {
+  return merge.hQueue().nOverruns() + merge.vQueue().nOverruns() +
+    merge.burstQueue().nOverruns();
+}
+
+static uint64_t
+clientDrops(const KaMerge &merge) {
+  std::vector<IwrfFanoutServer::ClientStats> clients =
+    merge.netWriter().server().clientStats();
+  uint64_t nDropped = 0;
+  for (size_t ii = 0; ii < clients.size(); ii++) {
+    nDropped += clients[ii].droppedPackets;
+  }
+  return nDropped;
+}
+
+// Run one case, and return its results as a JSON object. Called in the
+// child process for the case.
+
+static std::string
+runCase(const BenchCase &bc, const BenchOptions &opts, int port,
+        int argc, char **argv) {
+
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(1);
+  json << "    {\"gates\": " << bc.nGates <<
+    ", \"cohere_iq_to_burst\": " << jsonBool(bc.cohere) <<
+    ", \"combine_every_second_gate\": " << jsonBool(bc.combine);
+
+  // later values in the file override earlier ones
+  std::ostringstream configText;
+  configText << opts.configText << "\n" <<
+    "gates " << bc.nGates << "\n" <<
+    "cohere_iq_to_burst " << jsonBool(bc.cohere) << "\n" <<
+    "combine_every_second_gate " << jsonBool(bc.combine) << "\n" <<
+    "iwrf_server_tcp_port " << port << "\n";
+  char configPath[] = "/tmp/KaMergeBench_XXXXXX";
+  int configFd = mkstemp(configPath);
+  if (configFd < 0) {
+    json << jsonError("cannot create configuration file");
+    return json.str();
+  }
+  std::string text = configText.str();
+  bool written = (write(configFd, text.data(), text.size()) ==
+                  (ssize_t) text.size());
+  close(configFd);
+  KaDrxConfig config(written ? configPath : "/dev/null");
+  unlink(configPath);
+  if (!written || !config.isValid()) {
+    json << jsonError("incomplete DRX configuration");
+    return json.str();
+  }
+
+  QCoreApplication app(argc, argv);
+
+  // The monitor is not started, since it reads the hardware; the merge
+  // reports its default status. Neither is deleted, since KaMerge stops its
+  // threads with terminate(); the process exits when the case is done.
+  KaMonitor *monitor = new KaMonitor("localhost", 8080);
+  KaMerge &merge = *new KaMerge(config, *monitor);
+  merge.start();
+
+  IwrfSink sink;
+  if (!sink.start(port, 5.0)) {
+    std::ostringstream message;
+    message << "cannot connect to IWRF port " << port;
+    json << jsonError(message.str());
+    return json.str();
+  }
+
+  int nSamplesBurst = (int) (config.burst_sample_width() *
+                             config.burst_sample_frequency() + 0.5);
+  double g0FreqHz = config.rcvr_cntr_freq();
+  if (g0FreqHz == KaDrxConfig::UNSET_DOUBLE) {
+    g0FreqHz = 0.0;
+  }
+  PulseFeeder feeder(merge, bc.nGates, nSamplesBurst, g0FreqHz,
+                     opts.maxQueued);
+
+  int64_t seqNum = feeder.runStep(0, WarmUpRate, WarmUpSecs);
+  sink.endStep(seqNum, DrainSecs);
+
+  json << ",\n     \"steps\": [";
+  for (size_t step = 0; step < opts.rates.size(); step++) {
+
+    double rate = opts.rates[step];
+    uint64_t inOverruns = inputOverruns(merge);
+    uint64_t outOverruns = merge.netWriter().queue().nOverruns();
+    uint64_t clientDropped = clientDrops(merge);
+
+    sink.beginStep(seqNum);
+    int64_t firstSeqNum = seqNum;
+    seqNum = feeder.runStep(seqNum, rate, opts.stepSecs);
+    SinkStats stats = sink.endStep(seqNum, DrainSecs);
+
+    int64_t nSent = seqNum - firstSeqNum;
+    double secs = stats.lastSecs - stats.firstSecs;
+    double pulsesPerSec = secs > 0.0 ? (stats.nPulses - 1) / secs : 0.0;
+    double mbPerSec = secs > 0.0 ?
+      (stats.lastBytes - stats.firstBytes) / secs / 1.0e6 : 0.0;
+    std::sort(stats.latencyUsecs.begin(), stats.latencyUsecs.end());
+
+    json << (step == 0 ? "\n" : ",\n") <<
+      "       {\"offered_pulses_per_sec\": ";
+    if (rate > 0.0) {
+      json << rate;
+    } else {
+      json << "null";
+    }
+    json <<
+      ", \"pulses_sent\": " << nSent <<
+      ", \"pulses_received\": " << stats.nPulses <<
+      ", \"pulses_per_sec\": " << pulsesPerSec <<
+      ", \"megabytes_per_sec\": " << std::setprecision(3) << mbPerSec <<
+      std::setprecision(1) <<
+      ",\n        \"drops\": {\"input_overruns\": " <<
+      inputOverruns(merge) - inOverruns <<
+      ", \"output_overruns\": " <<
+      merge.netWriter().queue().nOverruns() - outOverruns <<
+      ", \"client_dropped_packets\": " << clientDrops(merge) - clientDropped <<
+      ", \"missing_pulses\": " << nSent - stats.nPulses <<
+      ", \"lost_packets\": " << stats.nLostPackets << "}" <<
+      ",\n        \"errors\": {\"framing\": " << stats.nFramingErrors <<
+      ", \"sequence\": " << stats.nSeqErrors << "}" <<
+      ",\n        \"latency_usecs\": {\"p50\": " <<
+      percentile(stats.latencyUsecs, 0.5) <<
+      ", \"p90\": " << percentile(stats.latencyUsecs, 0.9) <<
+      ", \"p99\": " << percentile(stats.latencyUsecs, 0.99) <<
+      ", \"p999\": " << percentile(stats.latencyUsecs, 0.999) <<
+      ", \"max\": " <<
+      (stats.latencyUsecs.empty() ? 0.0 : stats.latencyUsecs.back()) <<
+      "}}";
+
+    std::cerr << std::fixed << "  " << bc.nGates << " gates, cohere " << bc.cohere <<
+      ", combine " << bc.combine << ": offered " <<
+      (rate > 0.0 ? std::to_string((int64_t) rate) : std::string("max")) <<
+      ", sustained " << (int64_t) pulsesPerSec << " pulses/s, " <<
+      std::setprecision(1) << mbPerSec << " MB/s, " <<
+      nSent - stats.nPulses << " missing, p99 latency " <<
+      percentile(stats.latencyUsecs, 0.99) << " us" << std::endl;
+  }
+  json << "]}";
+  return json.str();
+
+}
+
+// Run a case in a child process, and return its JSON results
+
+static std::string
+forkCase(const BenchCase &bc, const BenchOptions &opts, int port,
+         int argc, char **argv) {
+
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+  std::cout.flush();
+  std::cerr.flush();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    // only the parent writes to stdout, which may be the JSON results
+    close(fds[0]);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    std::string result = runCase(bc, opts, port, argc, argv);
+    size_t done = 0;
+    while (done < result.size()) {
+      ssize_t n = write(fds[1], result.data() + done, result.size() - done);
+      if (n <= 0) {
+        break;
+      }
+      done += n;
+    }
+    close(fds[1]);
+    // the merge threads are not stopped; the process just goes
+    _exit(0);
+  }
+
+  close(fds[1]);
+  std::string result;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0 ||
+         (n < 0 && errno == EINTR)) {
+    if (n > 0) {
+      result.append(buf, n);
+    }
+  }
+  close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  if (result.empty()) {
+    std::ostringstream json;
+    json << "    {\"gates\": " << bc.nGates <<
+      ", \"cohere_iq_to_burst\": " << jsonBool(bc.cohere) <<
+      ", \"combine_every_second_gate\": " << jsonBool(bc.combine) <<
+      jsonError("benchmark process failed, status " +
+                std::to_string(status));
+    result = json.str();
+  }
+  return result;
+
+}
+
+// parse a comma separated list of numbers
+template <typename T>
+static bool
+parseList(const std::string &text, std::vector<T> &vals) {
+  vals.clear();
+  std::istringstream in(text);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    std::istringstream itemIn(item);
+    T val;
+    if (!(itemIn >> val)) {
+      return false;
+    }
+    vals.push_back(val);
+  }
+  return !vals.empty();
+}
+
+int
+main(int argc, char *argv[]) {
+
+  std::string drxConfig;
+  std::string gatesList("250,500,1000,2000");
+  std::string ratesList("1000,2000,5000,10000,20000,50000,0");
+  std::string cohereList("0,1");
+  std::string combineList("0,1");
+  std::string output;
+  BenchOptions opts;
+  opts.stepSecs = 2.0;
+  opts.port = 12090;
+  opts.maxQueued = 0;
+
+  po::options_description descripts("Options");
+  descripts.add_options()
+    ("help", "Describe options")
+    ("drxConfig", po::value<std::string>(&drxConfig),
+     "DRX configuration file (default: a typical one built in)")
+    ("gates", po::value<std::string>(&gatesList),
+     "Gate counts to run (default 250,500,1000,2000)")
+    ("rates", po::value<std::string>(&ratesList),
+     "Pulse rates to step through, pulses/s; 0 is as fast as the merge "
+     "takes them (default 1000,2000,5000,10000,20000,50000,0)")
+    ("cohere", po::value<std::string>(&cohereList),
+     "cohere_iq_to_burst values to run (default 0,1)")
+    ("combine", po::value<std::string>(&combineList),
+     "combine_every_second_gate values to run (default 0,1)")
+    ("seconds", po::value<double>(&opts.stepSecs),
+     "Seconds at each rate (default 2.0)")
+    ("port", po::value<int>(&opts.port),
+     "First IWRF TCP port; each case uses the next (default 12090)")
+    ("maxQueued", po::value<size_t>(&opts.maxQueued),
+     "Most pulses queued for the merge on each channel at rate 0; 0 is "
+     "the merge queue size (default 0)")
+    ("output", po::value<std::string>(&output),
+     "File for the JSON results (default stdout)")
+    ;
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, descripts), vm);
+    po::notify(vm);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  if (vm.count("help")) {
+    std::cout << "Usage: " << argv[0] << " [OPTION]..." << std::endl;
+    std::cout << descripts << std::endl;
+    return 0;
+  }
+
+  std::vector<int> gates;
+  std::vector<int> cohere;
+  std::vector<int> combine;
+  if (!parseList(gatesList, gates) || !parseList(ratesList, opts.rates) ||
+      !parseList(cohereList, cohere) || !parseList(combineList, combine) ||
+      opts.stepSecs <= 0.0) {
+    std::cerr << "Bad option value; see --help" << std::endl;
+    return 1;
+  }
+
+  opts.configText = DefaultConfig;
+  if (!drxConfig.empty()) {
+    std::ifstream in(drxConfig.c_str());
+    if (!in) {
+      std::cerr << "Cannot read " << drxConfig << std::endl;
+      return 1;
+    }
+    std::ostringstream text;
+    text << in.rdbuf();
+    opts.configText = text.str();
+  }
+
+  std::vector<BenchCase> cases;
+  for (size_t gg = 0; gg < gates.size(); gg++) {
+    for (size_t ch = 0; ch < cohere.size(); ch++) {
+      for (size_t cb = 0; cb < combine.size(); cb++) {
+        BenchCase bc;
+        bc.nGates = gates[gg];
+        bc.cohere = cohere[ch] != 0;
+        bc.combine = combine[cb] != 0;
+        cases.push_back(bc);
+      }
+    }
+  }
+
+  char host[256];
+  if (gethostname(host, sizeof(host)) != 0) {
+    strcpy(host, "unknown");
+  }
+  host[sizeof(host) - 1] = '\0';
+  time_t now = time(NULL);
+  char nowText[32];
+  strftime(nowText, sizeof(nowText), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+  std::ostringstream json;
+  json << "{\n  \"benchmark\": \"KaMergeBench\",\n" <<
+    "  \"host\": " << jsonString(host) << ",\n" <<
+    "  \"time\": " << jsonString(nowText) << ",\n" <<
+    "  \"drx_config\": " <<
+    jsonString(drxConfig.empty() ? "built-in" : drxConfig) << ",\n" <<
+    "  \"seconds_per_step\": " << opts.stepSecs << ",\n" <<
+    "  \"cases\": [\n";
+  for (size_t ii = 0; ii < cases.size(); ii++) {
+    std::cerr << "Case " << ii + 1 << " of " << cases.size() << std::endl;
+    json << forkCase(cases[ii], opts, opts.port + ii, argc, argv) <<
+      (ii + 1 < cases.size() ? ",\n" : "\n");
+  }
+  json << "  ]\n}\n";
+
+  if (output.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(output.c_str());
+    out << json.str();
+    if (!out) {
+      std::cerr << "Cannot write " << output << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+
+}
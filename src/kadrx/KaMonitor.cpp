@@ -13,12 +13,12 @@
 
 #include <QtCore/QDateTime>
 #include <QtCore/QTimer>
-#include <QtCore/QMutexLocker>
 
 #include <iomanip>
 #include <cmath>
 #include <vector>
 #include <deque>
+#include <unistd.h>
 
 #include <logx/Logging.h>
 
@@ -136,9 +136,28 @@ static const QEA_Cal_Val  QEA_Cal_VChan[] = {
 
 static const int QEA_CalLen_VChan = (sizeof(QEA_Cal_VChan) / (sizeof(QEA_Cal_Val)));
 
+// Return true iff the given host name refers to this host
+static bool
+_IsLocalHost(const std::string & host) {
+    if (host == "localhost" || host == "127.0.0.1") {
+        return(true);
+    }
+    char myName[256];
+    if (gethostname(myName, sizeof(myName)) == 0) {
+        myName[sizeof(myName) - 1] = '\0';
+        // Compare the short names, so "myhost" matches "myhost.domain"
+        std::string shortHost = host.substr(0, host.find('.'));
+        std::string myShortName(myName);
+        myShortName = myShortName.substr(0, myShortName.find('.'));
+        return(shortHost == myShortName);
+    }
+    return(false);
+}
+
 KaMonitor::KaMonitor(std::string xmitdHost, int xmitdPort) :
     QThread(),
-    _mutex(QMutex::Recursive),
+    _snapshot(KaMonitorSnapshot()),
+    _nUpdates(0),
     _procEnclosureTemps(),
     _procDrxTemps(),
     _txEnclosureTemps(),
@@ -159,7 +178,12 @@ KaMonitor::KaMonitor(std::string xmitdHost, int xmitdPort) :
     _osc2Frequency(0),
     _osc3Frequency(0),
     _xmitClient(xmitdHost, xmitdPort),
+    _xmitStatusShm(0),
     _xmitStatus() {
+    // ka_xmitd shares its status in memory with local processes
+    if (_IsLocalHost(xmitdHost)) {
+        _xmitStatusShm = new XmitdStatusShm(false);
+    }
 }
 
 KaMonitor::~KaMonitor() {
@@ -167,131 +191,111 @@ KaMonitor::~KaMonitor() {
     if (! wait(5000)) {
         ELOG << "KaMonitor thread failed to stop in 5 seconds. Exiting anyway.";
     }
+    delete(_xmitStatusShm);
 }
 
 float
 KaMonitor::procEnclosureTemp() const {
-    QMutexLocker locker(&_mutex);
-    return _dequeAverage(_procEnclosureTemps);
+    return snapshot().procEnclosureTemp;
 }
 
 float
 KaMonitor::procDrxTemp() const {
-    QMutexLocker locker(&_mutex);
-    return _dequeAverage(_procDrxTemps);
+    return snapshot().procDrxTemp;
 }
 
 float
 KaMonitor::txEnclosureTemp() const {
-    QMutexLocker locker(&_mutex);
-    return _dequeAverage(_txEnclosureTemps);
+    return snapshot().txEnclosureTemp;
 }
 
 float
 KaMonitor::rxTopTemp() const {
-    QMutexLocker locker(&_mutex);
-    return _dequeAverage(_rxTopTemps);
+    return snapshot().rxTopTemp;
 }
 
 float
 KaMonitor::rxBackTemp() const {
-    QMutexLocker locker(&_mutex);
-    return _dequeAverage(_rxBackTemps);
+    return snapshot().rxBackTemp;
 }
 
 float
 KaMonitor::rxFrontTemp() const {
-    QMutexLocker locker(&_mutex);
-    return _dequeAverage(_rxFrontTemps);
+    return snapshot().rxFrontTemp;
 }
 
 float
 KaMonitor::hTxPowerRaw() const {
-    QMutexLocker locker(&_mutex);
-    return _hTxPowerRaw;
+    return snapshot().hTxPowerRaw;
 }
 
 float
 KaMonitor::vTxPowerRaw() const {
-    QMutexLocker locker(&_mutex);
-    return _vTxPowerRaw;
+    return snapshot().vTxPowerRaw;
 }
 
 float
 KaMonitor::testTargetPowerRaw() const {
-    QMutexLocker locker(&_mutex);
-    return _testTargetPowerRaw;
+    return snapshot().testTargetPowerRaw;
 }
 
 float
 KaMonitor::psVoltage() const {
-    QMutexLocker locker(&_mutex);
-    return _psVoltage;
+    return snapshot().psVoltage;
 }
 
 bool
 KaMonitor::wgPressureGood() const {
-    QMutexLocker locker(&_mutex);
-    return _wgPressureGood;
+    return snapshot().wgPressureGood;
 }
 
 bool
 KaMonitor::locked100MHz() const {
-    QMutexLocker locker(&_mutex);
-    return _locked100MHz;
+    return snapshot().locked100MHz;
 }
 
 bool
 KaMonitor::gpsTimeServerGood() const {
-    QMutexLocker locker(&_mutex);
-    return _gpsTimeServerGood;
+    return snapshot().gpsTimeServerGood;
 }
 
 XmitdStatus
 KaMonitor::transmitterStatus() const {
-    QMutexLocker locker(&_mutex);
-    return _xmitStatus;
+    return snapshot().xmitStatus;
 }
 
 uint64_t
 KaMonitor::osc0Frequency() const {
-    QMutexLocker locker(&_mutex);
-    return(_osc0Frequency);
+    return(snapshot().osc0Frequency);
 }
 
 uint64_t
 KaMonitor::osc1Frequency() const {
-    QMutexLocker locker(&_mutex);
-    return(_osc1Frequency);
+    return(snapshot().osc1Frequency);
 }
 
 bool
 KaMonitor::afcIsTracking() const {
-    QMutexLocker locker(&_mutex);
-    return(_afcIsTracking);
+    return(snapshot().afcIsTracking);
 }
 
 double
 KaMonitor::g0AvgPower() const {
-    QMutexLocker locker(&_mutex);
-    return(_g0AvgPower);
+    return(snapshot().g0AvgPower);
 }
 uint64_t
 KaMonitor::osc2Frequency() const {
-    QMutexLocker locker(&_mutex);
-    return(_osc2Frequency);
+    return(snapshot().osc2Frequency);
 }
 
 uint64_t
 KaMonitor::osc3Frequency() const {
-    QMutexLocker locker(&_mutex);
-    return(_osc3Frequency);
+    return(snapshot().osc3Frequency);
 }
 
 uint64_t
 KaMonitor::derivedTxFrequency() const {
-    QMutexLocker locker(&_mutex);
-    return(2 * _osc2Frequency + _osc0Frequency + _osc3Frequency + 25000000);
+    return(snapshot().derivedTxFrequency());
 }
 
 void
@@ -301,6 +305,8 @@ KaMonitor::run() {
     // Since we have no event loop, allow thread termination via the terminate()
     // method.
     setTerminationEnabled(true);
+
+    _threadPolicy.applyToCurrentThread();
   
     while (true) {
         // Sleep if necessary to get ~1 second between updates
@@ -320,13 +326,14 @@ KaMonitor::run() {
         
         // Get oscillator frequencies
         _getAfcStatus();
+
+        // Make the new values available to readers, all at once
+        _publishSnapshot();
     }
 }
 
 void
 KaMonitor::_getMultiIoValues() {
-    QMutexLocker locker(&_mutex);
-
     KaPmc730 & pmc730 = KaPmc730::theKaPmc730();
     // Get data from analog channels 0-9 on the PMC-730 multi-IO card
     std::vector<float> analogData = pmc730.readAnalogChannels(0, 9);
@@ -370,14 +377,14 @@ KaMonitor::_getMultiIoValues() {
         "V: " << _vTxPowerRaw << " dBm, " <<
         "H: " << _hTxPowerRaw << " dBm";
     DLOG << std::fixed << std::setprecision(1) << 
-        "rx front: " << rxFrontTemp() <<  " C, " << 
-        "back: " << rxBackTemp() << " C, " << 
-        "top: " << rxTopTemp() << " C";
+        "rx front: " << _dequeAverage(_rxFrontTemps) <<  " C, " << 
+        "back: " << _dequeAverage(_rxBackTemps) << " C, " << 
+        "top: " << _dequeAverage(_rxTopTemps) << " C";
     DLOG << std::fixed << std::setprecision(1) << 
-        "tx enclosure: " << txEnclosureTemp() << " C";
+        "tx enclosure: " << _dequeAverage(_txEnclosureTemps) << " C";
     DLOG << std::fixed << std::setprecision(1) << 
-        "proc enclosure: " << procEnclosureTemp() << " C, " << 
-        "drx: " << procDrxTemp() << " C";
+        "proc enclosure: " << _dequeAverage(_procEnclosureTemps) << " C, " << 
+        "drx: " << _dequeAverage(_procDrxTemps) << " C";
     DLOG << std::fixed << std::setprecision(2) << 
         "5V PS: " << _psVoltage << " V";
     DLOG << "N2 waveguide pres OK: " << (_wgPressureGood ? "true" : "false");
@@ -387,19 +394,20 @@ KaMonitor::_getMultiIoValues() {
 
 void
 KaMonitor::_getXmitStatus() {
-    // Get the status first (which may take a little while under some 
-    // circumstances), then get the mutex and set our member variable. This 
-    // way, we don't have the mutex locked very long at all....
+    // This may take a little while under some circumstances, but readers
+    // see only published snapshots, so they are not held up.
+    XmitdShmStatus shmStatus;
+    if (_xmitStatusShm && _xmitStatusShm->read(shmStatus)) {
+        _xmitStatus = XmitdStatus(shmStatus);
+        return;
+    }
     XmitdStatus xmitStatus;
     _xmitClient.getStatus(xmitStatus);
-    
-    QMutexLocker locker(&_mutex);
     _xmitStatus = xmitStatus;
 }
 
 void
 KaMonitor::_getAfcStatus() {
-    QMutexLocker locker(&_mutex);
     KaOscControl::theControl().getOscFrequencies(_osc0Frequency,
             _osc1Frequency, _osc2Frequency, _osc3Frequency);
     _afcIsTracking = KaOscControl::theControl().afcIsTracking();
@@ -412,6 +420,37 @@ KaMonitor::_getAfcStatus() {
         std::setprecision(2) << ", 3: " << _osc3Frequency / 1.0e6 << " MHz";
 }
 
+void
+KaMonitor::_publishSnapshot() {
+    KaMonitorSnapshot snap;
+    snap.version = ++_nUpdates;
+    snap.updateTime = time(0);
+    snap.procEnclosureTemp = _dequeAverage(_procEnclosureTemps);
+    snap.procDrxTemp = _dequeAverage(_procDrxTemps);
+    snap.txEnclosureTemp = _dequeAverage(_txEnclosureTemps);
+    snap.rxTopTemp = _dequeAverage(_rxTopTemps);
+    snap.rxBackTemp = _dequeAverage(_rxBackTemps);
+    snap.rxFrontTemp = _dequeAverage(_rxFrontTemps);
+    snap.hTxPowerRaw = _hTxPowerRaw;
+    snap.vTxPowerRaw = _vTxPowerRaw;
+    snap.testTargetPowerRaw = _testTargetPowerRaw;
+    snap.psVoltage = _psVoltage;
+    snap.wgPressureGood = _wgPressureGood;
+    snap.locked100MHz = _locked100MHz;
+    snap.gpsTimeServerGood = _gpsTimeServerGood;
+    snap.afcIsTracking = _afcIsTracking;
+    snap.g0AvgPower = _g0AvgPower;
+    snap.osc0Frequency = _osc0Frequency;
+    snap.osc1Frequency = _osc1Frequency;
+    snap.osc2Frequency = _osc2Frequency;
+    snap.osc3Frequency = _osc3Frequency;
+    snap.xmitStatus = _xmitStatus;
+    if (! _snapshot.publish(snap)) {
+        WLOG << "Status readers hold every snapshot slot; skipping update " <<
+            snap.version;
+    }
+}
+
 double
 KaMonitor::_lookupQEAPower(const QEA_Cal_Val *qea_cal, unsigned len, double voltage) {
     // If we're below the lowest voltage in the cal table, just return the
@@ -9,12 +9,16 @@
 #define KAMONITOR_H_
 
 #include <stdint.h>
+#include <ctime>
 #include <deque>
 
 #include <QtCore/QThread>
-#include <QtCore/QMutex>
 
 #include <XmitClient.h>
+#include <XmitdStatusShm.h>
+
+#include "SnapshotBuffer.h"
+#include "ThreadPolicy.h"
 
 class KaMonitorPriv;
 typedef struct {
@@ -22,16 +26,82 @@ typedef struct {
     float voltage;
 } QEA_Cal_Val;
 
+/// All of the status gathered by KaMonitor in one update. A snapshot is
+/// never changed once published, so its values are consistent with each
+/// other.
+struct KaMonitorSnapshot {
+    KaMonitorSnapshot() :
+        version(0),
+        updateTime(0),
+        procEnclosureTemp(-99.9),
+        procDrxTemp(-99.9),
+        txEnclosureTemp(-99.9),
+        rxTopTemp(-99.9),
+        rxBackTemp(-99.9),
+        rxFrontTemp(-99.9),
+        hTxPowerRaw(0.0),
+        vTxPowerRaw(0.0),
+        testTargetPowerRaw(0.0),
+        psVoltage(0.0),
+        wgPressureGood(false),
+        locked100MHz(false),
+        gpsTimeServerGood(false),
+        afcIsTracking(false),
+        g0AvgPower(-999.0),
+        osc0Frequency(0),
+        osc1Frequency(0),
+        osc2Frequency(0),
+        osc3Frequency(0),
+        xmitStatus() {}
+
+    /// Transmitter frequency, derived from frequencies of oscillators 0-3,
+    /// in Hz.
+    uint64_t derivedTxFrequency() const {
+        return(2 * osc2Frequency + osc0Frequency + osc3Frequency + 25000000);
+    }
+
+    uint64_t version;           ///< update count, 0 before the first update
+    time_t updateTime;          ///< time of the update, 0 before the first
+    float procEnclosureTemp;    ///< processor enclosure temperature, C
+    float procDrxTemp;          ///< temperature near the DRX computer, C
+    float txEnclosureTemp;      ///< transmitter enclosure temperature, C
+    float rxTopTemp;            ///< receiver enclosure top temperature, C
+    float rxBackTemp;           ///< receiver enclosure back temperature, C
+    float rxFrontTemp;          ///< receiver enclosure front temperature, C
+    float hTxPowerRaw;          ///< H tx pulse power, dBm
+    float vTxPowerRaw;          ///< V tx pulse power, dBm
+    float testTargetPowerRaw;   ///< test target power, dBm
+    float psVoltage;            ///< 5V power supply voltage, V
+    bool wgPressureGood;        ///< N2 waveguide pressure good?
+    bool locked100MHz;          ///< 100 MHz oscillator locked?
+    bool gpsTimeServerGood;     ///< GPS NTP time server good?
+    bool afcIsTracking;         ///< AFC tracking (vs. coarse search)?
+    double g0AvgPower;          ///< last g0 average power used by AFC, dBm
+    uint64_t osc0Frequency;     ///< oscillator 0 frequency, Hz
+    uint64_t osc1Frequency;     ///< oscillator 1 frequency, Hz
+    uint64_t osc2Frequency;     ///< oscillator 2 frequency, Hz
+    uint64_t osc3Frequency;     ///< oscillator 3 frequency, Hz
+    XmitdStatus xmitStatus;     ///< transmitter status from ka_xmitd
+};
+
 
 /// QThread object which handles Ka monitoring, regularly sampling all status 
 /// available via the multi-IO card as well as transmitter status information 
 /// obtained from the ka_xmitd process.
+///
+/// After each round of sampling, the results are published together as a
+/// KaMonitorSnapshot. Readers get a copy of the latest snapshot without
+/// locking, so they never wait for the slow hardware and ka_xmitd reads.
+/// Callers wanting more than one value should take one snapshot() rather
+/// than call the individual getters, so that the values are consistent.
 class KaMonitor : public QThread {
 	Q_OBJECT
 public:
     /**
      * Construct a KaMonitor which will get transmitter status from ka_xmitd
-     * running on host xmitdHost/port xmitdPort.
+     * running on host xmitdHost/port xmitdPort. If ka_xmitd is on this host,
+     * status is read from its shared memory segment, with XML-RPC used only
+     * when the segment is unavailable.
      */
     KaMonitor(std::string xmitdHost, int xmitdPort);
     
@@ -39,6 +109,12 @@ public:
     
     void run();
 
+    /**
+     * Return a copy of the latest status snapshot.
+     * @return a copy of the latest status snapshot
+     */
+    KaMonitorSnapshot snapshot() const { return _snapshot.read(); }
+
     /**
      * Return processor enclosure temperature, C.
      * @return processor enclosure temperature, C
@@ -153,6 +229,15 @@ public:
      * 0-3, in Hz.
      */
     uint64_t derivedTxFrequency() const;
+
+    /**
+     * Set the CPU set and scheduling for the monitor thread. Must be called
+     * before the thread is started.
+     * @param policy the policy for the monitor thread
+     */
+    void setThreadPolicy(const ThreadPolicy & policy) {
+        _threadPolicy = policy;
+    }
     
 private:
     /**
@@ -179,13 +264,17 @@ private:
     void _getMultiIoValues();
     /**
      * Get status from the transmitter and put it in our local _xmitStatus
-     * member.
+     * member. Shared memory is used if available, otherwise XML-RPC.
      */
     void _getXmitStatus();
     /**
      * Get oscillator frequencies from the singleton KaOscControl.
      */
     void _getAfcStatus();
+    /**
+     * Publish a new snapshot of our current values.
+     */
+    void _publishSnapshot();
     /**
      * Return the average of values in a deque<float>, or -99.9 if the deque
      * is empty.
@@ -194,9 +283,15 @@ private:
      */
     static float _dequeAverage(const std::deque<float> & list);
     
-    /// Thread access mutex (mutable so we can lock the mutex even in const
-    /// methods)
-    mutable QMutex _mutex;
+    /// The latest published status. All of the members below are used by
+    /// the monitor thread alone.
+    SnapshotBuffer<KaMonitorSnapshot> _snapshot;
+
+    /// Number of snapshots published
+    uint64_t _nUpdates;
+
+    /// CPU set and scheduling for the monitor thread
+    ThreadPolicy _threadPolicy;
     
     /// window size for moving temperature averages
     static const unsigned int TEMP_AVERAGING_LEN = 20;
@@ -241,6 +336,8 @@ private:
     
     /// XML-RPC access to ka_xmitd for its status
     XmitClient _xmitClient;
+    /// Shared memory access to ka_xmitd status, when ka_xmitd is local
+    XmitdStatusShm * _xmitStatusShm;
     XmitdStatus _xmitStatus;
 };
 
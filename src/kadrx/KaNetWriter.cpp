@@ -0,0 +1,329 @@
+#include "KaNetWriter.h"
+#include <logx/Logging.h>
+#include <radar/iwrf_data.h>
+#include <cstring>
+#include <pthread.h>
+#include <toolsa/pmu.h>
+
+LOGGING("KaNetWriter")
+
+// Longest time to sleep in the server when there is nothing to do,
+// milliseconds. Sleeps are normally cut short by write() or by socket
+// activity.
+static const int IdleWaitMs = 1000;
+
+// The metadata packets sent to new clients when they connect, in the
+// order they are sent
+static const int MetaDataIds[] = {
+  IWRF_RADAR_INFO_ID,
+  IWRF_TS_PROCESSING_ID,
+  IWRF_CALIBRATION_ID
+};
+static const int NMetaDataIds = sizeof(MetaDataIds) / sizeof(MetaDataIds[0]);
+
+///////////////////////////////////////////////////////////////////////////
+
+KaNetWriter::KaNetWriter(const KaDrxConfig& config) :
+        QThread(),
+        _sleeping(false),
+        _blackBox(NULL),
+        _archiver(NULL),
+        _threadPolicy(config, "iwrf_writer")
+{
+
+  // queue of batches from KaMerge
+
+  int queueSize = 1000;
+  if (config.iwrf_queue_size() != KaDrxConfig::UNSET_INT) {
+    queueSize = config.iwrf_queue_size();
+  }
+  _queue = new SpscRing<PacketBatcher>(queueSize);
+  _spare = new PacketBatcher;
+
+  // IWRF server, sending the packets we publish into the ring to any
+  // number of clients
+
+  int ringMegabytes = 64;
+  int maxClients = 4;
+  IwrfFanoutServer::SlowClientPolicy policy = IwrfFanoutServer::DROP_OLDEST;
+  if (config.iwrf_ring_megabytes() != KaDrxConfig::UNSET_INT) {
+    ringMegabytes = config.iwrf_ring_megabytes();
+  }
+  if (config.iwrf_max_clients() != KaDrxConfig::UNSET_INT) {
+    maxClients = config.iwrf_max_clients();
+  }
+  if (config.iwrf_slow_client_policy() != KaDrxConfig::UNSET_STRING &&
+      !IwrfFanoutServer::parsePolicy(config.iwrf_slow_client_policy(),
+                                     policy)) {
+    ELOG << "Bad iwrf_slow_client_policy '" <<
+        config.iwrf_slow_client_policy() << "', using " <<
+        IwrfFanoutServer::policyName(policy);
+  }
+
+  // index one chunk per 4 kB of ring, which is plenty since the smallest
+  // packets we send are the metadata packets
+  size_t ringBytes = (size_t) ringMegabytes * 1024 * 1024;
+  _ring = new IwrfPacketRing(ringBytes, ringBytes / 4096);
+  _server = new IwrfFanoutServer(config.iwrf_server_tcp_port(), *_ring,
+                                 policy, maxClients);
+  ILOG << "IWRF server on port " << config.iwrf_server_tcp_port() <<
+      ", queue " << queueSize << " batches, ring " << ringMegabytes <<
+      " MB, max clients " << maxClients << ", slow client policy " <<
+      IwrfFanoutServer::policyName(policy);
+
+  // black box, holding the latest output to be written to a file when
+  // something goes wrong
+
+  if (config.blackbox_seconds() != KaDrxConfig::UNSET_DOUBLE &&
+      config.blackbox_seconds() > 0.0) {
+    int blackBoxMegabytes = 256;
+    std::string blackBoxDir = "/tmp";
+    if (config.blackbox_megabytes() != KaDrxConfig::UNSET_INT) {
+      blackBoxMegabytes = config.blackbox_megabytes();
+    }
+    if (config.blackbox_dir() != KaDrxConfig::UNSET_STRING) {
+      blackBoxDir = config.blackbox_dir();
+    }
+    _blackBox = new IwrfBlackBox(config, config.blackbox_seconds(),
+                                 (size_t) blackBoxMegabytes * 1024 * 1024,
+                                 blackBoxDir);
+    ILOG << "IWRF black box keeps " << config.blackbox_seconds() <<
+        " s in 2 x " << blackBoxMegabytes << " MB, dumps to " << blackBoxDir;
+  }
+
+  // continuous archive, written by its own thread
+
+  if (config.archive_dir() != KaDrxConfig::UNSET_STRING &&
+      !config.archive_dir().empty()) {
+    _archiver = new IwrfArchiver(config);
+    _archiver->start();
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+KaNetWriter::~KaNetWriter()
+
+{
+  // First stop the thread if it's running
+  terminate();
+  if (! wait(5000)) {
+    ELOG << "KaNetWriter thread failed to stop in 5 seconds.";
+  }
+
+  delete _server;
+  delete _blackBox;
+
+  // Let go of the batches in the ring. Those the archiver still holds are
+  // deleted with it, after it completes its current file.
+  _ring->clear();
+  PacketBatcher *batch;
+  while ((batch = _ring->takeDropped()) != NULL) {
+    _release(batch);
+  }
+  delete _ring;
+  delete _archiver;
+
+  delete _queue;
+  delete _spare;
+  for (size_t ii = 0; ii < _free.size(); ii++) {
+    delete _free[ii];
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Thread run method
+
+void KaNetWriter::run()
+
+{
+
+  // Since we have no event loop,
+  // allow thread termination via the terminate() method.
+
+  setTerminationEnabled(true);
+
+  _threadPolicy.applyToCurrentThread();
+
+  _timer.busy();
+
+  while (true) {
+
+    // publish everything queued, then send what we can to the clients
+
+    int nRead = 0;
+    PacketBatcher *batch;
+    while ((batch = _queue->read(_spare)) != NULL) {
+      batch->hold();
+      _publish(batch);
+      if (_archiver) {
+        batch->hold();
+        _release(_archiver->write(batch));
+      }
+      _release(batch);
+      _spare = _freeBatch();
+      nRead++;
+    }
+    if (_blackBox) {
+      _blackBox->service();
+    }
+    if (nRead > 0) {
+      _server->service(0);
+      continue;
+    }
+
+    // Nothing queued, so sleep in the server until a socket needs
+    // attention or write() wakes us. The fences pair with the one in
+    // write(), so that either we see the new batch or write() sees that
+    // we are sleeping.
+
+    _sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_queue->depth() == 0) {
+      PMU_auto_register("waiting for IWRF data");
+      _timer.idle();
+      _server->service(IdleWaitMs);
+      _timer.busy();
+    }
+    _sleeping.store(false, std::memory_order_relaxed);
+
+    pthread_testcancel();
+
+  } // while
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// queue a batch of packets for the clients
+// called by the KaMerge thread
+// Returns a batch object for recycling
+
+PacketBatcher *KaNetWriter::write(PacketBatcher *batch)
+{
+  PacketBatcher *retVal = _queue->write(batch);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (retVal != batch && _sleeping.load(std::memory_order_relaxed)) {
+    _server->wake();
+  }
+  return retVal;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// publish a batch to the ring, which holds it rather than a copy, keeping
+// any metadata packets it holds
+
+void KaNetWriter::_publish(PacketBatcher *batch)
+{
+
+  if (batch->nPackets() == 0) {
+    return;
+  }
+
+  _saveMetaData(*batch);
+
+  if (_server->publish(batch) == 0) {
+    batch->hold();
+  }
+  PacketBatcher *dropped;
+  while ((dropped = _ring->takeDropped()) != NULL) {
+    _release(dropped);
+  }
+
+  if (_blackBox) {
+    struct iovec iov;
+    iov.iov_base = const_cast<char *>(batch->data());
+    iov.iov_len = batch->len();
+    _blackBox->append(&iov, 1, batch->nPackets());
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// count a reader finished with a batch, and keep the batch for reuse once
+// none are left. Batches which were never shared, such as the archiver's
+// initial spares, are free at once.
+
+void KaNetWriter::_release(PacketBatcher *batch)
+{
+  if (batch->nHolders() > 0 && batch->release() > 0) {
+    return;
+  }
+  _free.push_back(batch);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// a batch for the queue to hand back to KaMerge, reused if one is free
+
+PacketBatcher *KaNetWriter::_freeBatch()
+{
+  if (_free.empty()) {
+    return new PacketBatcher;
+  }
+  PacketBatcher *batch = _free.back();
+  _free.pop_back();
+  return batch;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// keep the latest copy of each metadata packet in a batch, and update the
+// greeting sent to new clients if any have changed
+
+void KaNetWriter::_saveMetaData(const PacketBatcher &batch)
+{
+
+  bool changed = false;
+  size_t pos = 0;
+  while (pos + sizeof(iwrf_packet_info_t) <= batch.len()) {
+    iwrf_packet_info_t info;
+    memcpy(&info, batch.data() + pos, sizeof(info));
+    if (info.len_bytes < (int) sizeof(info) ||
+        pos + info.len_bytes > batch.len()) {
+      WLOG << "Bad IWRF packet length " << info.len_bytes <<
+          " in batch, not checked for metadata";
+      break;
+    }
+    for (int ii = 0; ii < NMetaDataIds; ii++) {
+      if (info.id == MetaDataIds[ii]) {
+        const char *packet = batch.data() + pos;
+        _metaData[info.id].assign(packet, packet + info.len_bytes);
+        changed = true;
+      }
+    }
+    pos += info.len_bytes;
+  }
+
+  if (!changed) {
+    return;
+  }
+
+  struct iovec iov[NMetaDataIds];
+  int iovCnt = 0;
+  for (int ii = 0; ii < NMetaDataIds; ii++) {
+    std::vector<char> &packet = _metaData[MetaDataIds[ii]];
+    if (!packet.empty()) {
+      iov[iovCnt].iov_base = &packet[0];
+      iov[iovCnt].iov_len = packet.size();
+      iovCnt++;
+    }
+  }
+  _server->setGreeting(iov, iovCnt, iovCnt);
+  if (_blackBox) {
+    _blackBox->setMetaData(iov, iovCnt);
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ask the black box to write the latest output to a file
+// safe to call from any thread
+
+bool KaNetWriter::triggerBlackBox(const std::string &reason) const
+{
+  if (!_blackBox) {
+    return false;
+  }
+  _blackBox->trigger(reason);
+  return true;
+}
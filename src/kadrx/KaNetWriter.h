@@ -0,0 +1,145 @@
+#ifndef KA_NET_WRITER_H_
+#define KA_NET_WRITER_H_
+
+#include "KaDrxConfig.h"
+#include "SpscRing.h"
+#include "PacketBatcher.h"
+#include "IwrfPacketRing.h"
+#include "IwrfFanoutServer.h"
+#include "IwrfBlackBox.h"
+#include "IwrfArchiver.h"
+#include "StageTimer.h"
+#include "ThreadPolicy.h"
+#include <QThread>
+#include <atomic>
+#include <map>
+#include <vector>
+
+/// KaNetWriter does all of the network I/O for the IWRF stream, in its own
+/// thread, so that a slow or stalled client can never hold up KaMerge.
+///
+/// KaMerge serializes IWRF packets into PacketBatcher objects and hands
+/// them over with write(), through a bounded lock-free SpscRing. write()
+/// never blocks: if the queue is full, the batch is dropped and counted as
+/// an overrun.
+///
+/// The writer thread publishes each batch to an IwrfPacketRing, which
+/// holds the batch itself rather than a copy, so that each packet is
+/// written to memory only when KaMerge serializes it. The thread also runs
+/// the IwrfFanoutServer which sends the ring to the clients. Batches are
+/// handed back to KaMerge for reuse once the ring has dropped them, and
+/// the archiver, if any, has written them. When the
+/// queue is empty, the thread sleeps in epoll, so it wakes at once for a
+/// new connection, a writable client, or the next write().
+///
+/// The latest radar info, time series processing and calibration packets
+/// are kept, and sent to each new client as soon as it connects.
+///
+/// If blackbox_seconds is set, the output is also recorded in an
+/// IwrfBlackBox, which writes the latest data to a file when
+/// triggerBlackBox() is called.
+///
+/// If archive_dir is set, each batch is then handed on to an IwrfArchiver,
+/// which writes the whole stream to disk in its own thread.
+///
+/// Since KaNetWriter does not use a Qt event loop, the thread should be
+/// stopped by calling its terminate() method.
+
+class KaNetWriter : public QThread {
+
+  Q_OBJECT
+
+public:
+
+  /**
+   * Constructor.
+   * @param config KaDrxConfig defining the desired configuration.
+   */
+
+  KaNetWriter(const KaDrxConfig& config);
+
+  /// Destructor
+
+  virtual ~KaNetWriter();
+
+  /// thread run method
+
+  void run();
+
+  // queue a batch of serialized packets for the clients
+  // called by the KaMerge thread
+  // Returns a batch object for recycling, which must be cleared before use
+
+  PacketBatcher *write(PacketBatcher *batch);
+
+  /// output queue, for occupancy and overrun statistics
+  const SpscRing<PacketBatcher> &queue() const { return *_queue; }
+
+  /// IWRF server, for client and packets per send call statistics
+  const IwrfFanoutServer &server() const { return *_server; }
+
+  /// busy and idle time of the writer thread, the send stage of the merge
+  const StageTimer &timer() const { return _timer; }
+
+  /// black box recording the output, or NULL if it is disabled
+  const IwrfBlackBox *blackBox() const { return _blackBox; }
+
+  // ask the black box to write the latest output to a file
+  // safe to call from any thread
+  // Returns false if the black box is disabled
+
+  bool triggerBlackBox(const std::string &reason) const;
+
+  /// archive writer, or NULL if archiving is disabled
+  const IwrfArchiver *archiver() const { return _archiver; }
+
+private:
+
+  void _publish(PacketBatcher *batch);
+  void _saveMetaData(const PacketBatcher &batch);
+  void _release(PacketBatcher *batch);
+  PacketBatcher *_freeBatch();
+
+  /// queue of batches from KaMerge, and the batch returned to it next
+
+  SpscRing<PacketBatcher> *_queue;
+  PacketBatcher *_spare;
+
+  /// batches no longer held by the ring or the archiver, used only by
+  /// the writer thread
+
+  std::vector<PacketBatcher *> _free;
+
+  /// set while the writer thread may be sleeping in the server, so that
+  /// write() knows to wake it
+
+  std::atomic<bool> _sleeping;
+
+  /// ring and server, used only by the writer thread
+
+  IwrfPacketRing *_ring;
+  IwrfFanoutServer *_server;
+
+  /// black box, fed by the writer thread, or NULL if disabled
+
+  IwrfBlackBox *_blackBox;
+
+  /// archive writer, fed by the writer thread, or NULL if disabled
+
+  IwrfArchiver *_archiver;
+
+  /// latest metadata packets, by packet id
+
+  std::map<int, std::vector<char> > _metaData;
+
+  /// CPU set and scheduling for the writer thread
+
+  ThreadPolicy _threadPolicy;
+
+  /// busy and idle time, written by the writer thread
+
+  StageTimer _timer;
+
+};
+
+#endif /* KA_NET_WRITER_H_ */
@@ -10,6 +10,7 @@
 #include "KaOscillator3.h"
 #include "QM2010_Oscillator.h"
 #include "TtyOscillator.h"
+#include "ThreadPolicy.h"
 
 #include <QThread>
 #include <QMutex>
@@ -187,6 +188,9 @@ private:
     
     /// Number of pulses dropped while coasting
     int64_t _coastingPulsesDropped;
+
+    /// CPU set and scheduling for our thread
+    ThreadPolicy _threadPolicy;
 };
 
 KaOscControl::KaOscControl(const KaDrxConfig & config, double maxDataLatency) {
@@ -270,7 +274,8 @@ KaOscControlPriv::KaOscControlPriv(const KaDrxConfig & config,
     _maxDataLatency(maxDataLatency),
     _inBlankingSector(false),
     _coastingEndPulse(0),
-    _coastingPulsesDropped(0) {
+    _coastingPulsesDropped(0),
+    _threadPolicy(config, "osc_control") {
     // Enable termination via terminate(), since we don't have a Qt event loop.
     setTerminationEnabled(true);
 
@@ -366,6 +371,7 @@ KaOscControlPriv::~KaOscControlPriv() {
 
 void
 KaOscControlPriv::run() {
+    _threadPolicy.applyToCurrentThread();
     while (true) {
         _mutex.lock();
         _newAverage.wait(&_mutex);
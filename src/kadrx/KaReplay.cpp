@@ -0,0 +1,821 @@
+#include "KaReplay.h"
+#include "BeamLease.h"
+#include <logx/Logging.h>
+#include <radar/iwrf_data.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <unistd.h>
+
+LOGGING("KaReplay")
+
+static const double RAD_TO_DEG = 57.29577951308092;
+
+// channel ids, as used by KaDrxPub
+static const int H_CHANNEL = 0;
+static const int V_CHANNEL = 1;
+static const int BURST_CHANNEL = 2;
+
+// buffers lent to the merge for each channel, enough to cover its input
+// queue backlog at the rates replays are run at
+static const int BEAMS_PER_CHANNEL = 1024;
+
+// monotonic time, seconds
+
+static double
+monotonicNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Pool of IQ buffers for one channel, lent to the merge. A pulse's IQ data
+// are lent by swapping its vector with a free buffer's, so the data stay
+// where the source put them and the source refills the vector it gets back.
+// Buffers come back from whichever thread releases their last reference.
+//
+// The merge may outlive the replay, still holding buffers, so the replay
+// does not delete the pool; it calls orphan(), and the pool deletes itself
+// once the last buffer comes back.
+
+class ReplayBeamPool : public BeamLender {
+public:
+
+  ReplayBeamPool(int nBeams) :
+    _nOnLoan(0),
+    _orphaned(false)
+  {
+    _beams.resize(nBeams);
+    for (int ii = 0; ii < nBeams; ii++) {
+      _beams[ii] = new Beam(this);
+      _free.push_back(_beams[ii]);
+    }
+  }
+
+  virtual ~ReplayBeamPool() {
+    for (size_t ii = 0; ii < _beams.size(); ii++) {
+      delete _beams[ii];
+    }
+  }
+
+  // lend the data in iq, nGates gates or samples, giving iq a free buffer
+  // in exchange. Returns the lease, holding one reference, or NULL if
+  // every buffer is out on loan.
+  BeamLease *lend(std::vector<int16_t> &iq, int nGates) {
+    Beam *beam;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_free.empty()) {
+        return NULL;
+      }
+      beam = _free.back();
+      _free.pop_back();
+      _nOnLoan++;
+    }
+    beam->iq.swap(iq);
+    beam->assign(&beam->iq[0], nGates);
+    return beam;
+  }
+
+  // a lease's last reference has been released
+  virtual void returnBeam(BeamLease *lease) {
+    bool lastBack;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _free.push_back(static_cast<Beam *>(lease));
+      _nOnLoan--;
+      lastBack = _orphaned && _nOnLoan == 0;
+    }
+    if (lastBack) {
+      delete this;
+    }
+  }
+
+  // hand the pool over to its borrowers, deleting it now if nothing is
+  // out on loan, or else when the last buffer comes back
+  void orphan() {
+    bool noneOut;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _orphaned = true;
+      noneOut = (_nOnLoan == 0);
+    }
+    if (noneOut) {
+      delete this;
+    }
+  }
+
+private:
+
+  struct Beam : public BeamLease {
+    Beam(BeamLender *lender) : BeamLease(lender) {}
+    std::vector<int16_t> iq;
+  };
+
+  std::mutex _mutex;
+  std::vector<Beam *> _beams;
+  std::vector<Beam *> _free;
+  int _nOnLoan;
+  bool _orphaned;
+
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Source of pulses from IWRF time series files
+
+class IwrfReplaySource : public KaReplay::Source {
+public:
+
+  IwrfReplaySource(const std::vector<std::string> &files) :
+    _files(files),
+    _fileIndex(0),
+    _fp(NULL),
+    _burstSeqNum(-1),
+    _warnedEncoding(false),
+    _warnedDecimated(false),
+    _warnedCohered(false)
+  {}
+
+  virtual ~IwrfReplaySource() {
+    if (_fp) {
+      fclose(_fp);
+    }
+  }
+
+  virtual bool rewind() {
+    if (_fp) {
+      fclose(_fp);
+      _fp = NULL;
+    }
+    _fileIndex = 0;
+    _burstSeqNum = -1;
+    return _openNext();
+  }
+
+  virtual bool next(KaReplay::Pulse &pulse) {
+    while (_fp) {
+      if (!_readPacket()) {
+        _openNext();
+        continue;
+      }
+      iwrf_packet_info_t info;
+      memcpy(&info, &_packet[0], sizeof(info));
+      if (info.id == IWRF_BURST_HEADER_ID) {
+        _saveBurst();
+      } else if (info.id == IWRF_PULSE_HEADER_ID) {
+        if (_getPulse(pulse)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+private:
+
+  // open the next file, skipping any which cannot be opened
+  bool _openNext() {
+    if (_fp) {
+      fclose(_fp);
+      _fp = NULL;
+    }
+    while (_fileIndex < _files.size()) {
+      const std::string &path = _files[_fileIndex++];
+      _fp = fopen(path.c_str(), "r");
+      if (_fp) {
+        ILOG << "Replaying " << path;
+        return true;
+      }
+      ELOG << "Cannot open " << path << ": " << strerror(errno);
+    }
+    return false;
+  }
+
+  // read the next packet into _packet
+  bool _readPacket() {
+    iwrf_packet_info_t info;
+    if (fread(&info, sizeof(info), 1, _fp) != 1) {
+      return false;
+    }
+    if (info.len_bytes < (int) sizeof(info) ||
+        info.len_bytes > 256 * 1024 * 1024) {
+      WLOG << "Bad IWRF packet length " << info.len_bytes <<
+          ", skipping the rest of the file";
+      return false;
+    }
+    _packet.resize(info.len_bytes);
+    memcpy(&_packet[0], &info, sizeof(info));
+    size_t rest = info.len_bytes - sizeof(info);
+    return (rest == 0 || fread(&_packet[sizeof(info)], rest, 1, _fp) == 1);
+  }
+
+  // IQ data after a header, or NULL if there are fewer than nShorts
+  const int16_t *_iq(size_t hdrLen, size_t offset, size_t nShorts) const {
+    if (_packet.size() < hdrLen ||
+        (_packet.size() - hdrLen) / sizeof(int16_t) < offset + nShorts) {
+      return NULL;
+    }
+    return reinterpret_cast<const int16_t *>(&_packet[hdrLen]) + offset;
+  }
+
+  bool _checkEncoding(int encoding) {
+    if (encoding == IWRF_IQ_ENCODING_SCALED_SI16) {
+      return true;
+    }
+    if (!_warnedEncoding) {
+      WLOG << "IQ encoding " << encoding << " cannot be replayed, " <<
+          "skipping such packets";
+      _warnedEncoding = true;
+    }
+    return false;
+  }
+
+  // Range decimation by the merge averages the power of adjacent gates,
+  // which cannot be undone, and replaying such data through the merge
+  // would decimate them again. The factor is found from the recorded gate
+  // spacing and pulse width.
+  bool _checkDecimation(const iwrf_pulse_header_t &hdr) {
+    double rawSpacing = hdr.pulse_width_us * 1.0e-6 * 1.5e8;
+    if (hdr.gate_spacing_m <= 0.0 || rawSpacing <= 0.0) {
+      return true;
+    }
+    int factor = (int) floor(hdr.gate_spacing_m / rawSpacing + 0.5);
+    if (factor <= 1) {
+      return true;
+    }
+    if (!_warnedDecimated) {
+      ELOG << "Pulses were recorded with gate decimation " << factor <<
+          ", and cannot be replayed, skipping such pulses";
+      _warnedDecimated = true;
+    }
+    return false;
+  }
+
+  // Undo the merge's coherence to the burst, by rotating each gate forward
+  // by the burst phase the merge rotated it back by. The data come back to
+  // within two counts of rounding of what the downconverter produced.
+  void _uncohere(std::vector<int16_t> &iq, double burstPhaseDeg) {
+    double cosPhase = cos(burstPhaseDeg / RAD_TO_DEG);
+    double sinPhase = sin(burstPhaseDeg / RAD_TO_DEG);
+    for (size_t ii = 0; ii + 1 < iq.size(); ii += 2) {
+      double ival = iq[ii];
+      double qval = iq[ii + 1];
+      iq[ii] = _clampCount(ival * cosPhase - qval * sinPhase);
+      iq[ii + 1] = _clampCount(qval * cosPhase + ival * sinPhase);
+    }
+  }
+
+  static int16_t _clampCount(double val) {
+    if (val > 32767.0) {
+      return 32767;
+    } else if (val < -32767.0) {
+      return -32767;
+    }
+    return (int16_t) floor(val + 0.5);
+  }
+
+  void _saveBurst() {
+    if (_packet.size() < sizeof(iwrf_burst_header_t)) {
+      return;
+    }
+    iwrf_burst_header_t hdr;
+    memcpy(&hdr, &_packet[0], sizeof(hdr));
+    const int16_t *iq = _iq(sizeof(hdr), 0, 2 * hdr.n_samples);
+    if (!_checkEncoding(hdr.iq_encoding) || hdr.n_samples < 0 || !iq) {
+      return;
+    }
+    _burstSeqNum = hdr.pulse_seq_num;
+    _burstIq.assign(iq, iq + 2 * hdr.n_samples);
+    _burstPowerDbm = hdr.power_dbm;
+    _burstPhaseDeg = hdr.phase_deg;
+    _burstFreqHz = hdr.freq_hz;
+  }
+
+  bool _getPulse(KaReplay::Pulse &pulse) {
+    if (_packet.size() < sizeof(iwrf_pulse_header_t)) {
+      return false;
+    }
+    iwrf_pulse_header_t hdr;
+    memcpy(&hdr, &_packet[0], sizeof(hdr));
+    if (!_checkEncoding(hdr.iq_encoding) || hdr.n_gates < 0 ||
+        !_checkDecimation(hdr)) {
+      return false;
+    }
+    const int16_t *iqH = _iq(sizeof(hdr), hdr.iq_offset[0], 2 * hdr.n_gates);
+    const int16_t *iqV = NULL;
+    if (hdr.n_channels > 1) {
+      iqV = _iq(sizeof(hdr), hdr.iq_offset[1], 2 * hdr.n_gates);
+    }
+    if (!iqH) {
+      WLOG << "Pulse " << hdr.pulse_seq_num << " is short of IQ data";
+      return false;
+    }
+
+    pulse.pulseSeqNum = hdr.pulse_seq_num;
+    pulse.timeSecs = hdr.packet.time_secs_utc +
+        1.0e-9 * hdr.packet.time_nano_secs;
+    pulse.nGatesH = hdr.n_gates;
+    pulse.iqH.assign(iqH, iqH + 2 * hdr.n_gates);
+    pulse.nGatesV = iqV ? hdr.n_gates : 0;
+    if (iqV) {
+      pulse.iqV.assign(iqV, iqV + 2 * hdr.n_gates);
+    }
+    if (hdr.phase_cohered) {
+      if (!_warnedCohered) {
+        WLOG << "Pulses were recorded cohered to the burst, undoing " <<
+            "the coherence, to within two counts of rounding";
+        _warnedCohered = true;
+      }
+      _uncohere(pulse.iqH, hdr.burst_arg[0]);
+      if (iqV) {
+        _uncohere(pulse.iqV, hdr.burst_arg[0]);
+      }
+    }
+    pulse.nSamplesBurst = 0;
+    if (_burstSeqNum == hdr.pulse_seq_num) {
+      pulse.nSamplesBurst = _burstIq.size() / 2;
+      pulse.iqBurst = _burstIq;
+      pulse.g0Magnitude = hdr.burst_mag[0];
+      pulse.g0PowerDbm = _burstPowerDbm;
+      pulse.g0PhaseDeg = _burstPhaseDeg;
+      pulse.g0FreqHz = _burstFreqHz;
+    }
+    return true;
+  }
+
+  std::vector<std::string> _files;
+  size_t _fileIndex;
+  FILE *_fp;
+  std::vector<char> _packet;
+
+  // the latest burst
+  int64_t _burstSeqNum;
+  std::vector<int16_t> _burstIq;
+  double _burstPowerDbm;
+  double _burstPhaseDeg;
+  double _burstFreqHz;
+
+  bool _warnedEncoding;
+  bool _warnedDecimated;
+  bool _warnedCohered;
+
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Source of pulses from Pei files, one set of files for each channel
+
+class PeiReplaySource : public KaReplay::Source {
+public:
+
+  PeiReplaySource(const std::vector<std::string> &files, double iqScaleForMw,
+                  double rcvrCntrFreq) :
+    _iqScaleForMw(iqScaleForMw),
+    _rcvrCntrFreq(rcvrCntrFreq),
+    _seqNum(0)
+  {
+    // sort the files by channel, from the chan<N>_ prefix of their names
+    for (size_t ii = 0; ii < files.size(); ii++) {
+      std::string base = files[ii].substr(files[ii].rfind('/') + 1);
+      int chan;
+      if (sscanf(base.c_str(), "chan%d_", &chan) == 1 &&
+          chan >= 0 && chan < N_CHANNELS) {
+        _chans[chan].files.push_back(files[ii]);
+      } else {
+        ELOG << "Cannot tell the channel of Pei file " << files[ii] <<
+            ", ignoring it";
+      }
+    }
+    for (int chan = 0; chan < N_CHANNELS; chan++) {
+      _chans[chan].fp = NULL;
+      if (_chans[chan].files.empty()) {
+        WLOG << "No Pei files for channel " << chan;
+      }
+    }
+  }
+
+  virtual ~PeiReplaySource() {
+    for (int chan = 0; chan < N_CHANNELS; chan++) {
+      if (_chans[chan].fp) {
+        fclose(_chans[chan].fp);
+      }
+    }
+  }
+
+  virtual bool rewind() {
+    bool ok = false;
+    for (int chan = 0; chan < N_CHANNELS; chan++) {
+      Channel &ch = _chans[chan];
+      if (ch.fp) {
+        fclose(ch.fp);
+        ch.fp = NULL;
+      }
+      ch.fileIndex = 0;
+      ch.haveRecord = false;
+      _readRecord(ch);
+      ok = ok || ch.haveRecord;
+    }
+    _seqNum = 0;
+    return ok;
+  }
+
+  // The channels' records for a pulse all have the same time, so gather
+  // those with the earliest time left
+  virtual bool next(KaReplay::Pulse &pulse) {
+    double minTime = 0.0;
+    bool any = false;
+    for (int chan = 0; chan < N_CHANNELS; chan++) {
+      if (_chans[chan].haveRecord &&
+          (!any || _chans[chan].time < minTime)) {
+        minTime = _chans[chan].time;
+        any = true;
+      }
+    }
+    if (!any) {
+      return false;
+    }
+
+    pulse.pulseSeqNum = _seqNum++;
+    pulse.timeSecs = minTime;
+    pulse.nGatesH = 0;
+    pulse.nGatesV = 0;
+    pulse.nSamplesBurst = 0;
+    for (int chan = 0; chan < N_CHANNELS; chan++) {
+      Channel &ch = _chans[chan];
+      if (!ch.haveRecord || ch.time > minTime) {
+        continue;
+      }
+      if (chan == H_CHANNEL) {
+        pulse.nGatesH = ch.nGates;
+        pulse.iqH.swap(ch.iq);
+      } else if (chan == V_CHANNEL) {
+        pulse.nGatesV = ch.nGates;
+        pulse.iqV.swap(ch.iq);
+      } else if (chan == BURST_CHANNEL) {
+        pulse.nSamplesBurst = ch.nGates;
+        pulse.iqBurst.swap(ch.iq);
+        _setG0(pulse);
+      }
+      _readRecord(ch);
+    }
+    return true;
+  }
+
+private:
+
+  static const int N_CHANNELS = 3;
+
+  struct Channel {
+    std::vector<std::string> files;
+    size_t fileIndex;
+    FILE *fp;
+    bool haveRecord;
+    double time;
+    int nGates;
+    std::vector<int16_t> iq;
+  };
+
+  // read the next record for a channel, moving on through its files
+  void _readRecord(Channel &ch) {
+    ch.haveRecord = false;
+    while (true) {
+      if (!ch.fp) {
+        if (ch.fileIndex >= ch.files.size()) {
+          return;
+        }
+        const std::string &path = ch.files[ch.fileIndex++];
+        ch.fp = fopen(path.c_str(), "r");
+        if (!ch.fp) {
+          ELOG << "Cannot open " << path << ": " << strerror(errno);
+          continue;
+        }
+        ILOG << "Replaying " << path;
+      }
+      float prf;
+      float pulseWidth;
+      if (fread(&ch.time, sizeof(ch.time), 1, ch.fp) == 1 &&
+          fread(&prf, sizeof(prf), 1, ch.fp) == 1 &&
+          fread(&pulseWidth, sizeof(pulseWidth), 1, ch.fp) == 1 &&
+          fread(&ch.nGates, sizeof(ch.nGates), 1, ch.fp) == 1 &&
+          ch.nGates >= 0 && ch.nGates <= 1000000) {
+        ch.iq.resize(2 * ch.nGates);
+        if (ch.nGates == 0 ||
+            fread(&ch.iq[0], 4, ch.nGates, ch.fp) == (size_t) ch.nGates) {
+          ch.haveRecord = true;
+          return;
+        }
+      }
+      fclose(ch.fp);
+      ch.fp = NULL;
+    }
+  }
+
+  // G0 from the burst samples; the frequency discriminator history is not
+  // recorded
+  void _setG0(KaReplay::Pulse &pulse) const {
+    KaReplay::SetG0(pulse, _iqScaleForMw);
+    pulse.g0FreqHz = _rcvrCntrFreq;
+  }
+
+  Channel _chans[N_CHANNELS];
+  double _iqScaleForMw;
+  double _rcvrCntrFreq;
+  int64_t _seqNum;
+
+};
+
+///////////////////////////////////////////////////////////////////////////
+
+KaReplay::KaReplay(const KaDrxConfig& config, KaMerge &merge,
+                   const std::vector<std::string> &files, Format format,
+                   Pacing pacing, double speed, int nPasses) :
+        QThread(),
+        _config(config),
+        _merge(merge),
+        _source(NULL),
+        _pacing(pacing),
+        _speed(pacing == SCALED ? speed : 1.0),
+        _nPasses(nPasses),
+        _firstPulseTime(0.0),
+        _startTime(-1.0),
+        _pulseH(new PulseData),
+        _pulseV(new PulseData),
+        _burst(new BurstData),
+        _poolH(NULL),
+        _poolV(NULL),
+        _poolB(NULL),
+        _stopping(false),
+        _done(false),
+        _nPulses(0)
+{
+  if (format == PEI_FILES) {
+    _source = new PeiReplaySource(files, config.iqcount_scale_for_mw(),
+                                  config.rcvr_cntr_freq());
+  } else {
+    _source = new IwrfReplaySource(files);
+  }
+  _init();
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+KaReplay::KaReplay(const KaDrxConfig& config, KaMerge &merge,
+                   Source *source, Pacing pacing, double speed,
+                   int nPasses) :
+        QThread(),
+        _config(config),
+        _merge(merge),
+        _source(source),
+        _pacing(pacing),
+        _speed(pacing == SCALED ? speed : 1.0),
+        _nPasses(nPasses),
+        _firstPulseTime(0.0),
+        _startTime(-1.0),
+        _pulseH(new PulseData),
+        _pulseV(new PulseData),
+        _burst(new BurstData),
+        _poolH(NULL),
+        _poolV(NULL),
+        _poolB(NULL),
+        _stopping(false),
+        _done(false),
+        _nPulses(0)
+{
+  _init();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void KaReplay::_init()
+{
+  if (_speed <= 0.0) {
+    WLOG << "Bad replay speed " << _speed << ", using 1.0";
+    _speed = 1.0;
+  }
+  if (_config.zero_copy_beams() == 1) {
+    _poolH = new ReplayBeamPool(BEAMS_PER_CHANNEL);
+    _poolV = new ReplayBeamPool(BEAMS_PER_CHANNEL);
+    _poolB = new ReplayBeamPool(BEAMS_PER_CHANNEL);
+    ILOG << "Lending replayed IQ data to the merge without copying";
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+KaReplay::~KaReplay()
+
+{
+  stop();
+  if (! wait(5000)) {
+    ELOG << "KaReplay thread failed to stop in 5 seconds.";
+  }
+  delete _source;
+  delete _pulseH;
+  delete _pulseV;
+  delete _burst;
+  if (_poolH) {
+    _poolH->orphan();
+    _poolV->orphan();
+    _poolB->orphan();
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool KaReplay::parsePacing(const std::string &name, Pacing &pacing)
+{
+  if (name == "realtime") {
+    pacing = REALTIME;
+  } else if (name == "scaled") {
+    pacing = SCALED;
+  } else if (name == "fast") {
+    pacing = FAST;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// G0 from burst sample 9, as KaDrxPub computes it
+
+void KaReplay::SetG0(Pulse &pulse, double iqScaleForMw)
+{
+  pulse.g0Magnitude = -9999.0;
+  pulse.g0PowerDbm = -9999.0;
+  pulse.g0PhaseDeg = -9999.0;
+  if (pulse.nSamplesBurst <= 9) {
+    return;
+  }
+  double ival = pulse.iqBurst[2 * 9] / iqScaleForMw;
+  double qval = pulse.iqBurst[2 * 9 + 1] / iqScaleForMw;
+  double g0Power = ival * ival + qval * qval;
+  pulse.g0Magnitude = sqrt(g0Power);
+  pulse.g0PowerDbm = 10 * log10(g0Power);
+  pulse.g0PhaseDeg = atan2(qval, ival) * RAD_TO_DEG;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Thread run method
+
+void KaReplay::run()
+
+{
+
+  Pulse pulse;
+  int64_t seqOffset = 0;
+  double timeOffset = 0.0;
+
+  for (int pass = 0; pass < _nPasses && !_stopping.load(); pass++) {
+
+    if (!_source->rewind()) {
+      ELOG << "Nothing to replay";
+      break;
+    }
+
+    int64_t firstSeqNum = -1;
+    int64_t lastSeqNum = -1;
+    double firstTime = 0.0;
+    double lastTime = 0.0;
+    double prevTime = 0.0;
+    while (!_stopping.load(std::memory_order_relaxed) &&
+           _source->next(pulse)) {
+      if (firstSeqNum < 0) {
+        firstSeqNum = pulse.pulseSeqNum;
+        firstTime = pulse.timeSecs;
+      }
+      prevTime = lastTime;
+      lastSeqNum = pulse.pulseSeqNum;
+      lastTime = pulse.timeSecs;
+      _pace(pulse.timeSecs + timeOffset);
+      _write(pulse, seqOffset, timeOffset);
+    }
+    if (firstSeqNum < 0) {
+      ELOG << "No pulses in the replay files";
+      break;
+    }
+
+    // carry on from where this pass left off, one pulse later
+    seqOffset += lastSeqNum - firstSeqNum + 1;
+    timeOffset += (lastTime - firstTime) + (lastTime - prevTime);
+    ILOG << "Replay pass " << pass + 1 << " done, " << nPulses() <<
+        " pulses so far";
+
+  }
+
+  _done.store(true);
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// wait until a pulse is due, or until the merge has room for it
+
+void KaReplay::_pace(double timeSecs)
+{
+
+  if (_pacing == FAST) {
+    _waitForRoom();
+    return;
+  }
+
+  double now = monotonicNow();
+  if (_startTime < 0.0) {
+    _startTime = now;
+    _firstPulseTime = timeSecs;
+    return;
+  }
+  double due = _startTime + (timeSecs - _firstPulseTime) / _speed;
+  if (due > now) {
+    double secs = due - now;
+    struct timespec ts;
+    ts.tv_sec = (time_t) secs;
+    ts.tv_nsec = (long) ((secs - ts.tv_sec) * 1.0e9);
+    nanosleep(&ts, NULL);
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// wait while any merge input queue is full
+
+void KaReplay::_waitForRoom() const
+{
+  while (!_stopping.load(std::memory_order_relaxed) &&
+         (_merge.hQueue().depth() + 1 >= _merge.hQueue().size() ||
+          _merge.vQueue().depth() + 1 >= _merge.vQueue().size() ||
+          _merge.burstQueue().depth() + 1 >= _merge.burstQueue().size())) {
+    usleep(100);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// write a pulse's burst, H and V data to the merge, lending the IQ data
+// if we can. Lent data are swapped out of the pulse.
+
+void KaReplay::_write(Pulse &pulse, int64_t seqOffset, double timeOffset)
+{
+
+  int64_t seqNum = pulse.pulseSeqNum + seqOffset;
+  double t = pulse.timeSecs + timeOffset;
+  time_t timeSecs = (time_t) floor(t);
+  int nanoSecs = (int) ((t - timeSecs) * 1.0e9 + 0.5);
+  if (nanoSecs >= 1000000000) {
+    nanoSecs = 999999999;
+  }
+
+  if (pulse.nSamplesBurst > 0) {
+    double phaseRad = pulse.g0PhaseDeg / RAD_TO_DEG;
+    BeamLease *lease =
+      _poolB ? _poolB->lend(pulse.iqBurst, pulse.nSamplesBurst) : NULL;
+    if (lease) {
+      _burst->lend(seqNum, timeSecs, nanoSecs,
+                   pulse.g0Magnitude, pulse.g0PowerDbm, pulse.g0PhaseDeg,
+                   cos(phaseRad), sin(phaseRad),
+                   pulse.g0FreqHz, pulse.g0FreqHz - _config.rcvr_cntr_freq(),
+                   lease);
+      lease->release();
+    } else {
+      _burst->set(seqNum, timeSecs, nanoSecs,
+                  pulse.g0Magnitude, pulse.g0PowerDbm, pulse.g0PhaseDeg,
+                  cos(phaseRad), sin(phaseRad),
+                  pulse.g0FreqHz, pulse.g0FreqHz - _config.rcvr_cntr_freq(),
+                  pulse.nSamplesBurst, &pulse.iqBurst[0]);
+    }
+    _burst = _merge.writeBurst(_burst);
+    _burst->releaseIq();
+  }
+
+  if (pulse.nGatesH > 0) {
+    BeamLease *lease =
+      _poolH ? _poolH->lend(pulse.iqH, pulse.nGatesH) : NULL;
+    if (lease) {
+      _pulseH->lend(seqNum, timeSecs, nanoSecs, H_CHANNEL, lease);
+      lease->release();
+    } else {
+      _pulseH->set(seqNum, timeSecs, nanoSecs, H_CHANNEL, pulse.nGatesH,
+                   &pulse.iqH[0]);
+    }
+    _pulseH = _merge.writePulseH(_pulseH);
+    _pulseH->releaseIq();
+  }
+
+  if (pulse.nGatesV > 0) {
+    BeamLease *lease =
+      _poolV ? _poolV->lend(pulse.iqV, pulse.nGatesV) : NULL;
+    if (lease) {
+      _pulseV->lend(seqNum, timeSecs, nanoSecs, V_CHANNEL, lease);
+      lease->release();
+    } else {
+      _pulseV->set(seqNum, timeSecs, nanoSecs, V_CHANNEL, pulse.nGatesV,
+                   &pulse.iqV[0]);
+    }
+    _pulseV = _merge.writePulseV(_pulseV);
+    _pulseV->releaseIq();
+  }
+
+  _nPulses.fetch_add(1, std::memory_order_relaxed);
+
+}
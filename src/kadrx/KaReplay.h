@@ -0,0 +1,198 @@
+#ifndef KA_REPLAY_H_
+#define KA_REPLAY_H_
+
+#include "KaDrxConfig.h"
+#include "KaMerge.h"
+#include "PulseData.h"
+#include "BurstData.h"
+#include <QThread>
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class ReplayBeamPool;
+
+/// KaReplay feeds recorded time series into KaMerge in place of the
+/// KaDrxPub threads, so that the merge and everything downstream of it can
+/// be run and profiled on field data with no Pentek card.
+///
+/// The recording may be:
+///   - IWRF time series files, as written by kadrx's archive or black box.
+///     The H and V IQ data are taken from each pulse packet, and the burst
+///     from the burst packet before it. Only IWRF_IQ_ENCODING_SCALED_SI16
+///     data, as sent by kadrx, can be replayed. Pulses recorded with range
+///     decimation (gate spacing more than the pulse width allows) cannot be
+///     replayed, and are skipped. Pulses recorded cohered to the burst are
+///     rotated back by the burst phase in their header, to within two
+///     counts of rounding, so that the merge may cohere them again.
+///   - Pei files, named chan<N>_..., as written with write_pei_files. The
+///     files for the three channels are read together, and records with
+///     the same time are given the same pulse number. The burst's G0 power
+///     and phase are recomputed from the burst samples, as KaDrxPub does;
+///     its frequency is the receiver center frequency, since the
+///     frequency discriminator history is not recorded.
+///
+/// Files are replayed in the order given, and pulses are written to
+/// KaMerge's writeBurst(), writePulseH() and writePulseV() from a single
+/// thread. Pacing is one of:
+///   - REALTIME: at the rate the pulses were recorded
+///   - SCALED: at the recorded rate times a speed factor
+///   - FAST: as fast as KaMerge takes them. The replay waits whenever a
+///     merge input queue is full, so no pulses are dropped.
+/// With REALTIME and SCALED pacing, a merge which cannot keep up overruns
+/// its input queues, just as it would with live data.
+///
+/// Pulses may also come from any other Source, such as the
+/// KaSyntheticSource.
+///
+/// With zero_copy_beams set in the configuration, the IQ data of each
+/// pulse are lent to the merge, with PulseData::lend() and
+/// BurstData::lend(), rather than copied, and come back for reuse once the
+/// merge has sent them or dropped them. If the merge is holding every
+/// buffer, the pulse is copied as usual.
+///
+/// The recording may be replayed a number of times. Later passes have
+/// their pulse numbers and times moved on, so KaMerge sees one continuous
+/// stream.
+///
+/// Call stop() to end the replay early.
+
+class KaReplay : public QThread {
+
+  Q_OBJECT
+
+public:
+
+  typedef enum {
+    IWRF_FILES,
+    PEI_FILES
+  } Format;
+
+  typedef enum {
+    REALTIME,
+    SCALED,
+    FAST
+  } Pacing;
+
+  /// One pulse, from a recording or generated. A channel with no data has
+  /// zero gates or samples.
+  struct Pulse {
+    int64_t pulseSeqNum;
+    double timeSecs;
+    int nGatesH;
+    int nGatesV;
+    int nSamplesBurst;
+    std::vector<int16_t> iqH;
+    std::vector<int16_t> iqV;
+    std::vector<int16_t> iqBurst;
+    double g0Magnitude;
+    double g0PowerDbm;
+    double g0PhaseDeg;
+    double g0FreqHz;
+  };
+
+  /**
+   * Set a pulse's G0 magnitude, power and phase from its burst samples,
+   * as KaDrxPub computes them. They are set to -9999 if there are too few
+   * samples.
+   * @param pulse the pulse
+   * @param iqScaleForMw scale from counts to sqrt(mW)
+   */
+  static void SetG0(Pulse &pulse, double iqScaleForMw);
+
+  /// Source of pulses, from a recording or generated
+  class Source {
+  public:
+    virtual ~Source() {}
+    /// start again at the beginning; false if there is nothing to replay
+    virtual bool rewind() = 0;
+    /// get the next pulse; false at the end
+    virtual bool next(Pulse &pulse) = 0;
+  };
+
+  /**
+   * Constructor.
+   * @param config KaDrxConfig used for the recording
+   * @param merge the KaMerge to feed
+   * @param files the files to replay, in order
+   * @param format the format of the files
+   * @param pacing how fast to replay
+   * @param speed speed factor for SCALED pacing
+   * @param nPasses the number of times to replay the files
+   */
+
+  KaReplay(const KaDrxConfig& config, KaMerge &merge,
+           const std::vector<std::string> &files, Format format,
+           Pacing pacing, double speed, int nPasses);
+
+  /**
+   * Constructor, replaying from the given source.
+   * @param config KaDrxConfig defining the desired configuration
+   * @param merge the KaMerge to feed
+   * @param source the source of pulses, which is deleted with this object
+   * @param pacing how fast to replay
+   * @param speed speed factor for SCALED pacing
+   * @param nPasses the number of times to replay the source
+   */
+
+  KaReplay(const KaDrxConfig& config, KaMerge &merge, Source *source,
+           Pacing pacing, double speed, int nPasses);
+
+  /// Destructor
+
+  virtual ~KaReplay();
+
+  /// thread run method
+
+  void run();
+
+  /// end the replay early; safe to call from any thread
+  void stop() { _stopping.store(true); }
+
+  /// @return true once the replay has finished or been stopped
+  bool done() const { return _done.load(); }
+
+  /// @return the number of pulses written to the merge
+  uint64_t nPulses() const {
+    return _nPulses.load(std::memory_order_relaxed);
+  }
+
+  /// parse a pacing name: "realtime", "scaled" or "fast"
+  static bool parsePacing(const std::string &name, Pacing &pacing);
+
+private:
+
+  void _init();
+  void _write(Pulse &pulse, int64_t seqOffset, double timeOffset);
+  void _pace(double timeSecs);
+  void _waitForRoom() const;
+
+  const KaDrxConfig &_config;
+  KaMerge &_merge;
+  Source *_source;
+  Pacing _pacing;
+  double _speed;
+  int _nPasses;
+
+  /// time of the first pulse and when it was written, for pacing
+  double _firstPulseTime;
+  double _startTime;
+
+  /// objects handed to the merge, and returned by it for reuse
+  PulseData *_pulseH;
+  PulseData *_pulseV;
+  BurstData *_burst;
+
+  /// buffers lent to the merge for each channel, NULL if data are copied
+  ReplayBeamPool *_poolH;
+  ReplayBeamPool *_poolV;
+  ReplayBeamPool *_poolB;
+
+  std::atomic<bool> _stopping;
+  std::atomic<bool> _done;
+  std::atomic<uint64_t> _nPulses;
+
+};
+
+#endif /* KA_REPLAY_H_ */
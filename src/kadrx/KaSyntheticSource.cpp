@@ -0,0 +1,288 @@
+#include "KaSyntheticSource.h"
+#include <logx/Logging.h>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+
+LOGGING("KaSyntheticSource")
+
+static const double DEG_TO_RAD = 0.017453292519943295;
+
+// amplitude of the burst samples, counts
+static const double BurstCounts = 10000.0;
+
+// number of values in the noise table, at least
+static const size_t NoiseTableLen = 65536;
+
+// the fewest burst samples for which G0 and the frequency discriminator
+// can be computed, as in KaDrxPub
+static const int MinBurstSamples = 20;
+
+///////////////////////////////////////////////////////////////////////////
+
+KaSyntheticSource::KaSyntheticSource(const KaDrxConfig &config,
+                                     int64_t nPulses) :
+        _nPulses(nPulses),
+        _prt1(config.prt1()),
+        _prt2(config.prt2()),
+        _staggered(config.staggered_prt() == 1),
+        _nGates(config.gates()),
+        _nSamplesBurst(40),
+        _burstSampleFreq(1.0e8),
+        _rcvrCntrFreq(config.rcvr_cntr_freq()),
+        _iqScaleForMw(config.iqcount_scale_for_mw()),
+        _signalCounts(1000.0),
+        _noiseCounts(10.0),
+        _dropH(0.0),
+        _dropV(0.0),
+        _dropBurst(0.0),
+        _seqJumpInterval(0),
+        _seqJumpSize(0),
+        _phaseDriftRad(0.0),
+        _freqOffset(0.0),
+        _clipCounts(32767),
+        _seed(1),
+        _startSecs(0.0),
+        _count(0),
+        _seqNum(0),
+        _timeSecs(0.0),
+        _numerator(0.0),
+        _denominator(0.0)
+{
+
+  if (config.burst_sample_frequency() != KaDrxConfig::UNSET_DOUBLE) {
+    _burstSampleFreq = config.burst_sample_frequency();
+  }
+  if (config.burst_sample_width() != KaDrxConfig::UNSET_DOUBLE) {
+    _nSamplesBurst = (int) (config.burst_sample_width() * _burstSampleFreq + 0.5);
+  }
+  _nSamplesBurst = std::max(_nSamplesBurst, MinBurstSamples);
+  if (!_staggered || _prt2 == KaDrxConfig::UNSET_DOUBLE) {
+    _staggered = false;
+    _prt2 = _prt1;
+  }
+
+  if (config.synth_signal_counts() != KaDrxConfig::UNSET_DOUBLE) {
+    _signalCounts = config.synth_signal_counts();
+  }
+  if (config.synth_noise_counts() != KaDrxConfig::UNSET_DOUBLE) {
+    _noiseCounts = config.synth_noise_counts();
+  }
+  if (config.synth_drop_h() != KaDrxConfig::UNSET_DOUBLE) {
+    _dropH = config.synth_drop_h();
+  }
+  if (config.synth_drop_v() != KaDrxConfig::UNSET_DOUBLE) {
+    _dropV = config.synth_drop_v();
+  }
+  if (config.synth_drop_burst() != KaDrxConfig::UNSET_DOUBLE) {
+    _dropBurst = config.synth_drop_burst();
+  }
+  if (config.synth_seq_jump_interval() != KaDrxConfig::UNSET_INT &&
+      config.synth_seq_jump_size() != KaDrxConfig::UNSET_INT) {
+    _seqJumpInterval = config.synth_seq_jump_interval();
+    _seqJumpSize = config.synth_seq_jump_size();
+  }
+  if (config.synth_burst_phase_drift() != KaDrxConfig::UNSET_DOUBLE) {
+    _phaseDriftRad = config.synth_burst_phase_drift() * DEG_TO_RAD;
+  }
+  if (config.synth_freq_offset() != KaDrxConfig::UNSET_DOUBLE) {
+    _freqOffset = config.synth_freq_offset();
+  }
+  if (config.synth_clip_counts() != KaDrxConfig::UNSET_INT) {
+    _clipCounts = std::min(std::max(config.synth_clip_counts(), 0), 32767);
+  }
+  if (config.synth_seed() != KaDrxConfig::UNSET_INT) {
+    _seed = config.synth_seed();
+  }
+
+  // three echoes, at a quarter, half and three quarters of the range, each
+  // with its own phase. V is a little weaker than H.
+
+  _echoH.resize(2 * _nGates);
+  _echoV.resize(2 * _nGates);
+  for (int g = 0; g < _nGates; g++) {
+    double amp = 0.0;
+    for (int target = 1; target <= 3; target++) {
+      double d = (g - target * _nGates / 4.0) / (_nGates / 50.0 + 1.0);
+      amp += exp(-d * d) / target;
+    }
+    amp *= _signalCounts;
+    double theta = 0.05 * g;
+    _echoH[2 * g] = amp * cos(theta);
+    _echoH[2 * g + 1] = amp * sin(theta);
+    _echoV[2 * g] = 0.8 * amp * cos(theta + 0.3);
+    _echoV[2 * g + 1] = 0.8 * amp * sin(theta + 0.3);
+  }
+
+  // pulse times start now, and are the same for every pass, so that
+  // KaReplay moves later passes on as it does for a recording
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  _startSecs = ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+
+  // noise, from a fixed seed so that it is the same every run
+
+  std::mt19937 noiseRandom(_seed);
+  std::normal_distribution<float> normal(0.0, _noiseCounts);
+  _noise.resize(std::max(NoiseTableLen, (size_t) 4 * _nGates));
+  for (size_t ii = 0; ii < _noise.size(); ii++) {
+    _noise[ii] = normal(noiseRandom);
+  }
+
+  ILOG << "Synthetic pulses: PRT " << _prt1 * 1.0e6 << "/" <<
+      _prt2 * 1.0e6 << " us, " << _nGates << " gates, " <<
+      _nSamplesBurst << " burst samples, drop H/V/burst " << _dropH <<
+      "/" << _dropV << "/" << _dropBurst << ", seq jump " << _seqJumpSize <<
+      " every " << _seqJumpInterval << ", phase drift " <<
+      _phaseDriftRad / DEG_TO_RAD << " deg/pulse, freq offset " <<
+      _freqOffset << " Hz, clip " << _clipCounts << " counts";
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// start again, with the same random numbers
+
+bool KaSyntheticSource::rewind()
+{
+  _random.seed(_seed);
+  _count = 0;
+  _seqNum = 0;
+  _timeSecs = _startSecs;
+  _numerator = 0.0;
+  _denominator = 0.0;
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool KaSyntheticSource::next(KaReplay::Pulse &pulse)
+{
+
+  if (_nPulses > 0 && _count >= _nPulses) {
+    return false;
+  }
+
+  // lose some pulses now and then, as the card does
+  if (_seqJumpInterval > 0 && _count > 0 &&
+      _count % _seqJumpInterval == 0) {
+    for (int ii = 0; ii < _seqJumpSize; ii++) {
+      _timeSecs += (_seqNum % 2 == 0) ? _prt1 : _prt2;
+      _seqNum++;
+    }
+  }
+
+  pulse.pulseSeqNum = _seqNum;
+  pulse.timeSecs = _timeSecs;
+
+  // the burst is always generated, so that the frequency discriminator
+  // sees every pulse, as it does in KaDrxPub, even if the burst is then
+  // dropped
+
+  double phaseRad = _seqNum * _phaseDriftRad;
+  _makeBurst(pulse);
+  if (_drop(_dropBurst)) {
+    pulse.nSamplesBurst = 0;
+  }
+
+  pulse.nGatesH = 0;
+  if (!_drop(_dropH)) {
+    pulse.nGatesH = _nGates;
+    _makeChannel(pulse.iqH, _echoH, phaseRad);
+  }
+  pulse.nGatesV = 0;
+  if (!_drop(_dropV)) {
+    pulse.nGatesV = _nGates;
+    _makeChannel(pulse.iqV, _echoV, phaseRad);
+  }
+
+  _timeSecs += (_seqNum % 2 == 0) ? _prt1 : _prt2;
+  _seqNum++;
+  _count++;
+  return true;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// generate the burst tone, and its G0 values as KaDrxPub computes them
+
+void KaSyntheticSource::_makeBurst(KaReplay::Pulse &pulse)
+{
+
+  pulse.nSamplesBurst = _nSamplesBurst;
+  pulse.iqBurst.resize(2 * _nSamplesBurst);
+  double phaseRad = _seqNum * _phaseDriftRad;
+  double dPhase = 2.0 * M_PI * _freqOffset / _burstSampleFreq;
+  for (int n = 0; n < _nSamplesBurst; n++) {
+    double phase = phaseRad + n * dPhase;
+    pulse.iqBurst[2 * n] = _clip(BurstCounts * cos(phase));
+    pulse.iqBurst[2 * n + 1] = _clip(BurstCounts * sin(phase));
+  }
+  KaReplay::SetG0(pulse, _iqScaleForMw);
+
+  // frequency discriminator, with the same weighted average over time
+
+  const double DIS_WT = 0.01;
+  const int16_t *i = &pulse.iqBurst[0];
+  const int16_t *q = &pulse.iqBurst[1];
+  double num = 0;
+  double den = 0;
+  for (int g = 2; g <= 17; g++) {
+    double a = i[2 * g] + i[2 * (g + 1)];
+    double b = q[2 * g] + q[2 * (g + 1)];
+    double c = i[2 * (g + 2)] + i[2 * (g + 1)];
+    double d = q[2 * (g + 2)] + q[2 * (g + 1)];
+    num += a * d - b * c;
+    den += a * c + b * d;
+  }
+  _numerator = _numerator * (1 - DIS_WT) + DIS_WT * num;
+  _denominator = _denominator * (1 - DIS_WT) + DIS_WT * den;
+  pulse.g0FreqHz = _rcvrCntrFreq + 8.0e6 * _numerator / _denominator;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// generate a channel's IQ data: the echoes rotated to the burst phase,
+// plus noise from a random place in the noise table
+
+void KaSyntheticSource::_makeChannel(std::vector<int16_t> &iq,
+                                     const std::vector<float> &echo,
+                                     double phaseRad)
+{
+  iq.resize(2 * _nGates);
+  double c = cos(phaseRad);
+  double s = sin(phaseRad);
+  std::uniform_int_distribution<size_t> start(0, _noise.size() - 2 * _nGates);
+  const float *noise = &_noise[start(_random)];
+  for (int g = 0; g < _nGates; g++) {
+    double ei = echo[2 * g];
+    double eq = echo[2 * g + 1];
+    iq[2 * g] = _clip(ei * c - eq * s + noise[2 * g]);
+    iq[2 * g + 1] = _clip(ei * s + eq * c + noise[2 * g + 1]);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// round to counts, clipping as a saturated ADC would
+
+int16_t KaSyntheticSource::_clip(double counts) const
+{
+  if (counts > _clipCounts) {
+    return _clipCounts;
+  }
+  if (counts < -_clipCounts) {
+    return -_clipCounts;
+  }
+  return (int16_t) lrint(counts);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// should this channel's data be dropped?
+
+bool KaSyntheticSource::_drop(double fraction)
+{
+  if (fraction <= 0.0) {
+    return false;
+  }
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  return uniform(_random) < fraction;
+}
@@ -0,0 +1,105 @@
+#ifndef KA_SYNTHETIC_SOURCE_H_
+#define KA_SYNTHETIC_SOURCE_H_
+
+#include "KaDrxConfig.h"
+#include "KaReplay.h"
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+/// KaSyntheticSource generates pulses for KaReplay, so that KaMerge can be
+/// driven at any rate with no Pentek card, and with faults injected on
+/// purpose. Given the same configuration, it generates the same pulses.
+///
+/// Pulses are spaced by prt1, alternating with prt2 if staggered_prt is
+/// set, and have the configured number of gates. The burst is a tone with
+/// a phase which moves on by synth_burst_phase_drift degrees each pulse
+/// and a frequency offset of synth_freq_offset Hz, sampled at
+/// burst_sample_frequency. Its G0 values, including the frequency
+/// discriminator estimate, are computed as KaDrxPub computes them. The H
+/// and V channels hold three echoes, cohered to the burst, plus Gaussian
+/// noise.
+///
+/// Impairments, all off by default:
+///   - synth_drop_h, synth_drop_v, synth_drop_burst: the fraction of
+///     pulses dropped from each channel
+///   - synth_seq_jump_interval, synth_seq_jump_size: every interval
+///     pulses, the pulse number and time jump ahead by size pulses, as
+///     when the card loses pulses
+///   - synth_clip_counts: IQ values are clipped to +/- this many counts,
+///     as by a saturated ADC
+///
+/// The signal and noise levels are synth_signal_counts and
+/// synth_noise_counts, and synth_seed seeds the random numbers.
+
+class KaSyntheticSource : public KaReplay::Source {
+
+public:
+
+  /**
+   * Constructor.
+   * @param config KaDrxConfig defining the pulses
+   * @param nPulses the number of pulses to generate in each pass, or 0
+   *     to generate pulses until the replay is stopped
+   */
+
+  KaSyntheticSource(const KaDrxConfig &config, int64_t nPulses);
+
+  virtual ~KaSyntheticSource() {}
+
+  virtual bool rewind();
+
+  virtual bool next(KaReplay::Pulse &pulse);
+
+private:
+
+  void _makeBurst(KaReplay::Pulse &pulse);
+  void _makeChannel(std::vector<int16_t> &iq, const std::vector<float> &echo,
+                    double phaseRad);
+  int16_t _clip(double counts) const;
+  bool _drop(double fraction);
+
+  /// configuration
+  int64_t _nPulses;
+  double _prt1;
+  double _prt2;
+  bool _staggered;
+  int _nGates;
+  int _nSamplesBurst;
+  double _burstSampleFreq;
+  double _rcvrCntrFreq;
+  double _iqScaleForMw;
+  double _signalCounts;
+  double _noiseCounts;
+  double _dropH;
+  double _dropV;
+  double _dropBurst;
+  int _seqJumpInterval;
+  int _seqJumpSize;
+  double _phaseDriftRad;
+  double _freqOffset;
+  int _clipCounts;
+  unsigned int _seed;
+
+  /// time of the first pulse
+  double _startSecs;
+
+  /// echo amplitude at each gate for H and V, as I, Q pairs before the
+  /// burst phase is applied
+  std::vector<float> _echoH;
+  std::vector<float> _echoV;
+
+  /// Gaussian noise, used from a random place for each pulse
+  std::vector<float> _noise;
+
+  /// generator state, reset by rewind()
+  std::mt19937 _random;
+  int64_t _count;
+  int64_t _seqNum;
+  double _timeSecs;
+  double _numerator;
+  double _denominator;
+
+};
+
+#endif /* KA_SYNTHETIC_SOURCE_H_ */
@@ -58,7 +58,17 @@ KadrxStatus::KadrxStatus(const NoXmitBitmap & noXmitBitmap,
     _rxTopTemp(rxTopTemp),
     _txEnclosureTemp(txEnclosureTemp),
     _psVoltage(psVoltage),
-    _noXmitBitmap(noXmitBitmap)
+    _noXmitBitmap(noXmitBitmap),
+    _hMergeQueue(),
+    _vMergeQueue(),
+    _burstMergeQueue(),
+    _iwrfPacketsPerSend(0.0),
+    _iwrfClients(),
+    _iwrfOutputQueue(),
+    _mergeSyncStage(),
+    _mergePackStage(),
+    _mergeSendStage(),
+    _mergePulseQueue()
 {
 }
 
@@ -97,6 +107,51 @@ KadrxStatus::_zeroAllMembers() {
     _txEnclosureTemp = 0.0;
     _psVoltage = 0.0;
     _noXmitBitmap = NoXmitBitmap();
+    _hMergeQueue = QueueStats();
+    _vMergeQueue = QueueStats();
+    _burstMergeQueue = QueueStats();
+    _iwrfPacketsPerSend = 0.0;
+    _iwrfClients.clear();
+    _iwrfOutputQueue = QueueStats();
+    _mergeSyncStage = StageStats();
+    _mergePackStage = StageStats();
+    _mergeSendStage = StageStats();
+    _mergePulseQueue = QueueStats();
+}
+
+void
+KadrxStatus::setMergeQueueStats(const QueueStats & hQueue,
+                                const QueueStats & vQueue,
+                                const QueueStats & burstQueue) {
+    _hMergeQueue = hQueue;
+    _vMergeQueue = vQueue;
+    _burstMergeQueue = burstQueue;
+}
+
+void
+KadrxStatus::setIwrfOutputQueueStats(const QueueStats & queue) {
+    _iwrfOutputQueue = queue;
+}
+
+void
+KadrxStatus::setIwrfPacketsPerSend(double packetsPerSend) {
+    _iwrfPacketsPerSend = packetsPerSend;
+}
+
+void
+KadrxStatus::setMergeStageStats(const StageStats & sync,
+                                const StageStats & pack,
+                                const StageStats & send,
+                                const QueueStats & pulseQueue) {
+    _mergeSyncStage = sync;
+    _mergePackStage = pack;
+    _mergeSendStage = send;
+    _mergePulseQueue = pulseQueue;
+}
+
+void
+KadrxStatus::setIwrfClientStats(const std::vector<IwrfClientStats> & clients) {
+    _iwrfClients = clients;
 }
 
 xmlrpc_c::value_struct
@@ -7,6 +7,9 @@
 #ifndef SRC_KADRX_KADRXSTATUS_H_
 #define SRC_KADRX_KADRXSTATUS_H_
 
+#include <sstream>
+#include <string>
+#include <vector>
 #include <xmlrpc-c/base.hpp>
 #include <boost/serialization/nvp.hpp>
 #include <boost/serialization/version.hpp>
@@ -90,6 +93,71 @@ public:
     /// @brief Destructor
     virtual ~KadrxStatus();
 
+    /// @brief Occupancy and overrun counts for one of the queues feeding
+    /// kadrx's merge thread
+    struct QueueStats {
+        QueueStats() : size(0), depth(0), highWater(0), overruns(0) {}
+        int size;       ///< number of slots in the queue
+        int depth;      ///< number of items currently waiting in the queue
+        int highWater;  ///< largest number of items seen waiting
+        int overruns;   ///< number of items dropped because the queue was full
+    };
+
+    /// @brief Set the occupancy and overrun counts for the H, V, and burst
+    /// channel queues feeding the merge thread.
+    /// @param hQueue statistics for the H channel queue
+    /// @param vQueue statistics for the V channel queue
+    /// @param burstQueue statistics for the burst channel queue
+    void setMergeQueueStats(const QueueStats & hQueue,
+                            const QueueStats & vQueue,
+                            const QueueStats & burstQueue);
+
+    /// @brief Throughput and lag for one IWRF client
+    struct IwrfClientStats {
+        IwrfClientStats() : connectedSecs(0.0), bytesPerSec(0.0),
+            lagBytes(0.0), lagSecs(0.0), droppedPackets(0) {}
+        double connectedSecs;   ///< time since the client connected, s
+        double bytesPerSec;     ///< mean send rate to the client, bytes/s
+        double lagBytes;        ///< bytes published but not yet sent
+        double lagSecs;         ///< age of the oldest data not yet sent, s
+        int droppedPackets;     ///< packets skipped because the client lagged
+    };
+
+    /// @brief Set the throughput and lag of each connected IWRF client
+    /// @param clients statistics for each connected IWRF client
+    void setIwrfClientStats(const std::vector<IwrfClientStats> & clients);
+
+    /// @brief Set the occupancy and overrun counts for the queue feeding
+    /// the IWRF network writer thread.
+    /// @param queue statistics for the IWRF output queue
+    void setIwrfOutputQueueStats(const QueueStats & queue);
+
+    /// @brief Set the mean number of IWRF packets sent per send call
+    /// @param packetsPerSend the mean number of IWRF packets sent per send
+    /// call
+    void setIwrfPacketsPerSend(double packetsPerSend);
+
+    /// @brief Busy and idle time for one stage of kadrx's merge pipeline.
+    /// The times are totals since kadrx started.
+    struct StageStats {
+        StageStats() : busySecs(0.0), idleSecs(0.0) {}
+        double busySecs;    ///< time spent working, s
+        double idleSecs;    ///< time spent waiting for work, s
+    };
+
+    /// @brief Set the busy and idle time of each merge pipeline stage,
+    /// and the occupancy and overrun counts for the queue between the sync
+    /// and pack stages.
+    /// @param sync statistics for the sync stage
+    /// @param pack statistics for the pack stage
+    /// @param send statistics for the send stage (IWRF network writer)
+    /// @param pulseQueue statistics for the queue feeding the pack stage,
+    /// all zero if the pack stage runs on the merge thread
+    void setMergeStageStats(const StageStats & sync,
+                            const StageStats & pack,
+                            const StageStats & send,
+                            const QueueStats & pulseQueue);
+
     /// @brief Return an external representation of the object's state as
     /// an xmlrpc_c::value_struct dictionary.
     ///
@@ -214,6 +282,54 @@ public:
     /// that kadrx is currently disabling transmit
     NoXmitBitmap noXmitBitmap() const { return(_noXmitBitmap); }
 
+    /// @brief Return occupancy and overrun counts for the H channel merge
+    /// queue
+    /// @return occupancy and overrun counts for the H channel merge queue
+    QueueStats hMergeQueueStats() const { return(_hMergeQueue); }
+
+    /// @brief Return occupancy and overrun counts for the V channel merge
+    /// queue
+    /// @return occupancy and overrun counts for the V channel merge queue
+    QueueStats vMergeQueueStats() const { return(_vMergeQueue); }
+
+    /// @brief Return occupancy and overrun counts for the burst channel
+    /// merge queue
+    /// @return occupancy and overrun counts for the burst channel merge queue
+    QueueStats burstMergeQueueStats() const { return(_burstMergeQueue); }
+
+    /// @brief Return the mean number of IWRF packets sent per send call,
+    /// which is greater than one when output batching is enabled
+    /// @return the mean number of IWRF packets sent per send call
+    double iwrfPacketsPerSend() const { return(_iwrfPacketsPerSend); }
+
+    /// @brief Return occupancy and overrun counts for the queue feeding the
+    /// IWRF network writer thread
+    /// @return occupancy and overrun counts for the IWRF output queue
+    QueueStats iwrfOutputQueueStats() const { return(_iwrfOutputQueue); }
+
+    /// @brief Return throughput and lag for each connected IWRF client
+    /// @return throughput and lag for each connected IWRF client
+    std::vector<IwrfClientStats> iwrfClientStats() const {
+        return(_iwrfClients);
+    }
+
+    /// @brief Return busy and idle time for the merge sync stage
+    /// @return busy and idle time for the merge sync stage
+    StageStats mergeSyncStageStats() const { return(_mergeSyncStage); }
+
+    /// @brief Return busy and idle time for the merge pack stage
+    /// @return busy and idle time for the merge pack stage
+    StageStats mergePackStageStats() const { return(_mergePackStage); }
+
+    /// @brief Return busy and idle time for the merge send stage
+    /// @return busy and idle time for the merge send stage
+    StageStats mergeSendStageStats() const { return(_mergeSendStage); }
+
+    /// @brief Return occupancy and overrun counts for the queue between the
+    /// merge sync and pack stages
+    /// @return occupancy and overrun counts for the merge pulse queue
+    QueueStats mergePulseQueueStats() const { return(_mergePulseQueue); }
+
 private:
     friend class boost::serialization::access;
 
@@ -255,8 +371,80 @@ private:
             _noXmitBitmap = NoXmitBitmap(rawBitmap);
         }
         if (version >= 1) {
-            // Version 1 stuff will go here...
+            _serializeQueueStats(ar, "hMergeQueue", _hMergeQueue);
+            _serializeQueueStats(ar, "vMergeQueue", _vMergeQueue);
+            _serializeQueueStats(ar, "burstMergeQueue", _burstMergeQueue);
+        }
+        if (version >= 2) {
+            ar & BOOST_SERIALIZATION_NVP(_iwrfPacketsPerSend);
         }
+        if (version >= 3) {
+            int nIwrfClients = _iwrfClients.size();
+            ar & BOOST_SERIALIZATION_NVP(nIwrfClients);
+            _iwrfClients.resize(nIwrfClients);
+            for (int i = 0; i < nIwrfClients; i++) {
+                std::ostringstream prefix;
+                prefix << "iwrfClient" << i;
+                _serializeIwrfClientStats(ar, prefix.str(), _iwrfClients[i]);
+            }
+        }
+        if (version >= 4) {
+            _serializeQueueStats(ar, "iwrfOutputQueue", _iwrfOutputQueue);
+        }
+        if (version >= 5) {
+            _serializeStageStats(ar, "mergeSyncStage", _mergeSyncStage);
+            _serializeStageStats(ar, "mergePackStage", _mergePackStage);
+            _serializeStageStats(ar, "mergeSendStage", _mergeSendStage);
+            _serializeQueueStats(ar, "mergePulseQueue", _mergePulseQueue);
+        }
+        if (version >= 6) {
+            // Version 6 stuff will go here...
+        }
+    }
+
+    /// @brief Serialize a QueueStats struct, using names with the given
+    /// prefix for its members.
+    /// @param ar the archive to load from or save to.
+    /// @param prefix the prefix for member names in the archive
+    /// @param stats the QueueStats to serialize
+    template<class Archive>
+    void _serializeQueueStats(Archive & ar, const std::string & prefix,
+                              QueueStats & stats) {
+        using boost::serialization::make_nvp;
+        ar & make_nvp((prefix + "Size").c_str(), stats.size);
+        ar & make_nvp((prefix + "Depth").c_str(), stats.depth);
+        ar & make_nvp((prefix + "HighWater").c_str(), stats.highWater);
+        ar & make_nvp((prefix + "Overruns").c_str(), stats.overruns);
+    }
+
+    /// @brief Serialize a StageStats struct, using names with the given
+    /// prefix for its members.
+    /// @param ar the archive to load from or save to.
+    /// @param prefix the prefix for member names in the archive
+    /// @param stats the StageStats to serialize
+    template<class Archive>
+    void _serializeStageStats(Archive & ar, const std::string & prefix,
+                              StageStats & stats) {
+        using boost::serialization::make_nvp;
+        ar & make_nvp((prefix + "BusySecs").c_str(), stats.busySecs);
+        ar & make_nvp((prefix + "IdleSecs").c_str(), stats.idleSecs);
+    }
+
+    /// @brief Serialize an IwrfClientStats struct, using names with the
+    /// given prefix for its members.
+    /// @param ar the archive to load from or save to.
+    /// @param prefix the prefix for member names in the archive
+    /// @param stats the IwrfClientStats to serialize
+    template<class Archive>
+    void _serializeIwrfClientStats(Archive & ar, const std::string & prefix,
+                                   IwrfClientStats & stats) {
+        using boost::serialization::make_nvp;
+        ar & make_nvp((prefix + "ConnectedSecs").c_str(), stats.connectedSecs);
+        ar & make_nvp((prefix + "BytesPerSec").c_str(), stats.bytesPerSec);
+        ar & make_nvp((prefix + "LagBytes").c_str(), stats.lagBytes);
+        ar & make_nvp((prefix + "LagSecs").c_str(), stats.lagSecs);
+        ar & make_nvp((prefix + "DroppedPackets").c_str(),
+                      stats.droppedPackets);
     }
 
     /// @brief Initialize all members to zero
@@ -289,9 +477,24 @@ private:
     double _psVoltage;           ///< power supply voltage, V
 
     NoXmitBitmap _noXmitBitmap; ///< bitmap of reasons transmit is disabled
+
+    QueueStats _hMergeQueue;     ///< H channel merge queue statistics
+    QueueStats _vMergeQueue;     ///< V channel merge queue statistics
+    QueueStats _burstMergeQueue; ///< burst channel merge queue statistics
+
+    double _iwrfPacketsPerSend;  ///< mean IWRF packets sent per send call
+
+    std::vector<IwrfClientStats> _iwrfClients; ///< IWRF client statistics
+
+    QueueStats _iwrfOutputQueue; ///< IWRF network writer queue statistics
+
+    StageStats _mergeSyncStage;  ///< merge sync stage busy/idle time
+    StageStats _mergePackStage;  ///< merge pack stage busy/idle time
+    StageStats _mergeSendStage;  ///< merge send stage busy/idle time
+    QueueStats _mergePulseQueue; ///< queue between sync and pack stages
 };
 
 // Increment this class version number when member variables are changed.
-BOOST_CLASS_VERSION(KadrxStatus, 0)
+BOOST_CLASS_VERSION(KadrxStatus, 5)
 
 #endif /* SRC_KADRX_KADRXSTATUS_H_ */
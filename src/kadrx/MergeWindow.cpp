@@ -0,0 +1,364 @@
+/*
+ * MergeWindow.cpp
+ *
+ * Reorder window used by KaMerge to assemble H/V/burst triples which share
+ * the same pulse sequence number.
+ */
+
+#include "MergeWindow.h"
+#include <ctime>
+
+/////////////////////////////////////////////////////////////////////////////
+MergeWindow::MergeWindow(int size, int maxDepth, double maxAgeSecs,
+                         PulsePool *pool) :
+  _size(size),
+  _maxDepth(maxDepth),
+  _maxAgeSecs(maxAgeSecs),
+  _headSeqNum(-1),
+  _newestSeqNum(-1),
+  _headBlockedSince(0.0),
+  _nDropped(0),
+  _nLate(0)
+{
+
+  if (_size < 2) {
+    _size = 2;
+  }
+  if (_maxDepth < 1 || _maxDepth >= _size) {
+    _maxDepth = _size - 1;
+  }
+
+  // preallocate the objects held in each slot
+
+  _slots.resize(_size);
+  for (int ii = 0; ii < _size; ii++) {
+    Slot &slot = _slots[ii];
+    slot.seqNum = -1;
+    if (pool) {
+      pool->create(slot.pulseH);
+      pool->create(slot.pulseV);
+      pool->create(slot.burst);
+    } else {
+      slot.pulseH = new PulseData;
+      slot.pulseV = new PulseData;
+      slot.burst = new BurstData;
+    }
+    slot.hasH = slot.hasV = slot.hasB = false;
+  }
+
+  for (int ii = 0; ii < NO_CHANNEL; ii++) {
+    _newestByChannel[ii] = -1;
+    _farBehind[ii] = false;
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+MergeWindow::~MergeWindow()
+{
+  for (int ii = 0; ii < _size; ii++) {
+    delete _slots[ii].pulseH;
+    delete _slots[ii].pulseV;
+    delete _slots[ii].burst;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// deposit H channel data, returning an object for recycling
+
+PulseData *MergeWindow::depositH(PulseData *pulse)
+{
+  Slot *slot = _slotFor(H_CHANNEL, pulse->getPulseSeqNum());
+  if (slot == NULL) {
+    return pulse;
+  }
+  PulseData *retVal = slot->pulseH;
+  slot->pulseH = pulse;
+  slot->hasH = true;
+  return retVal;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// deposit V channel data, returning an object for recycling
+
+PulseData *MergeWindow::depositV(PulseData *pulse)
+{
+  Slot *slot = _slotFor(V_CHANNEL, pulse->getPulseSeqNum());
+  if (slot == NULL) {
+    return pulse;
+  }
+  PulseData *retVal = slot->pulseV;
+  slot->pulseV = pulse;
+  slot->hasV = true;
+  return retVal;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// deposit burst channel data, returning an object for recycling
+
+BurstData *MergeWindow::depositB(BurstData *burst)
+{
+  Slot *slot = _slotFor(BURST_CHANNEL, burst->getPulseSeqNum());
+  if (slot == NULL) {
+    return burst;
+  }
+  BurstData *retVal = slot->burst;
+  slot->burst = burst;
+  slot->hasB = true;
+  return retVal;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// retrieve the head triple if it is complete
+
+bool MergeWindow::popComplete(PulseData *&pulseH, PulseData *&pulseV,
+                              BurstData *&burst)
+{
+
+  if (headMissing() != NO_CHANNEL) {
+    return false;
+  }
+
+  Slot &slot = _slots[_headSeqNum % _size];
+
+  PulseData *tmpH = slot.pulseH;
+  slot.pulseH = pulseH;
+  pulseH = tmpH;
+
+  PulseData *tmpV = slot.pulseV;
+  slot.pulseV = pulseV;
+  pulseV = tmpV;
+
+  BurstData *tmpB = slot.burst;
+  slot.burst = burst;
+  burst = tmpB;
+
+  _advance();
+  _headBlockedSince = 0.0;
+  return true;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// drop incomplete triples at the head which have exceeded the limits
+
+int MergeWindow::expire()
+{
+
+  int nDropped = 0;
+
+  while (_headSeqNum >= 0 && _newestSeqNum > _headSeqNum) {
+
+    Channel missing = headMissing();
+    if (missing == NO_CHANNEL) {
+      // ready to be retrieved
+      break;
+    }
+
+    // Each channel delivers its data in order, so if a missing channel
+    // has already delivered a newer pulse, the head can never complete.
+
+    const Slot &slot = _slots[_headSeqNum % _size];
+    bool hasData = (slot.seqNum == _headSeqNum);
+    bool abandoned =
+      (!(hasData && slot.hasH) && _newestByChannel[H_CHANNEL] > _headSeqNum) ||
+      (!(hasData && slot.hasV) && _newestByChannel[V_CHANNEL] > _headSeqNum) ||
+      (!(hasData && slot.hasB) && _newestByChannel[BURST_CHANNEL] > _headSeqNum);
+
+    if (!abandoned && (_newestSeqNum - _headSeqNum) < _maxDepth) {
+      double now = _now();
+      if (_headBlockedSince == 0.0) {
+        _headBlockedSince = now;
+        break;
+      }
+      if ((now - _headBlockedSince) < _maxAgeSecs) {
+        break;
+      }
+      // Aged out. Keep _headBlockedSince, since anything behind this
+      // triple has been waiting at least as long.
+    }
+
+    if (hasData) {
+      _nDropped++;
+      nDropped++;
+    }
+    _advance();
+
+  }
+
+  if (_headSeqNum < 0 || _newestSeqNum <= _headSeqNum) {
+    _headBlockedSince = 0.0;
+  }
+
+  return nDropped;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// first channel missing from the head triple
+
+MergeWindow::Channel MergeWindow::headMissing() const
+{
+
+  if (_headSeqNum < 0) {
+    return H_CHANNEL;
+  }
+
+  const Slot &slot = _slots[_headSeqNum % _size];
+  if (slot.seqNum != _headSeqNum) {
+    // nothing at all yet for the head, so return the channel which is
+    // furthest behind
+    Channel oldest = H_CHANNEL;
+    if (_newestByChannel[V_CHANNEL] < _newestByChannel[oldest]) {
+      oldest = V_CHANNEL;
+    }
+    if (_newestByChannel[BURST_CHANNEL] < _newestByChannel[oldest]) {
+      oldest = BURST_CHANNEL;
+    }
+    return oldest;
+  }
+
+  if (!slot.hasH) {
+    return H_CHANNEL;
+  }
+  if (!slot.hasV) {
+    return V_CHANNEL;
+  }
+  if (!slot.hasB) {
+    return BURST_CHANNEL;
+  }
+  return NO_CHANNEL;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// time before the head reaches the age limit
+
+double MergeWindow::headTimeRemaining() const
+{
+  if (_headBlockedSince == 0.0) {
+    return _maxAgeSecs;
+  }
+  double remaining = _maxAgeSecs - (_now() - _headBlockedSince);
+  return (remaining > 0.0) ? remaining : 0.0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// pulses which can be deposited before the oldest are pushed out
+
+int MergeWindow::room() const
+{
+  if (_headSeqNum < 0) {
+    return _size;
+  }
+  int64_t used = _newestSeqNum - _headSeqNum + 1;
+  return (used < _size) ? (int) (_size - used) : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// find the slot for the given channel and sequence number, advancing or
+// resetting the window as required. Returns NULL for late data.
+
+MergeWindow::Slot *MergeWindow::_slotFor(Channel channel, int64_t seqNum)
+{
+
+  if (_headSeqNum < 0) {
+    _reset(seqNum);
+  }
+
+  if (seqNum < _headSeqNum) {
+    // The triple for this pulse has already been retrieved or dropped.
+    // Data far behind the window are late too, unless every channel is
+    // now that far behind, when the pulse sequence has restarted.
+    _farBehind[channel] = (_headSeqNum - seqNum > _size);
+    if (!(_farBehind[H_CHANNEL] && _farBehind[V_CHANNEL] &&
+          _farBehind[BURST_CHANNEL])) {
+      _nLate++;
+      return NULL;
+    }
+    _reset(seqNum);
+  } else if (seqNum - _headSeqNum >= 2 * (int64_t) _size) {
+    // far ahead of the window - skip straight to it
+    _reset(seqNum);
+  }
+  _farBehind[channel] = false;
+
+  // make room by dropping the oldest triples
+
+  while (seqNum - _headSeqNum >= _size) {
+    if (_slots[_headSeqNum % _size].seqNum == _headSeqNum) {
+      _nDropped++;
+    }
+    _advance();
+  }
+
+  if (seqNum > _newestByChannel[channel]) {
+    _newestByChannel[channel] = seqNum;
+  }
+  if (seqNum > _newestSeqNum) {
+    _newestSeqNum = seqNum;
+  }
+
+  Slot &slot = _slots[seqNum % _size];
+  if (slot.seqNum != seqNum) {
+    slot.seqNum = seqNum;
+    slot.hasH = slot.hasV = slot.hasB = false;
+  }
+  return &slot;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// clear the head slot and advance the window by one pulse
+
+void MergeWindow::_advance()
+{
+  Slot &slot = _slots[_headSeqNum % _size];
+  if (slot.seqNum == _headSeqNum) {
+    _clear(slot);
+  }
+  _headSeqNum++;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// drop everything and restart the window at the given sequence number
+
+void MergeWindow::_reset(int64_t seqNum)
+{
+  for (int ii = 0; ii < _size; ii++) {
+    Slot &slot = _slots[ii];
+    if (slot.seqNum >= 0) {
+      _nDropped++;
+    }
+    _clear(slot);
+  }
+  for (int ii = 0; ii < NO_CHANNEL; ii++) {
+    _newestByChannel[ii] = -1;
+    _farBehind[ii] = false;
+  }
+  _headSeqNum = seqNum;
+  _newestSeqNum = seqNum;
+  _headBlockedSince = 0.0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// empty a slot, releasing any beam memory lent to the data it holds
+
+void MergeWindow::_clear(Slot &slot)
+{
+  slot.seqNum = -1;
+  slot.hasH = slot.hasV = slot.hasB = false;
+  slot.pulseH->releaseIq();
+  slot.pulseV->releaseIq();
+  slot.burst->releaseIq();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// monotonic time in seconds
+
+double MergeWindow::_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
@@ -0,0 +1,167 @@
+/*
+ * MergeWindow.h
+ *
+ * Reorder window used by KaMerge to assemble H/V/burst triples which share
+ * the same pulse sequence number.
+ */
+
+#ifndef MERGEWINDOW_H_
+#define MERGEWINDOW_H_
+
+#include <stdint.h>
+#include <vector>
+#include "PulseData.h"
+#include "BurstData.h"
+#include "PulsePool.h"
+
+/// MergeWindow holds recently received H, V and burst data in slots indexed
+/// by pulse sequence number modulo the window size. Data from each channel
+/// are deposited directly into the slot for their pulse, and complete
+/// H/V/burst triples are handed out in pulse sequence order.
+///
+/// If the triple at the head of the window is incomplete, it holds up the
+/// triples behind it until either the newest pulse deposited is maxDepth
+/// pulses past it, or it has been holding up the window for maxAgeSecs.
+/// Then it is dropped, so that a missing pulse on one channel costs only
+/// that pulse. Since each channel delivers its data in order, a head triple
+/// is also dropped at once if a channel it is missing has already delivered
+/// a newer pulse.
+///
+/// Data for a pulse more than a window behind the head are late, and are
+/// dropped like any other late data, so that a channel which falls behind
+/// only loses its own backlog. Only when every channel is delivering data
+/// that far behind is the pulse sequence taken to have restarted, and the
+/// window restarted with it. The window only moves on as fast as its
+/// newest pulse, so its user should deposit the channels' data in step, no
+/// more than room() pulses at a time.
+///
+/// Like the SpscRing which feeds it, MergeWindow recycles objects rather
+/// than copying them: each deposit or retrieval hands back another object
+/// for the caller to reuse. It is not thread safe, and is intended to be
+/// used only by the KaMerge thread. When a triple is dropped, any beam
+/// memory lent to its data is released straight away.
+class MergeWindow {
+public:
+    /// Channels making up a triple
+    typedef enum {
+        H_CHANNEL,
+        V_CHANNEL,
+        BURST_CHANNEL,
+        NO_CHANNEL
+    } Channel;
+
+    /**
+     * Constructor.
+     * @param size the number of slots in the window
+     * @param maxDepth drop an incomplete head triple once a pulse this many
+     *     pulses newer has been deposited
+     * @param maxAgeSecs drop an incomplete head triple once it has held up
+     *     the window for this long, in seconds
+     * @param pool if not NULL, the pool which provides the objects held
+     *     in the slots
+     */
+    MergeWindow(int size, int maxDepth, double maxAgeSecs,
+                PulsePool *pool = NULL);
+
+    ~MergeWindow();
+
+    /// Deposit H channel data. Returns an object for recycling.
+    PulseData *depositH(PulseData *pulse);
+
+    /// Deposit V channel data. Returns an object for recycling.
+    PulseData *depositV(PulseData *pulse);
+
+    /// Deposit burst channel data. Returns an object for recycling.
+    BurstData *depositB(BurstData *burst);
+
+    /**
+     * If the triple at the head of the window is complete, retrieve it and
+     * advance the window. The objects passed in are swapped with the
+     * objects holding the triple's data.
+     * @return true iff a complete triple was retrieved
+     */
+    bool popComplete(PulseData *&pulseH, PulseData *&pulseV,
+                     BurstData *&burst);
+
+    /**
+     * Drop incomplete triples at the head of the window which have exceeded
+     * the depth or age limit.
+     * @return the number of triples dropped
+     */
+    int expire();
+
+    /**
+     * Return the first channel missing from the head triple, or NO_CHANNEL
+     * if the head triple is complete. When the window is empty, H_CHANNEL
+     * is returned.
+     */
+    Channel headMissing() const;
+
+    /**
+     * Return the time in seconds before the head triple reaches the age
+     * limit, or maxAgeSecs if the head is not currently holding up any
+     * newer data.
+     */
+    double headTimeRemaining() const;
+
+    /**
+     * Return the number of pulses which can be deposited past the newest
+     * pulse in the window before the oldest triples are pushed out of it.
+     */
+    int room() const;
+
+    /// @return the total number of incomplete triples dropped
+    int64_t nDropped() const { return _nDropped; }
+
+    /// @return the total number of deposits which arrived too late, after
+    /// their triple had been retrieved or dropped
+    int64_t nLate() const { return _nLate; }
+
+private:
+    struct Slot {
+        int64_t seqNum;
+        PulseData *pulseH;
+        PulseData *pulseV;
+        BurstData *burst;
+        bool hasH;
+        bool hasV;
+        bool hasB;
+    };
+
+    /// Return the slot for the given channel and sequence number, advancing
+    /// or resetting the window as required, or NULL if the data are too old.
+    Slot *_slotFor(Channel channel, int64_t seqNum);
+
+    /// Clear the head slot and advance the window by one pulse
+    void _advance();
+
+    /// Drop everything and restart the window at the given sequence number
+    void _reset(int64_t seqNum);
+
+    /// Empty a slot, releasing any lent beam memory held by its data
+    void _clear(Slot &slot);
+
+    static double _now();
+
+    std::vector<Slot> _slots;
+    int _size;
+    int _maxDepth;
+    double _maxAgeSecs;
+
+    /// Sequence number of the head of the window, -1 before the first deposit
+    int64_t _headSeqNum;
+    /// Newest sequence number deposited, overall and for each channel
+    int64_t _newestSeqNum;
+    int64_t _newestByChannel[NO_CHANNEL];
+    /// Whether the last deposit on each channel was more than a window
+    /// behind the head
+    bool _farBehind[NO_CHANNEL];
+    /// Time at which the head triple started holding up newer data, or
+    /// zero if it is not doing so
+    double _headBlockedSince;
+
+    int64_t _nDropped;
+    int64_t _nLate;
+};
+
+#endif /* MERGEWINDOW_H_ */
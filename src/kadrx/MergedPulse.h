@@ -0,0 +1,57 @@
+/*
+ * MergedPulse.h
+ *
+ * One merged H/V/burst triple, as passed between the stages of KaMerge.
+ */
+
+#ifndef MERGEDPULSE_H_
+#define MERGEDPULSE_H_
+
+#include "PulseData.h"
+#include "BurstData.h"
+#include "SlabArena.h"
+
+/// MergedPulse holds the H pulse, V pulse and burst with the same pulse
+/// sequence number. It is the element type of the queue between KaMerge's
+/// sync stage, which assembles the triples, and its pack stage, which
+/// turns them into IWRF packets.
+///
+/// The data objects are owned by the MergedPulse. Their contents are
+/// swapped in and out by pointer, so a triple is never copied.
+
+class MergedPulse : public SlabArenaObject {
+public:
+  MergedPulse() :
+          pulseH(new PulseData),
+          pulseV(new PulseData),
+          burst(new BurstData) {}
+
+  /// Take ownership of the given data objects
+  MergedPulse(PulseData *h, PulseData *v, BurstData *b) :
+          pulseH(h),
+          pulseV(v),
+          burst(b) {}
+
+  ~MergedPulse() {
+    delete pulseH;
+    delete pulseV;
+    delete burst;
+  }
+
+  /// Hand any beam memory lent by the data source back for reuse
+  void releaseIq() {
+    pulseH->releaseIq();
+    pulseV->releaseIq();
+    burst->releaseIq();
+  }
+
+  PulseData *pulseH;
+  PulseData *pulseV;
+  BurstData *burst;
+
+private:
+  MergedPulse(const MergedPulse &);
+  MergedPulse &operator=(const MergedPulse &);
+};
+
+#endif /* MERGEDPULSE_H_ */
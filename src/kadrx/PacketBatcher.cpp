@@ -0,0 +1,113 @@
+/*
+ * PacketBatcher.cpp
+ *
+ * Gathers consecutive IWRF packets into one buffer, so that KaMerge can
+ * hand several packets to the network writer at once.
+ */
+
+#include "PacketBatcher.h"
+#include <cstring>
+#include <ctime>
+
+/////////////////////////////////////////////////////////////////////////////
+PacketBatcher::PacketBatcher() :
+  _len(0),
+  _nPackets(0),
+  _firstAddTime(0.0),
+  _nHolders(0)
+{
+}
+
+/////////////////////////////////////////////////////////////////////////////
+PacketBatcher::~PacketBatcher()
+{
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// add a packet to the batch
+
+void PacketBatcher::add(const struct iovec *iov, int iovCnt)
+{
+
+  size_t packetLen = 0;
+  for (int ii = 0; ii < iovCnt; ii++) {
+    packetLen += iov[ii].iov_len;
+  }
+
+  char *packet = append(packetLen);
+  for (int ii = 0; ii < iovCnt; ii++) {
+    memcpy(packet, iov[ii].iov_base, iov[ii].iov_len);
+    packet += iov[ii].iov_len;
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// add a packet to the batch, returning space for the caller to fill in
+
+char *PacketBatcher::append(size_t packetLen)
+{
+
+  // grow the buffer if this packet will not fit
+
+  if (_len + packetLen > _buf.size()) {
+    _buf.resize(_len + packetLen);
+  }
+
+  char *packet = &_buf[_len];
+  _len += packetLen;
+
+  if (_nPackets == 0) {
+    _firstAddTime = _now();
+  }
+  _nPackets++;
+
+  return packet;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// is the batch due to be sent?
+
+bool PacketBatcher::flushDue(size_t maxBytes, double maxDelaySecs) const
+{
+  if (_nPackets == 0) {
+    return false;
+  }
+  if (_len >= maxBytes) {
+    return true;
+  }
+  return (_now() - _firstAddTime) >= maxDelaySecs;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// time before the batch reaches its delay limit
+
+double PacketBatcher::timeRemaining(double maxDelaySecs) const
+{
+  if (_nPackets == 0) {
+    return maxDelaySecs;
+  }
+  double remaining = maxDelaySecs - (_now() - _firstAddTime);
+  return (remaining > 0.0) ? remaining : 0.0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// empty the batch
+
+void PacketBatcher::clear()
+{
+  _len = 0;
+  _nPackets = 0;
+  _firstAddTime = 0.0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// monotonic time in seconds
+
+double PacketBatcher::_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
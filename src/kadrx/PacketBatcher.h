@@ -0,0 +1,101 @@
+/*
+ * PacketBatcher.h
+ *
+ * Gathers consecutive IWRF packets into one buffer, so that KaMerge can
+ * hand several packets to the network writer at once.
+ */
+
+#ifndef PACKETBATCHER_H_
+#define PACKETBATCHER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+/// PacketBatcher accumulates packets, each given as an iovec, in a
+/// contiguous buffer. The batch should be passed on once flushDue() returns
+/// true, which happens when the batch holds at least maxBytes bytes, or
+/// when its oldest packet has been waiting for maxDelaySecs.
+///
+/// Packets are copied into the batch, since the data they point to are
+/// reused as soon as the packet has been added. The buffer keeps its size
+/// when the batch is cleared, so batches can be recycled through an
+/// SpscRing without further allocation.
+///
+/// Once a batch has been passed on, it may be shared by several readers
+/// on one thread, such as an IwrfPacketRing and an IwrfArchiver queue.
+/// hold() and release() count them, so that the batch is recycled only
+/// when the last has finished with it.
+///
+/// PacketBatcher is not thread safe.
+class PacketBatcher {
+public:
+    PacketBatcher();
+
+    ~PacketBatcher();
+
+    /// Add a packet to the batch
+    /// @param iov the pieces making up the packet
+    /// @param iovCnt the number of pieces
+    void add(const struct iovec *iov, int iovCnt);
+
+    /// Add a packet which the caller writes straight into the batch,
+    /// saving a copy.
+    /// @param packetLen the packet length in bytes
+    /// @return space for the packet, which must be filled in before the
+    /// batch is passed on, and is valid until the batch is next changed.
+    /// It is not aligned.
+    char *append(size_t packetLen);
+
+    /// @param maxBytes the batch size limit
+    /// @param maxDelaySecs the limit on the time the oldest packet waits,
+    ///     in seconds
+    /// @return true iff the batch has reached its size or delay limit
+    bool flushDue(size_t maxBytes, double maxDelaySecs) const;
+
+    /// @param maxDelaySecs the limit on the time the oldest packet waits,
+    ///     in seconds
+    /// @return the time in seconds before the batch reaches its delay
+    /// limit, or maxDelaySecs if the batch is empty
+    double timeRemaining(double maxDelaySecs) const;
+
+    /// @return the batched data
+    const char *data() const { return _buf.empty() ? 0 : &_buf[0]; }
+
+    /// @return the number of bytes in the batch
+    size_t len() const { return _len; }
+
+    /// @return the number of packets in the batch
+    int nPackets() const { return _nPackets; }
+
+    /// @return the size of the buffer, which is the memory the batch ties
+    /// up however little it holds
+    size_t capacity() const { return _buf.size(); }
+
+    /// Count another reader sharing the batch
+    void hold() { _nHolders++; }
+
+    /// Count a reader finished with the batch
+    /// @return the number of readers still sharing it
+    int release() { return --_nHolders; }
+
+    /// @return the number of readers sharing the batch
+    int nHolders() const { return _nHolders; }
+
+    /// Empty the batch
+    void clear();
+
+private:
+    static double _now();
+
+    std::vector<char> _buf;
+    size_t _len;
+    int _nPackets;
+    /// time at which the oldest packet in the batch was added
+    double _firstAddTime;
+    /// readers sharing the batch
+    int _nHolders;
+};
+
+#endif /* PACKETBATCHER_H_ */
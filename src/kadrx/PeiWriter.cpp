@@ -0,0 +1,362 @@
+/*
+ * PeiWriter.cpp
+ *
+ * Writes Pei format time series files for one channel, off the channel's
+ * reader thread.
+ */
+
+#include "PeiWriter.h"
+#include <logx/Logging.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+LOGGING("PeiWriter")
+
+// Bytes in a pulse record before the I and Q values: time, PRF, pulse
+// width and gate count
+static const size_t PulseHeaderLen =
+        sizeof(double) + 2 * sizeof(float) + sizeof(int);
+
+// Longest time span of pulses held in a buffer before it is handed to the
+// writer thread, seconds
+static const double MaxBufferSecs = 1.0;
+
+// Most files started within one second. Files after the first get a
+// zero-padded suffix, _001 on, so that they sort in order.
+static const int MaxFilesPerSecond = 1000;
+
+// Wait before trying a new file after the first failure, seconds
+static const int FirstRetrySecs = 1;
+
+/////////////////////////////////////////////////////////////////////////////
+// monotonic time, seconds
+
+static double
+monotonicNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+PeiWriter::PeiWriter(const KaDrxConfig &config, int chanId, int maxGates) :
+  _chanId(chanId),
+  _maxGates(maxGates),
+  _fileSecs(3600),
+  _maxFileBytes(2048ULL * 1024 * 1024),
+  _syncSecs(5),
+  _bufSize(4096 * 1024),
+  _writing(false),
+  _stopping(false),
+  _fd(-1),
+  _fileBytes(0),
+  _filePeriod(-1),
+  _lastSyncTime(0.0),
+  _retryTime(0.0),
+  _retrySecs(FirstRetrySecs),
+  _suspended(false),
+  _nBytesQueued(0),
+  _nBytesWritten(0),
+  _nPulsesDropped(0),
+  _threadPolicy(config, "pei_writer")
+{
+
+  if (config.pei_file_seconds() != KaDrxConfig::UNSET_INT &&
+      config.pei_file_seconds() > 0) {
+    _fileSecs = config.pei_file_seconds();
+  }
+  if (config.pei_file_megabytes() != KaDrxConfig::UNSET_INT &&
+      config.pei_file_megabytes() > 0) {
+    _maxFileBytes = (uint64_t) config.pei_file_megabytes() * 1024 * 1024;
+  }
+  if (config.pei_sync_seconds() != KaDrxConfig::UNSET_INT) {
+    _syncSecs = config.pei_sync_seconds();
+  }
+  if (config.pei_buffer_kb() != KaDrxConfig::UNSET_INT &&
+      config.pei_buffer_kb() > 0) {
+    _bufSize = (size_t) config.pei_buffer_kb() * 1024;
+  }
+
+  // a buffer must hold at least one pulse
+
+  size_t maxPulseLen = PulseHeaderLen + 4 * (size_t) _maxGates;
+  if (_bufSize < maxPulseLen) {
+    _bufSize = maxPulseLen;
+  }
+
+  _fill.data = new char[_bufSize];
+  _fill.len = 0;
+  _fill.nPulses = 0;
+  _fill.startTime = 0.0;
+  _full.data = new char[_bufSize];
+  _full.len = 0;
+  _full.nPulses = 0;
+  _full.startTime = 0.0;
+
+  ILOG << "Channel " << _chanId << " Pei files: new file every " <<
+      _fileSecs << " s or " << _maxFileBytes / (1024 * 1024) << " MB, " <<
+      "2 x " << _bufSize / 1024 << " kB buffers, sync every " <<
+      _syncSecs << " s";
+
+  _writerThread = new WriterThread(*this);
+  _writerThread->start();
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+PeiWriter::~PeiWriter()
+{
+
+  // hand over what the reader left, once the writer is free, then let the
+  // writer finish and close the file
+
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    while (_writing) {
+      _cond.wait(lock);
+    }
+  }
+  if (_fill.len > 0) {
+    _handOff();
+  }
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _stopping = true;
+    _cond.notify_all();
+  }
+  _writerThread->wait();
+  delete _writerThread;
+
+  delete[] _fill.data;
+  delete[] _full.data;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// copy a pulse into the fill buffer, handing the buffer to the writer
+// thread first if the pulse will not fit or the buffer is old enough
+
+void PeiWriter::addPulse(double timeSecs, float prf, float pulseWidth,
+                         int nGates, const int16_t *iq)
+{
+
+  if (nGates > _maxGates) {
+    nGates = _maxGates;
+  }
+  size_t pulseLen = PulseHeaderLen + 4 * (size_t) nGates;
+
+  if (_fill.len > 0 &&
+      (_fill.len + pulseLen > _bufSize ||
+       timeSecs - _fill.startTime >= MaxBufferSecs)) {
+    if (!_handOff() && _fill.len + pulseLen > _bufSize) {
+      // the writer still has the other buffer
+      _nPulsesDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+
+  if (_fill.len == 0) {
+    _fill.startTime = timeSecs;
+  }
+  char *p = _fill.data + _fill.len;
+  memcpy(p, &timeSecs, sizeof(timeSecs));
+  p += sizeof(timeSecs);
+  memcpy(p, &prf, sizeof(prf));
+  p += sizeof(prf);
+  memcpy(p, &pulseWidth, sizeof(pulseWidth));
+  p += sizeof(pulseWidth);
+  memcpy(p, &nGates, sizeof(nGates));
+  p += sizeof(nGates);
+  memcpy(p, iq, 4 * (size_t) nGates);
+  _fill.len += pulseLen;
+  _fill.nPulses++;
+  _nBytesQueued.fetch_add(pulseLen, std::memory_order_relaxed);
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// give the fill buffer to the writer thread, and carry on in the spare.
+// Returns false if the writer is still busy with the spare.
+
+bool PeiWriter::_handOff()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  if (_writing) {
+    return false;
+  }
+  std::swap(_fill, _full);
+  _fill.len = 0;
+  _fill.nPulses = 0;
+  _writing = true;
+  _cond.notify_all();
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// writer thread: write each buffer handed over
+
+void PeiWriter::_writeLoop()
+{
+
+  _threadPolicy.applyToCurrentThread();
+
+  while (true) {
+
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      while (!_writing && !_stopping) {
+        _cond.wait(lock);
+      }
+      if (!_writing) {
+        break;
+      }
+    }
+
+    _writeBuffer(_full);
+
+    boost::mutex::scoped_lock lock(_mutex);
+    _writing = false;
+    _cond.notify_all();
+
+  }
+
+  _closeFile();
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// write a buffer to the current file, starting a new file first if need be
+
+void PeiWriter::_writeBuffer(const Buffer &buf)
+{
+
+  int64_t period = (int64_t) floor(buf.startTime / _fileSecs);
+  if ((_fd < 0 || period != _filePeriod ||
+       (_fileBytes > 0 && _fileBytes + buf.len > _maxFileBytes)) &&
+      monotonicNow() >= _retryTime) {
+    _closeFile();
+    _openFile(buf.startTime);
+  }
+  if (_fd < 0) {
+    // no file until the next retry
+    _nPulsesDropped.fetch_add(buf.nPulses, std::memory_order_relaxed);
+    return;
+  }
+
+  size_t done = 0;
+  while (done < buf.len) {
+    ssize_t n = write(_fd, buf.data + done, buf.len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (!_suspended) {
+        ELOG << "Error writing Pei file " << _fileName << ": " <<
+            strerror(errno);
+      }
+      _closeFile();
+      _backOff();
+      _nPulsesDropped.fetch_add(buf.nPulses, std::memory_order_relaxed);
+      return;
+    }
+    done += n;
+  }
+  if (_suspended) {
+    ILOG << "Channel " << _chanId << " Pei files resumed";
+    _suspended = false;
+  }
+  _retrySecs = FirstRetrySecs;
+  _fileBytes += buf.len;
+  _nBytesWritten.fetch_add(buf.len, std::memory_order_relaxed);
+
+  double now = monotonicNow();
+  if (now - _lastSyncTime >= _syncSecs) {
+    fdatasync(_fd);
+    _lastSyncTime = now;
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// open the file for the given pulse time
+
+void PeiWriter::_openFile(double timeSecs)
+{
+
+  time_t fileTime = (time_t) floor(timeSecs);
+  struct tm tm;
+  gmtime_r(&fileTime, &tm);
+  char baseName[256];
+  snprintf(baseName, sizeof(baseName), "chan%d_%4d%02d%02d_%02d%02d%02d_pei",
+           _chanId, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+           tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+  // never append to an existing file: a file started in the same second,
+  // e.g. by a size rotation, gets the next free sequence suffix
+
+  _fd = -1;
+  for (int seq = 0; _fd < 0 && seq < MaxFilesPerSecond; seq++) {
+    char fileName[300];
+    if (seq == 0) {
+      snprintf(fileName, sizeof(fileName), "%s", baseName);
+    } else {
+      snprintf(fileName, sizeof(fileName), "%s_%03d", baseName, seq);
+    }
+    _fileName = fileName;
+    _fd = open(fileName, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (_fd < 0 && errno != EEXIST) {
+      break;
+    }
+  }
+  if (_fd < 0) {
+    if (!_suspended) {
+      ELOG << "Error opening Pei file '" << _fileName << "': " <<
+          strerror(errno);
+    }
+    _backOff();
+    return;
+  }
+  _fileBytes = 0;
+  _filePeriod = (int64_t) floor(timeSecs / _fileSecs);
+  _lastSyncTime = monotonicNow();
+  ILOG << "Writing Pei file " << _fileName;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// put off the next new file after a failure, for twice as long each time
+// in a row, up to the file period. The outage is logged once, rather than
+// for every buffer.
+
+void PeiWriter::_backOff()
+{
+  if (!_suspended) {
+    ELOG << "Channel " << _chanId << " Pei files suspended; pulses are " <<
+        "dropped until a file can be written";
+    _suspended = true;
+  }
+  _retryTime = monotonicNow() + _retrySecs;
+  _retrySecs *= 2;
+  if (_retrySecs > _fileSecs) {
+    _retrySecs = _fileSecs;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void PeiWriter::_closeFile()
+{
+  if (_fd < 0) {
+    return;
+  }
+  fdatasync(_fd);
+  if (close(_fd) != 0) {
+    ELOG << "Error closing Pei file " << _fileName << ": " << strerror(errno);
+  }
+  _fd = -1;
+}
@@ -0,0 +1,164 @@
+/*
+ * PeiWriter.h
+ *
+ * Writes Pei format time series files for one channel, off the channel's
+ * reader thread.
+ */
+
+#ifndef PEIWRITER_H_
+#define PEIWRITER_H_
+
+#include "KaDrxConfig.h"
+#include "ThreadPolicy.h"
+#include <QThread>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+/// PeiWriter writes the Pei format time series for one receive channel.
+/// Each pulse is written as:
+///
+/// time|PRF|pulse_width|n_gates|I(0)|Q(0)|I(1)|Q(1)|...|I(n_gates-1)|Q(n_gates-1)
+///
+/// time - pulse time in seconds since 1970-01-01 00:00:00 UTC, 8-byte IEEE float
+/// PRF - PRF in Hz, 4-byte IEEE float
+/// pulse_width - receiver pulse width in seconds, 4-byte IEEE float
+/// n_gates - gate count, 4-byte int
+/// I(n) - inphase counts for gate n, 2-byte int
+/// Q(n) - quadrature counts for gate n, 2-byte int
+///
+/// All values are written little-endian.
+///
+/// The channel's reader thread calls addPulse(), which only copies the
+/// pulse into one of two preallocated buffers. When the buffer is full, or
+/// holds a second of data, it is handed to a writer thread, and the reader
+/// carries on in the other buffer. The writer thread writes each buffer
+/// with one large write, calls fdatasync() every pei_sync_seconds, and
+/// starts a new file on each multiple of pei_file_seconds or when a file
+/// would exceed pei_file_megabytes. If the writer still has the other
+/// buffer when the reader needs it, pulses are dropped and counted rather
+/// than holding up the reader. So are the pulses in buffers arriving while
+/// no file can be opened or written; a new file is then tried after a
+/// second, then after twice as long with each further failure, up to
+/// pei_file_seconds.
+///
+/// addPulse() must only be called from one thread. The statistics methods
+/// may be called from any thread.
+class PeiWriter {
+public:
+
+  /**
+   * Constructor. The buffers are allocated and the writer thread started.
+   * @param config the KaDrxConfig
+   * @param chanId the channel number, used in the file names
+   * @param maxGates the largest number of gates in a pulse
+   */
+  PeiWriter(const KaDrxConfig &config, int chanId, int maxGates);
+
+  /// Destructor, writing out the data held and closing the file
+  ~PeiWriter();
+
+  /**
+   * Queue a pulse to be written.
+   * @param timeSecs pulse time, seconds since 1970-01-01 00:00:00 UTC
+   * @param prf the PRF, Hz
+   * @param pulseWidth the receiver pulse width, s
+   * @param nGates the number of gates to write, at most maxGates
+   * @param iq the I and Q counts for each gate
+   */
+  void addPulse(double timeSecs, float prf, float pulseWidth, int nGates,
+                const int16_t *iq);
+
+  /// @return the number of bytes queued by addPulse()
+  uint64_t nBytesQueued() const {
+    return _nBytesQueued.load(std::memory_order_relaxed);
+  }
+
+  /// @return the number of bytes written to files
+  uint64_t nBytesWritten() const {
+    return _nBytesWritten.load(std::memory_order_relaxed);
+  }
+
+  /// @return the number of pulses dropped because the writer fell behind
+  uint64_t nPulsesDropped() const {
+    return _nPulsesDropped.load(std::memory_order_relaxed);
+  }
+
+private:
+
+  class WriterThread : public QThread {
+  public:
+    WriterThread(PeiWriter &writer) : _writer(writer) {}
+    void run() { _writer._writeLoop(); }
+  private:
+    PeiWriter &_writer;
+  };
+
+  /// A buffer of whole pulses, their count, and the time of the first
+  struct Buffer {
+    char *data;
+    size_t len;
+    int nPulses;
+    double startTime;
+  };
+
+  // not copyable
+  PeiWriter(const PeiWriter &rhs);
+  PeiWriter & operator=(const PeiWriter &rhs);
+
+  bool _handOff();
+  void _writeLoop();
+  void _writeBuffer(const Buffer &buf);
+  void _openFile(double timeSecs);
+  void _backOff();
+  void _closeFile();
+
+  int _chanId;
+  int _maxGates;
+  int _fileSecs;
+  uint64_t _maxFileBytes;
+  int _syncSecs;
+  size_t _bufSize;
+
+  /// the buffer being filled, used only by the reader thread, and the
+  /// buffer being written, or the empty spare when the writer is idle
+
+  Buffer _fill;
+  Buffer _full;
+
+  /// Hand-off state, guarded by _mutex. _writing is set when _full is
+  /// handed to the writer thread, and cleared when it has been written.
+
+  boost::mutex _mutex;
+  boost::condition_variable _cond;
+  bool _writing;
+  bool _stopping;
+
+  /// current file, used only by the writer thread
+
+  int _fd;
+  std::string _fileName;
+  uint64_t _fileBytes;
+  int64_t _filePeriod;
+  double _lastSyncTime;
+
+  /// when a new file may next be tried, after a failure, monotonic
+  /// seconds, how long to wait after the next failure, and whether the
+  /// failure has been logged. Used only by the writer thread.
+
+  double _retryTime;
+  int _retrySecs;
+  bool _suspended;
+
+  std::atomic<uint64_t> _nBytesQueued;
+  std::atomic<uint64_t> _nBytesWritten;
+  std::atomic<uint64_t> _nPulsesDropped;
+
+  ThreadPolicy _threadPolicy;
+  WriterThread *_writerThread;
+
+};
+
+#endif /* PEIWRITER_H_ */
@@ -1,4 +1,5 @@
 #include "PulseData.h"
+#include "BeamLease.h"
 #include <cstdio>
 #include <cstring>
 #include <cmath>
@@ -18,6 +19,9 @@ PulseData::PulseData()
   _nGates = 0;
   _nGatesAlloc = 0;
   _iq = NULL;
+  _iqBuf = NULL;
+  _ownIqBuf = false;
+  _lease = NULL;
 
 }
 
@@ -26,8 +30,29 @@ PulseData::~PulseData()
 
 {
 
-  if (_iq) {
-    delete[] _iq;
+  releaseIq();
+
+  if (_ownIqBuf) {
+    delete[] _iqBuf;
+  }
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// use storage owned by the caller for the iq data
+
+void PulseData::useIqStorage(int16_t *iqBuf, int nGates)
+
+{
+
+  if (_ownIqBuf) {
+    delete[] _iqBuf;
+  }
+  _iqBuf = iqBuf;
+  _ownIqBuf = false;
+  _nGatesAlloc = nGates;
+  if (!_lease) {
+    _iq = _iqBuf;
   }
 
 }
@@ -49,76 +74,52 @@ void PulseData::set(int64_t pulseSeqNum,
   _nanoSecs = nanoSecs;
 
   _channelId = channelId;
+  releaseIq();
   _nGates = nGates;
   _allocIq();
+  _iq = _iqBuf;
   memcpy(_iq, iq, _nGates * 2 * sizeof(int16_t));
 
 }
 
 /////////////////////////////////////////////////////////////////////////////
-// combine every second gate in the IQ data
-// to reduce the number of gates to half
+// set the data, referencing lent beam memory
 
-void PulseData::combineEverySecondGate()
+void PulseData::lend(int64_t pulseSeqNum,
+                     time_t timeSecs,
+                     int nanoSecs,
+                     int channelId,
+                     BeamLease *lease)
 
 {
-  const int DecimationFactor = 2;  // every 2nd gate (for now?)
-  int newNGates = _nGates / DecimationFactor;
-
-  int16_t *iq = _iq;
-  int16_t *newIq = _iq;
-
-  for (int newG = 0; newG < newNGates; newG++) {
-
-    // Save I and Q of the first gate being averaged for this new gate
-    double firstI = iq[0];
-    double firstQ = iq[1];
-    double firstPower = firstI * firstI + firstQ * firstQ;
-
-    // Sum powers for the gates going into the new gate
-    double powerSum = 0.0;
-    for (int subG = 0; subG < DecimationFactor; subG++) {
-        double i = iq[0];
-        double q = iq[1];
-        
-        powerSum += i * i + q * q;
-        
-        iq += 2;    // step to the next original gate
-    }
-
-    // Average power for the two gates
-    double newPower = powerSum / DecimationFactor;
-    
-    // Scale factor for firstI and firstQ so that they keep their original phase 
-    // but will yield the average power of the combined gates.
-
-    double iqScale = (firstPower > 0.0) ? sqrt(newPower / firstPower) : 1.0;
-    
-    // Scale firstI and firstQ to generate values for our new gate.
-   
-    double newI = firstI * iqScale;
-    double newQ = firstQ * iqScale;
-
-    if (newI < -32768) {
-      newI = -32768;
-    } else if (newI > 32767) {
-      newI = 32767;
-    }
-    
-    if (newQ < -32768) {
-      newQ = -32768;
-    } else if (newQ > 32767) {
-      newQ = 32767;
-    }
-    
-    newIq[0] = (int16_t) newI;
-    newIq[1] = (int16_t) newQ;
-    
-    newIq += 2; // step to the next new gate
 
-  }
+  _pulseSeqNum = pulseSeqNum;
+  _timeSecs = timeSecs;
+  _nanoSecs = nanoSecs;
+
+  _channelId = channelId;
+
+  lease->addRef();
+  releaseIq();
+  _lease = lease;
+  _iq = _lease->iq();
+  _nGates = _lease->nGates();
+
+}
 
-  _nGates = newNGates;
+/////////////////////////////////////////////////////////////////////////////
+// release lent IQ data back to the data source
+
+void PulseData::releaseIq()
+
+{
+
+  if (_lease) {
+    _lease->release();
+    _lease = NULL;
+    _iq = _iqBuf;
+    _nGates = 0;
+  }
 
 }
 
@@ -133,11 +134,13 @@ void PulseData::_allocIq()
     return;
   }
 
-  if (_iq) {
-    delete[] _iq;
+  if (_ownIqBuf) {
+    delete[] _iqBuf;
   }
 
-  _iq = new int16_t[_nGates * 2];
+  _iqBuf = new int16_t[_nGates * 2];
+  _ownIqBuf = true;
+  _nGatesAlloc = _nGates;
 
 }
 
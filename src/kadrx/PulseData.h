@@ -8,8 +8,12 @@
 
 #include <sys/time.h>
 #include <sys/types.h>
+#include <cstddef>
+#include "SlabArena.h"
 
-class PulseData {
+class BeamLease;
+
+class PulseData : public SlabArenaObject {
 
 public:
     
@@ -32,10 +36,26 @@ public:
            int nGates,
            const int16_t *iq);
 
-  // combine every second gate in the IQ data
-  // to reduce the number of gates to half
+  // set the data, taking a reference to beam memory lent by the
+  // data source instead of copying the IQ data
+
+  void lend(int64_t pulseSeqNum,
+            time_t timeSecs,
+            int nanoSecs,
+            int channelId,
+            BeamLease *lease);
+
+  // release any lent IQ data back to the data source. This must be
+  // called once the IQ data have been used, so that the source can
+  // reuse the memory. The IQ data are no longer valid afterwards.
+
+  void releaseIq();
+
+  // use the given buffer, which holds up to nGates gates and is owned by
+  // the caller, for copies of the IQ data. Must be called before set().
+  // Used by PulsePool, which places objects and their IQ data together.
 
-  void combineEverySecondGate();
+  void useIqStorage(int16_t *iqBuf, int nGates);
 
   // get methods
 
@@ -46,6 +66,7 @@ public:
   inline int getNGates() const { return _nGates; }
   inline const int16_t *getIq() const { return _iq; }
   inline int16_t *getIq() { return _iq; }
+  inline bool isLent() const { return _lease != NULL; }
   
 private:
 
@@ -76,10 +97,14 @@ private:
   int _nGatesAlloc;
 
   /**
-   * IQ data
+   * IQ data. _iq points either into _iqBuf, which we own,
+   * or into memory lent to us by the data source via _lease.
    */
 
   int16_t *_iq;
+  int16_t *_iqBuf;
+  bool _ownIqBuf;
+  BeamLease *_lease;
 
   // functions
 
@@ -0,0 +1,289 @@
+/*
+ * PulseKernelBench.cpp
+ *
+ * Compares two ways of turning the raw H and V IQ data of a pulse into an
+ * IWRF pulse packet in KaMerge's output batch:
+ *
+ *   separate: decimate each channel in place, cohere each channel in
+ *     place, then gather the header and the IQ data into the batch, with
+ *     PacketBatcher::add(). This is how KaMerge used to do it, making
+ *     three passes over the IQ data.
+ *
+ *   fused: reserve the packet in the batch with PacketBatcher::append(),
+ *     and write each channel straight into it with IqKernels::packPulse(),
+ *     which reads the raw IQ data once.
+ *
+ * First the two are checked to produce identical packets for every case,
+ * and the program exits with status 1 if they do not. Then each case is
+ * timed, for 1000 to 4000 gates, with and without decimation.
+ *
+ * Each pulse is taken from a pool of pulses, and is refreshed from a
+ * pristine copy before it is processed, since the separate sequence
+ * modifies it. The refresh is not timed, and is done the same way for both
+ * methods. That leaves the pulse in cache, so each case is timed again
+ * with the pulse flushed from cache first ("cold"), as it would be when
+ * the data have just been written by the reader thread on another core.
+ *
+ * Usage: PulseKernelBench [nPulses]
+ */
+
+#include "IqKernels.h"
+#include "PacketBatcher.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_CLFLUSH 1
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+// stand-in for the iwrf_pulse_header, which this program does not need
+static const int HeaderLen = 256;
+
+// pulses in the pool
+static const int PoolSize = 64;
+
+// the batch is emptied whenever it holds this much, as KaMerge would
+// hand it on
+static const size_t BatchBytes = 1024 * 1024;
+
+static const double CosNorm = cos(0.7);
+static const double SinNorm = sin(0.7);
+
+/// The IQ data for one pulse
+struct Pulse {
+  std::vector<int16_t> h;
+  std::vector<int16_t> v;
+};
+
+// Add a pulse packet to the batch the old way.
+
+static void
+sendSeparate(Pulse &pulse, int factor, const char *header,
+             const std::vector<int16_t> &zeros, PacketBatcher &batch) {
+
+  int nGatesH = pulse.h.size() / 2;
+  int nGatesV = pulse.v.size() / 2;
+  if (factor > 1) {
+    nGatesH = IqKernels::decimate(&pulse.h[0], nGatesH, factor);
+    nGatesV = IqKernels::decimate(&pulse.v[0], nGatesV, factor);
+  }
+  IqKernels::cohere(&pulse.h[0], nGatesH, CosNorm, SinNorm);
+  IqKernels::cohere(&pulse.v[0], nGatesV, CosNorm, SinNorm);
+
+  int nGates = std::max(nGatesH, nGatesV);
+  size_t chanLen = nGates * 2 * sizeof(int16_t);
+  struct iovec iov[5];
+  int iovCnt = 0;
+  iov[iovCnt].iov_base = const_cast<char *>(header);
+  iov[iovCnt].iov_len = HeaderLen;
+  iovCnt++;
+  int16_t *iq[2] = { &pulse.h[0], &pulse.v[0] };
+  int nGatesChan[2] = { nGatesH, nGatesV };
+  for (int chan = 0; chan < 2; chan++) {
+    size_t iqLen = nGatesChan[chan] * 2 * sizeof(int16_t);
+    iov[iovCnt].iov_base = iq[chan];
+    iov[iovCnt].iov_len = iqLen;
+    iovCnt++;
+    if (iqLen < chanLen) {
+      iov[iovCnt].iov_base = const_cast<int16_t *>(&zeros[0]);
+      iov[iovCnt].iov_len = chanLen - iqLen;
+      iovCnt++;
+    }
+  }
+  batch.add(iov, iovCnt);
+
+}
+
+// Add a pulse packet to the batch with the fused kernel.
+
+static void
+sendFused(const Pulse &pulse, int factor, const char *header,
+          PacketBatcher &batch) {
+
+  int nGates = std::max(pulse.h.size(), pulse.v.size()) / 2 / factor;
+  size_t chanLen = nGates * 2 * sizeof(int16_t);
+  char *packet = batch.append(HeaderLen + 2 * chanLen);
+  memcpy(packet, header, HeaderLen);
+
+  char *iq = packet + HeaderLen;
+  const std::vector<int16_t> *chans[2] = { &pulse.h, &pulse.v };
+  for (int chan = 0; chan < 2; chan++) {
+    int nGatesChan = IqKernels::packPulse(&(*chans[chan])[0],
+                                          chans[chan]->size() / 2, factor,
+                                          true, CosNorm, SinNorm, iq);
+    size_t iqLen = nGatesChan * 2 * sizeof(int16_t);
+    memset(iq + iqLen, 0, chanLen - iqLen);
+    iq += chanLen;
+  }
+
+}
+
+// Make a pool of random pulses. V has a few gates fewer than H, so that
+// the padding is exercised.
+
+static std::vector<Pulse>
+makePool(int nGates) {
+  std::mt19937 rng(12345);
+  std::uniform_int_distribution<int> countDist(-32768, 32767);
+  std::vector<Pulse> pool(PoolSize);
+  for (int ii = 0; ii < PoolSize; ii++) {
+    pool[ii].h.resize(2 * nGates);
+    pool[ii].v.resize(2 * (nGates - 5));
+    for (size_t jj = 0; jj < pool[ii].h.size(); jj++) {
+      pool[ii].h[jj] = (int16_t) countDist(rng);
+    }
+    for (size_t jj = 0; jj < pool[ii].v.size(); jj++) {
+      pool[ii].v[jj] = (int16_t) countDist(rng);
+    }
+  }
+  return pool;
+}
+
+// Check that both methods give the same packet.
+
+static bool
+checkSame(int nGates, int factor, const char *header,
+          const std::vector<int16_t> &zeros) {
+  std::vector<Pulse> pool = makePool(nGates);
+  PacketBatcher separate, fused;
+  for (int ii = 0; ii < PoolSize; ii++) {
+    Pulse pulse = pool[ii];
+    sendSeparate(pulse, factor, header, zeros, separate);
+    sendFused(pool[ii], factor, header, fused);
+  }
+  return (separate.len() == fused.len() &&
+          memcmp(separate.data(), fused.data(), separate.len()) == 0);
+}
+
+// Flush a vector from the cache
+
+static void
+flush(const std::vector<int16_t> &data) {
+#ifdef HAVE_CLFLUSH
+  const char *start = (const char *) &data[0];
+  const char *end = start + data.size() * sizeof(int16_t);
+  for (const char *ptr = start; ptr < end; ptr += 64) {
+    _mm_clflush(ptr);
+  }
+  _mm_clflush(end - 1);
+  _mm_mfence();
+#endif
+}
+
+// Time one method, returning microseconds per pulse.
+
+static double
+timeMethod(bool useFused, bool cold, int nGates, int factor, int nPulses,
+           const char *header, const std::vector<int16_t> &zeros) {
+
+  const std::vector<Pulse> pristine = makePool(nGates);
+  std::vector<Pulse> pool = pristine;
+  PacketBatcher batch;
+
+  double secs = 0.0;
+  for (int ipulse = -1000; ipulse < nPulses; ipulse++) {
+    int index = (ipulse + 1000) % PoolSize;
+    Pulse &pulse = pool[index];
+    pulse = pristine[index];
+    if (cold) {
+      flush(pulse.h);
+      flush(pulse.v);
+    }
+    if (batch.len() >= BatchBytes) {
+      batch.clear();
+    }
+    Clock::time_point start = Clock::now();
+    if (useFused) {
+      sendFused(pulse, factor, header, batch);
+    } else {
+      sendSeparate(pulse, factor, header, zeros, batch);
+    }
+    // the first 1000 pulses are an untimed warm-up
+    if (ipulse >= 0) {
+      secs += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+  }
+
+  return secs / nPulses * 1.0e6;
+
+}
+
+int
+main(int argc, char *argv[])
+{
+
+  int nPulses = 20000;
+  if (argc > 1) {
+    nPulses = atoi(argv[1]);
+  }
+
+  const int gateCounts[] = { 1000, 2000, 3000, 4000 };
+  const int nGateCounts = sizeof(gateCounts) / sizeof(gateCounts[0]);
+  const int factors[] = { 1, 2, 4 };
+  const int nFactors = sizeof(factors) / sizeof(factors[0]);
+
+  std::vector<char> header(HeaderLen, 'h');
+  std::vector<int16_t> zeros(2 * 4000, 0);
+
+  std::cout << "PulseKernelBench: using the "
+            << IqKernels::isaName(IqKernels::bestIsa())
+            << " kernels, cohering to the burst phase" << std::endl;
+
+  bool ok = true;
+  for (int icount = 0; icount < nGateCounts; icount++) {
+    for (int ifactor = 0; ifactor < nFactors; ifactor++) {
+      if (!checkSame(gateCounts[icount], factors[ifactor],
+                     &header[0], zeros)) {
+        std::cout << gateCounts[icount] << " gates, factor "
+                  << factors[ifactor]
+                  << ": fused packet differs from separate - FAILED"
+                  << std::endl;
+        ok = false;
+      }
+    }
+  }
+  if (!ok) {
+    return 1;
+  }
+  std::cout << "fused packets match separate - OK" << std::endl;
+
+  std::cout << nPulses << " pulses, microseconds per pulse (H and V)"
+            << std::endl;
+  for (int icount = 0; icount < nGateCounts; icount++) {
+    for (int ifactor = 0; ifactor < nFactors; ifactor++) {
+      int nGates = gateCounts[icount];
+      int factor = factors[ifactor];
+      for (int cold = 0; cold < 2; cold++) {
+#ifndef HAVE_CLFLUSH
+        if (cold) {
+          continue;
+        }
+#endif
+        double separate = timeMethod(false, cold, nGates, factor, nPulses,
+                                     &header[0], zeros);
+        double fused = timeMethod(true, cold, nGates, factor, nPulses,
+                                  &header[0], zeros);
+        std::cout << std::setw(5) << nGates << " gates, factor " << factor
+                  << (cold ? ", cold" : ", warm")
+                  << std::fixed << std::setprecision(2)
+                  << ": separate " << std::setw(7) << separate
+                  << ", fused " << std::setw(7) << fused
+                  << ", " << separate / fused << "x" << std::endl;
+      }
+    }
+  }
+
+  return 0;
+
+}
@@ -0,0 +1,589 @@
+/*
+ * PulsePathAllocTest.cpp
+ *
+ * Tests that the pulse path from acquisition to IWRF output makes no heap
+ * allocations once it has seen a pulse at a given gate count.
+ *
+ * The global operator new and operator new[] are replaced with versions
+ * which count calls, on every thread, while counting is switched on. A
+ * KaMerge is built from a typical DRX configuration and started, and a
+ * client connects to its IWRF server on the local host and reads the
+ * stream. Pulses are then written to the merge as KaDrxPub::_addToMerge()
+ * does: the H, V and burst data are copied into heap PulseData and
+ * BurstData objects with set(), and handed over with writePulseH(),
+ * writePulseV() and writeBurst(), which return the objects to reuse.
+ * (KaDrxPub itself needs the Pentek card.) So everything downstream is the
+ * real thing: the merge queues and window, the sync and pack stages, the
+ * network writer with its batch reuse, the fan-out server and, in the
+ * second case, the merge workers, the pack thread, output batching, the
+ * black box and the archive.
+ *
+ * Every so often a V pulse is left out, so that incomplete triples are
+ * expired from the merge window too. The metadata packets are covered,
+ * but not the status packets, which are built as XML strings every two
+ * seconds: time() is replaced as well, and held still while counting, so
+ * that the merge sends none.
+ *
+ * Each phase warms up with enough pulses to cycle every object in the
+ * queues, the window and the IWRF ring, then counts allocations while
+ * nPulses more are written and the output drains. The phases
+ * are: the configured gate count, a smaller gate count, and a larger gate
+ * count which exceeds the IQ storage in the merge's pulse pool. Each case
+ * runs in its own process, since the merge threads are stopped with
+ * terminate().
+ *
+ * The program exits with status 1 if any allocation is counted, so that
+ * the build fails.
+ *
+ * Usage: PulsePathAllocTest [nPulses]
+ */
+
+#include "BurstData.h"
+#include "KaDrxConfig.h"
+#include "KaMerge.h"
+#include "KaMonitor.h"
+#include "PulseData.h"
+
+#include <QtCore/QCoreApplication>
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <ftw.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <new>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// allocations are counted while this is set, on any thread; the sizes of
+// the first few are kept, to say what they were
+
+static std::atomic<bool> Counting(false);
+static std::atomic<uint64_t> NAllocs(0);
+static const int MaxSizesKept = 16;
+static size_t AllocSizes[MaxSizesKept];
+
+static void *
+countedAlloc(size_t size) {
+  if (Counting.load(std::memory_order_relaxed)) {
+    uint64_t nth = NAllocs.fetch_add(1);
+    if (nth < MaxSizesKept) {
+      AllocSizes[nth] = size;
+    }
+  }
+  void *ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == NULL) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void *operator new(size_t size) { return countedAlloc(size); }
+void *operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+
+// time() is held at this value while it is non-zero, so that the merge
+// sends no status packets
+
+static std::atomic<time_t> FrozenTime(0);
+
+extern "C" time_t
+time(time_t *tloc) noexcept {
+  time_t now = FrozenTime.load();
+  if (now == 0) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now = ts.tv_sec;
+  }
+  if (tloc != NULL) {
+    *tloc = now;
+  }
+  return now;
+}
+
+// A typical DRX configuration, with queues and rings small enough to be
+// cycled quickly. The IWRF port and the options of each case are added.
+
+static const char *BaseConfig =
+  "radar_id                  Ka\n"
+  "gates                     980\n"
+  "staggered_prt             false\n"
+  "prt1                      1.0e-3\n"
+  "ant_gain                  45.9\n"
+  "ant_hbeam_width           0.86\n"
+  "ant_vbeam_width           0.91\n"
+  "rcvr_bandwidth            1.37e6\n"
+  "rcvr_cntr_freq            1.25e8\n"
+  "rcvr_digital_gain         -2.67\n"
+  "rcvr_filter_mismatch      0.4\n"
+  "rcvr_gate0_delay          5.5e-6\n"
+  "rcvr_noise_figure         8.3\n"
+  "rcvr_pulse_width          5.0e-7\n"
+  "rcvr_rf_gain              36.16\n"
+  "rcvr_h_power_corr         71.93\n"
+  "rcvr_v_power_corr         0.00\n"
+  "rcvr_tt_power_corr        -59.81\n"
+  "tx_cntr_freq              3.5e10\n"
+  "tx_peak_power             74.69\n"
+  "tx_pulse_width            5.0e-7\n"
+  "tx_delay                  0.0\n"
+  "tx_pulse_mod_delay        6.0e-7\n"
+  "tx_pulse_mod_width        6.0e-7\n"
+  "burst_sample_delay        1.55e-6\n"
+  "burst_sample_width        5.0e-7\n"
+  "burst_sample_frequency    1.0e8\n"
+  "external_clock            true\n"
+  "external_start_trigger    true\n"
+  "afc_enabled               true\n"
+  "afc_g0_threshold_dbm      -20.0\n"
+  "afc_coarse_step           5000000\n"
+  "afc_fine_step             100000\n"
+  "ldr_mode                  true\n"
+  "cohere_iq_to_burst        true\n"
+  "combine_every_second_gate true\n"
+  "merge_queue_size          256\n"
+  "pulse_interval_per_iwrf_meta_data 5000\n"
+  "iwrf_queue_size           64\n"
+  "iwrf_ring_megabytes       4\n"
+  "iqcount_scale_for_mw      9465\n"
+  "test_target_delay         485.08e-6\n"
+  "test_target_width         5.0e-6\n"
+  "range_to_gate0            37.5\n"
+  "write_pei_files           false\n"
+  "max_pei_gates             400\n"
+  "simulate_pmc730           false\n"
+  "simulate_tty_oscillators  false\n"
+  "allow_blanking            false\n";
+
+static const int ConfigGates = 980;
+
+// pulses written before counting starts in each phase
+static const int WarmUpPulses = 20000;
+
+// leave out one V pulse in this many
+static const int DropInterval = 97;
+
+// the longest wait for the merge to write the pulses of a phase
+static const double DrainSecs = 10.0;
+
+// the merge has drained once its output has been still for this long
+static const double QuietSecs = 0.2;
+
+static double
+monotonicSecs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// IWRF client which reads and discards the merge's output, counting the
+/// bytes. It allocates nothing once started.
+
+class IwrfSink {
+public:
+  IwrfSink() : _fd(-1), _stopping(false), _nBytes(0) {}
+
+  ~IwrfSink() {
+    _stopping.store(true);
+    if (_fd >= 0) {
+      shutdown(_fd, SHUT_RDWR);
+    }
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+    if (_fd >= 0) {
+      close(_fd);
+    }
+  }
+
+  /// Connect to the IWRF server on the local host and start reading.
+  /// The server is opened only once its writer thread runs, so connecting
+  /// is retried for up to timeoutSecs.
+  bool start(int port, double timeoutSecs) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    double giveUp = monotonicSecs() + timeoutSecs;
+    while (true) {
+      _fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (_fd < 0) {
+        return false;
+      }
+      if (connect(_fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        break;
+      }
+      close(_fd);
+      _fd = -1;
+      if (monotonicSecs() > giveUp) {
+        return false;
+      }
+      usleep(50000);
+    }
+    _thread = std::thread(&IwrfSink::_run, this);
+    return true;
+  }
+
+  /// @return the number of bytes read so far
+  uint64_t nBytes() const { return _nBytes.load(); }
+
+private:
+  void _run() {
+    static char buf[1024 * 1024];
+    while (!_stopping.load()) {
+      ssize_t nRead = recv(_fd, buf, sizeof(buf), 0);
+      if (nRead < 0 && errno == EINTR) {
+        continue;
+      }
+      if (nRead <= 0) {
+        break;
+      }
+      _nBytes.fetch_add(nRead);
+    }
+  }
+
+  int _fd;
+  std::thread _thread;
+  std::atomic<bool> _stopping;
+  std::atomic<uint64_t> _nBytes;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+/// Writes pulses to the merge, as the three KaDrxPub threads do, from one
+/// thread. Each merge input queue still has one producer.
+
+class PulseFeeder {
+public:
+  PulseFeeder(KaMerge &merge, int nSamplesBurst) :
+    _merge(merge), _nSamplesBurst(nSamplesBurst), _seqNum(0),
+    _pulseH(new PulseData), _pulseV(new PulseData), _burst(new BurstData)
+  {
+    _burstIq.resize(2 * nSamplesBurst);
+    for (int ii = 0; ii < nSamplesBurst; ii++) {
+      _burstIq[2 * ii] = 10000;
+      _burstIq[2 * ii + 1] = 0;
+    }
+  }
+
+  ~PulseFeeder() {
+    delete _pulseH;
+    delete _pulseV;
+    delete _burst;
+  }
+
+  /// Set the gate count of the pulses to come. The source data are set up
+  /// here, outside the counted pulses, as the digitizer DMA buffers would
+  /// be.
+  void setGates(int nGates) {
+    _nGates = nGates;
+    _iq.resize(2 * nGates);
+    for (int ii = 0; ii < 2 * nGates; ii++) {
+      _iq[ii] = (int16_t) (1000.0 * sin(0.05 * ii));
+    }
+  }
+
+  /// Write nPulses pulses, waiting for room in the queues as needed
+  void write(int nPulses) {
+    for (int ii = 0; ii < nPulses; ii++) {
+      _waitForRoom();
+      int64_t seqNum = _seqNum++;
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      _burst->set(seqNum, ts.tv_sec, ts.tv_nsec, 10000.0, 0.0, 0.0, 1.0,
+                  0.0, 1.25e8, 0.0, _nSamplesBurst, &_burstIq[0]);
+      _burst = _merge.writeBurst(_burst);
+      _burst->releaseIq();
+      _pulseH->set(seqNum, ts.tv_sec, ts.tv_nsec, 0, _nGates, &_iq[0]);
+      _pulseH = _merge.writePulseH(_pulseH);
+      _pulseH->releaseIq();
+      if (seqNum % DropInterval == 0) {
+        continue;
+      }
+      _pulseV->set(seqNum, ts.tv_sec, ts.tv_nsec, 1, _nGates, &_iq[0]);
+      _pulseV = _merge.writePulseV(_pulseV);
+      _pulseV->releaseIq();
+    }
+  }
+
+private:
+  // wait while a merge input queue, the queue to the pack stage or the
+  // IWRF output queue is more than half full, so that nothing is dropped
+  void _waitForRoom() const {
+    const SpscRing<MergedPulse> *pulseQueue = _merge.pulseQueue();
+    while (_merge.hQueue().depth() > _merge.hQueue().size() / 2 ||
+           _merge.vQueue().depth() > _merge.vQueue().size() / 2 ||
+           _merge.burstQueue().depth() > _merge.burstQueue().size() / 2 ||
+           (pulseQueue && pulseQueue->depth() > pulseQueue->size() / 2) ||
+           _merge.netWriter().queue().depth() >
+           _merge.netWriter().queue().size() / 2) {
+      usleep(10);
+    }
+  }
+
+  KaMerge &_merge;
+  int _nSamplesBurst;
+  int _nGates;
+  int64_t _seqNum;
+  std::vector<int16_t> _iq;
+  std::vector<int16_t> _burstIq;
+  PulseData *_pulseH;
+  PulseData *_pulseV;
+  BurstData *_burst;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+/// One set of merge options
+
+struct TestCase {
+  const char *name;
+  const char *config;
+  /// write a black box and an archive?
+  bool useDisk;
+};
+
+// wait until the merge input queues are empty and the merge has written
+// nothing more for QuietSecs, so that the network writer and the archive
+// have drained too. Triples may be dropped from the merge window as well
+// as written, so the count of pulses out is not known in advance. Returns
+// false on a timeout.
+
+static bool
+waitForMerge(const KaMerge &merge) {
+  double giveUp = monotonicSecs() + DrainSecs;
+  double quietSince = monotonicSecs();
+  uint64_t nWritten = merge.nPulsesWritten();
+  while (monotonicSecs() - quietSince < QuietSecs) {
+    if (monotonicSecs() > giveUp) {
+      return false;
+    }
+    usleep(1000);
+    if (merge.nPulsesWritten() != nWritten ||
+        merge.hQueue().depth() != 0 ||
+        merge.vQueue().depth() != 0 ||
+        merge.burstQueue().depth() != 0) {
+      nWritten = merge.nPulsesWritten();
+      quietSince = monotonicSecs();
+    }
+  }
+  return true;
+}
+
+// Warm up at the given gate count, then count the allocations over
+// nPulses pulses. Returns the count, or 1 if the merge fell silent.
+
+static uint64_t
+runPhase(KaMerge &merge, PulseFeeder &feeder, IwrfSink &sink,
+         const char *name, int nGates, int nPulses) {
+
+  feeder.setGates(nGates);
+  uint64_t nBefore = merge.nPulsesWritten();
+  feeder.write(WarmUpPulses);
+  if (!waitForMerge(merge) || merge.nPulsesWritten() == nBefore) {
+    std::cout << "  " << name << ": merge stalled in warm-up" << std::endl;
+    return 1;
+  }
+
+  // hold the clock still, and let any status packet now due go out first
+  FrozenTime.store(time(NULL));
+  feeder.write(10);
+  waitForMerge(merge);
+
+  uint64_t nBytes = sink.nBytes();
+  uint64_t nFirst = merge.nPulsesWritten();
+  NAllocs.store(0);
+  Counting.store(true);
+  feeder.write(nPulses);
+  bool drained = waitForMerge(merge);
+  Counting.store(false);
+  FrozenTime.store(0);
+  uint64_t nAllocs = NAllocs.load();
+
+  std::cout << "  " << name << ": " << nGates << " gates, " << nAllocs <<
+      " allocations in " << merge.nPulsesWritten() - nFirst <<
+      " steady state pulses out, " << sink.nBytes() - nBytes <<
+      " bytes to the client";
+  if (nAllocs != 0) {
+    std::cout << "  <-- FAIL, sizes";
+    for (uint64_t ii = 0; ii < nAllocs && ii < MaxSizesKept; ii++) {
+      std::cout << " " << AllocSizes[ii];
+    }
+  }
+  std::cout << std::endl;
+  if (!drained || sink.nBytes() == nBytes) {
+    std::cout << "  " << name << ": output stalled" << std::endl;
+    return nAllocs + 1;
+  }
+  return nAllocs;
+
+}
+
+// a free TCP port on the local host
+
+static int
+freePort() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  int port = -1;
+  if (fd >= 0 && bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+      getsockname(fd, (struct sockaddr *) &addr, &len) == 0) {
+    port = ntohs(addr.sin_port);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  return port;
+}
+
+static int
+removeEntry(const char *path, const struct stat *, int, struct FTW *) {
+  remove(path);
+  return 0;
+}
+
+// Run one case. Called in the child process for the case. Returns the
+// exit status: 0 if no allocations were counted.
+
+static int
+runCase(const TestCase &tc, const std::string &archiveDir, int nPulses,
+        int argc, char **argv) {
+
+  std::cout << tc.name << ":" << std::endl;
+
+  int port = freePort();
+  std::ostringstream configText;
+  configText << BaseConfig << tc.config <<
+    "iwrf_server_tcp_port " << port << "\n";
+  if (tc.useDisk) {
+    configText <<
+      "blackbox_seconds 1\n" <<
+      "blackbox_megabytes 4\n" <<
+      "blackbox_dir " << archiveDir << "\n" <<
+      "archive_dir " << archiveDir << "\n" <<
+      "archive_queue_size 64\n";
+  }
+  char configPath[] = "/tmp/PulsePathAllocTest_XXXXXX";
+  int configFd = mkstemp(configPath);
+  if (configFd < 0) {
+    std::cout << "  cannot create configuration file" << std::endl;
+    return 1;
+  }
+  std::string text = configText.str();
+  bool written = (write(configFd, text.data(), text.size()) ==
+                  (ssize_t) text.size());
+  close(configFd);
+  KaDrxConfig config(written ? configPath : "/dev/null");
+  unlink(configPath);
+  if (!written || !config.isValid()) {
+    std::cout << "  incomplete DRX configuration" << std::endl;
+    return 1;
+  }
+
+  QCoreApplication app(argc, argv);
+
+  // The monitor is not started, since it reads the hardware; the merge
+  // reports its default status. Neither is destroyed, since KaMerge stops
+  // its threads with terminate(); the process exits with _exit() when the
+  // case is done. The monitor is static rather than new'd, since it is
+  // cache-line aligned.
+  static KaMonitor monitor("localhost", 8080);
+  KaMerge &merge = *new KaMerge(config, monitor);
+  merge.start();
+
+  IwrfSink sink;
+  if (!sink.start(port, 5.0)) {
+    std::cout << "  cannot connect to IWRF port " << port << std::endl;
+    return 1;
+  }
+
+  int nSamplesBurst = (int) (config.burst_sample_width() *
+                             config.burst_sample_frequency() + 0.5);
+  PulseFeeder feeder(merge, nSamplesBurst);
+
+  uint64_t nAllocs = 0;
+  nAllocs += runPhase(merge, feeder, sink, "configured", ConfigGates,
+                      nPulses);
+  nAllocs += runPhase(merge, feeder, sink, "smaller", ConfigGates / 2,
+                      nPulses);
+  nAllocs += runPhase(merge, feeder, sink, "larger", ConfigGates * 2,
+                      nPulses);
+  return nAllocs == 0 ? 0 : 1;
+
+}
+
+int
+main(int argc, char *argv[]) {
+
+  int nPulses = 20000;
+  if (argc > 1) {
+    nPulses = atoi(argv[1]);
+  }
+
+  // the black box and the archive write under a directory of our own
+  char archiveDir[] = "/tmp/PulsePathAllocTest_archive_XXXXXX";
+  if (mkdtemp(archiveDir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  const TestCase cases[] = {
+    { "merge thread only", "", false },
+    { "workers, pack thread, batching, black box and archive",
+      "merge_worker_threads 2\n"
+      "merge_pack_thread true\n"
+      "iwrf_batch_max_delay 0.002\n", true },
+  };
+  int nCases = sizeof(cases) / sizeof(cases[0]);
+
+  int nFailed = 0;
+  for (int ii = 0; ii < nCases; ii++) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      return 1;
+    }
+    if (pid == 0) {
+      int status = runCase(cases[ii], archiveDir, nPulses, argc, argv);
+      std::cout.flush();
+      // the merge threads are not stopped; the process just goes
+      _exit(status);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      nFailed++;
+    }
+  }
+
+  nftw(archiveDir, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+
+  if (nFailed != 0) {
+    std::cout << "FAILED: allocations in steady state, or no output, in " <<
+        nFailed << " of " << nCases << " cases" << std::endl;
+    return 1;
+  }
+  std::cout << "OK: no allocations in steady state" << std::endl;
+  return 0;
+
+}
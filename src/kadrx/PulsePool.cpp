@@ -0,0 +1,113 @@
+/*
+ * PulsePool.cpp
+ *
+ * Pool of the PulseData, BurstData and MergedPulse objects held in
+ * KaMerge's queues, laid out in one slab arena.
+ */
+
+#include "PulsePool.h"
+#include <logx/Logging.h>
+#include <new>
+#include <sstream>
+#include <stdint.h>
+
+LOGGING("PulsePool")
+
+/////////////////////////////////////////////////////////////////////////////
+PulsePool::PulsePool(int nPulses, int nGates, int nBursts, int nSamples,
+                     int nMerged) :
+  _nGates(nGates),
+  _nSamples(nSamples),
+  _exhausted(false)
+{
+
+  // each slot: the object, then its IQ data, each starting on a cache line
+
+  _pulseStride = SlabArena::roundUp(sizeof(PulseData)) +
+    SlabArena::roundUp(_nGates * 2 * sizeof(int16_t));
+  _burstStride = SlabArena::roundUp(sizeof(BurstData)) +
+    SlabArena::roundUp(_nSamples * 2 * sizeof(int16_t));
+  _mergedStride = SlabArena::roundUp(sizeof(MergedPulse));
+
+  _arena = new SlabArena(nPulses * _pulseStride + nBursts * _burstStride +
+                         nMerged * _mergedStride);
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+PulsePool::~PulsePool()
+{
+  delete _arena;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// carve a slot, or return NULL if the pool is used up
+
+void *PulsePool::_alloc(size_t bytes)
+{
+  void *slot = _arena->alloc(bytes);
+  if (slot == NULL && !_exhausted) {
+    WLOG << "Pulse pool of " << _arena->size() << " bytes used up, " <<
+        "allocating further objects from the heap";
+    _exhausted = true;
+  }
+  return slot;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void PulsePool::create(PulseData *&pulse)
+{
+  char *slot = static_cast<char *>(_alloc(_pulseStride));
+  if (slot == NULL) {
+    pulse = new PulseData;
+    return;
+  }
+  pulse = ::new (slot) PulseData;
+  pulse->markInArena();
+  int16_t *iq = reinterpret_cast<int16_t *>
+    (slot + SlabArena::roundUp(sizeof(PulseData)));
+  pulse->useIqStorage(iq, _nGates);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void PulsePool::create(BurstData *&burst)
+{
+  char *slot = static_cast<char *>(_alloc(_burstStride));
+  if (slot == NULL) {
+    burst = new BurstData;
+    return;
+  }
+  burst = ::new (slot) BurstData;
+  burst->markInArena();
+  int16_t *iq = reinterpret_cast<int16_t *>
+    (slot + SlabArena::roundUp(sizeof(BurstData)));
+  burst->useIqStorage(iq, _nSamples);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void PulsePool::create(MergedPulse *&merged)
+{
+  PulseData *pulseH, *pulseV;
+  BurstData *burst;
+  create(pulseH);
+  create(pulseV);
+  create(burst);
+  void *slot = _alloc(_mergedStride);
+  if (slot == NULL) {
+    merged = new MergedPulse(pulseH, pulseV, burst);
+  } else {
+    merged = ::new (slot) MergedPulse(pulseH, pulseV, burst);
+    merged->markInArena();
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+std::string PulsePool::describe() const
+{
+  std::ostringstream text;
+  text << "pulse slots " << _pulseStride << " bytes (" << _nGates <<
+      " gates), burst slots " << _burstStride << " bytes (" << _nSamples <<
+      " samples), total " << _arena->size() / 1024 << " kB on " <<
+      _arena->pageKind();
+  return text.str();
+}
@@ -0,0 +1,80 @@
+/*
+ * PulsePool.h
+ *
+ * Pool of the PulseData, BurstData and MergedPulse objects held in
+ * KaMerge's queues, laid out in one slab arena.
+ */
+
+#ifndef PULSEPOOL_H_
+#define PULSEPOOL_H_
+
+#include "SlabArena.h"
+#include "PulseData.h"
+#include "BurstData.h"
+#include "MergedPulse.h"
+#include <cstddef>
+#include <string>
+
+/// PulsePool places the objects which circulate through KaMerge's queues
+/// and merge window, together with their IQ storage, in a single
+/// SlabArena. Each PulseData is followed directly by room for nGates gates
+/// of IQ data, and each BurstData by room for nSamples samples, in slots
+/// of fixed stride which start on a cache line. So a pulse and its data
+/// are contiguous, consecutive pulses are adjacent, and no two slots share
+/// a cache line.
+///
+/// The pool is sized up front for a given number of objects. If more are
+/// asked for, or data arrive with more gates than the slots hold, ordinary
+/// heap allocation is used, so the pool is an optimization only.
+///
+/// The create() methods fit the factory constructors of SpscRing and
+/// MergeWindow. Pool objects are deleted in the usual way, and their memory
+/// is released with the pool, which must outlive them.
+
+class PulsePool {
+public:
+  /**
+   * Constructor.
+   * @param nPulses the number of PulseData objects to hold
+   * @param nGates the number of gates of IQ data held with each
+   * @param nBursts the number of BurstData objects to hold
+   * @param nSamples the number of IQ samples held with each
+   * @param nMerged the number of MergedPulse objects to hold. Their
+   *     pulses and bursts are counted in nPulses and nBursts.
+   */
+  PulsePool(int nPulses, int nGates, int nBursts, int nSamples,
+            int nMerged);
+
+  ~PulsePool();
+
+  /// create a PulseData object, with IQ storage
+  void create(PulseData *&pulse);
+
+  /// create a BurstData object, with IQ storage
+  void create(BurstData *&burst);
+
+  /// create a MergedPulse object, with its pulses and burst
+  void create(MergedPulse *&merged);
+
+  /// @return the total size of the pool, bytes
+  size_t footprint() const { return _arena->size(); }
+
+  /// @return a one line description of the layout and size of the pool
+  std::string describe() const;
+
+private:
+  PulsePool(const PulsePool &);
+  PulsePool &operator=(const PulsePool &);
+
+  void *_alloc(size_t bytes);
+
+  SlabArena *_arena;
+  int _nGates;
+  int _nSamples;
+  size_t _pulseStride;
+  size_t _burstStride;
+  size_t _mergedStride;
+  bool _exhausted;
+};
+
+#endif /* PULSEPOOL_H_ */
@@ -0,0 +1,128 @@
+/*
+ * SlabArena.cpp
+ *
+ * One contiguous, cache-aligned block of memory, from which fixed objects
+ * are carved at startup.
+ */
+
+#include "SlabArena.h"
+#include <logx/Logging.h>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+LOGGING("SlabArena")
+
+// Size of an explicit huge page. The arena is rounded up to this when
+// huge pages are used.
+static const size_t HugePageSize = 2 * 1024 * 1024;
+
+// Whether the SlabArenaObject being deleted on this thread is in an arena.
+// Its destructor sets this, and operator delete reads it straight after,
+// since the object's own flag may not be read once it is destroyed.
+static thread_local bool DeletingArenaObject = false;
+
+/////////////////////////////////////////////////////////////////////////////
+SlabArena::SlabArena(size_t bytes) :
+  _base(NULL),
+  _size(0),
+  _used(0),
+  _pages(NORMAL_PAGES)
+{
+
+  if (bytes == 0) {
+    bytes = 1;
+  }
+
+  // explicit huge pages, if any have been reserved
+
+  size_t hugeSize = (bytes + HugePageSize - 1) & ~(HugePageSize - 1);
+  void *base = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (base != MAP_FAILED) {
+    _size = hugeSize;
+    _pages = HUGETLB_PAGES;
+  } else {
+
+    // otherwise ordinary pages, asking for transparent huge pages if the
+    // arena is big enough to use them
+
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    _size = (bytes + pageSize - 1) & ~(pageSize - 1);
+    base = mmap(NULL, _size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+      ELOG << "Cannot map " << _size << " byte slab arena: " <<
+          strerror(errno);
+      throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (_size >= HugePageSize && madvise(base, _size, MADV_HUGEPAGE) == 0) {
+      _pages = TRANSPARENT_HUGE_PAGES;
+    }
+#endif
+  }
+
+  _base = static_cast<char *>(base);
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+SlabArena::~SlabArena()
+{
+  munmap(_base, _size);
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// carve an aligned piece from the arena
+
+void *SlabArena::alloc(size_t bytes)
+{
+  bytes = roundUp(bytes);
+  if (bytes > _size - _used) {
+    return NULL;
+  }
+  void *piece = _base + _used;
+  _used += bytes;
+  return piece;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+std::string SlabArena::pageKind() const
+{
+  switch (_pages) {
+    case HUGETLB_PAGES:
+      return "huge pages";
+    case TRANSPARENT_HUGE_PAGES:
+      return "transparent huge pages";
+    default:
+      return "normal pages";
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+SlabArenaObject::~SlabArenaObject()
+{
+  DeletingArenaObject = _inArena;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// allocate an object on the heap
+
+void *SlabArenaObject::operator new(size_t bytes)
+{
+  return ::operator new(bytes);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// free an object, unless it lives in a slab arena
+
+void SlabArenaObject::operator delete(void *ptr)
+{
+  if (!DeletingArenaObject) {
+    ::operator delete(ptr);
+  }
+}
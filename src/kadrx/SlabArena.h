@@ -0,0 +1,100 @@
+/*
+ * SlabArena.h
+ *
+ * One contiguous, cache-aligned block of memory, from which fixed objects
+ * are carved at startup.
+ */
+
+#ifndef SLABARENA_H_
+#define SLABARENA_H_
+
+#include <cstddef>
+#include <string>
+
+/// SlabArena maps one block of memory, backed by huge pages if possible,
+/// and hands out 64-byte aligned pieces of it with a simple bump pointer.
+/// Pieces are never freed individually: the whole block is unmapped when
+/// the arena is destroyed.
+///
+/// The memory comes, in order of preference, from explicit huge pages
+/// (MAP_HUGETLB), from ordinary pages marked for transparent huge pages,
+/// or from ordinary pages.
+///
+/// alloc() is not thread safe, and is meant to be called while setting up.
+
+class SlabArena {
+public:
+  /// Alignment of every piece, and the size of a cache line
+  static const size_t ALIGNMENT = 64;
+
+  /// Map an arena
+  /// @param bytes the size of the arena, rounded up to a whole page
+  SlabArena(size_t bytes);
+
+  /// Unmap the arena. Any objects in it must already be destroyed.
+  ~SlabArena();
+
+  /// Carve a piece from the arena
+  /// @param bytes the size of the piece, rounded up to ALIGNMENT
+  /// @return the piece, or NULL if the arena is exhausted
+  void *alloc(size_t bytes);
+
+  /// @return the size of the arena, bytes
+  size_t size() const { return _size; }
+
+  /// @return the number of bytes carved so far
+  size_t used() const { return _used; }
+
+  /// @return a description of the memory backing the arena
+  std::string pageKind() const;
+
+  /// @return bytes rounded up to ALIGNMENT
+  static size_t roundUp(size_t bytes) {
+    return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+  }
+
+private:
+  SlabArena(const SlabArena &);
+  SlabArena &operator=(const SlabArena &);
+
+  typedef enum { HUGETLB_PAGES, TRANSPARENT_HUGE_PAGES, NORMAL_PAGES } Pages;
+
+  char *_base;
+  size_t _size;
+  size_t _used;
+  Pages _pages;
+};
+
+/// SlabArenaObject is a base for classes whose objects may be placed in a
+/// SlabArena as well as allocated on the heap. The object placing one in an
+/// arena calls markInArena(). Deleting an object always destroys it, but
+/// only frees the memory of a heap object: arena memory is released with
+/// the arena.
+///
+/// Objects are placed in an arena with ::new, since the class operator new
+/// hides the placement form.
+
+class SlabArenaObject {
+public:
+  static void *operator new(size_t bytes);
+  static void operator delete(void *ptr);
+
+  /// Note that this object was placed in an arena, and must not be freed
+  void markInArena() { _inArena = true; }
+
+protected:
+  SlabArenaObject() : _inArena(false) {}
+
+  /// Copies are not in an arena, whatever the original was
+  SlabArenaObject(const SlabArenaObject &) : _inArena(false) {}
+  SlabArenaObject &operator=(const SlabArenaObject &) { return *this; }
+
+  /// Tells operator delete, which runs next on this thread, whether to
+  /// free the memory
+  ~SlabArenaObject();
+
+private:
+  bool _inArena;
+};
+
+#endif /* SLABARENA_H_ */
@@ -0,0 +1,125 @@
+////////////////////////////////////////////////////////////////////
+// SnapshotBuffer.h
+//
+// Lock-free publication of the latest value of a status struct, from
+// one writer thread to any number of reader threads.
+//
+////////////////////////////////////////////////////////////////////
+//
+// The writer fills a spare slot with a complete new value, then makes
+// it current with one atomic store. A reader loads the current slot
+// index, pins the slot with a reader count, checks that it is still
+// current, and copies the value out. The writer never touches the
+// current slot or a pinned one, so a reader always copies a complete
+// value that is not being changed, and neither side ever waits for the
+// other.
+//
+// Unlike a seqlock, the copy never races with a write, so T may be any
+// copyable type, not just plain data.
+//
+// publish() is meant for values which change at a modest rate, such as
+// once a second. If a reader has been pre-empted while holding every
+// spare slot, the new value is not published, and the reader keeps
+// getting the previous one until the next publish().
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef SNAPSHOT_BUFFER_H_
+#define SNAPSHOT_BUFFER_H_
+
+#include <atomic>
+
+template <class T>
+class SnapshotBuffer
+{
+public:
+
+  /// Constructor
+  /// @param initial the value readers get until the first publish()
+  SnapshotBuffer(const T &initial);
+
+  /// Publish a new value. Writer thread only.
+  /// @return true iff the value was published, false if every spare
+  /// slot was pinned by a reader
+  bool publish(const T &value);
+
+  /// Get a copy of the latest published value. Any thread.
+  T read() const;
+
+private:
+
+  SnapshotBuffer(const SnapshotBuffer &rhs);
+  SnapshotBuffer & operator=(const SnapshotBuffer &rhs);
+
+  // the current slot, a spare for the writer, and spares for readers
+  // which are slow to finish their copies
+
+  static const int N_SLOTS = 4;
+
+  // each slot on its own cache lines, so readers pinning one slot do
+  // not disturb the others
+
+  struct alignas(64) Slot {
+    T value;
+    mutable std::atomic<int> nReaders;
+  };
+
+  Slot _slots[N_SLOTS];
+  std::atomic<int> _current;
+
+};
+
+////////////////////////////////////////////////
+// The Implementation.
+
+// constructor
+
+template <class T>
+SnapshotBuffer<T>::SnapshotBuffer(const T &initial) :
+  _current(0)
+{
+  for (int ii = 0; ii < N_SLOTS; ii++) {
+    _slots[ii].nReaders.store(0, std::memory_order_relaxed);
+  }
+  _slots[0].value = initial;
+}
+
+// publish
+
+template <class T>
+bool SnapshotBuffer<T>::publish(const T &value)
+{
+  int current = _current.load(std::memory_order_relaxed);
+  for (int ii = 1; ii < N_SLOTS; ii++) {
+    Slot &slot = _slots[(current + ii) % N_SLOTS];
+    // seq_cst, ordered against the reader's pin and re-check of _current
+    if (slot.nReaders.load(std::memory_order_seq_cst) == 0) {
+      slot.value = value;
+      _current.store((current + ii) % N_SLOTS, std::memory_order_seq_cst);
+      return true;
+    }
+  }
+  return false;
+}
+
+// read
+
+template <class T>
+T SnapshotBuffer<T>::read() const
+{
+  while (true) {
+    int current = _current.load(std::memory_order_seq_cst);
+    const Slot &slot = _slots[current];
+    slot.nReaders.fetch_add(1, std::memory_order_seq_cst);
+    // If the slot is still current, the writer cannot have started to
+    // reuse it, and will see our pin before it tries to.
+    if (_current.load(std::memory_order_seq_cst) == current) {
+      T value(slot.value);
+      slot.nReaders.fetch_sub(1, std::memory_order_release);
+      return value;
+    }
+    slot.nReaders.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+#endif
@@ -0,0 +1,319 @@
+////////////////////////////////////////////////////////////////////
+// SpscRing.h
+//
+// Lock-free single-producer/single-consumer ring buffer, with an
+// optional blocking read for the consumer.
+//
+////////////////////////////////////////////////////////////////////
+//
+// SpscRing keeps the pointer-swap recycling contract of CircBuffer:
+// the producer hands in a filled object and gets back an object to
+// fill next, and the consumer hands in an object it has finished with
+// and gets back the next filled object. No objects are allocated or
+// copied after construction.
+//
+// Unlike CircBuffer, there is no mutex. The producer owns the head
+// index and the consumer owns the tail index, and each lives on its own
+// cache line. Each side keeps a cached copy of the other's index, and
+// only reloads it when the ring looks full (producer) or empty
+// (consumer), so the cache lines are not passed back and forth on every
+// call. Exactly one thread may call write() and exactly one (other)
+// thread may call read() or readWait().
+//
+// When the ring is full, write() drops the incoming element rather than
+// overwriting unread slots (which the consumer may be reading), and
+// returns the same pointer to the producer for reuse. Dropped elements
+// are counted, and the current depth and its high-water mark are
+// available for monitoring from any thread. The producer keeps the
+// high-water mark exact without loading the tail on every write: the
+// depth seen with its cached tail is never less than the true depth, so
+// the tail is only reloaded when that depth would be a new high.
+//
+// readWait() lets the consumer sleep on a futex when the ring is empty
+// instead of polling. The producer only issues a wake-up system call
+// when the consumer has announced that it is sleeping.
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <ctime>
+#include <stdint.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+template <class T>
+class SpscRing
+{
+public:
+
+  /// Constructor. One object of type T is allocated for each slot.
+  /// @param size the number of slots in the ring
+  SpscRing(size_t size);
+
+  /// Constructor, taking the object for each slot from a pool, with
+  /// pool.create(T *&). The objects are deleted as usual.
+  /// @param size the number of slots in the ring
+  /// @param pool the pool
+  template <class Pool>
+  SpscRing(size_t size, Pool &pool);
+
+  /// Destructor. Deletes the objects currently held in the slots.
+  ~SpscRing();
+
+  /// @return the number of slots in the ring
+  inline size_t size() const { return _size; }
+
+  /// @return the number of elements currently waiting in the ring, 0 to
+  /// size(). From a thread other than the producer and consumer, this is
+  /// an estimate.
+  size_t depth() const {
+    // the tail first, since it never passes the head; the head may move
+    // on meanwhile, so clamp to the size
+    uint64_t tail = _tail.load(std::memory_order_acquire);
+    uint64_t head = _head.load(std::memory_order_acquire);
+    if (head < tail) {
+      return 0;
+    }
+    return (head - tail > _size) ? _size : head - tail;
+  }
+
+  /// @return the largest number of elements seen waiting in the ring
+  size_t highWater() const {
+    return _highWater.load(std::memory_order_relaxed);
+  }
+
+  /// @return the number of elements dropped because the ring was full
+  uint64_t nOverruns() const {
+    return _nOverruns.load(std::memory_order_relaxed);
+  }
+
+  /// Write (insert) an element into the ring. Producer thread only.
+  ///
+  /// You pass in a pointer to the object you want to write. The method
+  /// returns a pointer to an object which should be re-used for the next
+  /// write. If the ring is full the element is dropped, and the pointer
+  /// passed in is returned.
+  T *write(T *element);
+
+  /// Read (retrieve) an element from the ring. Consumer thread only.
+  ///
+  /// You pass in a pointer to an object which will replace the
+  /// retrieved object in the ring. The method returns a pointer to the
+  /// retrieved object, or NULL if no object is available.
+  T *read(T *element);
+
+  /// Read (retrieve) an element from the ring, sleeping for up to
+  /// timeoutUsecs microseconds if the ring is empty. Consumer thread only.
+  /// @return a pointer to the retrieved object, or NULL on timeout
+  T *readWait(T *element, int timeoutUsecs);
+
+private:
+
+  // not copyable
+  SpscRing(const SpscRing &rhs);
+  SpscRing & operator=(const SpscRing &rhs);
+
+  static const size_t CACHE_LINE = 64;
+
+  // Number of empty polls before the consumer goes to sleep
+  static const int SPIN_COUNT = 100;
+
+  // Shared, read-only after construction
+  T **_buf;
+  size_t _size;
+  char _pad0[CACHE_LINE];
+
+  // Producer's line: next slot to write, the producer's cached copy of
+  // the consumer's index, and the occupancy statistics, which only the
+  // producer updates
+  std::atomic<uint64_t> _head;
+  uint64_t _tailCache;
+  std::atomic<uint64_t> _highWater;
+  std::atomic<uint64_t> _nOverruns;
+  char _pad1[CACHE_LINE];
+
+  // Consumer's line: next slot to read, and the consumer's cached copy
+  // of the producer's index
+  std::atomic<uint64_t> _tail;
+  uint64_t _headCache;
+  char _pad2[CACHE_LINE];
+
+  // Wake-up handshake for readWait(). _wakeSeq is the futex word.
+  std::atomic<uint32_t> _sleeping;
+  std::atomic<uint32_t> _wakeSeq;
+  char _pad3[CACHE_LINE];
+
+  void _wakeConsumer();
+
+};
+
+////////////////////////////////////////////////
+// The Implementation.
+
+// constructor
+
+template <class T>
+SpscRing<T>::SpscRing(size_t size) :
+  _head(0),
+  _tailCache(0),
+  _highWater(0),
+  _nOverruns(0),
+  _tail(0),
+  _headCache(0),
+  _sleeping(0),
+  _wakeSeq(0)
+{
+  if (size < 1) {
+    size = 1;
+  }
+  _size = size;
+  _buf = new T*[_size];
+  for (size_t ii = 0; ii < _size; ii++) {
+    _buf[ii] = new T;
+  }
+}
+
+// constructor, with slot objects from a pool
+
+template <class T>
+template <class Pool>
+SpscRing<T>::SpscRing(size_t size, Pool &pool) :
+  _head(0),
+  _tailCache(0),
+  _highWater(0),
+  _nOverruns(0),
+  _tail(0),
+  _headCache(0),
+  _sleeping(0),
+  _wakeSeq(0)
+{
+  if (size < 1) {
+    size = 1;
+  }
+  _size = size;
+  _buf = new T*[_size];
+  for (size_t ii = 0; ii < _size; ii++) {
+    pool.create(_buf[ii]);
+  }
+}
+
+// destructor
+
+template <class T>
+SpscRing<T>::~SpscRing()
+{
+  for (size_t ii = 0; ii < _size; ii++) {
+    delete _buf[ii];
+  }
+  delete[] _buf;
+}
+
+// write
+
+template <class T>
+T *SpscRing<T>::write(T *element)
+{
+  uint64_t head = _head.load(std::memory_order_relaxed);
+  if (head - _tailCache >= _size) {
+    _tailCache = _tail.load(std::memory_order_acquire);
+    if (head - _tailCache >= _size) {
+      // full - drop the new element
+      _nOverruns.store(_nOverruns.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+      return element;
+    }
+  }
+  size_t slot = head % _size;
+  T *retVal = _buf[slot];
+  _buf[slot] = element;
+  _head.store(head + 1, std::memory_order_release);
+  _wakeConsumer();
+
+  // occupancy statistics. The cached tail may be stale, so the depth
+  // from it may be too large; only check the real tail if it would be a
+  // new high.
+  uint64_t highWater = _highWater.load(std::memory_order_relaxed);
+  if (head + 1 - _tailCache > highWater) {
+    _tailCache = _tail.load(std::memory_order_acquire);
+    uint64_t depth = head + 1 - _tailCache;
+    if (depth > highWater) {
+      _highWater.store(depth, std::memory_order_relaxed);
+    }
+  }
+  return retVal;
+}
+
+// read
+
+template <class T>
+T *SpscRing<T>::read(T *element)
+{
+  uint64_t tail = _tail.load(std::memory_order_relaxed);
+  if (tail == _headCache) {
+    _headCache = _head.load(std::memory_order_acquire);
+    if (tail == _headCache) {
+      // no new data available
+      return NULL;
+    }
+  }
+  size_t slot = tail % _size;
+  T *retVal = _buf[slot];
+  _buf[slot] = element;
+  _tail.store(tail + 1, std::memory_order_release);
+  return retVal;
+}
+
+// blocking read
+
+template <class T>
+T *SpscRing<T>::readWait(T *element, int timeoutUsecs)
+{
+
+  // brief spin first, since data usually arrives within microseconds
+
+  for (int ii = 0; ii < SPIN_COUNT; ii++) {
+    T *retVal = read(element);
+    if (retVal) {
+      return retVal;
+    }
+  }
+
+  // announce that we are going to sleep, then check again so that a
+  // write racing with the announcement is not missed
+
+  _sleeping.store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  uint32_t seq = _wakeSeq.load(std::memory_order_acquire);
+  T *retVal = read(element);
+  if (retVal == NULL) {
+    struct timespec timeout;
+    timeout.tv_sec = timeoutUsecs / 1000000;
+    timeout.tv_nsec = (timeoutUsecs % 1000000) * 1000;
+    syscall(SYS_futex, &_wakeSeq, FUTEX_WAIT_PRIVATE, seq, &timeout,
+            NULL, 0);
+    retVal = read(element);
+  }
+  _sleeping.store(0, std::memory_order_relaxed);
+  return retVal;
+
+}
+
+// wake the consumer if it is sleeping in readWait()
+
+template <class T>
+void SpscRing<T>::_wakeConsumer()
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (_sleeping.load(std::memory_order_relaxed)) {
+    _wakeSeq.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, &_wakeSeq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * SpscRingBench.cpp
+ *
+ * Microbenchmark comparing the mutex-based CircBuffer, polled the way
+ * KaMerge used to poll it, against the lock-free SpscRing, both spinning
+ * and using its blocking readWait().
+ *
+ * Two measurements are made for each queue:
+ *   - throughput: the producer writes as fast as it can
+ *   - latency: the producer writes at a fixed rate (default 10 kHz, a
+ *     typical PRF), and the consumer measures the time from write to read
+ *
+ * Usage: SpscRingBench [nItems] [rateHz] [queueSize]
+ */
+
+#include "CircBuffer.h"
+#include "SpscRing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// Item passed through the queues. The payload is roughly the size of
+// a PulseData object's header fields; the IQ data are not touched by
+// the queue anyway.
+struct BenchItem {
+  BenchItem() : seq(-1), stampNs(0) {}
+  int64_t seq;
+  int64_t stampNs;
+  char payload[48];
+};
+
+static int64_t
+nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>
+    (Clock::now().time_since_epoch()).count();
+}
+
+// Queue adapters, so that one templated benchmark drives all variants
+
+class CircBufferPoll {
+public:
+  CircBufferPoll(size_t size) : _q(size) {}
+  static std::string name() { return "CircBuffer + usleep(50)"; }
+  BenchItem *write(BenchItem *item) { return _q.write(item); }
+  BenchItem *read(BenchItem *item) {
+    BenchItem *tmp = NULL;
+    while (tmp == NULL) {
+      tmp = _q.read(item);
+      if (tmp == NULL) {
+        usleep(50);
+      }
+    }
+    return tmp;
+  }
+private:
+  CircBuffer<BenchItem> _q;
+};
+
+class SpscRingSpin {
+public:
+  SpscRingSpin(size_t size) : _q(size) {}
+  static std::string name() { return "SpscRing, spinning read()"; }
+  BenchItem *write(BenchItem *item) { return _q.write(item); }
+  BenchItem *read(BenchItem *item) {
+    BenchItem *tmp = NULL;
+    while (tmp == NULL) {
+      tmp = _q.read(item);
+    }
+    return tmp;
+  }
+private:
+  SpscRing<BenchItem> _q;
+};
+
+class SpscRingWait {
+public:
+  SpscRingWait(size_t size) : _q(size) {}
+  static std::string name() { return "SpscRing, readWait()"; }
+  BenchItem *write(BenchItem *item) { return _q.write(item); }
+  BenchItem *read(BenchItem *item) {
+    BenchItem *tmp = NULL;
+    while (tmp == NULL) {
+      tmp = _q.readWait(item, 100000);
+    }
+    return tmp;
+  }
+private:
+  SpscRing<BenchItem> _q;
+};
+
+// Run the producer and consumer for nItems. If rateHz is zero, the
+// producer runs flat out. Sets the number of items the consumer
+// received and their write-to-read latencies.
+
+template <class Q>
+static double
+runOnce(Q &queue, int64_t nItems, double rateHz,
+        int64_t &nReceived, std::vector<int64_t> &latenciesNs)
+{
+
+  latenciesNs.clear();
+  latenciesNs.reserve(nItems);
+  nReceived = 0;
+
+  // the producer writes a final item with seq == -2 to stop the consumer,
+  // retrying until the queue accepts it
+
+  std::thread consumer([&queue, &nReceived, &latenciesNs]() {
+    BenchItem *item = new BenchItem;
+    while (true) {
+      item = queue.read(item);
+      if (item->seq == -2) {
+        break;
+      }
+      latenciesNs.push_back(nowNs() - item->stampNs);
+      nReceived++;
+    }
+    delete item;
+  });
+
+  int64_t start = nowNs();
+  int64_t periodNs = (rateHz > 0.0) ? (int64_t) (1.0e9 / rateHz) : 0;
+
+  BenchItem *item = new BenchItem;
+  for (int64_t ii = 0; ii < nItems; ii++) {
+    if (periodNs) {
+      int64_t due = start + ii * periodNs;
+      while (nowNs() < due) {
+      }
+    }
+    item->seq = ii;
+    item->stampNs = nowNs();
+    item = queue.write(item);
+  }
+
+  // Stop marker. SpscRing returns the same pointer when full, so retry
+  // until it has been accepted. CircBuffer always accepts.
+  while (true) {
+    item->seq = -2;
+    item->stampNs = nowNs();
+    BenchItem *returned = queue.write(item);
+    if (returned != item) {
+      item = returned;
+      break;
+    }
+    std::this_thread::yield();
+  }
+  consumer.join();
+  delete item;
+
+  return (nowNs() - start) * 1.0e-9;
+
+}
+
+static int64_t
+percentile(std::vector<int64_t> &vals, double pct)
+{
+  if (vals.empty()) {
+    return 0;
+  }
+  size_t index = (size_t) (pct / 100.0 * (vals.size() - 1));
+  std::nth_element(vals.begin(), vals.begin() + index, vals.end());
+  return vals[index];
+}
+
+template <class Q>
+static void
+bench(int64_t nItems, double rateHz, size_t queueSize)
+{
+
+  int64_t nReceived;
+  std::vector<int64_t> latencies;
+
+  {
+    Q queue(queueSize);
+    double secs = runOnce(queue, nItems, 0.0, nReceived, latencies);
+    std::cout << std::left << std::setw(28) << Q::name() << std::right
+              << "  throughput: " << std::setw(8) << std::fixed
+              << std::setprecision(2) << nReceived / secs / 1.0e6
+              << " M items/s, received " << nReceived << "/" << nItems
+              << std::endl;
+  }
+
+  {
+    Q queue(queueSize);
+    int64_t nPaced = std::min(nItems, (int64_t) (rateHz * 5.0));
+    runOnce(queue, nPaced, rateHz, nReceived, latencies);
+    std::cout << std::left << std::setw(28) << "" << std::right
+              << "  latency @ " << rateHz << " Hz (usec): median "
+              << std::setprecision(1)
+              << percentile(latencies, 50.0) * 1.0e-3
+              << ", p99 " << percentile(latencies, 99.0) * 1.0e-3
+              << ", max " << percentile(latencies, 100.0) * 1.0e-3
+              << std::endl;
+  }
+
+}
+
+int
+main(int argc, char *argv[])
+{
+
+  int64_t nItems = 2000000;
+  double rateHz = 10000.0;
+  size_t queueSize = 20000;
+
+  if (argc > 1) {
+    nItems = atoll(argv[1]);
+  }
+  if (argc > 2) {
+    rateHz = atof(argv[2]);
+  }
+  if (argc > 3) {
+    queueSize = atol(argv[3]);
+  }
+
+  std::cout << "SpscRingBench: " << nItems << " items, queue size "
+            << queueSize << std::endl;
+
+  bench<CircBufferPoll>(nItems, rateHz, queueSize);
+  bench<SpscRingSpin>(nItems, rateHz, queueSize);
+  bench<SpscRingWait>(nItems, rateHz, queueSize);
+
+  return 0;
+
+}
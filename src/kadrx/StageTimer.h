@@ -0,0 +1,79 @@
+/*
+ * StageTimer.h
+ *
+ * Busy and idle time accounting for one stage of a processing pipeline.
+ */
+
+#ifndef STAGETIMER_H_
+#define STAGETIMER_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+/// StageTimer accumulates the time a pipeline stage spends working (busy)
+/// and waiting for input or for its output to drain (idle).
+///
+/// The stage's own thread marks each change of state with busy(), idle()
+/// or stop(), and the time since the previous mark is added to the total
+/// for the previous state. Time while stopped is not counted, which lets a
+/// thread running several stages inline hand its time from one to the
+/// next.
+///
+/// The totals may be read from any thread. They do not include the period
+/// in progress.
+
+class StageTimer {
+public:
+  StageTimer() : _state(STOPPED), _sinceNsecs(0), _busyNsecs(0),
+                 _idleNsecs(0) {}
+
+  /// Start a busy period, ending the current period
+  void busy() { _switchTo(BUSY); }
+
+  /// Start an idle period, ending the current period
+  void idle() { _switchTo(IDLE); }
+
+  /// End the current period without starting another
+  void stop() { _switchTo(STOPPED); }
+
+  /// @return the total busy time, seconds
+  double busySecs() const {
+    return _busyNsecs.load(std::memory_order_relaxed) * 1.0e-9;
+  }
+
+  /// @return the total idle time, seconds
+  double idleSecs() const {
+    return _idleNsecs.load(std::memory_order_relaxed) * 1.0e-9;
+  }
+
+private:
+  typedef enum { STOPPED, BUSY, IDLE } State;
+
+  void _switchTo(State state) {
+    uint64_t now = 0;
+    if (_state != STOPPED || state != STOPPED) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    // only the owning thread writes the totals, so a plain load and store
+    // is enough
+    if (_state == BUSY) {
+      _busyNsecs.store(_busyNsecs.load(std::memory_order_relaxed) +
+                       (now - _sinceNsecs), std::memory_order_relaxed);
+    } else if (_state == IDLE) {
+      _idleNsecs.store(_idleNsecs.load(std::memory_order_relaxed) +
+                       (now - _sinceNsecs), std::memory_order_relaxed);
+    }
+    _state = state;
+    _sinceNsecs = now;
+  }
+
+  State _state;
+  uint64_t _sinceNsecs;
+  std::atomic<uint64_t> _busyNsecs;
+  std::atomic<uint64_t> _idleNsecs;
+};
+
+#endif /* STAGETIMER_H_ */
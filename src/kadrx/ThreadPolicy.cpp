@@ -0,0 +1,309 @@
+/*
+ * ThreadPolicy.cpp
+ *
+ * CPU affinity, scheduling and stack pre-faulting for kadrx's threads.
+ */
+
+#include "ThreadPolicy.h"
+#include <logx/Logging.h>
+#include <alloca.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+LOGGING("ThreadPolicy")
+
+/////////////////////////////////////////////////////////////////////////////
+// touch each page of the given amount of stack below the caller, so that
+// it is mapped before it is needed
+
+static void __attribute__((noinline))
+prefaultStack(size_t bytes)
+{
+  long pageSize = sysconf(_SC_PAGESIZE);
+  volatile char *stack = static_cast<volatile char *>(alloca(bytes));
+  for (size_t ii = 0; ii < bytes; ii += pageSize) {
+    stack[ii] = 0;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static std::string
+schedPolicyName(int policy)
+{
+  switch (policy) {
+    case SCHED_FIFO:
+      return "fifo";
+    case SCHED_RR:
+      return "rr";
+    case SCHED_OTHER:
+      return "other";
+    default:
+      return "unknown";
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+ThreadPolicy::ThreadPolicy() :
+  _schedPolicy(-1),
+  _priority(0),
+  _stackBytes(0)
+{
+}
+
+/////////////////////////////////////////////////////////////////////////////
+ThreadPolicy::ThreadPolicy(const KaDrxConfig &config,
+                           const std::string &threadName) :
+  _threadName(threadName),
+  _schedPolicy(-1),
+  _priority(0),
+  _stackBytes(0)
+{
+  std::string spec = config.thread_policy(threadName);
+  if (spec != KaDrxConfig::UNSET_STRING) {
+    _parse(spec);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// parse a policy from its configuration value. Bad settings are logged and
+// ignored. Returns false if there were any.
+
+bool ThreadPolicy::_parse(const std::string &spec)
+{
+
+  bool ok = true;
+  std::istringstream words(spec);
+  std::string word;
+
+  while (words >> word) {
+
+    size_t eq = word.find('=');
+    std::string key = word.substr(0, eq);
+    std::string value = (eq == std::string::npos) ? "" : word.substr(eq + 1);
+    char *end;
+
+    if (key == "cpus") {
+      if (!_parseCpus(value, _cpus)) {
+        ELOG << "Bad CPU list '" << value << "' for thread " << _threadName;
+        _cpus.clear();
+        ok = false;
+      }
+    } else if (key == "sched") {
+      if (value == "fifo") {
+        _schedPolicy = SCHED_FIFO;
+      } else if (value == "rr") {
+        _schedPolicy = SCHED_RR;
+      } else if (value == "other") {
+        _schedPolicy = SCHED_OTHER;
+      } else {
+        ELOG << "Bad scheduling class '" << value << "' for thread " <<
+            _threadName << ", must be fifo, rr or other";
+        ok = false;
+      }
+    } else if (key == "priority") {
+      long priority = strtol(value.c_str(), &end, 10);
+      if (value.empty() || *end != '\0' || priority < 1 || priority > 99) {
+        ELOG << "Bad priority '" << value << "' for thread " <<
+            _threadName << ", must be 1 to 99";
+        ok = false;
+      } else {
+        _priority = priority;
+      }
+    } else if (key == "stack_kb") {
+      long kb = strtol(value.c_str(), &end, 10);
+      if (value.empty() || *end != '\0' || kb < 0 || kb > 4096) {
+        ELOG << "Bad stack_kb '" << value << "' for thread " <<
+            _threadName << ", must be 0 to 4096";
+        ok = false;
+      } else {
+        _stackBytes = kb * 1024;
+      }
+    } else {
+      ELOG << "Unknown setting '" << word << "' in policy for thread " <<
+          _threadName;
+      ok = false;
+    }
+
+  }
+
+  // a priority without a real-time class means fifo
+
+  if (_priority > 0 && _schedPolicy == -1) {
+    _schedPolicy = SCHED_FIFO;
+  }
+  if (_schedPolicy == SCHED_OTHER && _priority > 0) {
+    WLOG << "Priority ignored for thread " << _threadName <<
+        " with sched=other";
+    _priority = 0;
+  }
+  if ((_schedPolicy == SCHED_FIFO || _schedPolicy == SCHED_RR) &&
+      _priority == 0) {
+    _priority = 1;
+  }
+
+  return ok;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// parse a list of CPU numbers and ranges, e.g. "0-1,4"
+
+bool ThreadPolicy::_parseCpus(const std::string &value,
+                              std::vector<int> &cpus)
+{
+
+  cpus.clear();
+  std::istringstream items(value);
+  std::string item;
+
+  while (std::getline(items, item, ',')) {
+    char *end;
+    long first = strtol(item.c_str(), &end, 10);
+    long last = first;
+    if (end == item.c_str()) {
+      return false;
+    }
+    if (*end == '-') {
+      const char *lastStr = end + 1;
+      last = strtol(lastStr, &end, 10);
+      if (end == lastStr) {
+        return false;
+      }
+    }
+    if (*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+
+  return !cpus.empty();
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// apply the policy to the calling thread, and log the effective settings
+
+void ThreadPolicy::applyToCurrentThread() const
+{
+
+  if (_threadName.empty()) {
+    return;
+  }
+
+  pthread_t self = pthread_self();
+
+  // name the thread for top, ps and gdb (at most 15 characters)
+
+  std::string name = ("ka_" + _threadName).substr(0, 15);
+  pthread_setname_np(self, name.c_str());
+
+  // CPU affinity
+
+  if (!_cpus.empty()) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (size_t ii = 0; ii < _cpus.size(); ii++) {
+      CPU_SET(_cpus[ii], &cpuSet);
+    }
+    int status = pthread_setaffinity_np(self, sizeof(cpuSet), &cpuSet);
+    if (status != 0) {
+      WLOG << "Cannot set CPU affinity for thread " << _threadName <<
+          ": " << strerror(status);
+    }
+  }
+
+  // scheduling class and priority. Without the privilege for real-time
+  // scheduling, this fails with EPERM and the thread keeps its current
+  // scheduling.
+
+  if (_schedPolicy != -1) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = _priority;
+    int status = pthread_setschedparam(self, _schedPolicy, &param);
+    if (status != 0) {
+      WLOG << "Cannot set scheduling " << schedPolicyName(_schedPolicy) <<
+          "/" << _priority << " for thread " << _threadName << ": " <<
+          strerror(status) <<
+          (status == EPERM ? " (needs CAP_SYS_NICE or an rtprio limit)" : "");
+    }
+  }
+
+  // map the stack
+
+  if (_stackBytes > 0) {
+    prefaultStack(_stackBytes);
+  }
+
+  // log what we actually got
+
+  std::ostringstream cpuList;
+  cpu_set_t cpuSet;
+  if (pthread_getaffinity_np(self, sizeof(cpuSet), &cpuSet) == 0) {
+    int nCpus = CPU_COUNT(&cpuSet);
+    long nOnline = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nCpus >= nOnline) {
+      cpuList << "any";
+    } else {
+      const char *sep = "";
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpuSet)) {
+          cpuList << sep << cpu;
+          sep = ",";
+        }
+      }
+    }
+  }
+
+  int policy;
+  struct sched_param param;
+  pthread_getschedparam(self, &policy, &param);
+
+  ILOG << "Thread " << _threadName << ": CPUs " << cpuList.str() <<
+      ", sched " << schedPolicyName(policy) << "/" << param.sched_priority <<
+      ", stack prefaulted " << _stackBytes / 1024 << " kB";
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// lock all of the process's memory into RAM, if configured
+
+void ThreadPolicy::lockMemory(const KaDrxConfig &config)
+{
+
+  if (config.lock_memory() != 1) {
+    return;
+  }
+
+  // With MCL_FUTURE, every later allocation must also fit within the memory
+  // lock limit, or it fails. Unless that limit is unlimited or we have the
+  // privilege to exceed it, lock only what is mapped now.
+
+  int flags = MCL_CURRENT | MCL_FUTURE;
+  struct rlimit limit;
+  if (geteuid() != 0 && getrlimit(RLIMIT_MEMLOCK, &limit) == 0 &&
+      limit.rlim_cur != RLIM_INFINITY) {
+    WLOG << "Memory lock limit is " << limit.rlim_cur / 1024 <<
+        " kB, so only memory allocated so far will be locked";
+    flags = MCL_CURRENT;
+  }
+
+  if (mlockall(flags) != 0) {
+    WLOG << "Cannot lock memory: " << strerror(errno) <<
+        ", continuing with unlocked memory";
+    return;
+  }
+
+  ILOG << "Memory locked" <<
+      ((flags & MCL_FUTURE) ? ", including future allocations" : "");
+
+}
@@ -0,0 +1,69 @@
+/*
+ * ThreadPolicy.h
+ *
+ * CPU affinity, scheduling and stack pre-faulting for kadrx's threads.
+ */
+
+#ifndef THREADPOLICY_H_
+#define THREADPOLICY_H_
+
+#include "KaDrxConfig.h"
+#include <string>
+#include <vector>
+
+/// ThreadPolicy holds the CPU set, scheduling class and priority, and
+/// pre-faulted stack size for one of kadrx's named threads, as given by the
+/// thread_policy_<name> configuration key. The value is a list of
+/// <setting>=<value> words, any of which may be omitted:
+///
+///     cpus=2,3         CPUs the thread may run on, as a list of CPU numbers
+///                      and ranges (e.g. 0-1,4)
+///     sched=fifo       scheduling class: fifo, rr or other
+///     priority=80      real-time priority for fifo or rr, 1 to 99
+///     stack_kb=256     touch this much of the thread's stack at startup,
+///                      so that it is mapped (and locked, with lock_memory)
+///                      before the first data arrive
+///
+/// Settings which are omitted are left as the thread inherited them.
+///
+/// Each thread applies its own policy at the start of its run() method.
+/// If a setting cannot be applied, e.g. because kadrx lacks the privilege
+/// for real-time scheduling, a warning is logged and the thread runs with
+/// what it has. The effective settings are logged either way.
+
+class ThreadPolicy {
+public:
+  /// No policy: the thread keeps the settings it inherits.
+  ThreadPolicy();
+
+  /**
+   * The policy for the named thread, from the thread_policy_<name> key.
+   * Errors in the value are logged, and the offending setting ignored.
+   * @param config the kadrx configuration
+   * @param threadName the thread name, which is also used to name the
+   *     thread for tools such as top
+   */
+  ThreadPolicy(const KaDrxConfig &config, const std::string &threadName);
+
+  /// Apply the policy to the calling thread, and log the effective
+  /// settings.
+  void applyToCurrentThread() const;
+
+  /// Lock all current and future memory of the process into RAM, if
+  /// lock_memory is set. Falls back to not locking, with a warning, if the
+  /// process lacks the privilege or the memory lock limit is too low.
+  /// @param config the kadrx configuration
+  static void lockMemory(const KaDrxConfig &config);
+
+private:
+  bool _parse(const std::string &spec);
+  static bool _parseCpus(const std::string &value, std::vector<int> &cpus);
+
+  std::string _threadName;
+  std::vector<int> _cpus;     ///< empty to leave the affinity alone
+  int _schedPolicy;           ///< -1 to leave the scheduling class alone
+  int _priority;
+  size_t _stackBytes;
+};
+
+#endif /* THREADPOLICY_H_ */
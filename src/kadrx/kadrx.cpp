@@ -1,4 +1,6 @@
 #include <string>
+#include <algorithm>
+#include <climits>
 #include <csignal>
 #include <cmath>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -25,6 +27,8 @@
 #include "KaMerge.h"
 #include "KaMonitor.h"
 #include "NoXmitBitmap.h"
+#include "StatusPushServer.h"
+#include "ThreadPolicy.h"
 
 LOGGING("kadrx")
 
@@ -43,6 +47,8 @@ KaDrxPub * _hThread = NULL;     ///< thread to read and publish H channel data
 KaDrxPub * _vThread = NULL;     ///< thread to read and publish H channel data
 KaDrxPub * _burstThread = NULL; ///< thread to read and publish burst channel data
 const float STATUS_INTERVAL_SECS = 10.0;        ///< interval for status logging
+const int XMLRPC_PORT = 8081;   ///< port for our XML-RPC server
+const int STATUS_PUSH_INTERVAL_MS = 200;        ///< interval for pushing status changes
 int _tsLength = 256;            ///< The time series length
 std::string _gaussianFile = ""; ///< gaussian filter coefficient file
 std::string _kaiserFile = "";   ///< kaiser filter coefficient file
@@ -62,6 +68,12 @@ static NoXmitBitmap _noXmitBitmap;
 // Our KaMonitor instance
 KaMonitor * _kaMonitor = NULL;
 
+// Our KaMerge instance
+KaMerge * _merge = NULL;
+
+// Server pushing status changes to subscribers
+StatusPushServer * _statusPushServer = NULL;
+
 bool _terminate = false;         ///< set true to signal the main loop to terminate
 bool _hup = false;               ///< set true to signal the main loop we got a hup signal
 bool _usr1 = false;              ///< set true to signal the main loop we got a usr1 signal
@@ -166,6 +178,19 @@ startUpconverter(p7142sd3c * sd3c) {
     sd3c->upconverter()->startDAC();
 }
 
+///////////////////////////////////////////////////////////
+/// @brief Ask the IWRF black box (if enabled) to write the latest time
+/// series to a file
+/// @param reason why the data are wanted, for the log
+/// @return true iff the black box is enabled
+bool
+triggerBlackBox(const std::string & reason) {
+    if (! _merge) {
+        return(false);
+    }
+    return(_merge->netWriter().triggerBlackBox(reason));
+}
+
 ///////////////////////////////////////////////////////////
 /// @brief Update the state of the "transmit enable" line based on
 /// the current value of _noXmitBitmap
@@ -191,6 +216,17 @@ updateTxEnableLineState() {
                 }
             }
         }
+        // Save the time series leading up to newly set bits, except for
+        // routine blanking sector entry
+        for (NoXmitBitmap::BITNUM bitnum = NoXmitBitmap::BITNUM(0);
+             prevBitmapValid && bitnum < NoXmitBitmap::NBITS; bitnum++) {
+            if (bitnum != NoXmitBitmap::IN_BLANKING_SECTOR &&
+                    _noXmitBitmap.bitIsSet(bitnum) &&
+                    prevNoXmitBitmap.bitIsClear(bitnum)) {
+                triggerBlackBox("Transmit disabled: " +
+                                NoXmitBitmap::NoXmitReason(bitnum));
+            }
+        }
         prevNoXmitBitmap = _noXmitBitmap;
         prevBitmapValid = true;
     }
@@ -252,6 +288,7 @@ shutDownAndClean() {
     _burstThread->wait(1000);
 
     // Clean up dynamically allocated objects
+    delete(_statusPushServer);
     delete(_kaMonitor);
     delete(_hThread);
     delete(_vThread);
@@ -420,6 +457,87 @@ verifyPpsAndNtp() {
     ILOG << "System clock offset is currently " << offset_s << " s";
 }
 
+///////////////////////////////////////////////////////////
+/// @brief Return occupancy and overrun counts for one of the queues
+/// feeding the merge thread
+template <class T>
+KadrxStatus::QueueStats
+mergeQueueStats(const SpscRing<T> & queue) {
+    KadrxStatus::QueueStats stats;
+    stats.size = queue.size();
+    stats.depth = queue.depth();
+    stats.highWater = queue.highWater();
+    stats.overruns = std::min<uint64_t>(queue.nOverruns(), INT_MAX);
+    return(stats);
+}
+
+///////////////////////////////////////////////////////////
+/// @brief Log occupancy and overrun counts for one of the queues feeding
+/// the merge thread
+void
+logMergeQueueStats(const std::string & name,
+                   const KadrxStatus::QueueStats & stats) {
+    ILOG << name << " merge queue depth: " << stats.depth << "/" <<
+            stats.size << ", high water: " << stats.highWater <<
+            ", overruns: " << stats.overruns;
+}
+
+///////////////////////////////////////////////////////////
+/// @brief Return busy and idle time for one stage of the merge pipeline
+KadrxStatus::StageStats
+mergeStageStats(const StageTimer & timer) {
+    KadrxStatus::StageStats stats;
+    stats.busySecs = timer.busySecs();
+    stats.idleSecs = timer.idleSecs();
+    return(stats);
+}
+
+///////////////////////////////////////////////////////////
+/// @brief Log the fraction of time one stage of the merge pipeline was busy
+/// since the last call, which identifies the stage limiting throughput.
+/// @param name the stage name
+/// @param stats the stage's current busy and idle totals
+/// @param prev the totals at the last call, updated to stats
+void
+logMergeStageStats(const std::string & name,
+                   const KadrxStatus::StageStats & stats,
+                   KadrxStatus::StageStats & prev) {
+    double busySecs = stats.busySecs - prev.busySecs;
+    double idleSecs = stats.idleSecs - prev.idleSecs;
+    double totalSecs = busySecs + idleSecs;
+    prev = stats;
+    ILOG << name << " stage busy: " <<
+            (totalSecs > 0.0 ? 100.0 * busySecs / totalSecs : 0.0) <<
+            "%, " << busySecs << " s busy, " << idleSecs << " s idle";
+}
+
+///////////////////////////////////////////////////////////
+/// @brief Return the mean number of IWRF packets sent per send call
+double
+iwrfPacketsPerSend() {
+    const IwrfFanoutServer & server = _merge->netWriter().server();
+    uint64_t nSendCalls = server.nSendCalls();
+    return(nSendCalls ? double(server.nPacketsSent()) / nSendCalls : 0.0);
+}
+
+///////////////////////////////////////////////////////////
+/// @brief Return throughput and lag for each connected IWRF client
+std::vector<KadrxStatus::IwrfClientStats>
+iwrfClientStats() {
+    std::vector<IwrfFanoutServer::ClientStats> clients =
+            _merge->netWriter().server().clientStats();
+    std::vector<KadrxStatus::IwrfClientStats> stats(clients.size());
+    for (size_t i = 0; i < clients.size(); i++) {
+        stats[i].connectedSecs = clients[i].connectedSecs;
+        stats[i].bytesPerSec = clients[i].bytesPerSec;
+        stats[i].lagBytes = clients[i].lagBytes;
+        stats[i].lagSecs = clients[i].lagSecs;
+        stats[i].droppedPackets =
+                std::min<uint64_t>(clients[i].droppedPackets, INT_MAX);
+    }
+    return(stats);
+}
+
 ///////////////////////////////////////////////////////////
 /// @brief Function which is called on a periodic basis to log
 /// some basic status.
@@ -439,6 +557,78 @@ logStatus() {
             _burstThread->downconverter()->bytesRead() / (1.0e6 * STATUS_INTERVAL_SECS) <<
             " MB/s, drop: " << _burstThread->downconverter()->droppedPulses() <<
             " sync errs: " << _burstThread->downconverter()->syncErrors();
+
+    KaDrxPub * channels[] = { _hThread, _vThread, _burstThread };
+    const char * channelNames[] = { "H", "V", "burst" };
+    for (int i = 0; i < 3; i++) {
+        const PeiWriter * pei = channels[i]->peiWriter();
+        if (pei) {
+            ILOG << channelNames[i] << " Pei file: " <<
+                    pei->nBytesQueued() / 1.0e6 << " MB queued, " <<
+                    pei->nBytesWritten() / 1.0e6 << " MB written, " <<
+                    pei->nPulsesDropped() << " pulses dropped";
+        }
+    }
+
+    logMergeQueueStats("H", mergeQueueStats(_merge->hQueue()));
+    logMergeQueueStats("V", mergeQueueStats(_merge->vQueue()));
+    logMergeQueueStats("burst", mergeQueueStats(_merge->burstQueue()));
+
+    // merge throughput since the last status
+    static uint64_t prevPulsesWritten = 0;
+    static double prevPulseWriteSecs = 0.0;
+    uint64_t pulsesWritten = _merge->nPulsesWritten();
+    double pulseWriteSecs = _merge->pulseWriteSecs();
+    uint64_t nPulses = pulsesWritten - prevPulsesWritten;
+    double usecsPerPulse = (nPulses == 0) ? 0.0 :
+            (pulseWriteSecs - prevPulseWriteSecs) * 1.0e6 / nPulses;
+    prevPulsesWritten = pulsesWritten;
+    prevPulseWriteSecs = pulseWriteSecs;
+    ILOG << "Merge: " << nPulses / STATUS_INTERVAL_SECS << " pulses/s, " <<
+            usecsPerPulse << " us/pulse writing packets, " <<
+            _merge->nWorkers() << " workers";
+
+    // busy time of each merge pipeline stage since the last status
+    static KadrxStatus::StageStats prevSync, prevPack, prevSend;
+    logMergeStageStats("Merge sync", mergeStageStats(_merge->syncTimer()),
+                       prevSync);
+    logMergeStageStats("Merge pack", mergeStageStats(_merge->packTimer()),
+                       prevPack);
+    logMergeStageStats("Merge send",
+                       mergeStageStats(_merge->netWriter().timer()),
+                       prevSend);
+    if (_merge->pulseQueue()) {
+        logMergeQueueStats("pulse", mergeQueueStats(*_merge->pulseQueue()));
+    }
+
+    KadrxStatus::QueueStats outStats =
+            mergeQueueStats(_merge->netWriter().queue());
+    ILOG << "IWRF output queue depth: " << outStats.depth << "/" <<
+            outStats.size << ", high water: " << outStats.highWater <<
+            ", overruns: " << outStats.overruns;
+
+    const IwrfFanoutServer & server = _merge->netWriter().server();
+    ILOG << "IWRF packets sent: " << server.nPacketsSent() <<
+            ", send calls: " << server.nSendCalls() <<
+            ", packets/call: " << iwrfPacketsPerSend();
+    std::vector<IwrfFanoutServer::ClientStats> clients = server.clientStats();
+    for (size_t i = 0; i < clients.size(); i++) {
+        ILOG << "IWRF client " << clients[i].address << ": " <<
+                clients[i].bytesPerSec / 1.0e6 << " MB/s, lag: " <<
+                clients[i].lagBytes << " bytes, " <<
+                clients[i].lagSecs << " s, dropped: " <<
+                clients[i].droppedPackets;
+    }
+
+    const IwrfArchiver * archiver = _merge->netWriter().archiver();
+    if (archiver) {
+        KadrxStatus::QueueStats archiveStats =
+                mergeQueueStats(archiver->queue());
+        ILOG << "IWRF archive: " << archiver->nBytesWritten() / 1.0e6 <<
+                " MB in " << archiver->nFiles() << " files, queue depth: " <<
+                archiveStats.depth << "/" << archiveStats.size <<
+                ", overruns: " << archiveStats.overruns;
+    }
 }
 
 ///////////////////////////////////////////////////////////
@@ -453,6 +643,110 @@ checkN2Pressure() {
             setNoXmitBit(NoXmitBitmap::N2_PRESSURE_LOW);
 }
 
+///////////////////////////////////////////////////////////
+/// @brief Function which is called on a periodic basis to look for new
+/// transmitter faults in KaMonitor's status from ka_xmitd, and trigger the
+/// IWRF black box when one is seen.
+void
+checkXmitFaults() {
+    static int prevCounts[9];
+    static bool prevCountsValid = false;
+    static const char * FaultNames[9] = {
+        "magnetron current", "blower", "safety interlock", "reverse power",
+        "pulse input", "HVPS current", "waveguide pressure",
+        "HVPS under-voltage", "HVPS over-voltage"
+    };
+
+    if (! _kaMonitor) {
+        return;
+    }
+    XmitdStatus xs = _kaMonitor->snapshot().xmitStatus;
+    int counts[9] = {
+        xs.magnetronCurrentFaultCount(), xs.blowerFaultCount(),
+        xs.safetyInterlockCount(), xs.reversePowerFaultCount(),
+        xs.pulseInputFaultCount(), xs.hvpsCurrentFaultCount(),
+        xs.waveguidePressureFaultCount(), xs.hvpsUnderVoltageCount(),
+        xs.hvpsOverVoltageCount()
+    };
+    // Counts are -1 when there is no status from ka_xmitd, and start again
+    // from zero if ka_xmitd restarts, so only an increase means a new fault.
+    for (int i = 0; prevCountsValid && i < 9; i++) {
+        if (prevCounts[i] >= 0 && counts[i] > prevCounts[i]) {
+            triggerBlackBox(std::string("Transmitter ") + FaultNames[i] +
+                            " fault");
+        }
+    }
+    std::copy(counts, counts + 9, prevCounts);
+    prevCountsValid = true;
+}
+
+///////////////////////////////////////////////////////////
+/// @brief Return our current status
+/// @param withPipelineStats if false, the merge pipeline and IWRF client
+/// statistics are left at zero
+/// @return our current status
+KadrxStatus
+currentStatus(bool withPipelineStats = true) {
+    // Construct a KadrxStatus from the current values, taking one
+    // consistent snapshot of the monitor's values
+    const KaMonitorSnapshot km = _kaMonitor->snapshot();
+    KadrxStatus status(_noXmitBitmap,
+                       _afcEnabled,
+                       km.gpsTimeServerGood,
+                       km.locked100MHz,
+                       km.wgPressureGood,
+                       km.afcIsTracking,
+                       km.g0AvgPower,
+                       km.osc0Frequency,
+                       km.osc1Frequency,
+                       km.osc2Frequency,
+                       km.osc3Frequency,
+                       km.derivedTxFrequency(),
+                       km.hTxPowerRaw,
+                       km.vTxPowerRaw,
+                       km.testTargetPowerRaw,
+                       km.procDrxTemp,
+                       km.procEnclosureTemp,
+                       km.rxBackTemp,
+                       km.rxFrontTemp,
+                       km.rxTopTemp,
+                       km.txEnclosureTemp,
+                       km.psVoltage);
+    if (! withPipelineStats) {
+        return(status);
+    }
+    status.setMergeQueueStats(mergeQueueStats(_merge->hQueue()),
+                              mergeQueueStats(_merge->vQueue()),
+                              mergeQueueStats(_merge->burstQueue()));
+    status.setIwrfPacketsPerSend(iwrfPacketsPerSend());
+    status.setIwrfClientStats(iwrfClientStats());
+    status.setIwrfOutputQueueStats(
+            mergeQueueStats(_merge->netWriter().queue()));
+    status.setMergeStageStats(
+            mergeStageStats(_merge->syncTimer()),
+            mergeStageStats(_merge->packTimer()),
+            mergeStageStats(_merge->netWriter().timer()),
+            _merge->pulseQueue() ?
+                    mergeQueueStats(*_merge->pulseQueue()) :
+                    KadrxStatus::QueueStats());
+    return(status);
+}
+
+///////////////////////////////////////////////////////////
+/// @brief Function which is called on a periodic basis to accept new
+/// status subscribers and push them any change in our status. The status
+/// is only built when someone is listening. The pipeline statistics are
+/// left out, since the busy/idle totals and client throughput change on
+/// every tick and would make each push a DELTA; they are available from
+/// the XML-RPC getStatus method.
+void
+pushStatus() {
+    _statusPushServer->service();
+    if (_statusPushServer->nSubscribers() > 0) {
+        _statusPushServer->publish(StatusPush::encode(currentStatus(false)));
+    }
+}
+
 /// @brief xmlrpc_c::method to get status from the kadrx process.
 ///
 /// The method returns a xmlrpc_c::value_struct (dictionary) mapping
@@ -484,29 +778,7 @@ public:
     void
     execute(const xmlrpc_c::paramList & paramList, xmlrpc_c::value* retvalP) {
         DLOG << "Received 'getStatus' XML-RPC command";
-        // Construct a KadrxStatus from the current values
-        KadrxStatus status(_noXmitBitmap,
-                           _afcEnabled,
-                           _kaMonitor->gpsTimeServerGood(),
-                           _kaMonitor->locked100MHz(),
-                           _kaMonitor->wgPressureGood(),
-                           _kaMonitor->afcIsTracking(),
-                           _kaMonitor->g0AvgPower(),
-                           _kaMonitor->osc0Frequency(),
-                           _kaMonitor->osc1Frequency(),
-                           _kaMonitor->osc2Frequency(),
-                           _kaMonitor->osc3Frequency(),
-                           _kaMonitor->derivedTxFrequency(),
-                           _kaMonitor->hTxPowerRaw(),
-                           _kaMonitor->vTxPowerRaw(),
-                           _kaMonitor->testTargetPowerRaw(),
-                           _kaMonitor->procDrxTemp(),
-                           _kaMonitor->procEnclosureTemp(),
-                           _kaMonitor->rxBackTemp(),
-                           _kaMonitor->rxFrontTemp(),
-                           _kaMonitor->rxTopTemp(),
-                           _kaMonitor->txEnclosureTemp(),
-                           _kaMonitor->psVoltage());
+        KadrxStatus status = currentStatus();
         *retvalP = status.toXmlRpcValue();
     }
 };
@@ -649,6 +921,23 @@ public:
     }
 };
 
+/////////////////////////////////////////////////////////////////////
+/// @brief xmlrpc_c::method to write the latest IWRF time series held in
+/// the black box to a file. The method returns true if the dump was
+/// requested, or false if the black box is disabled.
+class DumpBlackBoxMethod : public xmlrpc_c::method {
+public:
+    DumpBlackBoxMethod() {
+        this->_signature = "b:";
+        this->_help = "This method writes the latest IWRF time series held in the black box to a file";
+    }
+    void
+    execute(const xmlrpc_c::paramList & paramList, xmlrpc_c::value* retvalP) {
+        DLOG << "Received 'dumpBlackBox' XML-RPC command";
+        *retvalP = xmlrpc_c::value_boolean(triggerBlackBox("XML-RPC request"));
+    }
+};
+
 ///////////////////////////////////////////////////////////
 int
 main(int argc, char** argv)
@@ -711,9 +1000,11 @@ main(int argc, char** argv)
 
     // Create our status monitoring thread.
     _kaMonitor = new KaMonitor(_xmitdHost, _xmitdPort);
+    _kaMonitor->setThreadPolicy(ThreadPolicy(kaConfig, "monitor"));
 
     // create the merge object (which is also the IWRF TCP server)
     KaMerge merge(kaConfig, *_kaMonitor);
+    _merge = &merge;
 
     // Figure out the lowest SD3C timer clock divisor which will support the
     // given PRT(s). Allowed divisor values are 2, 4, 8, or 16.
@@ -851,6 +1142,10 @@ main(int argc, char** argv)
     // apply.
     signal(SIGUSR1, usr1Handler);
 
+    // Lock memory into RAM if configured, now that the big buffers are
+    // allocated
+    ThreadPolicy::lockMemory(kaConfig);
+
     // Start monitor and merge
     PMU_auto_register("start monitor and merge");
     _kaMonitor->start();
@@ -897,16 +1192,29 @@ main(int argc, char** argv)
     // Verify that we have TX sync pulses being generated, or exit now
     exitIfNoSyncPulses();
 
-    // Start our XML-RPC server on port 8081
+    // Start our XML-RPC server on port XMLRPC_PORT
     xmlrpc_c::registry myRegistry;
     myRegistry.addMethod("getStatus", new GetStatusMethod);
     myRegistry.addMethod("raiseXmitTtyReset", new RaiseXmitTtyResetMethod);
     myRegistry.addMethod("lowerXmitTtyReset", new LowerXmitTtyResetMethod);
     myRegistry.addMethod("disableTransmit", new DisableTransmitMethod);
+    myRegistry.addMethod("dumpBlackBox", new DumpBlackBoxMethod);
     myRegistry.addMethod("enableTransmit", new EnableTransmitMethod);
     myRegistry.addMethod("setBlankingOn", new SetBlankingOnMethod);
     myRegistry.addMethod("setBlankingOff", new SetBlankingOffMethod);
-    QXmlRpcServerAbyss rpcServer(&myRegistry, 8081);
+    QXmlRpcServerAbyss rpcServer(&myRegistry, XMLRPC_PORT);
+
+    // Push status changes to subscribers on XMLRPC_PORT +
+    // StatusPush::PORT_OFFSET
+    _statusPushServer =
+            new StatusPushServer(XMLRPC_PORT + StatusPush::PORT_OFFSET);
+    QFunctionWrapper qPushStatus(pushStatus);
+
+    QTimer pushTimer(_app);
+    QObject::connect(&pushTimer, SIGNAL(timeout()),
+                     &qPushStatus, SLOT(callFunction()));
+    pushTimer.setInterval(STATUS_PUSH_INTERVAL_MS);
+    pushTimer.start();
 
     // Create a QFunctionWrapper and QTimer to periodically log our status
     QFunctionWrapper qLogStatus(logStatus);
@@ -927,6 +1235,16 @@ main(int argc, char** argv)
     n2TestTimer.setInterval(1000);      // check every 1000 ms
     n2TestTimer.start();
 
+    // Create a QFunctionWrapper and timer to look for transmitter faults,
+    // which trigger the IWRF black box.
+    QFunctionWrapper qCheckXmitFaults(checkXmitFaults);
+
+    QTimer xmitFaultTimer(_app);
+    QObject::connect(&xmitFaultTimer, SIGNAL(timeout()),
+                     &qCheckXmitFaults, SLOT(callFunction()));
+    xmitFaultTimer.setInterval(1000);   // check every 1000 ms
+    xmitFaultTimer.start();
+
     // Create a QFunctionWrapper and timer to act on flags that are set
     // on receipt of HUP and USR1 signals.
     QFunctionWrapper qActOnFlags(actOnSignalFlags);
@@ -0,0 +1,195 @@
+// kadrx_replay: feed recorded IWRF or Pei time series, or synthetic pulses,
+// through KaMerge and everything downstream of it, with no Pentek card. The
+// merged IWRF stream is served just as kadrx serves it, using the same DRX
+// configuration.
+
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <logx/Logging.h>
+#include <QtCore/QCoreApplication>
+
+#include "KaDrxConfig.h"
+#include "KaMerge.h"
+#include "KaMonitor.h"
+#include "KaReplay.h"
+#include "KaSyntheticSource.h"
+
+LOGGING("kadrx_replay")
+
+namespace po = boost::program_options;
+
+std::string _drxConfig;                 ///< DRX configuration file
+std::vector<std::string> _files;        ///< files to replay
+bool _pei = false;                      ///< files are Pei files?
+bool _synthetic = false;                ///< generate pulses, not read files?
+int64_t _pulses = 0;                    ///< synthetic pulses per pass, 0 for no limit
+std::string _pacing("realtime");        ///< replay pacing
+double _speed = 1.0;                    ///< speed factor for scaled pacing
+int _passes = 1;                        ///< times to replay the files
+const int STATUS_INTERVAL_SECS = 10;    ///< interval for status logging
+
+volatile sig_atomic_t _terminate = 0;   ///< set on SIGINT or SIGTERM
+
+/////////////////////////////////////////////////////////////////////
+void sigHandler(int sig) {
+    _terminate = 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Parse the command line options
+void parseOptions(int argc, char** argv)
+{
+    po::options_description descripts("Options");
+    descripts.add_options()
+    ("help", "Describe options")
+    ("drxConfig", po::value<std::string>(&_drxConfig), "DRX configuration file")
+    ("file", po::value<std::vector<std::string> >(&_files), "File to replay")
+    ("pei", "Files are Pei files (chan<N>_...), rather than IWRF")
+    ("synthetic", "Generate synthetic pulses, rather than reading files")
+    ("pulses", po::value<int64_t>(&_pulses),
+            "Number of synthetic pulses per pass (default 0, no limit)")
+    ("pacing", po::value<std::string>(&_pacing),
+            "Pacing: realtime, scaled or fast (default realtime)")
+    ("speed", po::value<double>(&_speed),
+            "Speed factor for scaled pacing (default 1.0)")
+    ("passes", po::value<int>(&_passes),
+            "Number of times to replay the files (default 1)")
+            ;
+    po::positional_options_description pd;
+    pd.add("drxConfig", 1);
+    pd.add("file", -1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(descripts).positional(pd).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << "Usage: " << argv[0] <<
+            " [OPTION]... [--drxConfig] <configFile> <file>..." << std::endl;
+        std::cout << "       " << argv[0] <<
+            " [OPTION]... --synthetic [--drxConfig] <configFile>" << std::endl;
+        std::cout << descripts << std::endl;
+        std::cout << "IWRF files recorded with range decimation (e.g. " <<
+            "combine_every_second_gate)" << std::endl <<
+            "cannot be replayed, and their pulses are skipped. IQ data " <<
+            "recorded cohered to" << std::endl <<
+            "the burst are rotated back by the recorded burst phase, " <<
+            "to within two counts" << std::endl <<
+            "of rounding, before the merge coheres them again." << std::endl;
+        exit(0);
+    }
+
+    if (vm.count("pei"))
+        _pei = true;
+    if (vm.count("synthetic"))
+        _synthetic = true;
+    if (vm.count("drxConfig") != 1) {
+        ELOG << "Exactly one DRX configuration file must be given!";
+        exit(1);
+    }
+    if (_synthetic && ! _files.empty()) {
+        ELOG << "Files may not be given with --synthetic!";
+        exit(1);
+    }
+    if (! _synthetic && _files.empty()) {
+        ELOG << "No files to replay!";
+        exit(1);
+    }
+}
+
+///////////////////////////////////////////////////////////
+/// Log replay and merge throughput since the last call
+void logStatus(const KaReplay & replay, const KaMerge & merge,
+               double intervalSecs) {
+    static uint64_t prevReplayed = 0;
+    static uint64_t prevWritten = 0;
+    uint64_t replayed = replay.nPulses();
+    uint64_t written = merge.nPulsesWritten();
+    ILOG << "Replayed " << (replayed - prevReplayed) / intervalSecs <<
+            " pulses/s, merged " << (written - prevWritten) / intervalSecs <<
+            " pulses/s; input queue overruns H: " <<
+            merge.hQueue().nOverruns() << ", V: " <<
+            merge.vQueue().nOverruns() << ", burst: " <<
+            merge.burstQueue().nOverruns() << ", IWRF output queue overruns: " <<
+            merge.netWriter().queue().nOverruns();
+    prevReplayed = replayed;
+    prevWritten = written;
+}
+
+///////////////////////////////////////////////////////////
+int
+main(int argc, char** argv)
+{
+    // Let logx get and strip out its arguments
+    logx::ParseLogArgs(argc, argv);
+
+    parseOptions(argc, argv);
+
+    QCoreApplication app(argc, argv);
+
+    KaReplay::Pacing pacing;
+    if (! KaReplay::parsePacing(_pacing, pacing)) {
+        ELOG << "Bad pacing '" << _pacing << "'";
+        exit(1);
+    }
+
+    KaDrxConfig kaConfig(_drxConfig);
+    if (! kaConfig.isValid()) {
+        ELOG << "Exiting on incomplete configuration!";
+        exit(1);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, sigHandler);
+    signal(SIGTERM, sigHandler);
+
+    // The monitor is not started, since it reads the hardware; the merge
+    // reports its default status.
+    KaMonitor monitor("localhost", 8080);
+
+    KaMerge merge(kaConfig, monitor);
+    KaReplay * replayPtr;
+    if (_synthetic) {
+        replayPtr = new KaReplay(kaConfig, merge,
+                                 new KaSyntheticSource(kaConfig, _pulses),
+                                 pacing, _speed, _passes);
+    } else {
+        replayPtr = new KaReplay(kaConfig, merge, _files,
+                                 _pei ? KaReplay::PEI_FILES : KaReplay::IWRF_FILES,
+                                 pacing, _speed, _passes);
+    }
+    KaReplay & replay = *replayPtr;
+
+    merge.start();
+    replay.start();
+
+    int secs = 0;
+    while (! _terminate && ! replay.done()) {
+        sleep(1);
+        if (++secs % STATUS_INTERVAL_SECS == 0) {
+            logStatus(replay, merge, STATUS_INTERVAL_SECS);
+        }
+    }
+    replay.stop();
+    replay.wait();
+
+    // let the merge finish what it has been given
+    for (int i = 0; i < 50 && ! _terminate; i++) {
+        if (merge.hQueue().depth() == 0 && merge.vQueue().depth() == 0 &&
+                merge.burstQueue().depth() == 0) {
+            break;
+        }
+        usleep(100000);
+    }
+    sleep(1);
+
+    ILOG << "Replayed " << replay.nPulses() << " pulses, merged " <<
+            merge.nPulsesWritten();
+    delete replayPtr;
+    return 0;
+}